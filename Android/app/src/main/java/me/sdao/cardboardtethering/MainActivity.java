@@ -4,19 +4,25 @@ import android.content.Context;
 import android.content.Intent;
 import android.graphics.Bitmap;
 import android.graphics.BitmapFactory;
+import android.graphics.Canvas;
+import android.graphics.Rect;
 import android.hardware.usb.UsbAccessory;
 import android.hardware.usb.UsbManager;
 import android.opengl.GLES20;
 import android.os.Handler;
 import android.os.ParcelFileDescriptor;
+import android.os.SystemClock;
 import android.support.annotation.NonNull;
 import android.support.v7.app.AppCompatActivity;
 import android.os.Bundle;
 import android.util.Log;
+import android.view.Choreographer;
 import android.view.View;
 
 import com.google.vr.sdk.base.GvrView;
 import com.google.vr.sdk.base.Eye;
+import com.google.vr.sdk.base.FieldOfView;
+import com.google.vr.sdk.base.GvrViewerParams;
 import com.google.vr.sdk.base.HeadTransform;
 import com.google.vr.sdk.base.Viewport;
 
@@ -43,25 +49,116 @@ public class MainActivity extends AppCompatActivity {
     public static final int STATUS_WRITE_ERROR = 4;
     public static final int STATUS_READ_ERROR = 5;
 
-    private static final byte TAG_HEADER = 0x27;
-    private static final byte TAG_WIDTH = 0x28;
-    private static final byte TAG_HEIGHT = 0x29;
-    private static final byte TAG_INTERPUPILLARY = 0x2A;
-    private static final byte TAG_FILL = 0x30;
-
+    // Message framing for everything after the handshake; see MessageCodec.h
+    // on the PC side.
+    private static final int MESSAGE_MAGIC = 0xCB;
+    private static final int MESSAGE_VERSION_MIN = 1;
+    private static final int MESSAGE_VERSION_MAX = 1;
+    private static final int MESSAGE_HEADER_LEN = 12;
+    private static final int MESSAGE_MAX_PAYLOAD = 16 * 1024 * 1024;
+    private static final int MESSAGE_FLAG_RESUME = 0x01; // PC HELLO: say hello again.
+    private static final int TYPE_POSE = 1;
+    private static final int TYPE_FRAME = 2;
+    private static final int TYPE_END = 3;
+    private static final int TYPE_HELLO = 4;
+    private static final int TYPE_VSYNC = 5;
+    private static final int TYPE_REFRESH = 6;
+    private static final int CAPABILITIES_LEN = 44; // See Capabilities.h on the PC side.
+
+    private static final int POSE_PACKET_LEN = 36;
+    private static final int POSE_HISTORY = 256; // Sample times kept for latency.
+    private static final int VSYNC_PACKET_LEN = 28; // See UsbDevice.h on the PC side.
+    private static final int VSYNC_TIMEOUT_MS = 10; // Poses keep flowing without vsyncs.
+
+    // Keyframe requests; see KeyframeRequests.h on the PC side.
+    private static final int REFRESH_PACKET_LEN = 12;
+    private static final int REFRESH_ALL_EYES = 0xFF;
+    private static final int REASON_LOST = 1;
+    private static final int REASON_DECODE_FAILED = 2;
+    private static final int REASON_DELTA_REJECTED = 3;
+
+    // After an IO error, how long to look for the accessory coming back.
+    // Matches the PC's reconnect budget.
+    private static final int RECONNECT_POLL_MS = 250;
+    private static final int RECONNECT_TIMEOUT_MS = 15000;
+
+    private static final int EYE_LEFT = 0;
+    private static final int EYE_RIGHT = 1;
+    private static final int EYE_COUNT = 2;
+
+    // How an eye payload's body is encoded; see TileCodec.h on the PC side.
+    private static final int CODEC_JPEG = 0;
+    private static final int CODEC_TILES = 1;
+    private static final int TILE_HEADER_LEN = 10;
+
+    // Per-payload header; see FrameHeader.h on the PC side.
+    private static final int FRAME_HEADER_VERSION = 1;
+    private static final int FRAME_HEADER_LEN = 64;
+    private static final int EYE_LAYOUT_SEPARATE = 0;
+
+    // Each eye arrives as its own payload and is swapped in (whole JPEG) or
+    // patched (changed tiles) independently.
     final private Object mBitmapLock = new Object();
-    private Bitmap mBitmap = null;
-    private boolean mBitmapNew = false;
+    private Bitmap[] mBitmaps = new Bitmap[EYE_COUNT];
+    private boolean[] mBitmapNew = new boolean[EYE_COUNT];
+    // Pose each eye's current image was rendered with, in the same axes as
+    // mRotation, for reprojecting against the latest head pose.
+    private float[][] mRenderPoses = new float[EYE_COUNT][4];
+    private int[] mRenderPoseSequences = new int[EYE_COUNT];
     private GvrView mGvrView = null;
     private int mViewportWidth;
     private int mViewportHeight;
     private float mInterpupillary;
+    private float[] mFov = new float[4]; // Left, right, bottom, top in degrees.
+    private float[] mDistortion = new float[2];
+    private volatile int mMaxTextureSize;
 
     final private Object mRotationLock = new Object();
     private float[] mRotation = new float[4];
-
-    private AtomicBoolean mCancel = new AtomicBoolean();
+    private long mRotationTimeNs;
+    // When each recently sent pose was sampled, indexed by sequence modulo
+    // POSE_HISTORY, and the latest pose-to-display measurement to report.
+    private int[] mSentSequences = new int[POSE_HISTORY];
+    private long[] mSentTimesNs = new long[POSE_HISTORY];
+    private int mDisplayedSequence;
+    private int mDisplayMicros;
+
+    // The latest display vsync, on the System.nanoTime() clock, and the last
+    // frame both eyes arrived for. The write thread reports them on every
+    // vsync so the PC can time frames to land just before the next one.
+    final private Object mVsyncLock = new Object();
+    private long mVsyncNs;
+    private long mVsyncCount;
+    private int mVsyncPeriodNs;
+    private long mArrivedFrameId;
+    private long mArrivalNs;
+    // A keyframe request for the write thread to send, if mRefreshEye >= 0.
+    private int mRefreshEye = -1;
+    private int mRefreshReason;
+    private long mRefreshFrameId;
+    private boolean mHelloRequested;
+    private final Choreographer.FrameCallback mVsyncCallback = new Choreographer.FrameCallback() {
+        @Override
+        public void doFrame(long frameTimeNanos) {
+            synchronized (mVsyncLock) {
+                mVsyncNs = frameTimeNanos;
+                mVsyncCount++;
+                mVsyncLock.notifyAll();
+            }
+            if (!mCancel.get()) {
+                Choreographer.getInstance().postFrameCallback(this);
+            }
+        }
+    };
+
+    // Each session's threads stop on their own flag, so a session that
+    // replaces a failed one isn't stopped by its stragglers.
+    private volatile AtomicBoolean mCancel = new AtomicBoolean();
+    // The version the PC chose, taken from its messages.
+    private volatile int mMessageVersion = MESSAGE_VERSION_MIN;
+    private volatile byte[] mCapabilities; // Our HELLO payload.
     private ParcelFileDescriptor mParcelFileDescriptor;
+    private boolean mReconnecting; // UI thread only.
 
     private Handler mHandler = new Handler();
 
@@ -83,22 +180,30 @@ public class MainActivity extends AppCompatActivity {
                 if (!mCancel.get()) {
                     synchronized (mRotationLock) {
                         headTransform.getQuaternion(mRotation, 0);
+                        mRotationTimeNs = System.nanoTime();
                     }
                 }
             }
 
             @Override
             public void onDrawEye(Eye eye) {
+                boolean left = eye.getType() == Eye.Type.LEFT;
+                int index = left ? EYE_LEFT : EYE_RIGHT;
+                int displayedSequence = 0;
                 synchronized (mBitmapLock) {
-                    if (mBitmapNew) {
-                        screenQuad.bindBitmap(mBitmap);
-                        mBitmapNew = false;
+                    if (mBitmapNew[index]) {
+                        screenQuad.bindBitmap(mBitmaps[index], left);
+                        mBitmapNew[index] = false;
+                        displayedSequence = mRenderPoseSequences[index];
                     }
                 }
+                if (left && displayedSequence != 0) {
+                    recordDisplay(displayedSequence);
+                }
 
                 GLES20.glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
                 GLES20.glClear(GLES20.GL_COLOR_BUFFER_BIT);
-                screenQuad.draw(eye.getType() == Eye.Type.LEFT);
+                screenQuad.draw(left);
             }
 
             @Override
@@ -109,11 +214,26 @@ public class MainActivity extends AppCompatActivity {
                 mViewportWidth = width;
                 mViewportHeight = height;
                 mInterpupillary = mGvrView.getInterpupillaryDistance();
+
+                GvrViewerParams params = mGvrView.getGvrViewerParams();
+                FieldOfView fov = params.getLeftEyeMaxFov();
+                mFov[0] = fov.getLeft();
+                mFov[1] = fov.getRight();
+                mFov[2] = fov.getBottom();
+                mFov[3] = fov.getTop();
+                float[] coefficients = params.getDistortion().getCoefficients();
+                for (int i = 0; i < mDistortion.length && i < coefficients.length; ++i) {
+                    mDistortion[i] = coefficients[i];
+                }
             }
 
             @Override
             public void onSurfaceCreated(EGLConfig eglConfig) {
                 screenQuad.setup();
+
+                int[] maxTextureSize = new int[1];
+                GLES20.glGetIntegerv(GLES20.GL_MAX_TEXTURE_SIZE, maxTextureSize, 0);
+                mMaxTextureSize = maxTextureSize[0];
             }
 
             @Override
@@ -158,45 +278,116 @@ public class MainActivity extends AppCompatActivity {
             return;
         }
 
+        int status = openSession(manager, accessory);
+        if (status != STATUS_OK) {
+            setResult(status);
+            finish();
+        }
+    }
+
+    @Override
+    protected void onDestroy() {
+        super.onDestroy();
+        mReconnecting = false;
+        mHandler.removeCallbacksAndMessages(null);
+    }
+
+    /** Opens the accessory, says hello and starts the threads; returns a STATUS_*. */
+    private int openSession(UsbManager manager, UsbAccessory accessory) {
         mParcelFileDescriptor = manager.openAccessory(accessory);
         if (mParcelFileDescriptor == null) {
-            setResult(STATUS_INITIALIZE_DEVICE_ERROR);
-            finish();
-            return;
+            return STATUS_INITIALIZE_DEVICE_ERROR;
         }
 
         if (!sendHandshake(mParcelFileDescriptor)) {
-            try {
-                mParcelFileDescriptor.close();
-                mParcelFileDescriptor = null;
-            } catch (IOException e) {}
-            setResult(STATUS_HANDSHAKE_ERROR);
-            finish();
-            return;
+            closeAccessory();
+            return STATUS_HANDSHAKE_ERROR;
         }
 
+        final AtomicBoolean cancel = new AtomicBoolean();
         ThreadCallback callback = new ThreadCallback() {
+            private boolean mCompleted = false;
+
             @Override
             public void onCompleted(boolean success, Exception e, int code) {
-                try {
-                    if (mParcelFileDescriptor != null) {
-                        mParcelFileDescriptor.close();
-                        mParcelFileDescriptor = null;
-                    }
-                } catch (IOException f) {}
-
-                setResult(code);
-                finish();
-
-                if (!success) {
-                    Log.d("THREADS", "IO error", e);
+                // Both threads report; the first one decides.
+                if (mCompleted) {
+                    return;
+                }
+                mCompleted = true;
+                cancel.set(true);
+                Choreographer.getInstance().removeFrameCallback(mVsyncCallback);
+                closeAccessory();
+
+                if (success) {
+                    setResult(code);
+                    finish();
+                    return;
                 }
+
+                // Most likely the cable or the PC hiccupped. The PC tries to
+                // resume the session, so wait for the accessory to come back.
+                Log.d("THREADS", "IO error", e);
+                waitForAccessory(code);
             }
         };
 
-        mCancel.set(false);
-        runReadThread(mParcelFileDescriptor, callback);
-        runWriteThread(mParcelFileDescriptor, callback);
+        synchronized (mVsyncLock) {
+            mHelloRequested = false;
+        }
+        mCancel = cancel;
+        mVsyncPeriodNs = Math.round(
+                1e9f / getWindowManager().getDefaultDisplay().getRefreshRate());
+        Choreographer.getInstance().postFrameCallback(mVsyncCallback);
+        runReadThread(mParcelFileDescriptor, cancel, callback);
+        runWriteThread(mParcelFileDescriptor, cancel, callback);
+        return STATUS_OK;
+    }
+
+    private void closeAccessory() {
+        try {
+            if (mParcelFileDescriptor != null) {
+                mParcelFileDescriptor.close();
+                mParcelFileDescriptor = null;
+            }
+        } catch (IOException e) {}
+    }
+
+    /**
+     * Polls for the accessory after an IO error and starts a new session on
+     * it, keeping the current image up meanwhile. Gives up with code after
+     * RECONNECT_TIMEOUT_MS.
+     */
+    private void waitForAccessory(final int code) {
+        final long startMs = SystemClock.uptimeMillis();
+        mReconnecting = true;
+        mHandler.post(new Runnable() {
+            @Override
+            public void run() {
+                if (!mReconnecting) {
+                    return;
+                }
+
+                UsbManager manager = (UsbManager) getSystemService(Context.USB_SERVICE);
+                UsbAccessory[] accessories = manager.getAccessoryList();
+                if (accessories != null && accessories.length > 0
+                        && manager.hasPermission(accessories[0])
+                        && openSession(manager, accessories[0]) == STATUS_OK) {
+                    mReconnecting = false;
+                    Log.i("RECONNECT", "Session resumed after "
+                            + (SystemClock.uptimeMillis() - startMs) + " ms");
+                    return;
+                }
+
+                if (SystemClock.uptimeMillis() - startMs >= RECONNECT_TIMEOUT_MS) {
+                    mReconnecting = false;
+                    setResult(code);
+                    finish();
+                    return;
+                }
+                mHandler.postDelayed(this, RECONNECT_POLL_MS);
+            }
+        });
     }
 
     private boolean sendHandshake(@NonNull ParcelFileDescriptor parcelFileDescriptor) {
@@ -205,58 +396,173 @@ public class MainActivity extends AppCompatActivity {
             Log.v("VIEWERPARAMS", String.format("w %d h %d ip %f", mViewportWidth, mViewportHeight,
                     mInterpupillary));
 
-            ByteBuffer handshake = ByteBuffer.allocate(Byte.SIZE * 16384)
-                    .order(ByteOrder.BIG_ENDIAN);
-
-            // Put header.
-            handshake.put(TAG_HEADER);
-
-            // Put width.
-            handshake.put(TAG_WIDTH)
-                    .putInt(mViewportWidth);
-
-            // Put height.
-            handshake.put(TAG_HEIGHT)
-                    .putInt(mViewportHeight);
-
-            // Put interpupillary.
-            handshake.put(TAG_INTERPUPILLARY)
-                    .putFloat(mInterpupillary);
-
-            while (handshake.hasRemaining()) {
-                handshake.put(TAG_FILL);
-            }
-
-            os.write(handshake.array());
+            mCapabilities = buildCapabilities();
+            os.write(helloMessage(1));
             return true;
         } catch (IOException e) {
             return false;
         }
     }
 
+    /** What we can do; the PC answers with what it picked. */
+    private byte[] buildCapabilities() {
+        // Decoded images become textures, so that's the size limit.
+        int maxDecode = Math.min(mMaxTextureSize > 0 ? mMaxTextureSize : 2048, 0xFFFF);
+        int refreshMilliHz = Math.round(
+                getWindowManager().getDefaultDisplay().getRefreshRate() * 1000.0f);
+        ByteBuffer caps = ByteBuffer.allocate(CAPABILITIES_LEN).order(ByteOrder.BIG_ENDIAN);
+        caps.put((byte) MESSAGE_VERSION_MIN)
+                .put((byte) MESSAGE_VERSION_MAX)
+                .put((byte) ((1 << CODEC_JPEG) | (1 << CODEC_TILES)))
+                .put((byte) 0)
+                .putShort((short) mViewportWidth)
+                .putShort((short) mViewportHeight)
+                .putShort((short) maxDecode)
+                .putShort((short) maxDecode)
+                .putInt(refreshMilliHz)
+                .putFloat(mInterpupillary);
+        for (float f : mFov) {
+            caps.putFloat(f);
+        }
+        for (float k : mDistortion) {
+            caps.putFloat(k);
+        }
+        return caps.array();
+    }
+
+    /** Our TYPE_HELLO, in the lowest version we speak. */
+    private byte[] helloMessage(int sequence) {
+        byte[] caps = mCapabilities;
+        ByteBuffer message = ByteBuffer.allocate(MESSAGE_HEADER_LEN + caps.length)
+                .order(ByteOrder.BIG_ENDIAN);
+        message.put((byte) MESSAGE_MAGIC)
+                .put((byte) MESSAGE_VERSION_MIN)
+                .put((byte) TYPE_HELLO)
+                .put((byte) 0)
+                .putInt(sequence)
+                .putInt(caps.length)
+                .put(caps);
+        return message.array();
+    }
+
     private void runReadThread(@NonNull ParcelFileDescriptor parcelFileDescriptor,
+                               final AtomicBoolean cancel,
                                final ThreadCallback callback) {
         final FileDescriptor fd = parcelFileDescriptor.getFileDescriptor();
         new Thread(null, new Runnable() {
             @Override
             public void run() {
                 byte[] buffer = new byte[1024 * 1024]; // Initialize 1 MB at first.
-                Bitmap backBitmap = null;
-                BitmapFactory.Options options = new BitmapFactory.Options();
-                options.inMutable = true;
+                Bitmap[] backBitmaps = new Bitmap[EYE_COUNT];
+                BitmapFactory.Options[] options = new BitmapFactory.Options[EYE_COUNT];
+                for (int i = 0; i < EYE_COUNT; ++i) {
+                    options[i] = new BitmapFactory.Options();
+                    options[i].inMutable = true;
+                }
+                BitmapFactory.Options atlasOptions = new BitmapFactory.Options();
+                atlasOptions.inMutable = true;
+                float[] renderPose = new float[4];
+                byte[] headerBytes = new byte[256];
+                ByteBuffer header = ByteBuffer.wrap(headerBytes).order(ByteOrder.BIG_ENDIAN);
+                long lastFrameId = -1;
+                long missingFrames = 0;
 
                 try (InputStream is = new FileInputStream(fd)) {
                     DataInputStream dis = new DataInputStream(is);
 
                     boolean cancelled;
-                    while (!(cancelled = mCancel.get())) {
+                    int lastMessageSequence = 0;
+                    boolean lostMessages = false;
+                    while (!(cancelled = cancel.get())) {
+                        int magic = dis.readUnsignedByte();
+                        int messageVersion = dis.readUnsignedByte();
+                        int type = dis.readUnsignedByte();
+                        int flags = dis.readUnsignedByte();
+                        int messageSequence = dis.readInt();
+                        int length = dis.readInt();
+                        if (magic != MESSAGE_MAGIC || messageVersion < MESSAGE_VERSION_MIN
+                                || messageVersion > MESSAGE_VERSION_MAX
+                                || length < 0 || length > MESSAGE_MAX_PAYLOAD) {
+                            throw new IllegalStateException("Bad message header");
+                        }
+                        // A HELLO starts the PC's numbering over.
+                        if (type != TYPE_HELLO && lastMessageSequence != 0
+                                && messageSequence != lastMessageSequence + 1) {
+                            // Whatever was lost, the next frame is drawn over
+                            // an image that's missing something.
+                            Log.d("MESSAGES", "gap before " + messageSequence);
+                            lostMessages = true;
+                        }
+                        lastMessageSequence = messageSequence;
+                        mMessageVersion = messageVersion;
+
+                        if (type == TYPE_END) {
+                            break;
+                        } else if (type == TYPE_HELLO && length >= CAPABILITIES_LEN) {
+                            // What the PC picked from our capabilities. With
+                            // FLAG_RESUME it reopened the link and wants to
+                            // hear ours again before streaming.
+                            byte[] hello = new byte[length];
+                            dis.readFully(hello);
+                            if ((flags & MESSAGE_FLAG_RESUME) != 0) {
+                                synchronized (mVsyncLock) {
+                                    mHelloRequested = true;
+                                    mVsyncLock.notifyAll();
+                                }
+                            }
+                            ByteBuffer caps = ByteBuffer.wrap(hello).order(ByteOrder.BIG_ENDIAN);
+                            Log.i("HANDSHAKE", String.format("version %d, %dx%d, codecs 0x%x",
+                                    caps.get(1) & 0xFF, caps.getShort(4) & 0xFFFF,
+                                    caps.getShort(6) & 0xFFFF, caps.get(2) & 0xFF));
+                            continue;
+                        } else if (type != TYPE_FRAME) {
+                            // A newer kind of message; not for us.
+                            skipFully(dis, length);
+                            continue;
+                        }
+
                         int size = dis.readInt();
                         Log.i("SIZE", "size=" + size);
 
                         if (size < 0 || size > 1024 * 1024 * 4 /* 4 MB */) {
                             throw new IndexOutOfBoundsException();
-                        } else if (size == 0) {
-                            break;
+                        }
+
+                        // Newer versions append fields; read them and skip.
+                        int version = dis.readUnsignedByte();
+                        int headerLen = dis.readUnsignedByte();
+                        if (version < FRAME_HEADER_VERSION || headerLen < FRAME_HEADER_LEN) {
+                            throw new IllegalStateException("Bad frame header");
+                        }
+                        if (headerLen + size > length) {
+                            throw new IllegalStateException("Frame overruns its message");
+                        }
+                        dis.readFully(headerBytes, 0, headerLen - 6);
+
+                        // Offsets below are from the eye field (byte 6).
+                        int eye = header.get(0) & 0xFF;
+                        int layout = header.get(1) & 0xFF;
+                        int codec = header.get(2) & 0xFF;
+                        if (eye >= EYE_COUNT || layout != EYE_LAYOUT_SEPARATE) {
+                            throw new IndexOutOfBoundsException();
+                        }
+                        long frameId = header.getLong(6);
+                        int poseSequence = header.getInt(14);
+                        for (int i = 0; i < 4; ++i) {
+                            renderPose[i] = header.getFloat(18 + 4 * i);
+                        }
+
+                        if (lostMessages) {
+                            requestRefresh(REFRESH_ALL_EYES, REASON_LOST, frameId);
+                            lostMessages = false;
+                        }
+
+                        if (frameId > lastFrameId) {
+                            if (lastFrameId >= 0 && frameId > lastFrameId + 1) {
+                                missingFrames += frameId - lastFrameId - 1;
+                                Log.d("FRAMES", "missing=" + missingFrames);
+                            }
+                            lastFrameId = frameId;
                         }
 
                         if (buffer.length < size) {
@@ -264,25 +570,45 @@ public class MainActivity extends AppCompatActivity {
                         }
 
                         dis.readFully(buffer, 0, size);
+                        skipFully(dis, length - headerLen - size);
 
-                        try {
-                            backBitmap = BitmapFactory.decodeByteArray(buffer, 0, size, options);
-                            synchronized (mBitmapLock) {
-                                Bitmap temp = mBitmap;
-                                mBitmap = backBitmap;
-                                mBitmapNew = true;
-                                backBitmap = temp;
-                                options.inBitmap = temp;
+                        if (codec == CODEC_TILES) {
+                            if (applyTiles(eye, buffer, size, atlasOptions)) {
+                                setRenderPose(eye, poseSequence, renderPose);
+                            } else {
+                                requestRefresh(eye, REASON_DELTA_REJECTED, frameId);
                             }
+                            recordArrival(eye, frameId);
+                            continue;
+                        } else if (codec != CODEC_JPEG) {
+                            continue;
+                        }
+
+                        Bitmap decoded;
+                        try {
+                            decoded = BitmapFactory.decodeByteArray(buffer, 0, size,
+                                    options[eye]);
                         } catch (IllegalArgumentException ex) {
-                            // Skip this frame; the bitmap changed size.
+                            // The image changed size; decode into a new bitmap.
+                            options[eye].inBitmap = null;
+                            decoded = BitmapFactory.decodeByteArray(buffer, 0, size,
+                                    options[eye]);
+                        }
+                        if (decoded == null) {
+                            // Corrupt; keep showing what we had until the
+                            // keyframe we ask for arrives.
+                            requestRefresh(eye, REASON_DECODE_FAILED, frameId);
+                        } else {
                             synchronized (mBitmapLock) {
-                                mBitmap = null;
-                                mBitmapNew = false;
-                                backBitmap = null;
-                                options.inBitmap = null;
+                                Bitmap temp = mBitmaps[eye];
+                                mBitmaps[eye] = decoded;
+                                mBitmapNew[eye] = true;
+                                backBitmaps[eye] = temp;
+                                options[eye].inBitmap = temp;
+                                setRenderPose(eye, poseSequence, renderPose);
                             }
                         }
+                        recordArrival(eye, frameId);
                     }
 
                     if (!cancelled) {
@@ -302,44 +628,272 @@ public class MainActivity extends AppCompatActivity {
                         }
                     });
                 } finally {
-                    if (backBitmap != null) {
-                        backBitmap.recycle();
+                    for (Bitmap backBitmap : backBitmaps) {
+                        if (backBitmap != null) {
+                            backBitmap.recycle();
+                        }
                     }
                 }
 
-                mCancel.set(true);
+                cancel.set(true);
                 Log.d("THREADS", "End read thread");
             }
         }).start();
     }
 
+    private static void skipFully(DataInputStream dis, int count) throws IOException {
+        while (count > 0) {
+            int skipped = dis.skipBytes(count);
+            if (skipped <= 0) {
+                dis.readByte(); // Throws at the end of the stream.
+                skipped = 1;
+            }
+            count -= skipped;
+        }
+    }
+
+    /**
+     * Measures how long ago the pose a newly displayed frame was rendered
+     * with was sampled, for the PC to pick up with the next pose packet.
+     */
+    private void recordDisplay(int sequence) {
+        long now = System.nanoTime();
+        synchronized (mRotationLock) {
+            int slot = (sequence & 0x7FFFFFFF) % POSE_HISTORY;
+            if (mSentSequences[slot] == sequence) {
+                mDisplayedSequence = sequence;
+                mDisplayMicros = (int) ((now - mSentTimesNs[slot]) / 1000);
+            }
+        }
+    }
+
+    /**
+     * Asks the PC for a keyframe for the eye, whose image went wrong at or
+     * before frameId. Requests not yet sent are merged.
+     */
+    private void requestRefresh(int eye, int reason, long frameId) {
+        Log.d("FRAMES", "refresh eye=" + eye + " reason=" + reason + " frame=" + frameId);
+        synchronized (mVsyncLock) {
+            if (mRefreshEye >= 0 && mRefreshEye != eye) {
+                eye = REFRESH_ALL_EYES;
+            }
+            mRefreshEye = eye;
+            mRefreshReason = reason;
+            mRefreshFrameId = Math.max(mRefreshFrameId, frameId);
+            mVsyncLock.notifyAll();
+        }
+    }
+
+    /** The PC sends the right eye last; once it's decoded, the frame is here. */
+    private void recordArrival(int eye, long frameId) {
+        if (eye != EYE_COUNT - 1) {
+            return;
+        }
+        synchronized (mVsyncLock) {
+            mArrivedFrameId = frameId;
+            mArrivalNs = System.nanoTime();
+        }
+    }
+
+    private void setRenderPose(int eye, int sequence, float[] pose) {
+        synchronized (mBitmapLock) {
+            mRenderPoseSequences[eye] = sequence;
+            System.arraycopy(pose, 0, mRenderPoses[eye], 0, 4);
+        }
+    }
+
+    /**
+     * Copies the changed tiles in a CODEC_TILES body onto the eye's current
+     * bitmap. Deltas for a missing or differently sized bitmap are dropped;
+     * the PC sends a whole JPEG again soon enough. Returns whether the bitmap
+     * was updated.
+     */
+    private boolean applyTiles(int eye, byte[] buffer, int size,
+                               BitmapFactory.Options atlasOptions) {
+        if (size < TILE_HEADER_LEN) {
+            return false;
+        }
+
+        ByteBuffer header = ByteBuffer.wrap(buffer, 0, size).order(ByteOrder.BIG_ENDIAN);
+        int width = header.getShort(0) & 0xFFFF;
+        int height = header.getShort(2) & 0xFFFF;
+        int tileSize = header.get(4) & 0xFF;
+        int tileCount = header.getShort(6) & 0xFFFF;
+        int columns = header.getShort(8) & 0xFFFF;
+        if (tileSize == 0 || columns == 0) {
+            return false;
+        } else if (tileCount == 0) {
+            // Nothing changed; the image stands for the new pose as well.
+            return true;
+        }
+
+        int tilesX = (width + tileSize - 1) / tileSize;
+        int tilesY = (height + tileSize - 1) / tileSize;
+        int mapLen = (tilesX * tilesY + 7) / 8;
+        int jpegOffset = TILE_HEADER_LEN + mapLen;
+        if (size <= jpegOffset) {
+            return false;
+        }
+
+        Bitmap atlas;
+        try {
+            atlas = BitmapFactory.decodeByteArray(buffer, jpegOffset, size - jpegOffset,
+                    atlasOptions);
+        } catch (IllegalArgumentException ex) {
+            // The atlas outgrew the reused bitmap.
+            atlasOptions.inBitmap = null;
+            atlas = BitmapFactory.decodeByteArray(buffer, jpegOffset, size - jpegOffset,
+                    atlasOptions);
+        }
+        if (atlas == null) {
+            return false;
+        }
+        atlasOptions.inBitmap = atlas;
+
+        Rect src = new Rect();
+        Rect dst = new Rect();
+        synchronized (mBitmapLock) {
+            Bitmap target = mBitmaps[eye];
+            if (target == null || target.getWidth() != width
+                    || target.getHeight() != height) {
+                return false;
+            }
+
+            Canvas canvas = new Canvas(target);
+            int cell = 0;
+            for (int i = 0; i < tilesX * tilesY && cell < tileCount; ++i) {
+                if ((buffer[TILE_HEADER_LEN + i / 8] & (1 << (i % 8))) == 0) {
+                    continue;
+                }
+
+                int x = (i % tilesX) * tileSize;
+                int y = (i / tilesX) * tileSize;
+                int w = Math.min(tileSize, width - x);
+                int h = Math.min(tileSize, height - y);
+                int atlasX = (cell % columns) * tileSize;
+                int atlasY = (cell / columns) * tileSize;
+                src.set(atlasX, atlasY, atlasX + w, atlasY + h);
+                dst.set(x, y, x + w, y + h);
+                canvas.drawBitmap(atlas, src, dst, null);
+                ++cell;
+            }
+            mBitmapNew[eye] = true;
+        }
+        return true;
+    }
+
     private void runWriteThread(@NonNull ParcelFileDescriptor parcelFileDescriptor,
+                                final AtomicBoolean cancel,
                                 final ThreadCallback callback) {
         final FileDescriptor fd = parcelFileDescriptor.getFileDescriptor();
         new Thread(null, new Runnable() {
             @Override
             public void run() {
-                ByteBuffer bytes = ByteBuffer.allocate(Float.SIZE / Byte.SIZE * 4)
+                // Quaternion, then sequence number and sample time so the PC
+                // can tell samples apart and see how old they are, then the
+                // latest pose-to-display latency.
+                ByteBuffer bytes = ByteBuffer.allocate(POSE_PACKET_LEN)
                         .order(ByteOrder.BIG_ENDIAN);
                 bytes.putFloat(0.04f)
                     .putFloat(0.08f)
                     .putFloat(0.15f)
-                    .putFloat(0.16f);
+                    .putFloat(0.16f)
+                    .putInt(0)
+                    .putLong(System.nanoTime())
+                    .putInt(0)
+                    .putInt(0);
+                int sequence = 0;
+
+                ByteBuffer message = ByteBuffer.allocate(MESSAGE_HEADER_LEN + POSE_PACKET_LEN)
+                        .order(ByteOrder.BIG_ENDIAN);
+                ByteBuffer vsync = ByteBuffer.allocate(MESSAGE_HEADER_LEN + VSYNC_PACKET_LEN)
+                        .order(ByteOrder.BIG_ENDIAN);
+                ByteBuffer refresh = ByteBuffer.allocate(MESSAGE_HEADER_LEN + REFRESH_PACKET_LEN)
+                        .order(ByteOrder.BIG_ENDIAN);
+                long lastVsyncCount = 0;
+                int messageSequence = 1; // The handshake was the first.
 
                 try (OutputStream os = new FileOutputStream(fd)) {
                     DataOutputStream dos = new DataOutputStream(os);
 
-                    while (!mCancel.get()) {
-                        dos.write(bytes.array());
+                    while (!cancel.get()) {
+                        // Wake with the display rather than on a fixed timer,
+                        // and tell the PC when it refreshed.
+                        boolean newVsync;
+                        boolean needRefresh;
+                        boolean needHello;
+                        synchronized (mVsyncLock) {
+                            if (mVsyncCount == lastVsyncCount && mRefreshEye < 0
+                                    && !mHelloRequested) {
+                                mVsyncLock.wait(VSYNC_TIMEOUT_MS);
+                            }
+                            needHello = mHelloRequested;
+                            mHelloRequested = false;
+                            needRefresh = mRefreshEye >= 0;
+                            if (needRefresh) {
+                                refresh.clear();
+                                refresh.put((byte) MESSAGE_MAGIC)
+                                        .put((byte) mMessageVersion)
+                                        .put((byte) TYPE_REFRESH)
+                                        .put((byte) 0)
+                                        .putInt(++messageSequence)
+                                        .putInt(REFRESH_PACKET_LEN)
+                                        .put((byte) mRefreshEye)
+                                        .put((byte) mRefreshReason)
+                                        .putShort((short) 0)
+                                        .putLong(mRefreshFrameId);
+                                mRefreshEye = -1;
+                                mRefreshFrameId = 0;
+                            }
+                            newVsync = mVsyncCount != lastVsyncCount;
+                            lastVsyncCount = mVsyncCount;
+                            vsync.clear();
+                            vsync.put((byte) MESSAGE_MAGIC)
+                                    .put((byte) mMessageVersion)
+                                    .put((byte) TYPE_VSYNC)
+                                    .put((byte) 0)
+                                    .putInt(0) // Sequence, filled in below.
+                                    .putInt(VSYNC_PACKET_LEN)
+                                    .putLong(mVsyncNs)
+                                    .putInt(mVsyncPeriodNs)
+                                    .putLong(mArrivedFrameId)
+                                    .putLong(mArrivalNs);
+                        }
+                        if (needHello) {
+                            dos.write(helloMessage(++messageSequence));
+                        }
+                        if (needRefresh) {
+                            dos.write(refresh.array());
+                        }
+                        if (newVsync) {
+                            vsync.putInt(4, ++messageSequence);
+                            dos.write(vsync.array());
+                        }
+
+                        message.clear();
+                        message.put((byte) MESSAGE_MAGIC)
+                                .put((byte) mMessageVersion)
+                                .put((byte) TYPE_POSE)
+                                .put((byte) 0)
+                                .putInt(++messageSequence)
+                                .putInt(POSE_PACKET_LEN)
+                                .put(bytes.array());
+                        dos.write(message.array());
 
                         synchronized (mRotationLock) {
                             bytes.position(0);
                             for (int i = 0; i < 4; ++i) {
                                 bytes.putFloat(mRotation[i]);
                             }
+                            bytes.putInt(++sequence);
+                            bytes.putLong(mRotationTimeNs);
+                            bytes.putInt(mDisplayedSequence);
+                            bytes.putInt(mDisplayMicros);
+
+                            int slot = (sequence & 0x7FFFFFFF) % POSE_HISTORY;
+                            mSentSequences[slot] = sequence;
+                            mSentTimesNs[slot] = mRotationTimeNs;
                         }
-
-                        Thread.sleep(10); // Throttle to 100 fps.
                     }
                 } catch (final Exception e) {
                     MainActivity.this.runOnUiThread(new Runnable() {
@@ -350,7 +904,7 @@ public class MainActivity extends AppCompatActivity {
                     });
                 }
 
-                mCancel.set(true);
+                cancel.set(true);
                 Log.d("THREADS", "End write thread");
             }
         }).start();
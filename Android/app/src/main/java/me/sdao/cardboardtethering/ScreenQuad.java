@@ -12,22 +12,17 @@ import java.nio.FloatBuffer;
 
 public class ScreenQuad {
 
+    // Each eye has its own texture, so both quads sample the whole of it.
     private static final float mLeftData[] = {
             /* x, y, z, s, t */
             -1.0f, -1.0f, 0.0f, 0.0f, 1.0f,
             -1.0f, 1.0f, 0.0f, 0.0f, 0.0f,
-            1.0f, -1.0f, 0.0f, 0.5f, 1.0f,
-            1.0f, 1.0f, 0.0f, 0.5f, 0.0f
-    };
-
-    private static final float mRightData[] = {
-            /* x, y, z, s, t */
-            -1.0f, -1.0f, 0.0f, 0.5f, 1.0f,
-            -1.0f, 1.0f, 0.0f, 0.5f, 0.0f,
             1.0f, -1.0f, 0.0f, 1.0f, 1.0f,
             1.0f, 1.0f, 0.0f, 1.0f, 0.0f
     };
 
+    private static final float mRightData[] = mLeftData;
+
     private static final int DATA_LENGTH = 20;
 
     private boolean mReady;
@@ -36,7 +31,7 @@ public class ScreenQuad {
     private int mProgramPositionParam;
     private int mProgramTexCoordParam;
     private int mProgramBitmapUniform;
-    private int[] mTextures = new int[1];
+    private int[] mTextures = new int[2];
     private int[] mBuffers = new int[2];
 
     public ScreenQuad(Context context) {
@@ -59,7 +54,7 @@ public class ScreenQuad {
         mProgramTexCoordParam = GLES20.glGetAttribLocation(mProgram, "a_TexCoord");
         mProgramBitmapUniform = GLES20.glGetUniformLocation(mProgram, "u_Bitmap");
 
-        GLES20.glGenTextures(1, mTextures, 0);
+        GLES20.glGenTextures(2, mTextures, 0);
         GLES20.glGenBuffers(2, mBuffers, 0);
         bufferData(true);
         bufferData(false);
@@ -68,7 +63,7 @@ public class ScreenQuad {
     }
 
     public void shutdown() {
-        GLES20.glDeleteTextures(1, mTextures, 0);
+        GLES20.glDeleteTextures(2, mTextures, 0);
         GLES20.glDeleteBuffers(2, mBuffers, 0);
 
         mReady = false;
@@ -91,12 +86,12 @@ public class ScreenQuad {
         GLES20.glBindBuffer(GLES20.GL_ARRAY_BUFFER, 0);
     }
 
-    public void bindBitmap(Bitmap bitmap) {
+    public void bindBitmap(Bitmap bitmap, boolean left) {
         if (bitmap == null || !mReady) {
             return;
         }
 
-        GLES20.glBindTexture(GLES20.GL_TEXTURE_2D, mTextures[0]);
+        GLES20.glBindTexture(GLES20.GL_TEXTURE_2D, left ? mTextures[0] : mTextures[1]);
 
         GLES20.glTexParameteri(GLES20.GL_TEXTURE_2D,
                 GLES20.GL_TEXTURE_MIN_FILTER,
@@ -116,7 +111,7 @@ public class ScreenQuad {
         GLES20.glUseProgram(mProgram);
 
         GLES20.glActiveTexture(GLES20.GL_TEXTURE0);
-        GLES20.glBindTexture(GLES20.GL_TEXTURE_2D, mTextures[0]);
+        GLES20.glBindTexture(GLES20.GL_TEXTURE_2D, left ? mTextures[0] : mTextures[1]);
         GLES20.glUniform1i(mProgramBitmapUniform, 0);
 
         GLES20.glBindBuffer(GLES20.GL_ARRAY_BUFFER, left ? mBuffers[0] : mBuffers[1]);
@@ -0,0 +1,79 @@
+#include "Bench.h"
+#include <cmath>
+#include <cstdlib>
+
+namespace Benchmark {
+
+  Options::Options() : _quick(false) {}
+
+  bool Options::quick() const {
+    return _quick;
+  }
+
+  void Options::setQuick(bool quick) {
+    _quick = quick;
+  }
+
+  void Options::set(const std::string& key, const std::string& value) {
+    _values[key] = value;
+  }
+
+  bool Options::has(const std::string& key) const {
+    return _values.find(key) != _values.end();
+  }
+
+  double Options::number(const std::string& key, double fallback) const {
+    auto it = _values.find(key);
+    if (it == _values.end() || it->second.empty()) {
+      return fallback;
+    }
+    char* end = nullptr;
+    double value = std::strtod(it->second.c_str(), &end);
+    return *end == '\0' ? value : fallback;
+  }
+
+  size_t Options::count(const std::string& key, size_t fallback) const {
+    double value = number(key, -1.0);
+    return value >= 0.0 ? static_cast<size_t>(value) : fallback;
+  }
+
+  std::string Options::text(const std::string& key,
+      const std::string& fallback) const {
+    auto it = _values.find(key);
+    return it == _values.end() ? fallback : it->second;
+  }
+
+  double averageOf(const std::vector<double>& values) {
+    double sum = 0.0;
+    for (double value : values) {
+      sum += value;
+    }
+    return values.empty() ? 0.0 : sum / values.size();
+  }
+
+  const char* jpegBackend() {
+#ifdef CARDBOARD_TURBOJPEG_SHIM
+    return "TurboJPEG shim over libjpeg";
+#else
+    return "libjpeg-turbo";
+#endif
+  }
+
+  double psnr(const unsigned char* a, size_t aPitch, const unsigned char* b,
+      size_t bPitch, size_t width, size_t height) {
+    double squared = 0.0;
+    for (size_t y = 0; y < height; ++y) {
+      const unsigned char* rowA = a + y * aPitch;
+      const unsigned char* rowB = b + y * bPitch;
+      for (size_t x = 0; x < width * 4; ++x) {
+        if (x % 4 != 3) {
+          double d = static_cast<double>(rowA[x]) - rowB[x];
+          squared += d * d;
+        }
+      }
+    }
+    double mse = squared / (width * height * 3);
+    return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+  }
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+#include "SampleWindow.h"
+
+/**
+ * Benchmarks for the streaming pipeline that don't need Unreal, a GPU or a
+ * phone. They run on synthetic frames so results are comparable between
+ * machines and commits. Each suite prints what it measured and returns
+ * whether that met its bar, which becomes cardboard_bench's exit code.
+ */
+namespace Benchmark {
+
+  /** --quick and the --key=value options from the command line. */
+  class Options {
+  public:
+    Options();
+
+    /** Small frames and short runs, for ctest. */
+    bool quick() const;
+    void setQuick(bool quick);
+
+    void set(const std::string& key, const std::string& value);
+    bool has(const std::string& key) const;
+    /** The fallback if the key is missing or isn't a number. */
+    double number(const std::string& key, double fallback) const;
+    size_t count(const std::string& key, size_t fallback) const;
+    std::string text(const std::string& key, const std::string& fallback) const;
+
+  private:
+    bool _quick;
+    std::map<std::string, std::string> _values;
+  };
+
+  double averageOf(const std::vector<double>& values);
+
+  /**
+   * Which TurboJPEG the encoder was built against: libjpeg-turbo's, or the
+   * shim over libjpeg that CARDBOARD_TURBOJPEG_SHIM selects.
+   */
+  const char* jpegBackend();
+
+  /**
+   * Peak signal-to-noise ratio over the colour channels of two BGRX images,
+   * in dB; 99 for identical images.
+   */
+  double psnr(const unsigned char* a, size_t aPitch, const unsigned char* b,
+    size_t bPitch, size_t width, size_t height);
+
+  bool runConvertSuite(const Options& options);
+  bool runEncodeSuite(const Options& options);
+  bool runLatencySuite(const Options& options);
+  bool runPacingSuite(const Options& options);
+  bool runPoseSuite(const Options& options);
+  bool runPredictSuite(const Options& options);
+  bool runProtocolSuite(const Options& options);
+  bool runRateSuite(const Options& options);
+  bool runReadbackSuite(const Options& options);
+  bool runReconnectSuite(const Options& options);
+  bool runRecoverySuite(const Options& options);
+  bool runSendSuite(const Options& options);
+  bool runShutdownSuite(const Options& options);
+  bool runStreamSuite(const Options& options);
+  bool runTilesSuite(const Options& options);
+  bool runUsbSuite(const Options& options);
+  bool runYuvSuite(const Options& options);
+  bool runPipelineSuite(const Options& options);
+
+}
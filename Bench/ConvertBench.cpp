@@ -0,0 +1,229 @@
+#include "Bench.h"
+#include "ColorConvert.h"
+#include "SyntheticFrameSource.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace Benchmark {
+
+  namespace {
+    /** A random frame of an awkward size: odd, narrower than a vector, padded pitch. */
+    struct TrialFrame {
+      size_t width;
+      size_t widthPitch;
+      size_t height;
+      std::vector<unsigned char> bgrx;
+    };
+
+    /** The planes of a width x height I420 image, packed into one buffer. */
+    class I420Buffer {
+    public:
+      I420Buffer(size_t width, size_t height, unsigned char fill)
+        : _chromaWidth((width + 1) / 2),
+          _bytes(width * height + 2 * _chromaWidth * ((height + 1) / 2), fill) {
+        _planes.y = _bytes.data();
+        _planes.u = _planes.y + width * height;
+        _planes.v = _planes.u + _chromaWidth * ((height + 1) / 2);
+        _planes.yStride = width;
+        _planes.uvStride = _chromaWidth;
+      }
+
+      const ColorConvert::YuvPlanes& planes() const { return _planes; }
+      const std::vector<unsigned char>& bytes() const { return _bytes; }
+
+    private:
+      size_t _chromaWidth;
+      std::vector<unsigned char> _bytes;
+      ColorConvert::YuvPlanes _planes;
+    };
+
+    /**
+     * Random frames alternating between noise and runs of extremes, where
+     * rounding and saturation mistakes show up. The same seed gives the same
+     * frames.
+     */
+    class TrialFrames {
+    public:
+      TrialFrames() : _seed(0x12345678), _trial(0) {}
+
+      TrialFrame next() {
+        TrialFrame frame;
+        frame.width = 1 + random() % 97;
+        frame.height = 1 + random() % 23;
+        frame.widthPitch = frame.width * 4 + (random() % 3) * 4;
+        frame.bgrx.resize(frame.widthPitch * frame.height);
+        for (unsigned char& c : frame.bgrx) {
+          c = (_trial % 2 == 0) ? static_cast<unsigned char>(random())
+            : ((random() & 1) ? 255 : 0);
+        }
+        _trial++;
+        return frame;
+      }
+
+    private:
+      uint32_t _seed;
+      size_t _trial;
+
+      uint32_t random() {
+        _seed ^= _seed << 13;
+        _seed ^= _seed >> 17;
+        _seed ^= _seed << 5;
+        return _seed;
+      }
+    };
+
+    /** Converts trial frames with the kernel and with scalar, and compares the planes. */
+    bool matchesReference(ColorConvert::Kernel kernel, size_t trials) {
+      TrialFrames frames;
+      for (size_t trial = 0; trial < trials; ++trial) {
+        TrialFrame frame = frames.next();
+        I420Buffer expected(frame.width, frame.height, 0);
+        I420Buffer actual(frame.width, frame.height, 0xCD);
+        ColorConvert::bgrxToI420(ColorConvert::KERNEL_SCALAR, frame.bgrx.data(),
+          frame.width, frame.widthPitch, frame.height, expected.planes());
+        ColorConvert::bgrxToI420(kernel, frame.bgrx.data(),
+          frame.width, frame.widthPitch, frame.height, actual.planes());
+        if (expected.bytes() != actual.bytes()) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /** Largest difference, per plane, from the float JFIF conversion. */
+    struct JfifError {
+      int y;
+      int cb;
+      int cr;
+    };
+
+    int jfifRound(double value) {
+      return static_cast<int>(std::floor(std::min(std::max(value, 0.0), 255.0) + 0.5));
+    }
+
+    /**
+     * Checks the scalar kernel against the JFIF (ITU-R BT.601 full range)
+     * formulas evaluated in double precision, with chroma from the average of
+     * each 2x2 block and the last row/column repeated for odd sizes. This is
+     * independent of the fixed-point coefficients the kernels share.
+     */
+    JfifError scalarJfifError(size_t trials) {
+      JfifError worst = { 0, 0, 0 };
+      TrialFrames frames;
+      for (size_t trial = 0; trial < trials; ++trial) {
+        TrialFrame frame = frames.next();
+        I420Buffer actual(frame.width, frame.height, 0xCD);
+        ColorConvert::bgrxToI420(ColorConvert::KERNEL_SCALAR, frame.bgrx.data(),
+          frame.width, frame.widthPitch, frame.height, actual.planes());
+        const ColorConvert::YuvPlanes& out = actual.planes();
+
+        auto pixel = [&](size_t x, size_t y) {
+          x = std::min(x, frame.width - 1);
+          y = std::min(y, frame.height - 1);
+          return frame.bgrx.data() + y * frame.widthPitch + x * 4;
+        };
+        for (size_t y = 0; y < frame.height; ++y) {
+          for (size_t x = 0; x < frame.width; ++x) {
+            const unsigned char* p = pixel(x, y);
+            int expected = jfifRound(0.299 * p[2] + 0.587 * p[1] + 0.114 * p[0]);
+            worst.y = std::max(worst.y, std::abs(out.y[y * out.yStride + x] - expected));
+          }
+        }
+        for (size_t y = 0; y < frame.height; y += 2) {
+          for (size_t x = 0; x < frame.width; x += 2) {
+            double r = 0.0, g = 0.0, b = 0.0;
+            for (size_t dy = 0; dy < 2; ++dy) {
+              for (size_t dx = 0; dx < 2; ++dx) {
+                const unsigned char* p = pixel(x + dx, y + dy);
+                b += p[0] / 4.0;
+                g += p[1] / 4.0;
+                r += p[2] / 4.0;
+              }
+            }
+            int cb = jfifRound(128.0 - 0.168736 * r - 0.331264 * g + 0.5 * b);
+            int cr = jfifRound(128.0 + 0.5 * r - 0.418688 * g - 0.081312 * b);
+            size_t i = (y / 2) * out.uvStride + x / 2;
+            worst.cb = std::max(worst.cb, std::abs(out.u[i] - cb));
+            worst.cr = std::max(worst.cr, std::abs(out.v[i] - cr));
+          }
+        }
+      }
+      return worst;
+    }
+
+    struct ConvertResult {
+      const char* name;
+      double megapixelsPerSecond;
+      bool matchesReference; /* Bit-exact against the scalar kernel. */
+    };
+
+    /** Times each supported BGRX to I420 kernel and checks it against scalar. */
+    std::vector<ConvertResult> runColorConvert(size_t width, size_t height,
+        size_t frames) {
+      std::vector<ConvertResult> results;
+      frames = std::max<size_t>(frames, 1);
+
+      size_t widthPitch = width * 4;
+      std::vector<unsigned char> pixels(widthPitch * height);
+      SyntheticFrameSource::fillTestPattern(pixels.data(), width, widthPitch, height, 0);
+
+      size_t chromaWidth = (width + 1) / 2;
+      size_t chromaHeight = (height + 1) / 2;
+      std::vector<unsigned char> planes(width * height + 2 * chromaWidth * chromaHeight);
+      ColorConvert::YuvPlanes yuv;
+      yuv.y = planes.data();
+      yuv.u = yuv.y + width * height;
+      yuv.v = yuv.u + chromaWidth * chromaHeight;
+      yuv.yStride = width;
+      yuv.uvStride = chromaWidth;
+
+      for (int i = 0; i < ColorConvert::KERNEL_COUNT; ++i) {
+        ColorConvert::Kernel kernel = static_cast<ColorConvert::Kernel>(i);
+        if (!ColorConvert::isSupported(kernel)) {
+          continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t frame = 0; frame < frames; ++frame) {
+          ColorConvert::bgrxToI420(kernel, pixels.data(), width, widthPitch, height, yuv);
+        }
+        double elapsedMs = std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - start).count();
+
+        ConvertResult result;
+        result.name = ColorConvert::kernelName(kernel);
+        result.megapixelsPerSecond = (width * height * frames) / (elapsedMs * 1000.0);
+        result.matchesReference = matchesReference(kernel, 200);
+        results.push_back(result);
+      }
+
+      return results;
+    }
+  }
+
+  /**
+   * The scalar kernel has to stay within 1 of the float JFIF conversion, and
+   * every other kernel this CPU runs has to match it bit for bit.
+   */
+  bool runConvertSuite(const Options& options) {
+    size_t frames = std::max<size_t>(
+      options.count("frames", options.quick() ? 5 : 30), 1);
+    JfifError error = scalarJfifError(200);
+    bool passed = error.y <= 1 && error.cb <= 1 && error.cr <= 1;
+    std::printf("scalar against float JFIF: Y within %d, Cb within %d, Cr within %d; %s\n",
+      error.y, error.cb, error.cr, passed ? "passed" : "FAILED");
+    for (const ConvertResult& result : runColorConvert(1920 * 2, 1080, frames)) {
+      std::printf("%s: %.0f MP/s, %s\n", result.name, result.megapixelsPerSecond,
+        result.matchesReference ? "matches reference" : "DOES NOT MATCH REFERENCE");
+      passed = passed && result.matchesReference;
+    }
+    std::printf("Selected: %s\n", ColorConvert::kernelName(ColorConvert::bestKernel()));
+    return passed;
+  }
+
+}
@@ -0,0 +1,118 @@
+#include "Bench.h"
+#include "JpegEncoder.h"
+#include "SyntheticFrameSource.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "turbojpeg.h"
+
+namespace Benchmark {
+
+  namespace {
+    struct EncodeResult {
+      size_t threads;
+      double msPerFrame;
+      double bytesPerFrame;
+      bool decoded; /* The stitched JPEG decoded to the frame's size. */
+      double psnr;  /* Decoded against the source. */
+    };
+
+    /**
+     * Encodes frames with JpegEncoder using 1..maxThreads threads, then
+     * decodes the last one so broken stitching can't pass for a fast encode.
+     */
+    std::vector<EncodeResult> runStripEncode(size_t width, size_t height,
+        size_t maxThreads, size_t frames, int quality) {
+      std::vector<EncodeResult> results;
+      frames = std::max<size_t>(frames, 1);
+
+      size_t widthPitch = width * 4;
+      std::vector<unsigned char> pixels(widthPitch * height);
+      SyntheticFrameSource::fillTestPattern(pixels.data(), width, widthPitch, height, 0);
+      std::vector<unsigned char> decoded(widthPitch * height);
+      tjhandle decoder = tjInitDecompress();
+
+      FrameView view;
+      view.data = pixels.data();
+      view.width = width;
+      view.widthPitch = widthPitch;
+      view.height = height;
+
+      for (size_t threads = 1; threads <= maxThreads; ++threads) {
+        JpegEncoder encoder(threads);
+        unsigned char* jpegBuffer = nullptr;
+        unsigned long jpegCapacity = 0;
+        unsigned long jpegSize = 0;
+
+        // Warm up buffers and worker threads outside the timed loop.
+        encoder.encode(view, quality, TJSAMP_420, &jpegBuffer, &jpegCapacity, &jpegSize);
+
+        double totalBytes = 0.0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < frames; ++i) {
+          encoder.encode(view, quality, TJSAMP_420, &jpegBuffer, &jpegCapacity, &jpegSize);
+          totalBytes += jpegSize;
+        }
+        double elapsedMs = std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - start).count();
+
+        EncodeResult result;
+        result.threads = threads;
+        result.msPerFrame = elapsedMs / frames;
+        result.bytesPerFrame = totalBytes / frames;
+
+        int decodedWidth = 0;
+        int decodedHeight = 0;
+        int subsamp = 0;
+        int colorspace = 0;
+        result.decoded = jpegBuffer != nullptr &&
+          tjDecompressHeader3(decoder, jpegBuffer, jpegSize, &decodedWidth,
+            &decodedHeight, &subsamp, &colorspace) == 0 &&
+          decodedWidth == static_cast<int>(width) &&
+          decodedHeight == static_cast<int>(height) &&
+          tjDecompress2(decoder, jpegBuffer, jpegSize, decoded.data(),
+            static_cast<int>(width), static_cast<int>(widthPitch),
+            static_cast<int>(height), TJPF_BGRX, 0) == 0;
+        result.psnr = result.decoded ?
+          psnr(pixels.data(), widthPitch, decoded.data(), widthPitch, width, height) : 0.0;
+
+        if (jpegBuffer != nullptr) {
+          tjFree(jpegBuffer);
+        }
+        results.push_back(result);
+      }
+
+      tjDestroy(decoder);
+      return results;
+    }
+  }
+
+  /**
+   * Side-by-side 1080p, the largest frame we expect to stream, encoded in
+   * strips on 1..--threads threads. Every thread count has to decode and
+   * look as good as the single-strip encode.
+   */
+  bool runEncodeSuite(const Options& options) {
+    size_t width = options.quick() ? 960 : 1920 * 2;
+    size_t height = options.quick() ? 540 : 1080;
+    size_t maxThreads = std::max<size_t>(
+      options.count("threads", options.quick() ? 2 : 4), 1);
+    size_t frames = std::max<size_t>(
+      options.count("frames", options.quick() ? 5 : 30), 1);
+    int quality = 50;
+
+    bool passed = true;
+    std::vector<EncodeResult> results = runStripEncode(width, height,
+      maxThreads, frames, quality);
+    for (const EncodeResult& result : results) {
+      bool good = result.decoded && result.psnr >= results[0].psnr - 0.5;
+      std::printf("%d thread(s): %.2f ms/frame, %.0f bytes/frame, PSNR %.1f dB; %s\n",
+        static_cast<int>(result.threads), result.msPerFrame, result.bytesPerFrame,
+        result.psnr, good ? "passed" : "FAILED");
+      passed = passed && good;
+    }
+    return passed;
+  }
+
+}
@@ -0,0 +1,195 @@
+#include "Bench.h"
+#include "LatencyTracker.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace Benchmark {
+
+  namespace {
+    constexpr int64_t MS = 1000000;
+
+    bool near(double a, double b) {
+      return std::abs(a - b) < 1e-9;
+    }
+
+    bool check(const char* name, const LatencyTracker::Summary& summary,
+        size_t samples, double p50, double p90, double p99, double max) {
+      bool passed = summary.samples == samples && near(summary.p50Ms, p50) &&
+        near(summary.p90Ms, p90) && near(summary.p99Ms, p99) && near(summary.maxMs, max);
+      std::printf("%s: %d samples, p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms (expected %d, %.1f, %.1f, %.1f, %.1f); %s\n",
+        name, static_cast<int>(summary.samples), summary.p50Ms, summary.p90Ms,
+        summary.p99Ms, summary.maxMs, static_cast<int>(samples), p50, p90, p99, max,
+        passed ? "passed" : "FAILED");
+      return passed;
+    }
+
+    /**
+     * 1..100 ms in shuffled order: each percentile is the sample at
+     * samples * percent / 100 in sorted order, so p50 is 51 ms.
+     */
+    bool knownSamples() {
+      std::vector<int64_t> values;
+      for (int64_t ms = 1; ms <= 100; ++ms) {
+        values.push_back(ms * MS);
+      }
+      std::shuffle(values.begin(), values.end(), std::mt19937(7));
+
+      LatencyTracker tracker;
+      uint32_t sequence = 0;
+      for (int64_t ns : values) {
+        ++sequence;
+        tracker.addFrame(sequence, sequence, ns, 2 * ns, 3 * ns);
+        tracker.addDisplay(sequence, ns + 10 * MS);
+      }
+
+      bool passed = check("capture", tracker.summarize(LatencyTracker::STAGE_CAPTURE),
+        100, 51.0, 91.0, 100.0, 100.0);
+      passed = check("encode", tracker.summarize(LatencyTracker::STAGE_ENCODE),
+        100, 102.0, 182.0, 200.0, 200.0) && passed;
+      passed = check("send", tracker.summarize(LatencyTracker::STAGE_SEND),
+        100, 153.0, 273.0, 300.0, 300.0) && passed;
+      passed = check("display", tracker.summarize(LatencyTracker::STAGE_DISPLAY),
+        100, 61.0, 101.0, 110.0, 110.0) && passed;
+
+      tracker.reset();
+      passed = check("after reset", tracker.summarize(LatencyTracker::STAGE_CAPTURE),
+        0, 0.0, 0.0, 0.0, 0.0) && passed;
+      return passed;
+    }
+
+    /**
+     * WINDOW + 250 rising samples: only the last WINDOW remain, so the
+     * percentiles start from sample 251.
+     */
+    bool windowWraps() {
+      const size_t total = LatencyTracker::WINDOW + 250;
+      LatencyTracker tracker;
+      for (size_t i = 1; i <= total; ++i) {
+        tracker.addDisplay(static_cast<uint32_t>(i), static_cast<int64_t>(i) * MS);
+      }
+      const double first = 251.0;
+      const size_t window = LatencyTracker::WINDOW;
+      return check("wrapped window", tracker.summarize(LatencyTracker::STAGE_DISPLAY),
+        window, first + window * 50 / 100, first + window * 90 / 100,
+        first + window * 99 / 100, static_cast<double>(total));
+    }
+
+    struct LogRow {
+      uint32_t poseSequence;
+      bool hasFrameId;
+      uint64_t frameId;
+      int64_t stageNs[LatencyTracker::STAGE_COUNT]; /* -1 where empty. */
+    };
+
+    bool parseRow(const std::string& line, LogRow* row) {
+      std::vector<std::string> fields;
+      std::stringstream stream(line);
+      std::string field;
+      while (std::getline(stream, field, ',')) {
+        fields.push_back(field);
+      }
+      if (!line.empty() && line.back() == ',') {
+        fields.push_back("");
+      }
+      if (fields.size() != 2 + LatencyTracker::STAGE_COUNT || fields[0].empty()) {
+        return false;
+      }
+
+      row->poseSequence = static_cast<uint32_t>(std::strtoul(fields[0].c_str(), nullptr, 10));
+      row->hasFrameId = !fields[1].empty();
+      row->frameId = std::strtoull(fields[1].c_str(), nullptr, 10);
+      for (size_t i = 0; i < LatencyTracker::STAGE_COUNT; ++i) {
+        const std::string& ms = fields[2 + i];
+        row->stageNs[i] = ms.empty() ? -1 :
+          static_cast<int64_t>(std::llround(std::strtod(ms.c_str(), nullptr) * 1e6));
+      }
+      return true;
+    }
+
+    /**
+     * Logs frame and display rows, writes them with stopLog and reads them
+     * back. A row has a frame id if it has one, or if it has a capture time,
+     * so frame 0 keeps its id and display-only rows leave it empty. Times
+     * are whole microseconds, which the 3 decimal ms fields keep exactly.
+     */
+    bool csvRoundTrips(const std::string& path) {
+      std::vector<LogRow> expected = {
+        { 1, true, 0, { 1500 * 1000, 4250 * 1000, 5001 * 1000, -1 } },
+        { 1, false, 0, { -1, -1, -1, 38123 * 1000 } },
+        { 2, true, 1, { 1 * 1000, 2 * 1000, 3 * 1000, -1 } },
+        { 3, true, 7, { -1, 9000 * 1000, 12345 * 1000, -1 } },
+        { 2, false, 0, { -1, -1, -1, 0 } },
+        { 4294967295u, true, 123456789012ull, { 250 * MS, 500 * MS, 750 * MS, -1 } },
+      };
+
+      LatencyTracker tracker;
+      tracker.addFrame(99, 99, MS, MS, MS); /* Before the log; not written. */
+      tracker.startLog();
+      for (const LogRow& row : expected) {
+        if (row.hasFrameId) {
+          tracker.addFrame(row.poseSequence, row.frameId, row.stageNs[0],
+            row.stageNs[1], row.stageNs[2]);
+        } else {
+          tracker.addDisplay(row.poseSequence, row.stageNs[LatencyTracker::STAGE_DISPLAY]);
+        }
+      }
+      size_t rows = 0;
+      bool written = tracker.stopLog(path, &rows);
+      tracker.addFrame(100, 100, MS, MS, MS); /* After the log; not written. */
+
+      std::vector<LogRow> actual;
+      bool parsed = true;
+      std::string header;
+      {
+        std::ifstream in(path.c_str());
+        std::getline(in, header);
+        std::string line;
+        while (std::getline(in, line)) {
+          LogRow row;
+          parsed = parseRow(line, &row) && parsed;
+          actual.push_back(row);
+        }
+      }
+      std::remove(path.c_str());
+
+      size_t matching = 0;
+      for (size_t i = 0; i < std::min(expected.size(), actual.size()); ++i) {
+        const LogRow& a = actual[i];
+        const LogRow& e = expected[i];
+        bool same = a.poseSequence == e.poseSequence && a.hasFrameId == e.hasFrameId &&
+          (!e.hasFrameId || a.frameId == e.frameId);
+        for (size_t s = 0; s < LatencyTracker::STAGE_COUNT; ++s) {
+          same = same && a.stageNs[s] == e.stageNs[s];
+        }
+        matching += same ? 1 : 0;
+      }
+
+      bool passed = written && parsed && rows == expected.size() &&
+        header == "pose_sequence,frame_id,capture_ms,encode_ms,send_ms,display_ms" &&
+        actual.size() == expected.size() && matching == expected.size();
+      std::printf("CSV round trip through %s: %d rows written, %d read back, %d matching; %s\n",
+        path.c_str(), static_cast<int>(rows), static_cast<int>(actual.size()),
+        static_cast<int>(matching), passed ? "passed" : "FAILED");
+      return passed;
+    }
+  }
+
+  /**
+   * LatencyTracker's percentiles on known samples, its window once it has
+   * wrapped, and its CSV log read back from disk.
+   */
+  bool runLatencySuite(const Options& options) {
+    bool passed = knownSamples();
+    passed = windowWraps() && passed;
+    passed = csvRoundTrips(options.text("csv", "CardboardLatency.csv")) && passed;
+    return passed;
+  }
+
+}
@@ -0,0 +1,121 @@
+#include "Bench.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+  struct Suite {
+    const char* name;
+    const char* usage;
+    bool (*run)(const Benchmark::Options& options);
+  };
+
+  const Suite SUITES[] = {
+#ifdef CARDBOARD_USB
+    { "send", "[--device=vid:pid] [--frames=n] [--kilobytes=n] [--depth=n]",
+      Benchmark::runSendSuite },
+#endif
+    { "readback", "[--frames=n]", Benchmark::runReadbackSuite },
+    { "encode", "[--threads=max] [--frames=n]", Benchmark::runEncodeSuite },
+    { "rate", "[--mbps=n] [--overhead=ms] [--fps=n] [--latency=ms] [--frames=n]",
+      Benchmark::runRateSuite },
+    { "yuv", "[--threads=n] [--frames=n]", Benchmark::runYuvSuite },
+    { "convert", "[--frames=n]", Benchmark::runConvertSuite },
+    { "tiles", "[--frames=n] [--drop=n]", Benchmark::runTilesSuite },
+    { "pose", "[--readers=n] [--seconds=n]", Benchmark::runPoseSuite },
+    { "predict", "[--log=path]", Benchmark::runPredictSuite },
+    { "latency", "[--csv=path]", Benchmark::runLatencySuite },
+    { "protocol", "[--trials=n]", Benchmark::runProtocolSuite },
+    { "pacing", "[--vsyncs=n]", Benchmark::runPacingSuite },
+    { "recovery", "[--frames=n] [--loss=p] [--undecodable=p] [--delay=n]",
+      Benchmark::runRecoverySuite },
+    { "reconnect", "[--outages=n] [--faults=p]", Benchmark::runReconnectSuite },
+    { "shutdown", "[--trials=n]", Benchmark::runShutdownSuite },
+#ifdef CARDBOARD_USB
+    { "usb", "[--device=vid:pid] [--frames=n] [--kilobytes=n]",
+      Benchmark::runUsbSuite },
+#endif
+    { "stream", "[--width=n] [--height=n] [--frames=n] [--threads=n]",
+      Benchmark::runStreamSuite },
+    { "pipeline", "[--mbps=n] [--latency=ms] [--hz=n] [--frames=n] [--width=n --height=n] [--quality=n] [--threads=n] [--json=path]",
+      Benchmark::runPipelineSuite },
+  };
+
+  void printUsage() {
+    std::printf("Usage: cardboard_bench [--quick] [--key=value...] all|<suite>...\n");
+    for (const Suite& suite : SUITES) {
+      std::printf("  %-10s %s\n", suite.name, suite.usage);
+    }
+    std::printf("Exits with 0 if every suite passed, 1 if any failed, 2 on bad usage.\n");
+  }
+
+  const Suite* findSuite(const char* name) {
+    for (const Suite& suite : SUITES) {
+      if (std::strcmp(suite.name, name) == 0) {
+        return &suite;
+      }
+    }
+    return nullptr;
+  }
+
+}
+
+int main(int argc, char** argv) {
+  Benchmark::Options options;
+  std::vector<const Suite*> suites;
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    if (std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0) {
+      printUsage();
+      return 0;
+    } else if (std::strcmp(arg, "--quick") == 0) {
+      options.setQuick(true);
+    } else if (std::strncmp(arg, "--", 2) == 0) {
+      const char* equals = std::strchr(arg, '=');
+      if (equals == nullptr) {
+        std::fprintf(stderr, "Options take a value: %s\n", arg);
+        return 2;
+      }
+      options.set(std::string(arg + 2, equals), equals + 1);
+    } else if (std::strcmp(arg, "all") == 0) {
+      for (const Suite& suite : SUITES) {
+        suites.push_back(&suite);
+      }
+    } else if (const Suite* suite = findSuite(arg)) {
+      suites.push_back(suite);
+    } else {
+      std::fprintf(stderr, "Unknown suite: %s\n", arg);
+      printUsage();
+      return 2;
+    }
+  }
+  if (suites.empty()) {
+    printUsage();
+    return 2;
+  }
+
+  std::printf("JPEG: %s\n\n", Benchmark::jpegBackend());
+  std::vector<const char*> failed;
+  for (const Suite* suite : suites) {
+    std::printf("== %s\n", suite->name);
+    std::fflush(stdout);
+    bool passed = suite->run(options);
+    std::printf("%s: %s\n\n", suite->name, passed ? "passed" : "FAILED");
+    std::fflush(stdout);
+    if (!passed) {
+      failed.push_back(suite->name);
+    }
+  }
+
+  if (!failed.empty()) {
+    std::printf("Failed:");
+    for (const char* name : failed) {
+      std::printf(" %s", name);
+    }
+    std::printf("\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,173 @@
+#include "Bench.h"
+#include "FramePacer.h"
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace Benchmark {
+
+  namespace {
+    struct PacingResult {
+      FramePacer::Stats pacer;
+      size_t vsyncs;
+      size_t repeated;      /* Vsyncs that showed no new frame. */
+      size_t skipped;       /* Frames replaced before any vsync showed them. */
+      double scanoutWaitMs; /* Average arrival to vsync, for shown frames. */
+    };
+
+    /**
+     * Runs a FramePacer against a simulated phone in simulated time: frames
+     * are captured at renderHz, take pipelineMs +/- jitterMs from release to
+     * arrival (half of it in the encoder), and the phone refreshes at
+     * refreshHz, reporting each vsync over a link with up to 1.3 ms of delay
+     * and a clock offset the pacer has to work out. paced=false releases every
+     * frame as soon as the encoder is free, as before pacing existed.
+     */
+    PacingResult runPacing(bool paced, double refreshHz, double renderHz,
+        double pipelineMs, double jitterMs, size_t vsyncs) {
+      // The host clock runs offsetNs ahead of the phone's; frame ids count
+      // captures from 1, the first at phone time 0.
+      const int64_t offsetNs = 5000000000LL;
+      const int64_t periodNs = static_cast<int64_t>(1e9 / refreshHz);
+      const int64_t renderNs = static_cast<int64_t>(1e9 / renderHz);
+      const int64_t phaseNs = periodNs / 3;
+      auto vsyncNs = [&](size_t k) { return phaseNs + static_cast<int64_t>(k) * periodNs; };
+
+      std::mt19937 random(42);
+      std::uniform_real_distribution<double> jitter(-jitterMs, jitterMs);
+      std::uniform_real_distribution<double> reportDelayMs(0.3, 1.3);
+      std::vector<int64_t> reportDelays(vsyncs);
+      for (int64_t& delay : reportDelays) {
+        delay = static_cast<int64_t>(reportDelayMs(random) * 1e6);
+      }
+
+      FramePacer pacer;
+      FramePacer::Settings settings;
+      settings.enabled = paced;
+      pacer.setSettings(settings);
+      pacer.setRefreshHint(static_cast<uint32_t>(refreshHz * 1000.0));
+
+      struct Arrival {
+        uint64_t frameId;
+        int64_t deviceNs;
+      };
+      std::vector<Arrival> arrivals;
+      auto latestArrival = [&](int64_t deviceNs) {
+        const Arrival* latest = nullptr;
+        for (const Arrival& arrival : arrivals) {
+          if (arrival.deviceNs <= deviceNs &&
+              (!latest || arrival.deviceNs > latest->deviceNs)) {
+            latest = &arrival;
+          }
+        }
+        return latest;
+      };
+
+      // Each vsync report carries the last frame that had arrived by then.
+      size_t nextReport = 0;
+      auto deliverReports = [&](int64_t hostNs) {
+        while (nextReport < vsyncs &&
+            vsyncNs(nextReport) + offsetNs + reportDelays[nextReport] <= hostNs) {
+          int64_t vsync = vsyncNs(nextReport);
+          pacer.addVsync(vsync, static_cast<uint32_t>(periodNs),
+            vsync + offsetNs + reportDelays[nextReport]);
+          const Arrival* arrival = latestArrival(vsync);
+          if (arrival) {
+            pacer.addArrival(arrival->frameId, arrival->deviceNs);
+          }
+          nextReport++;
+        }
+      };
+
+      const int64_t endNs = vsyncNs(vsyncs) + offsetNs;
+      int64_t encoderFreeNs = offsetNs;
+      uint64_t lastFrameId = 0;
+      while (true) {
+        // The encoder waits for a capture it hasn't had yet.
+        int64_t nextCaptureNs = offsetNs + static_cast<int64_t>(lastFrameId) * renderNs;
+        int64_t nowNs = std::max(encoderFreeNs, nextCaptureNs);
+        if (nowNs >= endNs) {
+          break;
+        }
+        deliverReports(nowNs);
+
+        int64_t releaseNs = std::max(pacer.releaseTime(nowNs), nowNs);
+        uint64_t frameId = static_cast<uint64_t>((releaseNs - offsetNs) / renderNs) + 1;
+        pacer.released(frameId, releaseNs);
+
+        int64_t durationNs = static_cast<int64_t>(
+          std::max(1.0, pipelineMs + jitter(random)) * 1e6);
+        encoderFreeNs = releaseNs + durationNs / 2;
+        Arrival arrival = { frameId, releaseNs + durationNs - offsetNs };
+        arrivals.push_back(arrival);
+        lastFrameId = frameId;
+      }
+      deliverReports(endNs + periodNs);
+
+      // What the phone showed at each vsync: the newest frame to have arrived.
+      PacingResult result = {};
+      result.pacer = pacer.getStats();
+      result.vsyncs = vsyncs;
+      const Arrival* shown = nullptr;
+      size_t shownCount = 0;
+      double waitMs = 0.0;
+      for (size_t k = 0; k < vsyncs; ++k) {
+        const Arrival* latest = latestArrival(vsyncNs(k));
+        if (!latest) {
+          continue;
+        }
+        if (latest == shown) {
+          result.repeated++;
+        } else {
+          shownCount++;
+          waitMs += (vsyncNs(k) - latest->deviceNs) / 1e6;
+        }
+        shown = latest;
+      }
+      size_t arrivedInTime = 0;
+      for (const Arrival& arrival : arrivals) {
+        if (vsyncs > 0 && arrival.deviceNs <= vsyncNs(vsyncs - 1)) {
+          arrivedInTime++;
+        }
+      }
+      result.skipped = arrivedInTime - shownCount;
+      result.scanoutWaitMs = shownCount > 0 ? waitMs / shownCount : 0.0;
+      return result;
+    }
+  }
+
+  /**
+   * A 60 Hz phone and a game rendering faster, slower and in step with it,
+   * in simulated time. At every render rate the paced run has to lock onto
+   * the phone's vsync and beat the unpaced run on p90 error and on time from
+   * arrival to scanout.
+   */
+  bool runPacingSuite(const Options& options) {
+    size_t vsyncs = std::max<size_t>(
+      options.count("vsyncs", options.quick() ? 300 : 600), 1);
+    bool passed = true;
+    for (double renderHz : { 90.0, 60.0, 45.0 }) {
+      PacingResult unpaced = {};
+      for (bool paced : { false, true }) {
+        PacingResult result = runPacing(paced, 60.0, renderHz, 12.0, 2.0, vsyncs);
+        bool good = !paced || (result.pacer.locked &&
+          result.pacer.p90Ms < unpaced.pacer.p90Ms &&
+          result.scanoutWaitMs < unpaced.scanoutWaitMs);
+        std::printf("%.0f fps %s: error p50 %.1f ms, p90 %.1f ms, %llu missed; %d repeated, %d skipped of %d vsyncs, %.1f ms arrival to scanout%s\n",
+          renderHz, paced ? "paced" : "unpaced",
+          result.pacer.p50Ms, result.pacer.p90Ms,
+          static_cast<unsigned long long>(result.pacer.missed),
+          static_cast<int>(result.repeated), static_cast<int>(result.skipped),
+          static_cast<int>(result.vsyncs), result.scanoutWaitMs,
+          paced ? (good ? "; passed" : "; FAILED") : "");
+        if (!paced) {
+          unpaced = result;
+        }
+        passed = passed && good;
+      }
+    }
+    return passed;
+  }
+
+}
@@ -0,0 +1,211 @@
+#include "Bench.h"
+#include "StreamHarness.h"
+#include "StreamSession.h"
+#include "LoopbackTransport.h"
+#include "SyntheticFrameSource.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Benchmark {
+
+  namespace {
+    struct PipelineCase {
+      size_t width;  /* Per eye. */
+      size_t height;
+      int quality;   /* Held for the whole run. */
+      size_t threads;
+    };
+
+    /** Every combination of eye size, quality and encode threads. */
+    struct PipelineMatrix {
+      std::vector<std::pair<size_t, size_t>> eyeSizes;
+      std::vector<int> qualities;
+      std::vector<size_t> threads;
+
+      std::vector<PipelineCase> cases() const {
+        std::vector<PipelineCase> cases;
+        for (const std::pair<size_t, size_t>& size : eyeSizes) {
+          for (int quality : qualities) {
+            for (size_t threadCount : threads) {
+              PipelineCase c = { size.first, size.second, quality, threadCount };
+              cases.push_back(c);
+            }
+          }
+        }
+        return cases;
+      }
+    };
+
+    /**
+     * 1280x720, 1920x1080 and 2560x1440 side by side and two 1440x1440
+     * eyes; quality 50, 75 and 90; one thread and maxThreads. Quick runs
+     * keep one small size at one quality.
+     */
+    PipelineMatrix standardMatrix(size_t maxThreads, bool quick) {
+      PipelineMatrix matrix;
+      if (quick) {
+        matrix.eyeSizes = { { 320, 240 } };
+        matrix.qualities = { 75 };
+      } else {
+        matrix.eyeSizes = { { 640, 720 }, { 960, 1080 }, { 1280, 1440 }, { 1440, 1440 } };
+        matrix.qualities = { 50, 75, 90 };
+      }
+      matrix.threads = { 1 };
+      if (maxThreads > 1) {
+        matrix.threads.push_back(maxThreads);
+      }
+      return matrix;
+    }
+
+    struct PipelineResult {
+      PipelineCase config;
+      StreamResult stream;
+      bool passed;
+    };
+
+    /**
+     * Streams each case end to end over a LoopbackTransport shaped like the
+     * link, with the rate controller held at the case's quality. Frames are
+     * rendered at renderHz, or with 0, each as soon as the previous one has
+     * been encoded.
+     */
+    std::vector<PipelineResult> runPipeline(const std::vector<PipelineCase>& cases,
+        const LoopbackTransport::Shape& link, size_t frames, double renderHz) {
+      std::vector<PipelineResult> results;
+      frames = std::max<size_t>(frames, 2);
+
+      for (const PipelineCase& c : cases) {
+        RateController::Targets targets;
+        targets.minQuality = c.quality;
+        targets.maxQuality = c.quality;
+        targets.allowDownscale = false;
+        targets.adaptive = false;
+
+        SyntheticFrameSource pattern(c.width * EYE_COUNT, c.height,
+          SyntheticFrameSource::PATTERN_ANIMATED, 4);
+        std::shared_ptr<LoopbackTransport> host, phone;
+        LoopbackTransport::createPair(&host, &phone,
+          LoopbackTransport::DEFAULT_CAPACITY, link);
+
+        PipelineResult result;
+        result.config = c;
+        result.stream = streamOver("pipeline", host, phone, nullptr,
+          &pattern, c.width, c.height, frames, c.threads, renderHz, &targets,
+          host.get());
+        result.passed = result.stream.handshakeStatus == StreamSession::STATUS_OK &&
+          result.stream.status == 0 && result.stream.received > 0 &&
+          result.stream.endReceived;
+        results.push_back(result);
+      }
+
+      return results;
+    }
+
+    /**
+     * Writes the results as JSON, with the link and frame settings, so runs
+     * can be compared between commits.
+     */
+    bool writePipelineJson(const std::string& path,
+        const LoopbackTransport::Shape& link, size_t frames, double renderHz,
+        const std::vector<PipelineResult>& results) {
+      std::ofstream out(path.c_str());
+      if (!out) {
+        return false;
+      }
+
+      char line[1024];
+      std::snprintf(line, sizeof(line),
+        "{\n  \"benchmark\": \"pipeline\",\n  \"version\": 1,\n"
+        "  \"jpeg\": \"%s\",\n"
+        "  \"frames\": %d,\n  \"render_hz\": %.2f,\n"
+        "  \"link\": { \"megabytes_per_second\": %.2f, \"latency_ms\": %.3f },\n"
+        "  \"results\": [",
+        jpegBackend(), static_cast<int>(frames), renderHz, link.megabytesPerSecond,
+        link.latencyMs);
+      out << line;
+
+      for (size_t i = 0; i < results.size(); ++i) {
+        const PipelineResult& r = results[i];
+        const StreamResult& s = r.stream;
+        std::snprintf(line, sizeof(line),
+          "%s\n    { \"width\": %d, \"height\": %d, \"quality\": %d, \"threads\": %d,"
+          " \"published\": %d, \"received\": %d,"
+          " \"encode_ms_per_frame\": %.3f, \"bytes_per_frame\": %.0f, \"fps\": %.2f,"
+          " \"queue_depth_avg\": %.2f, \"queue_depth_max\": %d,"
+          " \"link_backlog_kb_avg\": %.1f,"
+          " \"latency_ms\": { \"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f },"
+          " \"status\": %d, \"passed\": %s }",
+          i == 0 ? "" : ",",
+          static_cast<int>(r.config.width), static_cast<int>(r.config.height),
+          r.config.quality, static_cast<int>(r.config.threads),
+          static_cast<int>(s.published), static_cast<int>(s.received),
+          s.encodeMsPerFrame, s.bytesPerFrame, s.framesPerSecond,
+          s.averageQueueDepth, static_cast<int>(s.maxQueueDepth),
+          s.averageBacklogKilobytes,
+          percentileOf(s.latenciesMs, 50), percentileOf(s.latenciesMs, 90),
+          percentileOf(s.latenciesMs, 99), percentileOf(s.latenciesMs, 100),
+          s.status, r.passed ? "true" : "false");
+        out << line;
+      }
+      out << "\n  ]\n}\n";
+      return static_cast<bool>(out);
+    }
+  }
+
+  /**
+   * Encode and framing over a shaped in-process link, across eye sizes,
+   * qualities and thread counts; writes CardboardPipeline.json, or --json.
+   */
+  bool runPipelineSuite(const Options& options) {
+    LoopbackTransport::Shape link;
+    link.megabytesPerSecond = std::max(options.number("mbps", 40.0), 0.0);
+    link.latencyMs = std::max(options.number("latency", 1.0), 0.0);
+    double renderHz = std::max(options.number("hz", 0.0), 0.0);
+    size_t frames = std::min<size_t>(std::max<size_t>(
+      options.count("frames", options.quick() ? 30 : 120), 2), 10000);
+
+    PipelineMatrix matrix = standardMatrix(StreamSession::getDefaultEncodeThreads(),
+      options.quick());
+    if (options.has("width") && options.has("height")) {
+      matrix.eyeSizes = { std::make_pair(
+        std::min<size_t>(std::max<size_t>(options.count("width", 0), 16), 4096),
+        std::min<size_t>(std::max<size_t>(options.count("height", 0), 16), 4096)) };
+    }
+    if (options.has("quality")) {
+      matrix.qualities = {
+        std::min(std::max(static_cast<int>(options.number("quality", 75)), 1), 100) };
+    }
+    if (options.count("threads", 0) > 0) {
+      matrix.threads = { options.count("threads", 0) };
+    }
+
+    std::vector<PipelineResult> results = runPipeline(matrix.cases(), link,
+      frames, renderHz);
+    bool passed = true;
+    for (const PipelineResult& result : results) {
+      const StreamResult& s = result.stream;
+      std::printf("%dx%d x2, quality %d, %d threads: %.2f ms encode, %.0f bytes, %.1f fps, queue %.1f (max %d), latency p50 %.1f ms, p90 %.1f ms, p99 %.1f ms; %s\n",
+        static_cast<int>(result.config.width), static_cast<int>(result.config.height),
+        result.config.quality, static_cast<int>(result.config.threads),
+        s.encodeMsPerFrame, s.bytesPerFrame, s.framesPerSecond,
+        s.averageQueueDepth, static_cast<int>(s.maxQueueDepth),
+        percentileOf(s.latenciesMs, 50), percentileOf(s.latenciesMs, 90),
+        percentileOf(s.latenciesMs, 99), result.passed ? "passed" : "FAILED");
+      passed = passed && result.passed;
+    }
+
+    std::string path = options.text("json", "CardboardPipeline.json");
+    if (writePipelineJson(path, link, frames, renderHz, results)) {
+      std::printf("Wrote %s\n", path.c_str());
+    } else {
+      std::printf("Could not write %s\n", path.c_str());
+      passed = false;
+    }
+    return passed;
+  }
+
+}
@@ -0,0 +1,155 @@
+#include "Bench.h"
+#include "PoseChannel.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace Benchmark {
+
+  namespace {
+    struct PoseStressResult {
+      const char* name;
+      uint64_t writes;
+      uint64_t reads;
+      uint64_t torn; /* Reads whose fields came from different writes. */
+    };
+
+    /** Every field is a function of n, so a mixed read is detectable. */
+    PoseSample stressSample(uint32_t n) {
+      PoseSample sample;
+      sample.x = static_cast<float>(n & 0xFFFFFF);
+      sample.y = -sample.x;
+      sample.z = sample.x * 0.5f;
+      sample.w = sample.x + 1.0f;
+      sample.sequence = n;
+      sample.deviceNs = static_cast<int64_t>(n) * 1000 + 7;
+      sample.receivedNs = static_cast<int64_t>(n) * 3;
+      return sample;
+    }
+
+    bool isConsistent(const PoseSample& sample) {
+      PoseSample expected = stressSample(sample.sequence);
+      return sample.x == expected.x && sample.y == expected.y &&
+        sample.z == expected.z && sample.w == expected.w &&
+        sample.deviceNs == expected.deviceNs &&
+        sample.receivedNs == expected.receivedNs;
+    }
+
+    /** The scheme PoseChannel replaced: each field stored separately. */
+    struct SeparateAtomics {
+      std::atomic<float> x, y, z, w;
+      std::atomic<uint32_t> sequence;
+      std::atomic<int64_t> deviceNs, receivedNs;
+
+      void store(const PoseSample& sample) {
+        x.store(sample.x);
+        y.store(sample.y);
+        z.store(sample.z);
+        w.store(sample.w);
+        sequence.store(sample.sequence);
+        deviceNs.store(sample.deviceNs);
+        receivedNs.store(sample.receivedNs);
+      }
+
+      PoseSample load() const {
+        PoseSample sample;
+        sample.x = x.load();
+        sample.y = y.load();
+        sample.z = z.load();
+        sample.w = w.load();
+        sample.sequence = sequence.load();
+        sample.deviceNs = deviceNs.load();
+        sample.receivedNs = receivedNs.load();
+        return sample;
+      }
+    };
+
+    template <typename Channel>
+    PoseStressResult stressPoses(const char* name, Channel* channel,
+        size_t readers, double seconds) {
+      PoseStressResult result = { name, 0, 0, 0 };
+      channel->store(stressSample(0));
+
+      std::atomic_bool stop(false);
+      std::atomic<uint64_t> reads(0);
+      std::atomic<uint64_t> torn(0);
+      std::vector<std::thread> threads;
+      for (size_t i = 0; i < readers; ++i) {
+        threads.emplace_back([&] {
+          uint64_t localReads = 0;
+          uint64_t localTorn = 0;
+          while (!stop.load(std::memory_order_relaxed)) {
+            if (!isConsistent(channel->load())) {
+              localTorn++;
+            }
+            localReads++;
+          }
+          reads += localReads;
+          torn += localTorn;
+        });
+      }
+
+      auto end = std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(seconds));
+      uint32_t n = 0;
+      while (std::chrono::steady_clock::now() < end) {
+        for (int i = 0; i < 1000; ++i) {
+          channel->store(stressSample(++n));
+        }
+      }
+      stop.store(true);
+      for (auto& thread : threads) {
+        thread.join();
+      }
+
+      result.writes = n;
+      result.reads = reads.load();
+      result.torn = torn.load();
+      return result;
+    }
+
+    /**
+     * One thread writes poses as fast as it can while `readers` threads read
+     * them back and check that every field belongs to the same write. Runs
+     * PoseChannel and, for comparison, one atomic per field (the old scheme),
+     * which tears under contention.
+     */
+    std::vector<PoseStressResult> runPoseStress(size_t readers, double seconds) {
+      readers = std::max<size_t>(readers, 1);
+      std::vector<PoseStressResult> results;
+
+      PoseChannel channel;
+      results.push_back(stressPoses("PoseChannel", &channel, readers, seconds));
+
+      SeparateAtomics atomics;
+      results.push_back(stressPoses("Separate atomics", &atomics, readers, seconds));
+      return results;
+    }
+  }
+
+  /**
+   * --readers threads hammer the pose channel the render thread reads while
+   * the read loop writes. PoseChannel must never hand out a torn pose; the
+   * old separate atomics are shown for comparison and may tear.
+   */
+  bool runPoseSuite(const Options& options) {
+    size_t readers = std::max<size_t>(options.count("readers", 2), 1);
+    double seconds = std::max(options.number("seconds", options.quick() ? 0.25 : 1.0), 0.01);
+
+    std::vector<PoseStressResult> results = runPoseStress(readers, seconds);
+    for (const PoseStressResult& result : results) {
+      std::printf("%s: %llu writes, %llu reads, %llu torn\n", result.name,
+        static_cast<unsigned long long>(result.writes),
+        static_cast<unsigned long long>(result.reads),
+        static_cast<unsigned long long>(result.torn));
+    }
+    const PoseStressResult& channel = results.front();
+    bool passed = channel.reads > 0 && channel.torn == 0;
+    return passed;
+  }
+
+}
@@ -0,0 +1,41 @@
+#include "Bench.h"
+#include "PosePredictor.h"
+#include <cstdio>
+#include <vector>
+
+namespace Benchmark {
+
+  /**
+   * Synthetic head motion at the phone's 100 Hz, or a log written by HMD
+   * POSELOG (--log=path), predicted over a range of horizons. Prediction has
+   * to beat just using the latest pose at every one of them.
+   */
+  bool runPredictSuite(const Options& options) {
+    std::vector<PoseSample> samples;
+    if (options.has("log")) {
+      std::string path = options.text("log", "");
+      if (!PoseLog::read(path, &samples)) {
+        std::printf("Could not read %s\n", path.c_str());
+        return false;
+      }
+    } else {
+      samples = PoseLog::synthesize(options.quick() ? 5.0 : 20.0, 100.0, 1);
+    }
+
+    PosePredictor::Settings settings;
+    settings.enabled = true;
+    bool passed = true;
+    for (double horizonMs : { 15.0, 30.0, 50.0 }) {
+      settings.horizonMs = horizonMs;
+      PoseLog::Error error = PoseLog::evaluate(samples, settings);
+      bool better = error.samples > 0 &&
+        error.meanDegrees < error.unpredictedMeanDegrees;
+      std::printf("%.0f ms ahead: %.2f deg mean, %.2f deg p95, %.2f deg max (%.2f deg mean without prediction); %s\n",
+        horizonMs, error.meanDegrees, error.p95Degrees, error.maxDegrees,
+        error.unpredictedMeanDegrees, better ? "passed" : "FAILED");
+      passed = passed && better;
+    }
+    return passed;
+  }
+
+}
@@ -0,0 +1,105 @@
+#include "Bench.h"
+#include "MessageCodec.h"
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+namespace Benchmark {
+
+  namespace {
+    /**
+     * Fuzz-style self check: writes random messages, feeds them back through
+     * a Parser in random chunk sizes and compares, then feeds corrupted
+     * streams and checks that the parser fails cleanly instead of misreading.
+     */
+    bool roundTrips(size_t trials) {
+      uint32_t seed = 0x2545F491;
+      auto next = [&seed]() {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+      };
+
+      struct Sent {
+        uint8_t type;
+        std::vector<unsigned char> payload;
+      };
+
+      for (size_t trial = 0; trial < trials; ++trial) {
+        // Mostly small payloads, the odd large one, and some empty ones.
+        Message::Writer writer;
+        std::vector<Sent> sent(1 + next() % 20);
+        std::vector<unsigned char> stream;
+        for (Sent& message : sent) {
+          message.type = static_cast<uint8_t>(next());
+          size_t length = next() % 8 == 0 ? next() % 70000 : next() % 64;
+          message.payload.resize(length);
+          for (unsigned char& c : message.payload) {
+            c = static_cast<unsigned char>(next());
+          }
+          writer.append(message.type, message.payload.data(),
+            message.payload.size(), &stream);
+        }
+
+        Message::Parser parser;
+        size_t received = 0;
+        bool matches = true;
+        auto handler = [&](const Message::Header& header, const unsigned char* payload) {
+          if (received >= sent.size()) {
+            matches = false;
+            return;
+          }
+          const Sent& expected = sent[received++];
+          matches = matches && header.type == expected.type &&
+            header.sequence == received &&
+            header.length == expected.payload.size() &&
+            std::equal(expected.payload.begin(), expected.payload.end(), payload);
+        };
+
+        size_t offset = 0;
+        while (offset < stream.size()) {
+          size_t chunk = std::min<size_t>(stream.size() - offset, 1 + next() % 300);
+          if (parser.feed(stream.data() + offset, chunk, handler) != 0) {
+            return false;
+          }
+          offset += chunk;
+        }
+        if (!matches || received != sent.size() || parser.getStats().missing != 0) {
+          return false;
+        }
+
+        // Flip one byte of the first header. The parser must either reject
+        // it or deliver something no longer than what's actually there.
+        std::vector<unsigned char> corrupt = stream;
+        size_t at = next() % Message::HEADER_LEN;
+        corrupt[at] ^= static_cast<unsigned char>(1 + next() % 255);
+        Message::Parser fuzzed;
+        size_t delivered = 0;
+        fuzzed.feed(corrupt.data(), corrupt.size(),
+          [&](const Message::Header& header, const unsigned char* /*payload*/) {
+            delivered += Message::HEADER_LEN + header.length;
+          });
+        if (delivered > corrupt.size()) {
+          return false;
+        }
+        if ((at == 0 || at == 1) && fuzzed.getStats().messages != 0) {
+          return false;
+        }
+      }
+
+      return true;
+    }
+  }
+
+  /** Fuzz the message framing: random round trips and corrupted headers. */
+  bool runProtocolSuite(const Options& options) {
+    size_t trials = std::max<size_t>(
+      options.count("trials", options.quick() ? 100 : 500), 1);
+    bool passed = roundTrips(trials);
+    std::printf("Message framing, %d trials: %s\n", static_cast<int>(trials),
+      passed ? "passed" : "FAILED");
+    return passed;
+  }
+
+}
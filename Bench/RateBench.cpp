@@ -0,0 +1,166 @@
+#include "Bench.h"
+#include "RateController.h"
+#include "JpegEncoder.h"
+#include "AlignedBuffer.h"
+#include "FramePipeline.h"
+#include "SyntheticFrameSource.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "turbojpeg.h"
+
+namespace Benchmark {
+
+  namespace {
+    /** USB link stand-in: a fixed per-frame overhead plus a bandwidth cap. */
+    struct SimulatedLink {
+      double megabytesPerSecond;
+      double overheadMs;
+
+      double sendMs(size_t bytes) const {
+        return overheadMs + bytes / (std::max(megabytesPerSecond, 0.001) * 1000.0);
+      }
+    };
+
+    struct RateStep {
+      size_t frame;
+      RateController::Settings settings;
+      double encodeMs;
+      double sendMs;
+      size_t bytes;
+    };
+
+    /**
+     * Streams animated frames through a RateController, encoding them for
+     * real and timing the transmit over the simulated link. Returns every
+     * frame's settings and costs so convergence can be inspected.
+     */
+    std::vector<RateStep> runRateControl(size_t width, size_t height,
+        size_t threads, size_t frames, const SimulatedLink& link,
+        const RateController::Targets& targets) {
+      std::vector<RateStep> steps;
+      RateController controller(targets);
+
+      size_t widthPitch = width * 4;
+      std::vector<unsigned char> pixels(widthPitch * height);
+
+      FrameView view;
+      view.data = pixels.data();
+      view.width = width;
+      view.widthPitch = widthPitch;
+      view.height = height;
+
+      JpegEncoder encoder(threads);
+      AlignedBuffer scaled;
+      unsigned char* jpegBuffer = nullptr;
+      unsigned long jpegCapacity = 0;
+
+      for (size_t i = 0; i < frames; ++i) {
+        SyntheticFrameSource::fillTestPattern(pixels.data(), width, widthPitch, height, i);
+        RateController::Settings settings = controller.getSettings();
+
+        // Both eyes, one after the other, like the device with a single
+        // encode thread; threads only speed up each eye.
+        size_t bytes = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t eye = 0; eye < EYE_COUNT; ++eye) {
+          FrameView source = downscaleFrame(eyeView(view, eye),
+            settings.downscale, &scaled);
+          unsigned long jpegSize = 0;
+          encoder.encode(source, settings.quality, settings.subsamp,
+            &jpegBuffer, &jpegCapacity, &jpegSize);
+          bytes += jpegSize;
+        }
+        double encodeMs = std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - start).count();
+
+        RateController::Sample sample;
+        sample.generation = settings.generation;
+        sample.encodeMs = encodeMs;
+        sample.sendMs = link.sendMs(bytes);
+        sample.bytes = bytes;
+        controller.addSample(sample);
+
+        RateStep step;
+        step.frame = i;
+        step.settings = settings;
+        step.encodeMs = encodeMs;
+        step.sendMs = sample.sendMs;
+        step.bytes = bytes;
+        steps.push_back(step);
+      }
+
+      if (jpegBuffer != nullptr) {
+        tjFree(jpegBuffer);
+      }
+
+      return steps;
+    }
+
+    bool sameSettings(const RateController::Settings& a,
+        const RateController::Settings& b) {
+      return a.quality == b.quality && a.subsamp == b.subsamp &&
+        a.downscale == b.downscale;
+    }
+  }
+
+  /**
+   * Side-by-side 1080p over a link too slow for it at the starting
+   * settings. The controller has to bring the last quarter of the run within
+   * the frame budget and the latency target on average, or end up at the
+   * cheapest settings it has.
+   */
+  bool runRateSuite(const Options& options) {
+    SimulatedLink link;
+    link.megabytesPerSecond = options.number("mbps", options.quick() ? 1.0 : 4.0);
+    link.overheadMs = options.number("overhead", 1.0);
+    RateController::Targets targets;
+    targets.framesPerSecond = std::max(options.number("fps", targets.framesPerSecond), 1.0);
+    targets.latencyMs = options.number("latency", targets.latencyMs);
+    size_t width = options.quick() ? 960 : 1920 * 2;
+    size_t height = options.quick() ? 540 : 1080;
+    size_t frames = std::max<size_t>(
+      options.count("frames", options.quick() ? 120 : 300), 8);
+
+    std::vector<RateStep> steps = runRateControl(width, height, 1, frames,
+      link, targets);
+    uint64_t generation = 0;
+    for (const RateStep& step : steps) {
+      if (step.settings.generation != generation || &step == &steps.back()) {
+        generation = step.settings.generation;
+        std::printf("Frame %d: quality %d, subsamp %d, downscale %d; %.2f ms encode, %.2f ms send, %d bytes\n",
+          static_cast<int>(step.frame), step.settings.quality, step.settings.subsamp,
+          static_cast<int>(step.settings.downscale), step.encodeMs, step.sendMs,
+          static_cast<int>(step.bytes));
+      }
+    }
+
+    double frameMs = 0.0;
+    double latencyMs = 0.0;
+    size_t tail = steps.size() / 4;
+    for (size_t i = steps.size() - tail; i < steps.size(); ++i) {
+      frameMs += std::max(steps[i].encodeMs, steps[i].sendMs) / tail;
+      latencyMs += (steps[i].encodeMs + steps[i].sendMs) / tail;
+    }
+    double budgetMs = 1000.0 / targets.framesPerSecond;
+
+    RateController::Targets cheapestTargets = targets;
+    RateController cheapest(cheapestTargets);
+    for (int i = 0; i < 1000; ++i) {
+      // Far over budget: walk it down the ladder.
+      RateController::Sample sample = { cheapest.getSettings().generation,
+        budgetMs * 10.0, budgetMs * 10.0, 1 };
+      cheapest.addSample(sample);
+    }
+    bool atCheapest = sameSettings(steps.back().settings, cheapest.getSettings());
+
+    bool passed = (frameMs <= budgetMs && latencyMs <= targets.latencyMs) ||
+      atCheapest;
+    std::printf("Last %d frames: %.2f ms per frame (budget %.2f), %.2f ms latency (target %.2f)%s; %s\n",
+      static_cast<int>(tail), frameMs, budgetMs, latencyMs, targets.latencyMs,
+      atCheapest ? ", at the cheapest settings" : "", passed ? "passed" : "FAILED");
+    return passed;
+  }
+
+}
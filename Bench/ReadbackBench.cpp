@@ -0,0 +1,116 @@
+#include "Bench.h"
+#include "FrameReadback.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace Benchmark {
+
+  namespace {
+    constexpr size_t WIDTH = 16;
+    constexpr size_t HEIGHT = 8;
+    constexpr size_t PITCH = WIDTH * 4 + 16; /* Padded, like a mapped texture. */
+
+    /** Every byte of frame n's pixels says n, so a delivery names its frame. */
+    void drawFrame(std::vector<unsigned char>* pixels, uint32_t n) {
+      pixels->assign(PITCH * HEIGHT, static_cast<unsigned char>(n * 7 + 1));
+      std::memcpy(pixels->data(), &n, sizeof(n));
+    }
+
+    struct ReadbackCase {
+      size_t latency;
+      size_t readyDelay;
+    };
+
+    /**
+     * Submits and polls once per frame, as the bridge does, and checks the
+     * counters and every delivery against what the ring should do. Each copy
+     * is delivered exactly max(latency, readyDelay) frames after it was
+     * submitted, with its own pixels and pose. A ring that can't keep up
+     * reports polls that found the oldest copy not ready, and skips frames:
+     * each of its latency + 1 slots is busy for readyDelay + 1 frames.
+     */
+    bool runCase(const ReadbackCase& c, size_t frames) {
+      CpuFrameReadback readback(c.latency, c.readyDelay);
+      const size_t expectedAge = std::max(c.latency, c.readyDelay);
+      const bool behind = c.readyDelay > c.latency;
+      const double expectedIssued = behind ?
+        static_cast<double>(frames) * (c.latency + 1) / (c.readyDelay + 1) : frames;
+
+      std::vector<unsigned char> pixels;
+      std::vector<unsigned char> expected;
+      size_t delivered = 0;
+      size_t wrongAge = 0;
+      size_t wrongPixels = 0;
+      size_t wrongPoses = 0;
+      for (uint32_t tick = 1; tick <= frames; ++tick) {
+        drawFrame(&pixels, tick);
+        RenderPose pose;
+        pose.x = static_cast<float>(tick);
+        pose.sequence = tick;
+        readback.submit(pixels.data(), WIDTH, PITCH, HEIGHT, pose);
+
+        readback.poll([&](const FrameView& view) {
+          delivered++;
+          uint32_t n = 0;
+          std::memcpy(&n, view.data, sizeof(n));
+          drawFrame(&expected, n);
+          if (view.width != WIDTH || view.widthPitch != PITCH || view.height != HEIGHT ||
+              std::memcmp(view.data, expected.data(), expected.size()) != 0) {
+            wrongPixels++;
+          }
+          if (view.pose.sequence != n || view.pose.x != static_cast<float>(n)) {
+            wrongPoses++;
+          }
+          if (tick - n != expectedAge) {
+            wrongAge++;
+          }
+        });
+      }
+
+      FrameReadback::Stats stats = readback.getStats();
+      bool counted = stats.submitted + stats.skipped == frames &&
+        stats.delivered == delivered &&
+        stats.delivered + readback.inFlight() == stats.submitted &&
+        stats.superseded == 0 &&
+        std::abs(stats.submitted - expectedIssued) <= c.latency + 1 &&
+        (stats.skipped > 0) == behind && (stats.notReady > 0) == behind &&
+        stats.averageLatencyFrames() == static_cast<double>(expectedAge);
+      bool passed = counted && delivered > 0 &&
+        wrongAge == 0 && wrongPixels == 0 && wrongPoses == 0;
+      std::printf("latency %d, ready after %d: %d issued, %d skipped, %d not ready, %d delivered, %.2f frames latency (expected %d); %d wrong age, %d wrong pixels, %d wrong poses; %s\n",
+        static_cast<int>(c.latency), static_cast<int>(c.readyDelay),
+        static_cast<int>(stats.submitted), static_cast<int>(stats.skipped),
+        static_cast<int>(stats.notReady), static_cast<int>(stats.delivered),
+        stats.averageLatencyFrames(), static_cast<int>(expectedAge),
+        static_cast<int>(wrongAge), static_cast<int>(wrongPixels),
+        static_cast<int>(wrongPoses), passed ? "passed" : "FAILED");
+      return passed;
+    }
+  }
+
+  /**
+   * CpuFrameReadback standing in for a GPU that finishes copies before,
+   * exactly at and after the ring's latency.
+   */
+  bool runReadbackSuite(const Options& options) {
+    size_t frames = std::max<size_t>(options.count("frames", options.quick() ? 60 : 600), 8);
+    const ReadbackCase cases[] = {
+      { 2, 0 },
+      { 2, 1 },
+      { 2, 2 },
+      { 2, 3 },
+      { 1, 4 },
+      { 3, 7 },
+    };
+
+    bool passed = true;
+    for (const ReadbackCase& c : cases) {
+      passed = runCase(c, frames) && passed;
+    }
+    return passed;
+  }
+
+}
@@ -0,0 +1,237 @@
+#include "Bench.h"
+#include "Reconnector.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace Benchmark {
+
+  namespace {
+    struct ReconnectResult {
+      const char* name;
+      size_t outages;
+      size_t recovered;
+      int status;          /* From Reconnector::reconnect, the last failure if several. */
+      size_t attempts;     /* Over all outages. */
+      double elapsedMs;    /* Simulated, failure to streaming or giving up; the worst. */
+      std::vector<double> backoffsMs;
+      bool passed;         /* Ended the way the scenario should. */
+    };
+
+    // Stand-ins for UsbDevice statuses; the fake link only needs them distinct.
+    constexpr int FAKE_NOT_FOUND = -1;
+    constexpr int FAKE_TIMEOUT = -2;
+    constexpr int FAKE_SEND_ERROR = -3;
+    constexpr int FAKE_CHANGED_CLIENT = -4;
+
+    constexpr int64_t MS = 1000000;
+
+    /**
+     * A device and phone that misbehave to order, on a simulated clock. Each
+     * step costs about what it does over USB; a resume that gets no answer
+     * costs the whole handshake timeout.
+     */
+    class FakeLink : public Reconnector::Link {
+    public:
+      int64_t clockNs = 0;
+      int64_t presentAtNs = 0;     /* Device enumerates from here; -1 never. */
+      size_t resumeTimeouts = 0;   /* Resumes that get no answer first. */
+      int resumeError = 0;         /* Every resume fails with this. */
+      int64_t cancelAtNs = -1;     /* The user disconnects here. */
+      double faultRate = 0.0;      /* Any step fails with this probability. */
+      std::mt19937* rng = nullptr;
+      std::vector<double> backoffsMs;
+
+      int64_t nowNs() override { return clockNs; }
+
+      bool wait(int64_t ns) override {
+        backoffsMs.push_back(ns / 1e6);
+        if (cancelAtNs >= 0 && clockNs + ns >= cancelAtNs) {
+          clockNs = cancelAtNs;
+          return false;
+        }
+        clockNs += ns;
+        return true;
+      }
+
+      int open() override {
+        clockNs += 20 * MS;
+        if (presentAtNs < 0 || clockNs < presentAtNs || fault()) {
+          return FAKE_NOT_FOUND;
+        }
+        return 0;
+      }
+
+      int resume() override {
+        if (resumeError != 0) {
+          clockNs += 30 * MS;
+          return resumeError;
+        }
+        if (resumeTimeouts > 0 || fault()) {
+          resumeTimeouts -= resumeTimeouts > 0 ? 1 : 0;
+          clockNs += 3000 * MS;
+          return FAKE_TIMEOUT;
+        }
+        clockNs += 30 * MS;
+        return 0;
+      }
+
+      int start() override {
+        clockNs += 5 * MS;
+        return fault() ? FAKE_SEND_ERROR : 0;
+      }
+
+      bool isPermanent(int status) override {
+        return status == FAKE_CHANGED_CLIENT;
+      }
+
+    private:
+      bool fault() {
+        return rng != nullptr &&
+          std::uniform_real_distribution<double>(0.0, 1.0)(*rng) < faultRate;
+      }
+    };
+
+    ReconnectResult reconnectOnce(const char* name, FakeLink* link) {
+      Reconnector reconnector;
+      ReconnectResult result;
+      result.name = name;
+      result.outages = 1;
+      result.status = reconnector.reconnect(link, FAKE_SEND_ERROR);
+      result.recovered = result.status == 0 ? 1 : 0;
+      result.attempts = static_cast<size_t>(reconnector.getStats().attempts);
+      result.elapsedMs = link->clockNs / 1e6;
+      result.backoffsMs = link->backoffsMs;
+      result.passed = false;
+      return result;
+    }
+
+    /**
+     * Drives a Reconnector with default settings through a fake link that
+     * injects faults on a simulated clock: a device that takes a while to
+     * re-enumerate, resume handshakes that time out, a phone that never comes
+     * back, one that comes back with different parameters, a user who
+     * disconnects mid-outage, and `outages` outages where every step fails
+     * with probability faultRate (the last result sums those up).
+     */
+    std::vector<ReconnectResult> runReconnect(size_t outages, double faultRate) {
+      std::vector<ReconnectResult> results;
+      Reconnector::Settings settings;
+
+      // Back after three attempts: 100 + 200 + 400 ms of backoff.
+      {
+        FakeLink link;
+        link.presentAtNs = 350 * MS;
+        ReconnectResult result = reconnectOnce("re-enumeration", &link);
+        result.passed = result.status == 0 && result.attempts == 3 &&
+          result.backoffsMs == std::vector<double>({ 100.0, 200.0, 400.0 });
+        results.push_back(result);
+      }
+
+      {
+        FakeLink link;
+        link.resumeTimeouts = 2;
+        ReconnectResult result = reconnectOnce("resume timeouts", &link);
+        result.passed = result.status == 0 && result.attempts == 3;
+        results.push_back(result);
+      }
+
+      // Gone for good: every attempt is used, backoff stays capped, and the
+      // budget is never overrun.
+      {
+        FakeLink link;
+        link.presentAtNs = -1;
+        ReconnectResult result = reconnectOnce("unplugged", &link);
+        bool capped = !result.backoffsMs.empty() &&
+          *std::max_element(result.backoffsMs.begin(), result.backoffsMs.end()) ==
+            settings.maxBackoffMs;
+        result.passed = result.status == FAKE_NOT_FOUND &&
+          result.attempts == settings.maxAttempts && capped &&
+          result.elapsedMs <= settings.budgetMs;
+        results.push_back(result);
+      }
+
+      {
+        FakeLink link;
+        link.resumeError = FAKE_CHANGED_CLIENT;
+        ReconnectResult result = reconnectOnce("different phone", &link);
+        result.passed = result.status == FAKE_CHANGED_CLIENT && result.attempts == 1;
+        results.push_back(result);
+      }
+
+      {
+        FakeLink link;
+        link.presentAtNs = -1;
+        link.cancelAtNs = 500 * MS;
+        ReconnectResult result = reconnectOnce("user disconnect", &link);
+        result.passed = result.status == Reconnector::CANCELLED &&
+          result.elapsedMs <= 500.0;
+        results.push_back(result);
+      }
+
+      // Random faults everywhere; report the worst outage. Reconnector logs
+      // every attempt, which would bury the results.
+      {
+        std::streambuf* log = std::cout.rdbuf(nullptr);
+        std::mt19937 rng(20);
+        ReconnectResult total;
+        total.name = "random faults";
+        total.outages = outages;
+        total.recovered = 0;
+        total.status = 0;
+        total.attempts = 0;
+        total.elapsedMs = 0.0;
+        for (size_t i = 0; i < outages; ++i) {
+          FakeLink link;
+          link.faultRate = faultRate;
+          link.rng = &rng;
+          ReconnectResult result = reconnectOnce(total.name, &link);
+          total.recovered += result.recovered;
+          if (result.status != 0) {
+            total.status = result.status;
+          }
+          total.attempts += result.attempts;
+          total.elapsedMs = std::max(total.elapsedMs, result.elapsedMs);
+        }
+        std::cout.rdbuf(log);
+        total.passed = total.recovered * 100 >= outages * 99;
+        results.push_back(total);
+      }
+
+      return results;
+    }
+  }
+
+  /**
+   * Every scripted outage has to end the way its scenario says, and with
+   * --faults of every step failing at random, 99% of --outages have to
+   * recover within the retry budget.
+   */
+  bool runReconnectSuite(const Options& options) {
+    size_t outages = std::max<size_t>(
+      options.count("outages", options.quick() ? 200 : 1000), 1);
+    double faultRate = options.number("faults", 0.1);
+
+    bool passed = true;
+    for (const ReconnectResult& result : runReconnect(outages, faultRate)) {
+      std::string backoffs;
+      char backoff[32];
+      for (double ms : result.backoffsMs) {
+        std::snprintf(backoff, sizeof(backoff), " %.0f", ms);
+        backoffs += backoff;
+      }
+      std::printf("%s: %d of %d recovered in %d attempts, %.0f ms at worst, status %d; backoff ms:%s; %s\n",
+        result.name, static_cast<int>(result.recovered), static_cast<int>(result.outages),
+        static_cast<int>(result.attempts), result.elapsedMs, result.status,
+        backoffs.empty() ? " -" : backoffs.c_str(),
+        result.passed ? "passed" : "FAILED");
+      passed = passed && result.passed;
+    }
+    return passed;
+  }
+
+}
@@ -0,0 +1,180 @@
+#include "Bench.h"
+#include "KeyframeRequests.h"
+#include "TileCodec.h"
+#include "JpegEncoder.h"
+#include "StreamSession.h"
+#include "SyntheticFrameSource.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <utility>
+#include <vector>
+#include "turbojpeg.h"
+
+namespace Benchmark {
+
+  namespace {
+    struct RecoveryResult {
+      size_t frames;
+      size_t lost;            /* Payloads that never reached the receiver. */
+      size_t undecodable;     /* Payloads the receiver couldn't decode. */
+      size_t wrongFrames;     /* Delivered frames showing stale tiles. */
+      size_t longestWrongRun; /* Consecutive wrong frames, at worst. */
+      size_t keyframes;
+      double bytesPerFrame;
+      KeyframeRequests::Stats requests;
+    };
+
+    /**
+     * Streams fillStaticPattern frames through a TileEncoder to a simulated
+     * lossy receiver: each payload is lost with probability lossRate or fails
+     * to decode with probability decodeFailRate. Like the phone, the receiver
+     * notices a loss at the next payload (the message sequence skips) and
+     * asks for a keyframe; its requests reach the host requestDelay frames
+     * later and go through KeyframeRequests. sendRequests=false leaves the
+     * periodic keyframes as the only way back. A delivered frame is wrong if
+     * the receiver's canvas differs from one that got every payload.
+     */
+
+    RecoveryResult runLossyReceiver(size_t width, size_t height, size_t tileSize,
+        size_t refreshInterval, size_t frames, int quality, double lossRate,
+        double decodeFailRate, size_t requestDelay, bool sendRequests) {
+      RecoveryResult result = {};
+      frames = std::max<size_t>(frames, 1);
+      const int64_t frameNs = 16666667;
+
+      size_t widthPitch = width * 4;
+      std::vector<unsigned char> pixels(widthPitch * height);
+      FrameView view;
+      view.data = pixels.data();
+      view.width = width;
+      view.widthPitch = widthPitch;
+      view.height = height;
+
+      JpegEncoder encoder(1);
+      TileEncoder tiles(tileSize, refreshInterval);
+      TileCompositor compositor;
+      TileCompositor lossless; /* Gets every payload. */
+      KeyframeRequests requests;
+      EncodedEye eye;
+      std::vector<unsigned char> body;
+      uint64_t lastSent = 0;
+      double bytes = 0.0;
+
+      std::mt19937 random(7);
+      std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+      // Requests in flight from the receiver: (frame they arrive at, frame id).
+      std::vector<std::pair<size_t, uint64_t>> inFlight;
+      bool gap = false;
+      size_t wrongRun = 0;
+
+      for (size_t i = 0; i < frames; ++i) {
+        uint64_t frameId = i + 1;
+        int64_t nowNs = static_cast<int64_t>(i) * frameNs;
+        for (auto it = inFlight.begin(); it != inFlight.end();) {
+          if (it->first <= i) {
+            requests.request(0, it->second, nowNs);
+            it = inFlight.erase(it);
+          } else {
+            ++it;
+          }
+        }
+
+        // The host never learns what was lost, only what it sent.
+        SyntheticFrameSource::fillStaticPattern(pixels.data(), width, widthPitch, height, i);
+        TileEncoder::Result tileResult;
+        bool forced = requests.take(0);
+        tiles.encode(view, forced ? 0 : lastSent, &encoder, quality, TJSAMP_420,
+          &eye, &tileResult);
+        lastSent = eye.sequence;
+        requests.sent(0, frameId, tileResult.keyframe, nowNs);
+        if (tileResult.keyframe) {
+          result.keyframes++;
+        }
+        bytes += eye.bodySize();
+        body.assign(eye.prefix.begin(), eye.prefix.end());
+        body.insert(body.end(), eye.jpegBuffer, eye.jpegBuffer + eye.jpegBufferSize);
+        lossless.apply(eye.codec, body.data(), body.size());
+
+        double roll = chance(random);
+        if (roll < lossRate) {
+          result.lost++;
+          gap = true;
+          continue;
+        }
+        if (gap && sendRequests) {
+          inFlight.push_back(std::make_pair(i + requestDelay, frameId));
+        }
+        gap = false;
+        if (roll < lossRate + decodeFailRate) {
+          // The canvas is left as it was, as when the phone's decoder fails.
+          result.undecodable++;
+          if (sendRequests) {
+            inFlight.push_back(std::make_pair(i + requestDelay, frameId));
+          }
+          continue;
+        }
+
+        if (compositor.apply(eye.codec, body.data(), body.size()) != 0) {
+          // A delta without a canvas to go on.
+          if (sendRequests) {
+            inFlight.push_back(std::make_pair(i + requestDelay, frameId));
+          }
+          continue;
+        }
+
+        bool wrong = compositor.width() != lossless.width() ||
+          compositor.height() != lossless.height() ||
+          std::memcmp(compositor.canvas(), lossless.canvas(), width * height * 4) != 0;
+        if (wrong) {
+          result.wrongFrames++;
+          wrongRun++;
+          result.longestWrongRun = std::max(result.longestWrongRun, wrongRun);
+        } else {
+          wrongRun = 0;
+        }
+      }
+
+      result.frames = frames;
+      result.bytesPerFrame = bytes / frames;
+      result.requests = requests.getStats();
+      return result;
+    }
+  }
+
+  /**
+   * 3% of payloads lost and 2% undecodable, with requests taking two frames
+   * to reach the host. With keyframe requests no eye may stay wrong any
+   * longer than that; the run without them is there for comparison. It is
+   * cheap enough that --quick runs it as is: smaller frames hide losses.
+   */
+  bool runRecoverySuite(const Options& options) {
+    size_t width = 1280;
+    size_t height = 720;
+    size_t frames = std::max<size_t>(options.count("frames", 300), 1);
+    double lossRate = options.number("loss", 0.03);
+    double decodeFailRate = options.number("undecodable", 0.02);
+    size_t requestDelay = options.count("delay", 2);
+
+    bool passed = true;
+    for (bool sendRequests : { false, true }) {
+      RecoveryResult result = runLossyReceiver(width, height,
+        StreamSession::DEFAULT_TILE_SIZE, StreamSession::DEFAULT_TILE_REFRESH,
+        frames, 50, lossRate, decodeFailRate, requestDelay, sendRequests);
+      bool recovered = !sendRequests || result.longestWrongRun <= requestDelay;
+      std::printf("%s: %d lost, %d undecodable; %d wrong frames (at most %d in a row), %d keyframes, %.0f bytes/frame; %llu requests, %llu already repaired%s\n",
+        sendRequests ? "Keyframe requests" : "No requests",
+        static_cast<int>(result.lost), static_cast<int>(result.undecodable),
+        static_cast<int>(result.wrongFrames), static_cast<int>(result.longestWrongRun),
+        static_cast<int>(result.keyframes), result.bytesPerFrame,
+        static_cast<unsigned long long>(result.requests.requests),
+        static_cast<unsigned long long>(result.requests.stale),
+        sendRequests ? (recovered ? "; passed" : "; FAILED") : "");
+      passed = passed && recovered;
+    }
+    return passed;
+  }
+
+}
@@ -0,0 +1,122 @@
+#include "Bench.h"
+#include "UsbHarness.h"
+#include "UsbEventThread.h"
+#include "UsbSendQueue.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include "libusb.h"
+
+namespace Benchmark {
+
+  namespace {
+    constexpr unsigned int TRANSFER_TIMEOUT_MS = 5000;
+
+    struct SendResult {
+      const char* name;
+      size_t frames;          /* Sent without error. */
+      int status;             /* First error, LIBUSB_SUCCESS for none. */
+      double megabytesPerSecond;
+      double framesPerSecond;
+    };
+
+    SendResult finish(const char* name, size_t frames, size_t frameBytes,
+        int status, std::chrono::steady_clock::time_point start) {
+      double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+      SendResult result;
+      result.name = name;
+      result.frames = frames;
+      result.status = status;
+      result.megabytesPerSecond = seconds > 0.0 ? frames * frameBytes / seconds / 1e6 : 0.0;
+      result.framesPerSecond = seconds > 0.0 ? frames / seconds : 0.0;
+      return result;
+    }
+
+    /** The path UsbSendQueue replaced: one blocking transfer per chunk. */
+    SendResult sendBlocking(const UsbTestDevice& device,
+        const std::vector<unsigned char>& frame, size_t frames) {
+      auto start = std::chrono::steady_clock::now();
+      int status = LIBUSB_SUCCESS;
+      size_t sent = 0;
+      for (size_t f = 0; f < frames && status == LIBUSB_SUCCESS; ++f) {
+        for (size_t i = 0; i < frame.size() && status == LIBUSB_SUCCESS;
+            i += UsbSendQueue::DEFAULT_CHUNK_LEN) {
+          int chunk = static_cast<int>(
+            std::min(UsbSendQueue::DEFAULT_CHUNK_LEN, frame.size() - i));
+          int transferred = 0;
+          status = libusb_bulk_transfer(device.handle(), device.outEndpoint(),
+            const_cast<unsigned char*>(frame.data() + i), chunk, &transferred,
+            TRANSFER_TIMEOUT_MS);
+        }
+        sent += status == LIBUSB_SUCCESS ? 1 : 0;
+      }
+      return finish("blocking", sent, frame.size(), status, start);
+    }
+
+    SendResult sendQueued(const char* name, const UsbTestDevice& device,
+        const std::vector<unsigned char>& frame, size_t frames, size_t depth) {
+      std::unique_ptr<UsbEventThread> events(new UsbEventThread(device.context()));
+      UsbSendQueue queue(events.get(), device.handle(), device.outEndpoint(), depth);
+      auto start = std::chrono::steady_clock::now();
+      int status = LIBUSB_SUCCESS;
+      size_t sent = 0;
+      for (size_t f = 0; f < frames && status == LIBUSB_SUCCESS; ++f) {
+        status = queue.sendFrame(nullptr, 0, frame.data(), frame.size(),
+          TRANSFER_TIMEOUT_MS).status;
+        sent += status == LIBUSB_SUCCESS ? 1 : 0;
+      }
+      return finish(name, sent, frame.size(), status, start);
+    }
+
+    bool print(const SendResult& result, size_t frames, double blockingMBps) {
+      bool passed = result.status == LIBUSB_SUCCESS && result.frames == frames;
+      std::printf("%s: %.1f MB/s, %.1f frames/s, %.2fx blocking, status %s; %s\n",
+        result.name, result.megabytesPerSecond, result.framesPerSecond,
+        blockingMBps > 0.0 ? result.megabytesPerSecond / blockingMBps : 0.0,
+        libusb_error_name(result.status), passed ? "passed" : "FAILED");
+      return passed;
+    }
+  }
+
+  /**
+   * UsbSendQueue on a real bulk OUT endpoint, gadget zero by default, at
+   * depth 1 and --depth (4), against one blocking libusb_bulk_transfer per
+   * 16 KB chunk as the plugin sent before it. Skipped if there's no device.
+   */
+  bool runSendSuite(const Options& options) {
+    UsbTestDevice device(options);
+    if (!device.isOpen()) {
+      std::printf("No USB test device %s; skipped\n", device.describe().c_str());
+      return true;
+    }
+
+    size_t frames = std::max<size_t>(options.count("frames", options.quick() ? 20 : 200), 1);
+    size_t kilobytes = std::max<size_t>(options.count("kilobytes", 256), 1);
+    size_t depth = std::max<size_t>(
+      options.count("depth", UsbSendQueue::DEFAULT_IN_FLIGHT), 1);
+    std::printf("%s, OUT 0x%02x, %d frames of %d KB in %d KB chunks\n",
+      device.describe().c_str(), device.outEndpoint(), static_cast<int>(frames),
+      static_cast<int>(kilobytes),
+      static_cast<int>(UsbSendQueue::DEFAULT_CHUNK_LEN / 1024));
+
+    std::vector<unsigned char> frame(kilobytes * 1024, 0x5a);
+    SendResult blocking = sendBlocking(device, frame, frames);
+    bool passed = print(blocking, frames, blocking.megabytesPerSecond);
+
+    char name[32];
+    std::vector<size_t> depths = { 1 };
+    if (depth != 1) {
+      depths.push_back(depth);
+    }
+    for (size_t inFlight : depths) {
+      std::snprintf(name, sizeof(name), "queue, depth %d", static_cast<int>(inFlight));
+      SendResult queued = sendQueued(name, device, frame, frames, inFlight);
+      passed = print(queued, frames, blocking.megabytesPerSecond) && passed;
+    }
+    return passed;
+  }
+
+}
@@ -0,0 +1,232 @@
+#include "Bench.h"
+#include "FrameRing.h"
+#include "WorkerThread.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Benchmark {
+
+  namespace {
+    struct ShutdownResult {
+      const char* name;
+      size_t trials;
+      double averageMs;  /* Cancel to every loop joined. */
+      double worstMs;
+      bool passed;
+    };
+
+    // Stand-ins for UsbDevice statuses; the fake endpoints only need them distinct.
+    constexpr int FAKE_TIMEOUT = -2;
+    constexpr int FAKE_INTERRUPTED = -5;
+
+    /**
+     * A bulk endpoint on a phone that has stopped talking: nothing arrives
+     * and nothing drains, so every transfer runs to its timeout unless it's
+     * cancelled, like a libusb transfer cancelled by UsbReader or
+     * UsbSendQueue::interrupt().
+     */
+    class FakeEndpoint {
+    public:
+      int transfer(unsigned int timeoutMs) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        bool cancelled = _cv.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+          [&] { return _cancelled; });
+        return cancelled ? FAKE_INTERRUPTED : FAKE_TIMEOUT;
+      }
+
+      void cancel() {
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _cancelled = true;
+        }
+        _cv.notify_all();
+      }
+
+    private:
+      std::mutex _mutex;
+      std::condition_variable _cv;
+      bool _cancelled = false;
+    };
+
+    /**
+     * UsbDevice's three loops over fake endpoints: a read loop blocked on
+     * IN, an encode loop waiting for frames that never come and a send loop
+     * stuck writing one. woken=false leaves the endpoints uncancelled, so
+     * the loops only notice at their next timeout, as with blocking libusb
+     * calls. With failReads, a read that times out is a link failure and
+     * goes to onReadError, which may drop the device.
+     */
+    class FakeDevice {
+    public:
+      FakeDevice(bool woken, unsigned int timeoutMs, bool failReads = false,
+          std::function<void()> onReadError = nullptr) {
+        std::shared_ptr<FakeEndpoint> in = std::make_shared<FakeEndpoint>();
+        std::shared_ptr<FakeEndpoint> out = std::make_shared<FakeEndpoint>();
+        _reader.reset(new WorkerThread("fake read loop",
+          [=](const WorkerThread::SharedAtomicBool cancel) {
+            while (!cancel->load()) {
+              if (in->transfer(timeoutMs) == FAKE_TIMEOUT && failReads &&
+                  !cancel->load()) {
+                onReadError();
+                return;
+              }
+            }
+          },
+          [=]() {
+            if (woken) {
+              in->cancel();
+            }
+          }));
+        _encoder.reset(new WorkerThread("fake encode loop",
+          [=](const WorkerThread::SharedAtomicBool cancel) {
+            while (_frames.waitAcquire(*cancel)) {}
+          },
+          [=]() { _frames.wake(); }));
+        _sender.reset(new WorkerThread("fake send loop",
+          [=](const WorkerThread::SharedAtomicBool cancel) {
+            while (!cancel->load()) {
+              out->transfer(timeoutMs);
+            }
+          },
+          [=]() {
+            if (woken) {
+              out->cancel();
+            }
+          }));
+      }
+
+      ~FakeDevice() {
+        stop();
+      }
+
+      /** Like UsbDevice::stopWorkers(): cancel all, then join each. */
+      double stop() {
+        std::unique_ptr<WorkerThread>* workers[] = { &_reader, &_encoder, &_sender };
+        auto start = std::chrono::steady_clock::now();
+        for (auto* worker : workers) {
+          if (*worker) {
+            (*worker)->cancel();
+          }
+        }
+        for (auto* worker : workers) {
+          if (*worker) {
+            (*worker)->stop();
+            worker->reset();
+          }
+        }
+        return std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - start).count();
+      }
+
+    private:
+      FrameRing<int> _frames;
+      std::unique_ptr<WorkerThread> _reader;
+      std::unique_ptr<WorkerThread> _encoder;
+      std::unique_ptr<WorkerThread> _sender;
+    };
+
+    /** Lets the loops block; varies where in a timeout they get stopped. */
+    void settle(size_t trial) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5 + (trial * 37) % 100));
+    }
+
+    ShutdownResult stopTrials(const char* name, bool woken, size_t trials) {
+      ShutdownResult result = { name, trials, 0.0, 0.0, true };
+      for (size_t trial = 0; trial < trials; ++trial) {
+        FakeDevice device(woken, 500);
+        settle(trial);
+        double ms = device.stop();
+        result.averageMs += ms / trials;
+        result.worstMs = std::max(result.worstMs, ms);
+      }
+      return result;
+    }
+
+    /**
+     * Stops a stand-in for UsbDevice's loops, built on WorkerThread over fake
+     * endpoints that block until their timeout or until cancelled, `trials`
+     * times each: with the loops left to notice at their next timeout as
+     * before, with them woken on cancel, and from a failing loop's own
+     * callback, which drops the device.
+     */
+    std::vector<ShutdownResult> runShutdown(size_t trials) {
+      std::vector<ShutdownResult> results;
+      trials = std::max<size_t>(trials, 1);
+
+      // The old scheme, for comparison: each loop notices at its next 500 ms
+      // timeout (and the device then slept 2 s on top to be sure).
+      results.push_back(stopTrials("polled", false, trials));
+
+      ShutdownResult woken = stopTrials("woken", true, trials);
+      woken.passed = woken.worstMs < 50.0;
+      results.push_back(woken);
+
+      // A read fails and its callback drops the device, as HandleStreamError
+      // and DisconnectUsb may: the read loop can't join itself, the others
+      // must still be joined, and nothing may hang.
+      {
+        ShutdownResult result = { "dropped from a loop", trials, 0.0, 0.0, true };
+        for (size_t trial = 0; trial < trials; ++trial) {
+          std::mutex mutex;
+          std::condition_variable cv;
+          std::unique_ptr<FakeDevice> device;
+          bool dropped = false;
+          double ms = 0.0;
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            device.reset(new FakeDevice(true, 20 + trial % 30, true, [&]() {
+              std::unique_ptr<FakeDevice> last;
+              std::lock_guard<std::mutex> lock(mutex);
+              last.swap(device);
+              ms = last->stop();
+              dropped = true;
+              cv.notify_all();
+            }));
+          }
+
+          std::unique_lock<std::mutex> lock(mutex);
+          if (!cv.wait_for(lock, std::chrono::seconds(2), [&] { return dropped; })) {
+            // Leak the device rather than take the caller down with it.
+            device.release();
+            result.passed = false;
+            result.worstMs = 2000.0;
+            break;
+          }
+          result.averageMs += ms / trials;
+          result.worstMs = std::max(result.worstMs, ms);
+        }
+        result.passed = result.passed && result.worstMs < 50.0;
+        results.push_back(result);
+      }
+
+      return results;
+    }
+  }
+
+  /**
+   * Loops stuck on a silent phone, stopped the old way and the new. Woken
+   * loops, and loops dropped from one of their own callbacks, have to be
+   * joined within 50 ms every time; the polled run is there for comparison.
+   */
+  bool runShutdownSuite(const Options& options) {
+    size_t trials = std::max<size_t>(
+      options.count("trials", options.quick() ? 3 : 10), 1);
+
+    bool passed = true;
+    for (const ShutdownResult& result : runShutdown(trials)) {
+      std::printf("%s: %d stops, %.2f ms average, %.2f ms at worst; %s\n",
+        result.name, static_cast<int>(result.trials), result.averageMs,
+        result.worstMs, result.passed ? "passed" : "FAILED");
+      passed = passed && result.passed;
+    }
+    return passed;
+  }
+
+}
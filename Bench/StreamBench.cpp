@@ -0,0 +1,114 @@
+#include "Bench.h"
+#include "StreamHarness.h"
+#include "StreamSession.h"
+#include "LoopbackTransport.h"
+#include "SocketTransport.h"
+#include "SyntheticFrameSource.h"
+#include "FrameRecording.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace Benchmark {
+
+  namespace {
+    void print(const StreamResult& result, bool passed) {
+      std::printf("%s: handshake %d in %.1f ms; %d of %d frames, %.1f fps, %.1f MB/s, latency %.1f ms average, %.1f ms worst; %d poses, status %d%s; %s\n",
+        result.name, result.handshakeStatus, result.handshakeMs,
+        static_cast<int>(result.received), static_cast<int>(result.published),
+        result.framesPerSecond, result.megabytesPerSecond,
+        averageOf(result.latenciesMs), percentileOf(result.latenciesMs, 100),
+        static_cast<int>(result.poses), result.status,
+        result.endReceived ? ", ended" : "", passed ? "passed" : "FAILED");
+    }
+
+    /** Handshake, every loop clean, frames and poses both ways, then TYPE_END. */
+    bool streamed(const StreamResult& result) {
+      return result.handshakeStatus == StreamSession::STATUS_OK &&
+        result.status == 0 && result.received > 0 && result.poses > 0 &&
+        result.endReceived;
+    }
+  }
+
+  /**
+   * The whole session against a stand-in phone, no USB: over a
+   * LoopbackTransport and, off Windows, a SocketTransport; a FrameRecording
+   * played back as HMD SOURCE REPLAY would; and a loopback cable pulled
+   * halfway through, which must end in a link error.
+   */
+  bool runStreamSuite(const Options& options) {
+    size_t width = std::min<size_t>(std::max<size_t>(
+      options.count("width", options.quick() ? 320 : 960), 16), 4096);
+    size_t height = std::min<size_t>(std::max<size_t>(
+      options.count("height", options.quick() ? 240 : 1080), 16), 4096);
+    size_t frames = std::max<size_t>(
+      options.count("frames", options.quick() ? 40 : 300), 2);
+    size_t threads = std::max<size_t>(
+      options.count("threads", StreamSession::getDefaultEncodeThreads()), 1);
+    std::printf("%dx%d per eye, %d frames, %d threads\n",
+      static_cast<int>(width), static_cast<int>(height),
+      static_cast<int>(frames), static_cast<int>(threads));
+
+    // A few distinct frames, drawn up front so drawing them isn't timed.
+    const size_t frameWidth = width * EYE_COUNT;
+    SyntheticFrameSource pattern(frameWidth, height,
+      SyntheticFrameSource::PATTERN_ANIMATED, 4);
+    bool passed = true;
+
+    {
+      std::shared_ptr<LoopbackTransport> host, phone;
+      LoopbackTransport::createPair(&host, &phone);
+      StreamResult result = streamOver("loopback", host, phone, nullptr,
+        &pattern, width, height, frames, threads);
+      print(result, streamed(result));
+      passed = passed && streamed(result);
+    }
+
+#ifndef _WIN32
+    {
+      std::shared_ptr<SocketTransport> host, phone;
+      StreamResult result = {};
+      result.name = "socketpair";
+      result.handshakeStatus = StreamSession::STATUS_NOT_FOUND_ERROR;
+      if (SocketTransport::createPair(&host, &phone)) {
+        result = streamOver("socketpair", host, phone, nullptr,
+          &pattern, width, height, frames, threads);
+      }
+      print(result, streamed(result));
+      passed = passed && streamed(result);
+    }
+#endif
+
+    {
+      // The static scene, recorded and played back as HMD SOURCE REPLAY would.
+      std::shared_ptr<FrameRecording> recording =
+        std::make_shared<FrameRecording>();
+      SyntheticFrameSource scene(frameWidth, height,
+        SyntheticFrameSource::PATTERN_STATIC);
+      for (int i = 0; i < 8; ++i) {
+        scene.deliver(recording.get());
+      }
+      ReplayFrameSource replay(recording);
+
+      std::shared_ptr<LoopbackTransport> host, phone;
+      LoopbackTransport::createPair(&host, &phone);
+      StreamResult result = streamOver("loopback, replayed", host, phone,
+        nullptr, &replay, width, height, frames, threads);
+      print(result, streamed(result));
+      passed = passed && streamed(result);
+    }
+
+    {
+      std::shared_ptr<LoopbackTransport> host, phone;
+      LoopbackTransport::createPair(&host, &phone);
+      StreamResult result = streamOver("loopback, unplugged", host, phone,
+        phone.get(), &pattern, width, height, frames, threads);
+      bool unplugged = result.handshakeStatus == StreamSession::STATUS_OK &&
+        StreamSession::isLinkError(result.status);
+      print(result, unplugged);
+      passed = passed && unplugged;
+    }
+
+    return passed;
+  }
+
+}
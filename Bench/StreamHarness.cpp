@@ -0,0 +1,283 @@
+#include "StreamHarness.h"
+#include "StreamSession.h"
+#include "FrameHeader.h"
+#include "MessageCodec.h"
+#include "Capabilities.h"
+#include "WorkerThread.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+namespace Benchmark {
+
+  namespace {
+    /** Hands frames to a session and remembers whether it took the last. */
+    class PublishingSink : public FrameSink {
+    public:
+      explicit PublishingSink(StreamSession* session)
+        : _session(session), _published(false) {}
+
+      virtual bool publishFrame(const FrameView& view) override {
+        _published = _session->publishFrame(view);
+        return _published;
+      }
+
+      bool published() const { return _published; }
+
+    private:
+      StreamSession* _session;
+      bool _published;
+    };
+
+    /**
+     * The phone's end of the link for streamOver: says hello until the host
+     * has had it, hands everything the host sends to a FrameReceiver, and
+     * answers each complete frame with a pose for the read loop.
+     */
+    class FakePhone {
+    public:
+      FakePhone(std::shared_ptr<Transport> transport, size_t width, size_t height)
+        : _transport(transport),
+          _received(0),
+          _ended(false),
+          _failed(false) {
+        Capabilities device;
+        device.codecs = (1 << CODEC_JPEG) | (1 << CODEC_TILES);
+        device.viewportWidth = static_cast<uint16_t>(width);
+        device.viewportHeight = static_cast<uint16_t>(height);
+        device.maxDecodeWidth = static_cast<uint16_t>(width);
+        device.maxDecodeHeight = static_cast<uint16_t>(height);
+        device.refreshMilliHz = 60000;
+        device.interpupillary = 0.064f;
+        std::vector<unsigned char> hello;
+        device.write(&hello);
+        Message::Writer writer;
+        writer.append(Message::TYPE_HELLO, hello.data(), hello.size(), &_hello);
+
+        _transport->resetReads();
+        _reader.reset(new WorkerThread("phone",
+          [this](const WorkerThread::SharedAtomicBool cancel) { readLoop(*cancel); },
+          [transport]() { transport->cancelReads(); }));
+      }
+
+      ~FakePhone() {
+        _reader.reset();
+      }
+
+      /** Only until the reader starts answering frames. */
+      int sayHello() {
+        return _transport->send(_hello.data(), _hello.size(), nullptr, 0, 500).status;
+      }
+
+      size_t received() const { return _received.load(); }
+
+      /** Waits for TYPE_END or a broken stream. */
+      bool waitEnd(int timeoutMs) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _cv.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+          [this] { return _ended.load() || _failed.load(); }) && _ended.load();
+      }
+
+      /** Capture to both eyes received, for each frame in order. */
+      std::vector<double> latenciesMs() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _latenciesMs;
+      }
+
+    private:
+      std::shared_ptr<Transport> _transport;
+      std::vector<unsigned char> _hello;
+      std::unique_ptr<WorkerThread> _reader;
+
+      mutable std::mutex _mutex;
+      std::condition_variable _cv;
+      std::atomic<size_t> _received;
+      std::vector<double> _latenciesMs;
+      std::atomic_bool _ended;
+      std::atomic_bool _failed;
+
+      void readLoop(const std::atomic_bool& cancel) {
+        FrameReceiver receiver;
+        Message::Writer writer;
+        std::vector<unsigned char> input(StreamSession::READ_BUFFER_LEN);
+        std::vector<unsigned char> pose;
+        unsigned char posePayload[StreamSession::POSE_PACKET_LEN] = {};
+        uint64_t lastFrameId = 0;
+        while (!cancel.load()) {
+          int read = 0;
+          int status = _transport->read(input.data(), static_cast<int>(input.size()),
+            &read, 0);
+          if (status != Transport::SUCCESS) {
+            break;
+          }
+
+          int state = receiver.feed(input.data(), read);
+          const FrameHeader& right = receiver.lastHeader(EYE_RIGHT);
+          if (right.frameId != lastFrameId) {
+            // Both eyes of a frame are in; eyes are sent left first.
+            lastFrameId = right.frameId;
+            double latencyMs = (steadyClockNs() - right.captureNs) / 1e6;
+            {
+              std::lock_guard<std::mutex> lock(_mutex);
+              _latenciesMs.push_back(latencyMs);
+            }
+            _received++;
+
+            pose.clear();
+            writer.append(Message::TYPE_POSE, posePayload, sizeof(posePayload), &pose);
+            _transport->send(pose.data(), pose.size(), nullptr, 0, 500);
+          }
+
+          if (state != 0) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            (state > 0 ? _ended : _failed).store(true);
+            _cv.notify_all();
+            break;
+          }
+        }
+      }
+    };
+  }
+
+  StreamResult streamOver(const char* name, std::shared_ptr<Transport> host,
+      std::shared_ptr<Transport> phoneEnd, LoopbackTransport* unplug,
+      FrameSource* source, size_t width, size_t height, size_t frames,
+      size_t threads, double renderHz, const RateController::Targets* targets,
+      LoopbackTransport* backlog) {
+    // Until the handshake says otherwise, the phone never answered.
+    StreamResult result = {};
+    result.name = name;
+    result.handshakeStatus = StreamSession::STATUS_LIBUSB_ERROR + Transport::ERROR_TIMEOUT;
+    FakePhone phone(phoneEnd, width, height);
+    std::unique_ptr<StreamSession> session(new StreamSession(host));
+    session->setEncodeThreads(threads);
+    if (targets != nullptr) {
+      session->setRateTargets(*targets);
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool handshook = false;
+    std::atomic<size_t> poses(0);
+    std::atomic<int> loopStatus(0);
+    auto fail = [&](int status) {
+      int expected = 0;
+      loopStatus.compare_exchange_strong(expected, status);
+    };
+
+    // The handshake flushes what arrived before it, as the plugin does, so
+    // keep saying hello until it has heard one.
+    auto start = std::chrono::steady_clock::now();
+    session->waitHandshakeAsync([&](int status) {
+      std::lock_guard<std::mutex> lock(mutex);
+      result.handshakeStatus = status;
+      handshook = true;
+      cv.notify_all();
+    });
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      for (int attempt = 0; attempt < 20 && !handshook; ++attempt) {
+        lock.unlock();
+        phone.sayHello();
+        lock.lock();
+        cv.wait_for(lock, std::chrono::milliseconds(100), [&] { return handshook; });
+      }
+    }
+    result.handshakeMs = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+    if (result.handshakeStatus != StreamSession::STATUS_OK) {
+      return result;
+    }
+
+    session->beginReadLoop([&](uint8_t type, const unsigned char*, size_t, int status) {
+      if (status != 0) {
+        fail(status);
+      } else if (type == Message::TYPE_POSE) {
+        poses++;
+      }
+    });
+    session->beginSendLoop(fail);
+
+    PublishingSink sink(session.get());
+    double depthSum = 0.0;
+    double backlogSum = 0.0;
+    start = std::chrono::steady_clock::now();
+    auto nextFrame = start;
+    for (size_t i = 1; i <= frames && loopStatus.load() == 0; ++i) {
+      if (unplug != nullptr && i == frames / 2) {
+        unplug->disconnect();
+      }
+
+      if (!source->deliver(&sink) || !sink.published()) {
+        break;
+      }
+      result.published++;
+
+      // Frames somewhere between publish and the link, including this one.
+      PipelineStats stats = session->getPipelineStats();
+      int64_t depth = static_cast<int64_t>(stats.captured) -
+        static_cast<int64_t>(stats.droppedBeforeEncode + stats.droppedBeforeSend +
+          stats.sent);
+      size_t clamped = static_cast<size_t>(std::max<int64_t>(depth, 0));
+      depthSum += clamped;
+      result.maxQueueDepth = std::max(result.maxQueueDepth, clamped);
+      if (backlog != nullptr) {
+        backlogSum += backlog->outstanding() / 1024.0;
+      }
+
+      if (renderHz > 0.0) {
+        // The game renders on its own clock; frames the encoder hasn't
+        // started on are replaced.
+        nextFrame += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(1.0 / renderHz));
+        std::this_thread::sleep_until(nextFrame);
+        continue;
+      }
+
+      // Publishing faster than the encoder would only replace frames.
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+      while (session->getPipelineStats().encoded < i && loopStatus.load() == 0 &&
+          std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    }
+
+    // Let the last frames arrive.
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (loopStatus.load() == 0 && std::chrono::steady_clock::now() < deadline) {
+      PipelineStats stats = session->getPipelineStats();
+      if (stats.sent + stats.droppedBeforeSend >= stats.encoded &&
+          phone.received() >= stats.sent) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    double elapsedMs = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+
+    result.received = phone.received();
+    result.framesPerSecond = elapsedMs > 0.0 ? result.received * 1000.0 / elapsedMs : 0.0;
+    result.megabytesPerSecond = session->getSendStats().megabytesPerSecond();
+    if (result.published > 0) {
+      result.averageQueueDepth = depthSum / result.published;
+      result.averageBacklogKilobytes = backlogSum / result.published;
+    }
+    for (size_t eye = 0; eye < EYE_COUNT; ++eye) {
+      EyeStats stats = session->getEyeStats(eye);
+      result.encodeMsPerFrame += stats.averageEncodeMs();
+      result.bytesPerFrame += stats.averageBytes();
+    }
+    result.latenciesMs = phone.latenciesMs();
+    result.poses = poses.load();
+
+    // Dropping the session stops the loops, which says goodbye.
+    session.reset();
+    result.status = loopStatus.load();
+    result.endReceived = unplug == nullptr && phone.waitEnd(1000);
+    return result;
+  }
+
+}
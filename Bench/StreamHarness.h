@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "RateController.h"
+#include "LoopbackTransport.h"
+#include "FrameSource.h"
+
+namespace Benchmark {
+
+  struct StreamResult {
+    const char* name;
+    int handshakeStatus;
+    double handshakeMs;
+    size_t published;
+    size_t received;         /* Frames the phone got both eyes of. */
+    double framesPerSecond;  /* First publish to last frame received. */
+    double megabytesPerSecond;
+    double encodeMsPerFrame; /* Both eyes' encode time added up. */
+    double bytesPerFrame;    /* Both eyes. */
+    double averageQueueDepth; /* Frames captured, not yet sent or dropped. */
+    size_t maxQueueDepth;
+    double averageBacklogKilobytes; /* Sent but not yet read by the phone. */
+    std::vector<double> latenciesMs; /* Capture to both eyes received, in order. */
+    size_t poses;            /* Passed on by the read loop. */
+    int status;              /* First error from the loops, 0 for none. */
+    bool endReceived;        /* TYPE_END when the session was dropped. */
+  };
+
+  /**
+   * Runs a StreamSession end to end against a stand-in phone on phoneEnd:
+   * the handshake, `frames` frames of two width x height eyes from source
+   * through the encode and send loops, a pose back through the read loop for
+   * each, and TYPE_END on the way out. Frames are rendered at renderHz, or
+   * with 0, each once the previous one has been encoded. unplug, if given,
+   * is disconnected halfway through; backlog, if given, is sampled for data
+   * sent but not yet read.
+   */
+  StreamResult streamOver(const char* name, std::shared_ptr<Transport> host,
+    std::shared_ptr<Transport> phoneEnd, LoopbackTransport* unplug,
+    FrameSource* source, size_t width, size_t height, size_t frames,
+    size_t threads, double renderHz = 0.0,
+    const RateController::Targets* targets = nullptr,
+    LoopbackTransport* backlog = nullptr);
+
+}
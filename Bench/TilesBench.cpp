@@ -0,0 +1,134 @@
+#include "Bench.h"
+#include "TileCodec.h"
+#include "JpegEncoder.h"
+#include "StreamSession.h"
+#include "SyntheticFrameSource.h"
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include "turbojpeg.h"
+
+namespace Benchmark {
+
+  namespace {
+    struct TileResult {
+      size_t frames;
+      size_t keyframes;
+      double changedFraction;      /* Average over delta frames. */
+      double bytesPerFrame;
+      double fullJpegBytesPerFrame; /* The same frames as plain JPEGs. */
+      double minPsnr;              /* Compositor output against the source. */
+      double fullJpegMinPsnr;
+      size_t rejected;             /* Payloads the compositor refused. */
+    };
+
+    /**
+     * Streams fillStaticPattern frames through a TileEncoder and applies them
+     * with a TileCompositor, skipping every dropEvery-th payload (0 for none)
+     * as if it never reached the receiver. The compositor output is compared
+     * with the source after every delivered frame; stale tiles show up as a
+     * PSNR well below the plain JPEG's.
+     */
+    TileResult runTileRoundTrip(size_t width, size_t height, size_t tileSize,
+        size_t refreshInterval, size_t frames, int quality, size_t dropEvery) {
+      TileResult result = {};
+      result.minPsnr = 99.0;
+      result.fullJpegMinPsnr = 99.0;
+      frames = std::max<size_t>(frames, 1);
+
+      size_t widthPitch = width * 4;
+      std::vector<unsigned char> pixels(widthPitch * height);
+      FrameView view;
+      view.data = pixels.data();
+      view.width = width;
+      view.widthPitch = widthPitch;
+      view.height = height;
+
+      JpegEncoder encoder(1);
+      TileEncoder tiles(tileSize, refreshInterval);
+      TileCompositor compositor;
+      TileCompositor reference;
+      EncodedEye eye;
+      EncodedEye full;
+      std::vector<unsigned char> body;
+      uint64_t lastSent = 0;
+      size_t deltas = 0;
+      double changed = 0.0;
+      double bytes = 0.0;
+      double fullBytes = 0.0;
+
+      for (size_t i = 0; i < frames; ++i) {
+        SyntheticFrameSource::fillStaticPattern(pixels.data(), width, widthPitch, height, i);
+
+        TileEncoder::Result tileResult;
+        tiles.encode(view, lastSent, &encoder, quality, TJSAMP_420, &eye, &tileResult);
+        if (tileResult.keyframe) {
+          result.keyframes++;
+        } else {
+          deltas++;
+          changed += static_cast<double>(tileResult.changedTiles) / tileResult.totalTiles;
+        }
+        bytes += eye.bodySize();
+
+        unsigned long fullSize = 0;
+        encoder.encode(view, quality, TJSAMP_420, &full.jpegBuffer,
+          &full.jpegBufferCapacity, &fullSize);
+        fullBytes += fullSize;
+        reference.apply(CODEC_JPEG, full.jpegBuffer, fullSize);
+        result.fullJpegMinPsnr = std::min(result.fullJpegMinPsnr,
+          psnr(pixels.data(), widthPitch, reference.canvas(), width * 4, width, height));
+
+        if (dropEvery != 0 && i % dropEvery == dropEvery - 1) {
+          continue;
+        }
+
+        body.assign(eye.prefix.begin(), eye.prefix.end());
+        body.insert(body.end(), eye.jpegBuffer, eye.jpegBuffer + eye.jpegBufferSize);
+        if (compositor.apply(eye.codec, body.data(), body.size()) != 0 ||
+            compositor.width() != width || compositor.height() != height) {
+          result.rejected++;
+          continue;
+        }
+        lastSent = eye.sequence;
+        result.minPsnr = std::min(result.minPsnr,
+          psnr(pixels.data(), widthPitch, compositor.canvas(), width * 4, width, height));
+      }
+
+      result.frames = frames;
+      result.changedFraction = deltas > 0 ? changed / deltas : 0.0;
+      result.bytesPerFrame = bytes / frames;
+      result.fullJpegBytesPerFrame = fullBytes / frames;
+      return result;
+    }
+  }
+
+  /**
+   * One eye of side-by-side 1080p with every third payload lost in transit,
+   * at each tile size. The compositor has to accept every payload that
+   * arrives and keep within 0.5 dB PSNR of plain JPEGs at worst, so lost
+   * tiles must be resent.
+   */
+  bool runTilesSuite(const Options& options) {
+    size_t width = options.quick() ? 640 : 1920;
+    size_t height = options.quick() ? 360 : 1080;
+    size_t frames = std::max<size_t>(
+      options.count("frames", options.quick() ? 40 : 120), 1);
+    size_t dropEvery = options.count("drop", 3);
+
+    bool passed = true;
+    for (size_t tileSize : { 16, 32, 64 }) {
+      TileResult result = runTileRoundTrip(width, height, tileSize,
+        StreamSession::DEFAULT_TILE_REFRESH, frames, 50, dropEvery);
+      bool matches = result.rejected == 0 &&
+        result.minPsnr >= result.fullJpegMinPsnr - 0.5;
+      std::printf("%dpx tiles: %d keyframes, %.1f%% changed, %.0f bytes/frame (JPEG %.0f), PSNR %.1f dB (JPEG %.1f dB), %s\n",
+        static_cast<int>(tileSize), static_cast<int>(result.keyframes),
+        result.changedFraction * 100.0, result.bytesPerFrame,
+        result.fullJpegBytesPerFrame, result.minPsnr, result.fullJpegMinPsnr,
+        matches ? "matches source" : "DOES NOT MATCH SOURCE");
+      passed = passed && matches;
+    }
+    return passed;
+  }
+
+}
@@ -0,0 +1,394 @@
+// The subset of the TurboJPEG API the streaming core uses, over libjpeg's own
+// API, for systems whose libjpeg-turbo package ships without libturbojpeg.
+// Only built when CMake can't find the real thing. Needs libjpeg-turbo's
+// extended colour spaces (JCS_EXTENSIONS) for the BGRX input.
+
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <jpeglib.h>
+#include "turbojpeg.h"
+
+#ifndef JCS_EXTENSIONS
+#error "libjpeg-turbo with JCS_EXTENSIONS is needed for the TurboJPEG shim"
+#endif
+
+namespace {
+
+struct ErrorManager {
+  jpeg_error_mgr pub;
+  std::jmp_buf jump;
+};
+
+struct Instance {
+  bool compressor;
+  jpeg_compress_struct c;
+  jpeg_decompress_struct d;
+  ErrorManager error;
+};
+
+char g_errorStr[JMSG_LENGTH_MAX] = "No error";
+
+void errorExit(j_common_ptr cinfo) {
+  ErrorManager* error = reinterpret_cast<ErrorManager*>(cinfo->err);
+  (*cinfo->err->format_message)(cinfo, g_errorStr);
+  std::longjmp(error->jump, 1);
+}
+
+void emitMessage(j_common_ptr, int) {
+  // Warnings, e.g. about corrupt data, aren't errors to TurboJPEG either.
+}
+
+int fail(const char* message) {
+  std::snprintf(g_errorStr, sizeof(g_errorStr), "%s", message);
+  return -1;
+}
+
+bool colorSpaceOf(int pixelFormat, J_COLOR_SPACE* space) {
+  switch (pixelFormat) {
+    case TJPF_RGB: *space = JCS_EXT_RGB; return true;
+    case TJPF_BGR: *space = JCS_EXT_BGR; return true;
+    case TJPF_RGBX: *space = JCS_EXT_RGBX; return true;
+    case TJPF_BGRX: *space = JCS_EXT_BGRX; return true;
+    case TJPF_XBGR: *space = JCS_EXT_XBGR; return true;
+    case TJPF_XRGB: *space = JCS_EXT_XRGB; return true;
+    case TJPF_GRAY: *space = JCS_GRAYSCALE; return true;
+    case TJPF_RGBA: *space = JCS_EXT_RGBA; return true;
+    case TJPF_BGRA: *space = JCS_EXT_BGRA; return true;
+    case TJPF_ABGR: *space = JCS_EXT_ABGR; return true;
+    case TJPF_ARGB: *space = JCS_EXT_ARGB; return true;
+    default: return false;
+  }
+}
+
+/** Luma sampling factors for each TJSAMP; chroma is always 1x1. */
+const int SAMP_H[TJ_NUMSAMP] = { 1, 2, 2, 1, 1, 4 };
+const int SAMP_V[TJ_NUMSAMP] = { 1, 1, 2, 1, 2, 1 };
+
+void setSubsampling(jpeg_compress_struct* c, int subsamp) {
+  if (subsamp == TJSAMP_GRAY) {
+    jpeg_set_colorspace(c, JCS_GRAYSCALE);
+  } else {
+    jpeg_set_colorspace(c, JCS_YCbCr);
+  }
+  c->comp_info[0].h_samp_factor = SAMP_H[subsamp];
+  c->comp_info[0].v_samp_factor = SAMP_V[subsamp];
+  for (int i = 1; i < c->num_components; ++i) {
+    c->comp_info[i].h_samp_factor = 1;
+    c->comp_info[i].v_samp_factor = 1;
+  }
+}
+
+/** Copies the compressed image out as TurboJPEG would hand it back. */
+int finishInto(unsigned char* mem, unsigned long memSize, int width, int height,
+    int subsamp, unsigned char** jpegBuf, unsigned long* jpegSize, int flags) {
+  if (flags & TJFLAG_NOREALLOC) {
+    if (*jpegBuf == nullptr || memSize > tjBufSize(width, height, subsamp)) {
+      std::free(mem);
+      return fail("tjCompress2(): destination buffer is not large enough");
+    }
+  } else if (*jpegBuf == nullptr || *jpegSize < memSize) {
+    tjFree(*jpegBuf);
+    *jpegBuf = tjAlloc(static_cast<int>(memSize));
+    if (*jpegBuf == nullptr) {
+      std::free(mem);
+      return fail("tjCompress2(): memory allocation failure");
+    }
+  }
+  std::memcpy(*jpegBuf, mem, memSize);
+  *jpegSize = memSize;
+  std::free(mem);
+  return 0;
+}
+
+Instance* instanceOf(tjhandle handle, bool compressor) {
+  Instance* instance = static_cast<Instance*>(handle);
+  if (instance == nullptr || instance->compressor != compressor) {
+    fail("Invalid handle");
+    return nullptr;
+  }
+  return instance;
+}
+
+}
+
+extern "C" {
+
+tjhandle tjInitCompress(void) {
+  Instance* instance = new Instance();
+  instance->compressor = true;
+  instance->c.err = jpeg_std_error(&instance->error.pub);
+  instance->error.pub.error_exit = errorExit;
+  instance->error.pub.emit_message = emitMessage;
+  jpeg_create_compress(&instance->c);
+  return instance;
+}
+
+tjhandle tjInitDecompress(void) {
+  Instance* instance = new Instance();
+  instance->compressor = false;
+  instance->d.err = jpeg_std_error(&instance->error.pub);
+  instance->error.pub.error_exit = errorExit;
+  instance->error.pub.emit_message = emitMessage;
+  jpeg_create_decompress(&instance->d);
+  return instance;
+}
+
+int tjDestroy(tjhandle handle) {
+  Instance* instance = static_cast<Instance*>(handle);
+  if (instance == nullptr) {
+    return fail("Invalid handle");
+  }
+  if (instance->compressor) {
+    jpeg_destroy_compress(&instance->c);
+  } else {
+    jpeg_destroy_decompress(&instance->d);
+  }
+  delete instance;
+  return 0;
+}
+
+unsigned char* tjAlloc(int bytes) {
+  return static_cast<unsigned char*>(std::malloc(bytes));
+}
+
+void tjFree(unsigned char* buffer) {
+  std::free(buffer);
+}
+
+char* tjGetErrorStr(void) {
+  return g_errorStr;
+}
+
+unsigned long tjBufSize(int width, int height, int jpegSubsamp) {
+  if (width < 1 || height < 1 || jpegSubsamp < 0 || jpegSubsamp >= TJ_NUMSAMP) {
+    return static_cast<unsigned long>(-1);
+  }
+  // As libjpeg-turbo computes it: 16-bit coefficients can expand the image.
+  unsigned long mcuw = tjMCUWidth[jpegSubsamp];
+  unsigned long mcuh = tjMCUHeight[jpegSubsamp];
+  unsigned long chromasf = jpegSubsamp == TJSAMP_GRAY ? 0 : 4 * 64 / (mcuw * mcuh);
+  return ((width + mcuw - 1) / mcuw * mcuw) * ((height + mcuh - 1) / mcuh * mcuh) *
+    (2 + chromasf) + 2048;
+}
+
+int tjCompress2(tjhandle handle, const unsigned char* srcBuf, int width,
+    int pitch, int height, int pixelFormat, unsigned char** jpegBuf,
+    unsigned long* jpegSize, int jpegSubsamp, int jpegQual, int flags) {
+  Instance* instance = instanceOf(handle, true);
+  J_COLOR_SPACE space;
+  if (instance == nullptr) {
+    return -1;
+  }
+  if (srcBuf == nullptr || width < 1 || height < 1 || jpegBuf == nullptr ||
+      jpegSize == nullptr || jpegSubsamp < 0 || jpegSubsamp >= TJ_NUMSAMP ||
+      !colorSpaceOf(pixelFormat, &space)) {
+    return fail("tjCompress2(): Invalid argument");
+  }
+  const size_t rowPitch = pitch != 0 ? static_cast<size_t>(pitch) :
+    static_cast<size_t>(width) * tjPixelSize[pixelFormat];
+
+  jpeg_compress_struct* c = &instance->c;
+  unsigned char* mem = nullptr;
+  unsigned long memSize = 0;
+  if (setjmp(instance->error.jump)) {
+    jpeg_abort_compress(c);
+    std::free(mem);
+    return -1;
+  }
+
+  jpeg_mem_dest(c, &mem, &memSize);
+  c->image_width = width;
+  c->image_height = height;
+  c->input_components = tjPixelSize[pixelFormat];
+  c->in_color_space = space;
+  jpeg_set_defaults(c);
+  jpeg_set_quality(c, jpegQual, TRUE);
+  c->dct_method = (flags & TJFLAG_FASTDCT) ? JDCT_IFAST : JDCT_ISLOW;
+  setSubsampling(c, jpegSubsamp);
+
+  jpeg_start_compress(c, TRUE);
+  while (c->next_scanline < c->image_height) {
+    int y = static_cast<int>(c->next_scanline);
+    if (flags & TJFLAG_BOTTOMUP) {
+      y = height - 1 - y;
+    }
+    JSAMPROW row = const_cast<JSAMPROW>(srcBuf + static_cast<size_t>(y) * rowPitch);
+    jpeg_write_scanlines(c, &row, 1);
+  }
+  jpeg_finish_compress(c);
+  return finishInto(mem, memSize, width, height, jpegSubsamp, jpegBuf,
+    jpegSize, flags);
+}
+
+int tjCompressFromYUVPlanes(tjhandle handle, const unsigned char** srcPlanes,
+    int width, const int* strides, int height, int subsamp,
+    unsigned char** jpegBuf, unsigned long* jpegSize, int jpegQual, int flags) {
+  Instance* instance = instanceOf(handle, true);
+  if (instance == nullptr) {
+    return -1;
+  }
+  if (srcPlanes == nullptr || srcPlanes[0] == nullptr || width < 1 ||
+      height < 1 || subsamp < 0 || subsamp >= TJ_NUMSAMP || jpegBuf == nullptr ||
+      jpegSize == nullptr ||
+      (subsamp != TJSAMP_GRAY && (srcPlanes[1] == nullptr || srcPlanes[2] == nullptr))) {
+    return fail("tjCompressFromYUVPlanes(): Invalid argument");
+  }
+
+  jpeg_compress_struct* c = &instance->c;
+  unsigned char* mem = nullptr;
+  unsigned long memSize = 0;
+  if (setjmp(instance->error.jump)) {
+    jpeg_abort_compress(c);
+    std::free(mem);
+    return -1;
+  }
+
+  jpeg_mem_dest(c, &mem, &memSize);
+  c->image_width = width;
+  c->image_height = height;
+  c->input_components = subsamp == TJSAMP_GRAY ? 1 : 3;
+  c->in_color_space = subsamp == TJSAMP_GRAY ? JCS_GRAYSCALE : JCS_YCbCr;
+  jpeg_set_defaults(c);
+  jpeg_set_quality(c, jpegQual, TRUE);
+  c->dct_method = (flags & TJFLAG_FASTDCT) ? JDCT_IFAST : JDCT_ISLOW;
+  setSubsampling(c, subsamp);
+  c->raw_data_in = TRUE;
+
+  // Plane sizes as the YUV notes give them; rows past the bottom repeat the
+  // last one, as TurboJPEG pads them.
+  int components = c->num_components;
+  int planeWidth[3], planeHeight[3], stride[3];
+  for (int i = 0; i < components; ++i) {
+    int h = i == 0 ? 1 : SAMP_H[subsamp];
+    int v = i == 0 ? 1 : SAMP_V[subsamp];
+    int lumaWidth = (width + SAMP_H[subsamp] - 1) / SAMP_H[subsamp] * SAMP_H[subsamp];
+    int lumaHeight = (height + SAMP_V[subsamp] - 1) / SAMP_V[subsamp] * SAMP_V[subsamp];
+    planeWidth[i] = lumaWidth / h;
+    planeHeight[i] = lumaHeight / v;
+    stride[i] = strides != nullptr && strides[i] != 0 ? strides[i] : planeWidth[i];
+  }
+
+  jpeg_start_compress(c, TRUE);
+  int rowsPerPass = DCTSIZE * c->max_v_samp_factor;
+  std::vector<JSAMPROW> rows[3];
+  JSAMPARRAY data[3];
+  for (int i = 0; i < components; ++i) {
+    rows[i].resize(DCTSIZE * c->comp_info[i].v_samp_factor);
+    data[i] = rows[i].data();
+  }
+  for (int y = 0; y < static_cast<int>(c->image_height); y += rowsPerPass) {
+    for (int i = 0; i < components; ++i) {
+      int componentY = y * c->comp_info[i].v_samp_factor / c->max_v_samp_factor;
+      for (size_t r = 0; r < rows[i].size(); ++r) {
+        int row = std::min(componentY + static_cast<int>(r), planeHeight[i] - 1);
+        rows[i][r] = const_cast<JSAMPROW>(srcPlanes[i] +
+          static_cast<size_t>(row) * stride[i]);
+      }
+    }
+    jpeg_write_raw_data(c, data, rowsPerPass);
+  }
+  jpeg_finish_compress(c);
+  return finishInto(mem, memSize, width, height, subsamp, jpegBuf, jpegSize,
+    flags);
+}
+
+int tjDecompressHeader3(tjhandle handle, const unsigned char* jpegBuf,
+    unsigned long jpegSize, int* width, int* height, int* jpegSubsamp,
+    int* jpegColorspace) {
+  Instance* instance = instanceOf(handle, false);
+  if (instance == nullptr) {
+    return -1;
+  }
+  if (jpegBuf == nullptr || jpegSize == 0 || width == nullptr ||
+      height == nullptr || jpegSubsamp == nullptr || jpegColorspace == nullptr) {
+    return fail("tjDecompressHeader3(): Invalid argument");
+  }
+
+  jpeg_decompress_struct* d = &instance->d;
+  if (setjmp(instance->error.jump)) {
+    jpeg_abort_decompress(d);
+    return -1;
+  }
+
+  jpeg_mem_src(d, const_cast<unsigned char*>(jpegBuf), jpegSize);
+  jpeg_read_header(d, TRUE);
+  *width = d->image_width;
+  *height = d->image_height;
+  *jpegSubsamp = -1;
+  if (d->num_components == 1) {
+    *jpegSubsamp = TJSAMP_GRAY;
+  } else {
+    for (int i = 0; i < TJ_NUMSAMP; ++i) {
+      if (i != TJSAMP_GRAY && d->comp_info[0].h_samp_factor == SAMP_H[i] &&
+          d->comp_info[0].v_samp_factor == SAMP_V[i]) {
+        *jpegSubsamp = i;
+      }
+    }
+  }
+  switch (d->jpeg_color_space) {
+    case JCS_GRAYSCALE: *jpegColorspace = TJCS_GRAY; break;
+    case JCS_RGB: *jpegColorspace = TJCS_RGB; break;
+    case JCS_CMYK: *jpegColorspace = TJCS_CMYK; break;
+    case JCS_YCCK: *jpegColorspace = TJCS_YCCK; break;
+    default: *jpegColorspace = TJCS_YCbCr; break;
+  }
+  jpeg_abort_decompress(d);
+
+  if (*jpegSubsamp < 0) {
+    return fail("tjDecompressHeader3(): Could not determine subsampling type for JPEG image");
+  }
+  return 0;
+}
+
+int tjDecompress2(tjhandle handle, const unsigned char* jpegBuf,
+    unsigned long jpegSize, unsigned char* dstBuf, int width, int pitch,
+    int height, int pixelFormat, int flags) {
+  Instance* instance = instanceOf(handle, false);
+  J_COLOR_SPACE space;
+  if (instance == nullptr) {
+    return -1;
+  }
+  if (jpegBuf == nullptr || jpegSize == 0 || dstBuf == nullptr ||
+      width < 0 || height < 0 || !colorSpaceOf(pixelFormat, &space)) {
+    return fail("tjDecompress2(): Invalid argument");
+  }
+
+  jpeg_decompress_struct* d = &instance->d;
+  if (setjmp(instance->error.jump)) {
+    jpeg_abort_decompress(d);
+    return -1;
+  }
+
+  jpeg_mem_src(d, const_cast<unsigned char*>(jpegBuf), jpegSize);
+  jpeg_read_header(d, TRUE);
+  // No scaling: the destination must take the whole image.
+  if ((width != 0 && width != static_cast<int>(d->image_width)) ||
+      (height != 0 && height != static_cast<int>(d->image_height))) {
+    jpeg_abort_decompress(d);
+    return fail("tjDecompress2(): Scaling is not supported");
+  }
+  int outputHeight = d->image_height;
+  const size_t rowPitch = pitch != 0 ? static_cast<size_t>(pitch) :
+    static_cast<size_t>(d->image_width) * tjPixelSize[pixelFormat];
+  d->out_color_space = space;
+  d->dct_method = (flags & TJFLAG_FASTDCT) ? JDCT_IFAST : JDCT_ISLOW;
+  d->do_fancy_upsampling = (flags & TJFLAG_FASTUPSAMPLE) ? FALSE : TRUE;
+
+  jpeg_start_decompress(d);
+  while (d->output_scanline < d->output_height) {
+    int y = static_cast<int>(d->output_scanline);
+    if (flags & TJFLAG_BOTTOMUP) {
+      y = outputHeight - 1 - y;
+    }
+    JSAMPROW row = dstBuf + static_cast<size_t>(y) * rowPitch;
+    jpeg_read_scanlines(d, &row, 1);
+  }
+  jpeg_finish_decompress(d);
+  return 0;
+}
+
+}
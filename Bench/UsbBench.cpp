@@ -0,0 +1,163 @@
+#include "Bench.h"
+#include "UsbHarness.h"
+#include "UsbEventThread.h"
+#include "UsbReader.h"
+#include "UsbSendQueue.h"
+#include "FramePipeline.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "libusb.h"
+
+namespace Benchmark {
+
+  namespace {
+    // Long enough that a transfer only ends early because it was cancelled.
+    constexpr unsigned int TRANSFER_TIMEOUT_MS = 5000;
+    constexpr double STOP_BUDGET_MS = 250.0;
+    constexpr int READ_LEN = 1 << 20;
+
+    /**
+     * Sends and reads frames through UsbSendQueue and UsbReader, and checks
+     * the event thread ran exactly one callback for every transfer submitted.
+     */
+    bool callbacksDelivered(const UsbTestDevice& device, size_t frames,
+        size_t frameBytes) {
+      UsbEventThread events(device.context());
+      UsbSendQueue queue(&events, device.handle(), device.outEndpoint());
+      UsbReader reader(&events, device.handle(), device.inEndpoint());
+
+      std::vector<unsigned char> header(64, 0xa5);
+      std::vector<unsigned char> payload(frameBytes, 0x5a);
+      std::vector<unsigned char> input(UsbSendQueue::DEFAULT_CHUNK_LEN);
+      const size_t chunksPerFrame = 1 +
+        (frameBytes + UsbSendQueue::DEFAULT_CHUNK_LEN - 1) / UsbSendQueue::DEFAULT_CHUNK_LEN;
+
+      events.resetStats();
+      size_t submitted = 0;
+      int firstError = LIBUSB_SUCCESS;
+      for (size_t i = 0; i < frames && firstError == LIBUSB_SUCCESS; ++i) {
+        firstError = queue.sendFrame(header.data(), header.size(),
+          payload.data(), payload.size(), TRANSFER_TIMEOUT_MS).status;
+        submitted += chunksPerFrame;
+        if (firstError != LIBUSB_SUCCESS) {
+          break;
+        }
+
+        int read = 0;
+        firstError = reader.read(input.data(), static_cast<int>(input.size()),
+          &read, TRANSFER_TIMEOUT_MS);
+        submitted++;
+      }
+
+      // Both return only after their last callback has been counted.
+      UsbEventThread::Stats stats = events.getStats();
+      bool passed = firstError == LIBUSB_SUCCESS && stats.completions == submitted;
+      std::printf("callbacks: %d of %d transfers completed through the event thread, %.1f wakeups/s, latency %.2f ms average, %.2f ms worst, status %s; %s\n",
+        static_cast<int>(stats.completions), static_cast<int>(submitted),
+        stats.wakeupsPerSecond(), stats.averageLatencyMs, stats.maxLatencyMs,
+        libusb_error_name(firstError), passed ? "passed" : "FAILED");
+      return passed;
+    }
+
+    /**
+     * Keeps a long frame and a long read in flight, then stops both the way
+     * UsbTransport does on disconnect. Each must come back interrupted well
+     * inside its timeout with no transfer left in flight, and the event
+     * thread must then stop within its idle timeout.
+     */
+    bool stopCancels(const UsbTestDevice& device, size_t frameBytes) {
+      std::unique_ptr<UsbEventThread> events(new UsbEventThread(device.context()));
+      UsbSendQueue queue(events.get(), device.handle(), device.outEndpoint());
+      UsbReader reader(events.get(), device.handle(), device.inEndpoint());
+
+      std::vector<unsigned char> payload(frameBytes, 0x5a);
+      std::vector<unsigned char> input(READ_LEN);
+      std::atomic<int> sendStatus(LIBUSB_SUCCESS);
+      std::atomic<int> readStatus(LIBUSB_SUCCESS);
+      std::atomic<int64_t> sendStoppedNs(0);
+      std::atomic<int64_t> readStoppedNs(0);
+      // So a stop that doesn't work fails instead of hanging.
+      std::atomic<int64_t> giveUpNs(INT64_MAX);
+
+      std::thread sender([&] {
+        int status;
+        do {
+          status = queue.sendFrame(nullptr, 0, payload.data(), payload.size(),
+            TRANSFER_TIMEOUT_MS).status;
+        } while (status == LIBUSB_SUCCESS && steadyClockNs() < giveUpNs.load());
+        sendStoppedNs = steadyClockNs();
+        sendStatus = status;
+      });
+      std::thread receiver([&] {
+        int status;
+        do {
+          int read = 0;
+          status = reader.read(input.data(), READ_LEN, &read, TRANSFER_TIMEOUT_MS);
+        } while (status == LIBUSB_SUCCESS && steadyClockNs() < giveUpNs.load());
+        readStoppedNs = steadyClockNs();
+        readStatus = status;
+      });
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+      int64_t stopNs = steadyClockNs();
+      giveUpNs = stopNs + static_cast<int64_t>(STOP_BUDGET_MS * 4e6);
+      queue.interrupt();
+      reader.cancel();
+      sender.join();
+      receiver.join();
+      double sendMs = (sendStoppedNs.load() - stopNs) / 1e6;
+      double readMs = (readStoppedNs.load() - stopNs) / 1e6;
+
+      // A transfer still in flight would complete after its loop returned.
+      uint64_t completions = events->getStats().completions;
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      bool settled = events->getStats().completions == completions;
+
+      int64_t joinNs = steadyClockNs();
+      events.reset();
+      double joinMs = (steadyClockNs() - joinNs) / 1e6;
+
+      bool passed = sendStatus.load() == LIBUSB_ERROR_INTERRUPTED &&
+        readStatus.load() == LIBUSB_ERROR_INTERRUPTED &&
+        sendMs < STOP_BUDGET_MS && readMs < STOP_BUDGET_MS && settled &&
+        joinMs < UsbEventThread::IDLE_TIMEOUT_MS + STOP_BUDGET_MS;
+      std::printf("stop: send %s in %.1f ms, read %s in %.1f ms, %s, event thread joined in %.1f ms; %s\n",
+        libusb_error_name(sendStatus.load()), sendMs,
+        libusb_error_name(readStatus.load()), readMs,
+        settled ? "nothing left in flight" : "transfers still completing",
+        joinMs, passed ? "passed" : "FAILED");
+      return passed;
+    }
+  }
+
+  /**
+   * UsbEventThread with UsbSendQueue and UsbReader on a real bulk pair,
+   * gadget zero by default: every transfer's callback is delivered, and
+   * stopping cancels what is in flight. Skipped if there's no device.
+   */
+  bool runUsbSuite(const Options& options) {
+    UsbTestDevice device(options);
+    if (!device.isOpen()) {
+      std::printf("No USB test device %s; skipped\n", device.describe().c_str());
+      return true;
+    }
+
+    size_t frames = std::max<size_t>(options.count("frames", options.quick() ? 20 : 200), 1);
+    size_t kilobytes = std::max<size_t>(options.count("kilobytes", 256), 1);
+    std::printf("%s, IN 0x%02x, OUT 0x%02x, %d frames of %d KB\n",
+      device.describe().c_str(), device.inEndpoint(), device.outEndpoint(),
+      static_cast<int>(frames), static_cast<int>(kilobytes));
+
+    bool passed = callbacksDelivered(device, frames, kilobytes * 1024);
+    // Big enough that the interrupt lands mid-frame on any bus speed.
+    passed = stopCancels(device, 64 << 20) && passed;
+    return passed;
+  }
+
+}
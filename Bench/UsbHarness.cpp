@@ -0,0 +1,102 @@
+#include "UsbHarness.h"
+#include <cstdio>
+#include <cstdlib>
+#include "libusb.h"
+
+namespace Benchmark {
+
+  UsbTestDevice::UsbTestDevice(const Options& options)
+    : _ctx(nullptr),
+      _handle(nullptr),
+      _interface(-1),
+      _inEndpoint(0),
+      _outEndpoint(0) {
+    unsigned int vendor = GADGET_ZERO_VENDOR;
+    unsigned int product = GADGET_ZERO_PRODUCT;
+    std::string device = options.text("device", "");
+    if (!device.empty() && std::sscanf(device.c_str(), "%x:%x", &vendor, &product) != 2) {
+      _description = device + " (not vid:pid)";
+      return;
+    }
+    char id[16];
+    std::snprintf(id, sizeof(id), "%04x:%04x", vendor, product);
+    _description = id;
+
+    if (libusb_init(&_ctx) != LIBUSB_SUCCESS) {
+      _ctx = nullptr;
+      _description += " (libusb_init failed)";
+      return;
+    }
+    _handle = libusb_open_device_with_vid_pid(_ctx,
+      static_cast<uint16_t>(vendor), static_cast<uint16_t>(product));
+    if (_handle == nullptr) {
+      _description += " (not found, or no permission)";
+      return;
+    }
+    if (!claimBulkPair()) {
+      libusb_close(_handle);
+      _handle = nullptr;
+    }
+  }
+
+  UsbTestDevice::~UsbTestDevice() {
+    if (_handle != nullptr) {
+      libusb_release_interface(_handle, _interface);
+      libusb_close(_handle);
+    }
+    if (_ctx != nullptr) {
+      libusb_exit(_ctx);
+    }
+  }
+
+  bool UsbTestDevice::claimBulkPair() {
+    libusb_config_descriptor* config = nullptr;
+    if (libusb_get_active_config_descriptor(libusb_get_device(_handle), &config) !=
+        LIBUSB_SUCCESS) {
+      _description += " (no active configuration)";
+      return false;
+    }
+
+    // The first interface with a bulk endpoint each way.
+    for (int i = 0; i < config->bNumInterfaces && _interface < 0; ++i) {
+      if (config->interface[i].num_altsetting < 1) {
+        continue;
+      }
+      const libusb_interface_descriptor& setting = config->interface[i].altsetting[0];
+      uint8_t in = 0;
+      uint8_t out = 0;
+      for (int e = 0; e < setting.bNumEndpoints; ++e) {
+        const libusb_endpoint_descriptor& endpoint = setting.endpoint[e];
+        if ((endpoint.bmAttributes & 0x03) != LIBUSB_TRANSFER_TYPE_BULK) {
+          continue;
+        }
+        if ((endpoint.bEndpointAddress & LIBUSB_ENDPOINT_IN) != 0) {
+          in = in != 0 ? in : endpoint.bEndpointAddress;
+        } else {
+          out = out != 0 ? out : endpoint.bEndpointAddress;
+        }
+      }
+      if (in != 0 && out != 0) {
+        _interface = setting.bInterfaceNumber;
+        _inEndpoint = in;
+        _outEndpoint = out;
+      }
+    }
+    libusb_free_config_descriptor(config);
+    if (_interface < 0) {
+      _description += " (no bulk IN and OUT pair)";
+      return false;
+    }
+
+    if (libusb_kernel_driver_active(_handle, _interface) == 1) {
+      libusb_detach_kernel_driver(_handle, _interface);
+    }
+    int status = libusb_claim_interface(_handle, _interface);
+    if (status != LIBUSB_SUCCESS) {
+      _description += std::string(" (claim failed: ") + libusb_error_name(status) + ")";
+      return false;
+    }
+    return true;
+  }
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "Bench.h"
+
+struct libusb_context;
+struct libusb_device_handle;
+
+namespace Benchmark {
+
+  /**
+   * A real device for the USB suites: one interface with a bulk IN endpoint
+   * that always has data and a bulk OUT endpoint that takes anything, as the
+   * Linux gadget zero's source/sink configuration has. dummy_hcd with g_zero
+   * provides one on the same machine, without hardware.
+   */
+  class UsbTestDevice {
+  public:
+    static constexpr uint16_t GADGET_ZERO_VENDOR = 0x0525;
+    static constexpr uint16_t GADGET_ZERO_PRODUCT = 0xa4a0;
+
+    /** Opens --device=vid:pid (hex), gadget zero by default. */
+    explicit UsbTestDevice(const Options& options);
+    ~UsbTestDevice();
+
+    UsbTestDevice(const UsbTestDevice&) = delete;
+    UsbTestDevice& operator=(const UsbTestDevice&) = delete;
+
+    /** False if there's no such device, or it has no bulk pair to claim. */
+    bool isOpen() const { return _handle != nullptr; }
+    /** vid:pid, and why it couldn't be opened if it wasn't. */
+    const std::string& describe() const { return _description; }
+
+    libusb_context* context() const { return _ctx; }
+    libusb_device_handle* handle() const { return _handle; }
+    uint8_t inEndpoint() const { return _inEndpoint; }
+    uint8_t outEndpoint() const { return _outEndpoint; }
+
+  private:
+    libusb_context* _ctx;
+    libusb_device_handle* _handle;
+    int _interface;
+    uint8_t _inEndpoint;
+    uint8_t _outEndpoint;
+    std::string _description;
+
+    bool claimBulkPair();
+  };
+
+}
@@ -0,0 +1,105 @@
+#include "Bench.h"
+#include "JpegEncoder.h"
+#include "SyntheticFrameSource.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "turbojpeg.h"
+
+namespace Benchmark {
+
+  namespace {
+    struct PathResult {
+      const char* name;
+      double msPerFrame;
+      double bytesPerFrame;
+      double psnr; /* Decoded against the source; 0 if it didn't decode. */
+    };
+
+    /** Encodes identical frames with BGRX input and with planar YUV input. */
+    std::vector<PathResult> runInputPaths(size_t width, size_t height,
+        size_t threads, size_t frames, int quality) {
+      std::vector<PathResult> results;
+      frames = std::max<size_t>(frames, 1);
+
+      size_t widthPitch = width * 4;
+      std::vector<unsigned char> pixels(widthPitch * height);
+      SyntheticFrameSource::fillTestPattern(pixels.data(), width, widthPitch, height, 0);
+      std::vector<unsigned char> decoded(widthPitch * height);
+      tjhandle decoder = tjInitDecompress();
+
+      FrameView view;
+      view.data = pixels.data();
+      view.width = width;
+      view.widthPitch = widthPitch;
+      view.height = height;
+
+      const JpegEncoder::InputFormat inputs[] = {
+        JpegEncoder::INPUT_BGRX,
+        JpegEncoder::INPUT_YUV420
+      };
+      for (JpegEncoder::InputFormat input : inputs) {
+        JpegEncoder encoder(threads, input);
+        unsigned char* jpegBuffer = nullptr;
+        unsigned long jpegCapacity = 0;
+        unsigned long jpegSize = 0;
+
+        encoder.encode(view, quality, TJSAMP_420, &jpegBuffer, &jpegCapacity, &jpegSize);
+
+        double totalBytes = 0.0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < frames; ++i) {
+          encoder.encode(view, quality, TJSAMP_420, &jpegBuffer, &jpegCapacity, &jpegSize);
+          totalBytes += jpegSize;
+        }
+        double elapsedMs = std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - start).count();
+
+        PathResult result;
+        result.name = input == JpegEncoder::INPUT_BGRX ? "encode BGRX" : "encode YUV 4:2:0";
+        result.msPerFrame = elapsedMs / frames;
+        result.bytesPerFrame = totalBytes / frames;
+        result.psnr = jpegBuffer != nullptr &&
+          tjDecompress2(decoder, jpegBuffer, jpegSize, decoded.data(),
+            static_cast<int>(width), static_cast<int>(widthPitch),
+            static_cast<int>(height), TJPF_BGRX, 0) == 0 ?
+          psnr(pixels.data(), widthPitch, decoded.data(), widthPitch, width, height) : 0.0;
+
+        if (jpegBuffer != nullptr) {
+          tjFree(jpegBuffer);
+        }
+        results.push_back(result);
+      }
+
+      tjDestroy(decoder);
+      return results;
+    }
+  }
+
+  /**
+   * Side-by-side 1080p through both encoder inputs. The YUV path converts
+   * on our side instead of libjpeg-turbo's, so it has to decode to a frame
+   * within 0.5 dB PSNR of the BGRX path's.
+   */
+  bool runYuvSuite(const Options& options) {
+    size_t width = options.quick() ? 960 : 1920 * 2;
+    size_t height = options.quick() ? 540 : 1080;
+    size_t threads = std::max<size_t>(options.count("threads", 1), 1);
+    size_t frames = std::max<size_t>(
+      options.count("frames", options.quick() ? 5 : 30), 1);
+
+    std::vector<PathResult> results = runInputPaths(width, height, threads,
+      frames, 50);
+    bool passed = true;
+    for (const PathResult& result : results) {
+      bool good = result.psnr > 0.0 && result.psnr >= results[0].psnr - 0.5;
+      std::printf("%s: %.2f ms/frame, %.0f bytes/frame, PSNR %.1f dB; %s\n",
+        result.name, result.msPerFrame, result.bytesPerFrame, result.psnr,
+        good ? "passed" : "FAILED");
+      passed = passed && good;
+    }
+    return passed;
+  }
+
+}
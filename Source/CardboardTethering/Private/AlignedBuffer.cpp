@@ -0,0 +1,81 @@
+#include "AlignedBuffer.h"
+#include <cstdlib>
+
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+
+namespace {
+
+  void* alignedAlloc(size_t size) {
+#if defined(_MSC_VER)
+    return _aligned_malloc(size, AlignedBuffer::ALIGNMENT);
+#else
+    void* ptr = nullptr;
+    return posix_memalign(&ptr, AlignedBuffer::ALIGNMENT, size) == 0 ? ptr : nullptr;
+#endif
+  }
+
+  void alignedFree(void* ptr) {
+#if defined(_MSC_VER)
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+  }
+
+}
+
+AlignedBuffer::AlignedBuffer()
+  : _data(nullptr), _capacity(0), _counter(nullptr) {}
+
+AlignedBuffer::~AlignedBuffer() {
+  release();
+}
+
+void AlignedBuffer::setCounter(MemoryCounter* counter) {
+  if (counter == _counter) {
+    return;
+  }
+  if (_counter != nullptr) {
+    *_counter -= _capacity;
+  }
+  _counter = counter;
+  if (_counter != nullptr) {
+    *_counter += _capacity;
+  }
+}
+
+bool AlignedBuffer::reserve(size_t size) {
+  if (size <= _capacity) {
+    return true;
+  }
+
+  release();
+
+  // Whole pages, so growing by a few rows usually fits without reallocating.
+  size_t rounded = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  _data = static_cast<unsigned char*>(alignedAlloc(rounded));
+  if (_data == nullptr) {
+    return false;
+  }
+
+  _capacity = rounded;
+  if (_counter != nullptr) {
+    *_counter += _capacity;
+  }
+  return true;
+}
+
+void AlignedBuffer::release() {
+  if (_data == nullptr) {
+    return;
+  }
+
+  alignedFree(_data);
+  if (_counter != nullptr) {
+    *_counter -= _capacity;
+  }
+  _data = nullptr;
+  _capacity = 0;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+/** Running total of the bytes held by a group of buffers. */
+typedef std::atomic<int64_t> MemoryCounter;
+
+/**
+ * Page-aligned byte buffer for frame-sized data. Page alignment also covers
+ * cache lines and every SIMD load width, and keeps large buffers from
+ * sharing pages with unrelated allocations.
+ *
+ * Grows but never shrinks, and does not preserve its contents when it grows.
+ * If a MemoryCounter is attached, the capacity is added to it.
+ */
+class AlignedBuffer {
+public:
+  static constexpr size_t ALIGNMENT = 4096;
+
+  AlignedBuffer();
+  ~AlignedBuffer();
+
+  AlignedBuffer(const AlignedBuffer&) = delete;
+  AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+  /** Counts this buffer's capacity in counter from now on (may be null). */
+  void setCounter(MemoryCounter* counter);
+
+  /** Ensures capacity() >= size; returns false if allocation failed. */
+  bool reserve(size_t size);
+  void release();
+
+  unsigned char* data() { return _data; }
+  const unsigned char* data() const { return _data; }
+  size_t capacity() const { return _capacity; }
+
+private:
+  unsigned char* _data;
+  size_t _capacity;
+  MemoryCounter* _counter;
+};
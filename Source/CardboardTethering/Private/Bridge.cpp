@@ -8,7 +8,8 @@
 #if PLATFORM_WINDOWS
 
 FCardboardTethering::D3D11Bridge::D3D11Bridge(FCardboardTethering* plugin)
-  : BridgeBaseImpl(plugin), RenderTargetTexture(nullptr) {}
+  : BridgeBaseImpl(plugin), RenderTargetTexture(nullptr),
+    Readback(new D3D11FrameReadback(READBACK_LATENCY)) {}
 
 void FCardboardTethering::D3D11Bridge::BeginRendering() {
   check(IsInRenderingThread());
@@ -21,9 +22,36 @@ void FCardboardTethering::D3D11Bridge::BeginRendering() {
 
 void FCardboardTethering::D3D11Bridge::FinishRendering() {
   FScopeLock lock(&Plugin->ActiveUsbDeviceMutex);
-  if (Plugin->ActiveUsbDevice.IsValid() && Plugin->ActiveUsbDevice->isSending()) {
-    Plugin->ActiveUsbDevice->sendImage(RenderTargetTexture);
+  UsbDevice* device = Plugin->GetSettledDevice();
+  if (device == nullptr || !device->isSending()) {
+    return;
+  }
+
+  FrameTee tee(device, Plugin->Recording.get());
+  FrameSink* sink = Plugin->Recording ? static_cast<FrameSink*>(&tee) : device;
+
+  if (Plugin->FrameSourceOverride) {
+    // HMD SOURCE: stand-in frames replace the game's, and the GPU copy is
+    // skipped altogether.
+    Plugin->FrameSourceOverride->deliver(sink);
+    return;
   }
+
+  // Copies are mapped READBACK_LATENCY frames after they're issued, so the
+  // frame delivered here (if any) is an older one that has already finished
+  // on the GPU. Its pose travels with it through the ring.
+  if (!Readback->submit(RenderTargetTexture, Plugin->RenderThreadPose)) {
+    device->captureFailed();
+  }
+  Readback->deliver(sink);
+}
+
+FrameReadback::Stats FCardboardTethering::D3D11Bridge::GetReadbackStats() const {
+  return Readback->getStats();
+}
+
+uint64_t FCardboardTethering::D3D11Bridge::GetStagingBytes() const {
+  return Readback->stagingBytes();
 }
 
 void FCardboardTethering::D3D11Bridge::Reset() {}
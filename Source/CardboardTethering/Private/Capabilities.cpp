@@ -0,0 +1,134 @@
+#include "Capabilities.h"
+#include "FramePipeline.h"
+#include "MessageCodec.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+  void putBig(std::vector<unsigned char>* out, uint32_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+      out->push_back(static_cast<unsigned char>(value >> (8 * (bytes - 1 - i))));
+    }
+  }
+
+  uint32_t getBig(const unsigned char* p, size_t bytes) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+      value = (value << 8) | p[i];
+    }
+    return value;
+  }
+
+  void putFloat(std::vector<unsigned char>* out, float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    putBig(out, bits, 4);
+  }
+
+  float getFloat(const unsigned char* p) {
+    uint32_t bits = getBig(p, 4);
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+}
+
+Capabilities::Capabilities()
+  : versionMin(Message::VERSION_MIN),
+    versionMax(Message::VERSION_MAX),
+    codecs(1 << CODEC_JPEG),
+    viewportWidth(0),
+    viewportHeight(0),
+    maxDecodeWidth(0),
+    maxDecodeHeight(0),
+    refreshMilliHz(0),
+    interpupillary(0.0f),
+    fov(),
+    distortion() {}
+
+void Capabilities::write(std::vector<unsigned char>* out) const {
+  out->push_back(versionMin);
+  out->push_back(versionMax);
+  out->push_back(codecs);
+  out->push_back(0);
+  putBig(out, viewportWidth, 2);
+  putBig(out, viewportHeight, 2);
+  putBig(out, maxDecodeWidth, 2);
+  putBig(out, maxDecodeHeight, 2);
+  putBig(out, refreshMilliHz, 4);
+  putFloat(out, interpupillary);
+  for (float f : fov) {
+    putFloat(out, f);
+  }
+  for (float k : distortion) {
+    putFloat(out, k);
+  }
+}
+
+bool Capabilities::read(const unsigned char* data, size_t size,
+    Capabilities* out) {
+  if (size < LENGTH) {
+    return false;
+  }
+
+  Capabilities caps;
+  caps.versionMin = data[0];
+  caps.versionMax = data[1];
+  caps.codecs = data[2];
+  caps.viewportWidth = static_cast<uint16_t>(getBig(data + 4, 2));
+  caps.viewportHeight = static_cast<uint16_t>(getBig(data + 6, 2));
+  caps.maxDecodeWidth = static_cast<uint16_t>(getBig(data + 8, 2));
+  caps.maxDecodeHeight = static_cast<uint16_t>(getBig(data + 10, 2));
+  caps.refreshMilliHz = getBig(data + 12, 4);
+  caps.interpupillary = getFloat(data + 16);
+  for (size_t i = 0; i < 4; ++i) {
+    caps.fov[i] = getFloat(data + 20 + 4 * i);
+  }
+  for (size_t i = 0; i < 2; ++i) {
+    caps.distortion[i] = getFloat(data + 36 + 4 * i);
+  }
+
+  *out = caps;
+  return true;
+}
+
+int Capabilities::choose(const Capabilities& device, uint8_t hostCodecs,
+    Capabilities* reply) {
+  int version = Message::negotiateVersion(device.versionMin, device.versionMax);
+  if (version < 0 || !device.supportsCodec(CODEC_JPEG)) {
+    return -1;
+  }
+
+  Capabilities chosen = device;
+  chosen.versionMin = static_cast<uint8_t>(version);
+  chosen.versionMax = static_cast<uint8_t>(version);
+  chosen.codecs = device.codecs & hostCodecs;
+  chosen.maxDecodeWidth = 0;
+  chosen.maxDecodeHeight = 0;
+  chosen.refreshMilliHz = 0;
+
+  // Shrink, keeping the aspect ratio, until both sides fit the decoder.
+  double scale = 1.0;
+  if (device.maxDecodeWidth > 0 && device.viewportWidth > device.maxDecodeWidth) {
+    scale = std::min(scale, static_cast<double>(device.maxDecodeWidth) / device.viewportWidth);
+  }
+  if (device.maxDecodeHeight > 0 && device.viewportHeight > device.maxDecodeHeight) {
+    scale = std::min(scale, static_cast<double>(device.maxDecodeHeight) / device.viewportHeight);
+  }
+  if (scale < 1.0) {
+    chosen.viewportWidth = static_cast<uint16_t>(std::max(1.0, device.viewportWidth * scale));
+    chosen.viewportHeight = static_cast<uint16_t>(std::max(1.0, device.viewportHeight * scale));
+  }
+
+  *reply = chosen;
+  return 0;
+}
+
+bool Capabilities::sameLink(const Capabilities& other) const {
+  return versionMax == other.versionMax &&
+    codecs == other.codecs &&
+    viewportWidth == other.viewportWidth &&
+    viewportHeight == other.viewportHeight;
+}
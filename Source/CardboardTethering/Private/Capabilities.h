@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * What each end of the link can do, exchanged as Message::TYPE_HELLO right
+ * after the accessory connection opens. The phone speaks first; the host
+ * replies with what it picked. All integers are big-endian:
+ *
+ *   u8  versionMin        Message versions spoken; in the host's reply both
+ *   u8  versionMax        are the version chosen.
+ *   u8  codecs            Bit (1 << codec) for each CODEC_* supported; in
+ *                         the reply, the codecs the host will send.
+ *   u8  reserved          0.
+ *   u16 viewportWidth     Size the phone wants frames rendered at; in the
+ *   u16 viewportHeight    reply, the size the host will send.
+ *   u16 maxDecodeWidth    Largest image the phone can decode and upload,
+ *   u16 maxDecodeHeight   per dimension; 0 in the reply.
+ *   u32 refreshMilliHz    Display refresh rate; 0 in the reply.
+ *   f32 interpupillary    Metres.
+ *   f32 fov[4]            Lens field of view per eye in degrees: left,
+ *                         right, bottom, top.
+ *   f32 distortion[2]     Lens distortion coefficients k1, k2.
+ *
+ * Fields are only ever appended; a longer record than LENGTH is fine.
+ *
+ * Phones from before this handshake open the link with a 16 KB block
+ * starting with LEGACY_HANDSHAKE_TAG instead.
+ */
+struct Capabilities {
+  static constexpr size_t LENGTH = 44;
+  static constexpr unsigned char LEGACY_HANDSHAKE_TAG = 0x27;
+
+  uint8_t versionMin;
+  uint8_t versionMax;
+  uint8_t codecs;
+  uint16_t viewportWidth;
+  uint16_t viewportHeight;
+  uint16_t maxDecodeWidth;
+  uint16_t maxDecodeHeight;
+  uint32_t refreshMilliHz;
+  float interpupillary;
+  float fov[4];
+  float distortion[2];
+
+  Capabilities();
+
+  bool supportsCodec(uint8_t codec) const { return (codecs & (1 << codec)) != 0; }
+  double refreshHz() const { return refreshMilliHz / 1000.0; }
+
+  void write(std::vector<unsigned char>* out) const;
+
+  /** False if the record is too short. */
+  static bool read(const unsigned char* data, size_t size, Capabilities* out);
+
+  /**
+   * Picks the host's reply to a phone's capabilities: the common message
+   * version, the codecs both ends have, and a viewport that fits the
+   * phone's decoder with the same aspect ratio. Returns 0, or -1 if there's
+   * no common version or the phone can't decode JPEG.
+   */
+  static int choose(const Capabilities& device, uint8_t hostCodecs,
+    Capabilities* reply);
+
+  /**
+   * Whether two replies describe the same stream: version, codecs and
+   * viewport. A resumed link must match the one it replaces.
+   */
+  bool sameLink(const Capabilities& other) const;
+};
@@ -9,7 +9,11 @@
 #include "PostProcess/PostProcessHMD.h"
 #include "EndianUtils.h"
 #include "CardboardTetheringStyle.h"
+#include "UsbEventThread.h"
+#include "SyntheticFrameSource.h"
 #include <stdio.h>
+#include <chrono>
+#include <algorithm>
 
 #if WITH_EDITOR
 #include "Editor/UnrealEd/Classes/Editor/EditorEngine.h"
@@ -183,7 +187,19 @@ void FCardboardTethering::GetCurrentPose(FQuat& CurrentOrientation) {
     CurrentOrientation = FQuat(FRotator(0.0f, 0.0f, 0.0f));
   }
   */
-  CurrentOrientation = FQuat(FeedbackOrientationX.load(), FeedbackOrientationY.load(), FeedbackOrientationZ.load(), FeedbackOrientationW.load());
+  CurrentOrientation = ToHmdOrientation(PredictPose());
+}
+
+PoseSample FCardboardTethering::PredictPose() const {
+  // Predict to when the frame rendered with this pose will be on screen.
+  int64_t nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+  return FeedbackPredictor.predict(FeedbackPose.load(), nowNs);
+}
+
+FQuat FCardboardTethering::ToHmdOrientation(const PoseSample& pose) {
+  // Determined by empirical testing, this seems to convert the coord space correctly!
+  return FQuat(pose.x, pose.z, pose.w, pose.y);
 }
 
 void FCardboardTethering::GetCurrentOrientationAndPosition(FQuat& CurrentOrientation, FVector& CurrentPosition) {
@@ -235,11 +251,468 @@ bool FCardboardTethering::Exec(UWorld* InWorld, const TCHAR* Cmd, FOutputDevice&
     } else if (FParse::Command(&Cmd, TEXT("DISCONNECT"))) {
       DisconnectUsb(0);
       return true;
+    } else if (FParse::Command(&Cmd, TEXT("STATS"))) {
+      PrintStats(Ar);
+      return true;
+    } else if (FParse::Command(&Cmd, TEXT("ENCODETHREADS"))) {
+      int32 threads = FCString::Atoi(Cmd);
+      FScopeLock lock(&ActiveUsbDeviceMutex);
+      if (threads > 0) {
+        EncodeThreads = threads;
+      }
+      UsbDevice* device = GetSettledDevice();
+      if (device != nullptr) {
+        device->setEncodeThreads(EncodeThreads);
+      }
+      Ar.Logf(TEXT("Encode threads: %d"), (int32)EncodeThreads);
+      return true;
+    } else if (FParse::Command(&Cmd, TEXT("RATE"))) {
+      SetRateTargets(Cmd, Ar);
+      return true;
+    } else if (FParse::Command(&Cmd, TEXT("YUV"))) {
+      FScopeLock lock(&ActiveUsbDeviceMutex);
+      if (FParse::Command(&Cmd, TEXT("ON"))) {
+        YuvInput = true;
+      } else if (FParse::Command(&Cmd, TEXT("OFF"))) {
+        YuvInput = false;
+      }
+      UsbDevice* device = GetSettledDevice();
+      if (device != nullptr) {
+        device->setYuvInput(YuvInput);
+      }
+      Ar.Logf(TEXT("Encoder input: %s"), YuvInput ? TEXT("planar YUV") : TEXT("BGRX"));
+      return true;
+    } else if (FParse::Command(&Cmd, TEXT("TILES"))) {
+      // HMD TILES ON|OFF SIZE=64 REFRESH=120
+      FScopeLock lock(&ActiveUsbDeviceMutex);
+      if (FParse::Command(&Cmd, TEXT("ON"))) {
+        TileCoding = true;
+      } else if (FParse::Command(&Cmd, TEXT("OFF"))) {
+        TileCoding = false;
+      }
+      int32 value;
+      if (FParse::Value(Cmd, TEXT("SIZE="), value) && value > 0) {
+        TileSize = TileEncoder::roundTileSize(value);
+      }
+      if (FParse::Value(Cmd, TEXT("REFRESH="), value) && value > 0) {
+        TileRefresh = value;
+      }
+      UsbDevice* device = GetSettledDevice();
+      if (device != nullptr) {
+        device->setTileCoding(TileCoding, TileSize, TileRefresh);
+      }
+      Ar.Logf(TEXT("Tile coding: %s, %dpx tiles, keyframe every %d frames"),
+        TileCoding ? TEXT("on") : TEXT("off"), (int32)TileSize, (int32)TileRefresh);
+      return true;
+    } else if (FParse::Command(&Cmd, TEXT("PACING"))) {
+      // HMD PACING ON|OFF LEAD=2
+      FScopeLock lock(&ActiveUsbDeviceMutex);
+      if (FParse::Command(&Cmd, TEXT("ON"))) {
+        Pacing.enabled = true;
+      } else if (FParse::Command(&Cmd, TEXT("OFF"))) {
+        Pacing.enabled = false;
+      }
+      float lead;
+      if (FParse::Value(Cmd, TEXT("LEAD="), lead)) {
+        Pacing.leadMs = FMath::Max(lead, 0.0f);
+      }
+      UsbDevice* device = GetSettledDevice();
+      if (device != nullptr) {
+        device->setPacing(Pacing);
+      }
+      Ar.Logf(TEXT("Frame pacing: %s, arriving %.1f ms before vsync"),
+        Pacing.enabled ? TEXT("on") : TEXT("off"), Pacing.leadMs);
+      return true;
+    } else if (FParse::Command(&Cmd, TEXT("RECONNECT"))) {
+      SetReconnect(Cmd, Ar);
+      return true;
+    } else if (FParse::Command(&Cmd, TEXT("PREDICT"))) {
+      SetPrediction(Cmd, Ar);
+      return true;
+    } else if (FParse::Command(&Cmd, TEXT("LATENCY"))) {
+      ReportLatency(Cmd, Ar);
+      return true;
+    } else if (FParse::Command(&Cmd, TEXT("POSELOG"))) {
+      RecordPoses(Cmd, Ar);
+      return true;
+    } else if (FParse::Command(&Cmd, TEXT("SOURCE"))) {
+      SetFrameSource(Cmd, Ar);
+      return true;
+    } else if (FParse::Command(&Cmd, TEXT("RECORD"))) {
+      RecordFrames(Cmd, Ar);
+      return true;
     }
   }
   return false;
 }
 
+void FCardboardTethering::PrintStats(FOutputDevice& Ar) {
+  // Outlives any one device, so it's there after giving up too.
+  Reconnector::Stats reconnect = UsbReconnector.getStats();
+  Ar.Logf(TEXT("Reconnects: %llu of %llu outages recovered in %llu attempts, last %.0f ms, average %.0f ms, worst %.0f ms; %s, last error %d"),
+    reconnect.recovered, reconnect.outages, reconnect.attempts,
+    reconnect.lastMs, reconnect.averageMs, reconnect.maxMs,
+    ANSI_TO_TCHAR(Reconnector::stateName(reconnect.state)), reconnect.lastError);
+  Ar.Logf(TEXT("Last disconnect: loops stopped in %.1f ms"), LastDisconnectMs.load());
+  if (SharedLibraryInitParams.IsValid() && SharedLibraryInitParams->UsbEvents) {
+    UsbEventThread::Stats events = SharedLibraryInitParams->UsbEvents->getStats();
+    Ar.Logf(TEXT("USB events: %llu wakeups (%.1f/s), %llu transfers completed, %.2f ms average from submission, %.2f ms worst"),
+      events.wakeups, events.wakeupsPerSecond(), events.completions,
+      events.averageLatencyMs, events.maxLatencyMs);
+  }
+
+  FScopeLock lock(&ActiveUsbDeviceMutex);
+  if (!ActiveUsbDevice.IsValid()) {
+    Ar.Logf(TEXT("USB not connected"));
+    return;
+  }
+  UsbDevice* device = GetSettledDevice();
+  if (device == nullptr) {
+    Ar.Logf(TEXT("USB reconnecting"));
+    return;
+  }
+
+  Capabilities phone = device->getDeviceCapabilities();
+  Ar.Logf(TEXT("Phone: viewport %dx%d, decodes up to %dx%d, %.2f Hz, codecs 0x%x"),
+    (int32)phone.viewportWidth, (int32)phone.viewportHeight,
+    (int32)phone.maxDecodeWidth, (int32)phone.maxDecodeHeight,
+    phone.refreshHz(), (int32)phone.codecs);
+
+  uint64_t stagingBytes = 0;
+#if PLATFORM_WINDOWS
+  if (pD3D11Bridge) {
+    FrameReadback::Stats readback = pD3D11Bridge->GetReadbackStats();
+    Ar.Logf(TEXT("GPU copies: %llu issued, %llu skipped (ring full), %llu not ready, %.2f frames latency"),
+      readback.submitted, readback.skipped, readback.notReady, readback.averageLatencyFrames());
+    stagingBytes = pD3D11Bridge->GetStagingBytes();
+  }
+#endif
+  if (FrameSourceOverride) {
+    Ar.Logf(TEXT("Frames: from HMD SOURCE, not the game"));
+  }
+
+  PipelineStats pipeline = device->getPipelineStats();
+  Ar.Logf(TEXT("Readback: %llu captured, %llu rejected"),
+    pipeline.captured, pipeline.captureRejected);
+  Ar.Logf(TEXT("Encode: %llu encoded, %llu dropped before encode"),
+    pipeline.encoded, pipeline.droppedBeforeEncode);
+  Ar.Logf(TEXT("Transmit: %llu sent, %llu dropped before send"),
+    pipeline.sent, pipeline.droppedBeforeSend);
+
+  Transport::Stats send = device->getSendStats();
+  Ar.Logf(TEXT("Link: %.2f MB/s, %.2f payloads/s"),
+    send.megabytesPerSecond(), send.framesPerSecond());
+  Ar.Logf(TEXT("Loops last stopped (reconnect) in %.1f ms"),
+    device->getLastStopMs());
+
+  for (size_t eye = 0; eye < EYE_COUNT; ++eye) {
+    EyeStats stats = device->getEyeStats(eye);
+    Ar.Logf(TEXT("%s eye: %llu sent (%llu keyframes), %.0f bytes, %.2f ms encode, %.2f ms send"),
+      eye == EYE_LEFT ? TEXT("Left") : TEXT("Right"),
+      stats.payloads, stats.keyframes, stats.averageBytes(),
+      stats.averageEncodeMs(), stats.averageSendMs());
+  }
+  Ar.Logf(TEXT("Encode threads: %d"), (int32)device->getEncodeThreads());
+
+  PoseSample pose = FeedbackPose.load();
+  int64_t nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+  Ar.Logf(TEXT("Pose: %llu updates, sequence %u, %.1f ms old"),
+    FeedbackPose.updates(), pose.sequence,
+    pose.receivedNs > 0 ? (nowNs - pose.receivedNs) / 1e6 : 0.0);
+
+  MemoryStats memory = device->getMemoryStats();
+  memory.staging = stagingBytes;
+  const double MB = 1024.0 * 1024.0;
+  Ar.Logf(TEXT("Memory: %.1f MB (staging %.1f, frames %.1f, encoder %.1f, JPEG %.1f)"),
+    memory.total() / MB, memory.staging / MB, memory.frames / MB,
+    memory.encoder / MB, memory.jpeg / MB);
+
+  FramePacer::Settings pacing = device->getPacingSettings();
+  FramePacer::Stats pacer = device->getPacingStats();
+  Ar.Logf(TEXT("Pacing: %s, %.2f Hz, %.1f ms pipeline, %.1f ms held; error p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, mean %+.1f ms; %llu of %llu frames missed their vsync"),
+    !pacing.enabled ? TEXT("off") : pacer.locked ? TEXT("locked") : TEXT("waiting for vsync reports"),
+    pacer.refreshHz, pacer.pipelineMs, pacer.averageWaitMs,
+    pacer.p50Ms, pacer.p90Ms, pacer.p99Ms, pacer.meanErrorMs,
+    pacer.missed, pacer.arrivals);
+
+  KeyframeRequests::Stats requests = device->getKeyframeRequestStats();
+  Ar.Logf(TEXT("Keyframe requests: %llu (%llu already repaired), %llu eyes recovered in %.1f ms on average, %.1f ms at worst"),
+    requests.requests, requests.stale, requests.recovered,
+    requests.averageRecoveryMs, requests.maxRecoveryMs);
+
+  RateController::Settings rate = device->getRateSettings();
+  RateController::Estimate estimate = device->getRateEstimate();
+  Ar.Logf(TEXT("Rate: quality %d, subsamp %d, downscale %d; %.2f ms encode, %.2f ms send, %.2f MB/s link"),
+    rate.quality, rate.subsamp, (int32)rate.downscale,
+    estimate.encodeMs, estimate.sendMs, estimate.linkMegabytesPerSecond);
+}
+
+void FCardboardTethering::SetRateTargets(const TCHAR* Cmd, FOutputDevice& Ar) {
+  FScopeLock lock(&ActiveUsbDeviceMutex);
+
+  // HMD RATE FPS=60 LATENCY=50 MINQUALITY=20 MAXQUALITY=90 DOWNSCALE=1
+  float value;
+  int32 intValue;
+  if (FParse::Value(Cmd, TEXT("FPS="), value) && value > 0.0f) {
+    RateTargets.framesPerSecond = value;
+  }
+  if (FParse::Value(Cmd, TEXT("LATENCY="), value) && value > 0.0f) {
+    RateTargets.latencyMs = value;
+  }
+  if (FParse::Value(Cmd, TEXT("MINQUALITY="), intValue)) {
+    RateTargets.minQuality = FMath::Clamp(intValue, 1, 100);
+  }
+  if (FParse::Value(Cmd, TEXT("MAXQUALITY="), intValue)) {
+    RateTargets.maxQuality = FMath::Clamp(intValue, 1, 100);
+  }
+  if (FParse::Value(Cmd, TEXT("DOWNSCALE="), intValue)) {
+    RateTargets.allowDownscale = intValue != 0;
+  }
+
+  Ar.Logf(TEXT("Rate targets: %.1f fps, %.1f ms latency, quality %d-%d, downscale %s"),
+    RateTargets.framesPerSecond, RateTargets.latencyMs,
+    RateTargets.minQuality, RateTargets.maxQuality,
+    RateTargets.allowDownscale ? TEXT("allowed") : TEXT("off"));
+
+  UsbDevice* device = GetSettledDevice();
+  if (device != nullptr) {
+    device->setRateTargets(RateTargets);
+  }
+}
+
+void FCardboardTethering::SetReconnect(const TCHAR* Cmd, FOutputDevice& Ar) {
+  // HMD RECONNECT ATTEMPTS=10 BACKOFF=100 MAXBACKOFF=2000 BUDGET=15000
+  Reconnector::Settings settings = UsbReconnector.getSettings();
+  int32 intValue;
+  float value;
+  if (FParse::Value(Cmd, TEXT("ATTEMPTS="), intValue) && intValue > 0) {
+    settings.maxAttempts = intValue;
+  }
+  if (FParse::Value(Cmd, TEXT("BACKOFF="), value) && value >= 0.0f) {
+    settings.initialBackoffMs = value;
+  }
+  if (FParse::Value(Cmd, TEXT("MAXBACKOFF="), value) && value >= 0.0f) {
+    settings.maxBackoffMs = value;
+  }
+  if (FParse::Value(Cmd, TEXT("BUDGET="), value) && value > 0.0f) {
+    settings.budgetMs = value;
+  }
+  UsbReconnector.setSettings(settings);
+
+  settings = UsbReconnector.getSettings();
+  Ar.Logf(TEXT("Reconnect: up to %d attempts in %.0f ms, backoff %.0f ms doubling to %.0f ms"),
+    (int32)settings.maxAttempts, settings.budgetMs, settings.initialBackoffMs,
+    settings.maxBackoffMs);
+}
+
+void FCardboardTethering::SetPrediction(const TCHAR* Cmd, FOutputDevice& Ar) {
+  PosePredictor::Settings settings = FeedbackPredictor.getSettings();
+
+  if (FParse::Command(&Cmd, TEXT("EVAL"))) {
+    // HMD PREDICT EVAL path/to/poses.csv, with the current settings.
+    FString path = FString(Cmd).Trim().TrimTrailing();
+    std::vector<PoseSample> samples;
+    if (!PoseLog::read(TCHAR_TO_UTF8(*path), &samples)) {
+      Ar.Logf(TEXT("Could not read %s"), *path);
+      return;
+    }
+
+    PoseLog::Error error = PoseLog::evaluate(samples, settings);
+    Ar.Logf(TEXT("%d samples: %.2f deg mean, %.2f deg p95, %.2f deg max (%.2f deg mean without prediction)"),
+      (int32)error.samples, error.meanDegrees, error.p95Degrees, error.maxDegrees,
+      error.unpredictedMeanDegrees);
+    return;
+  }
+
+  // HMD PREDICT ON|OFF MS=30 WINDOW=20 FILTER=0.5 MAX=100
+  if (FParse::Command(&Cmd, TEXT("ON"))) {
+    settings.enabled = true;
+  } else if (FParse::Command(&Cmd, TEXT("OFF"))) {
+    settings.enabled = false;
+  }
+  float value;
+  if (FParse::Value(Cmd, TEXT("MS="), value)) {
+    settings.horizonMs = value;
+  }
+  if (FParse::Value(Cmd, TEXT("WINDOW="), value)) {
+    settings.windowMs = value;
+  }
+  if (FParse::Value(Cmd, TEXT("FILTER="), value)) {
+    settings.filter = value;
+  }
+  if (FParse::Value(Cmd, TEXT("MAX="), value)) {
+    settings.maxExtrapolationMs = value;
+  }
+  FeedbackPredictor.setSettings(settings);
+
+  settings = FeedbackPredictor.getSettings();
+  Ar.Logf(TEXT("Prediction %s: %.1f ms ahead, %.1f ms window, filter %.2f, at most %.1f ms"),
+    settings.enabled ? TEXT("on") : TEXT("off"), settings.horizonMs,
+    settings.windowMs, settings.filter, settings.maxExtrapolationMs);
+}
+
+void FCardboardTethering::RecordPoses(const TCHAR* Cmd, FOutputDevice& Ar) {
+  if (FParse::Command(&Cmd, TEXT("START"))) {
+    FScopeLock lock(&PoseLogMutex);
+    RecordedPoses.clear();
+    PoseLogging.store(true);
+    Ar.Logf(TEXT("Recording poses"));
+  } else if (FParse::Command(&Cmd, TEXT("STOP"))) {
+    // HMD POSELOG STOP [path]; defaults to Saved/CardboardPoses.csv.
+    PoseLogging.store(false);
+    FString path = FString(Cmd).Trim().TrimTrailing();
+    if (path.IsEmpty()) {
+      path = FPaths::ConvertRelativePathToFull(
+        FPaths::Combine(*FPaths::GameSavedDir(), TEXT("CardboardPoses.csv")));
+    }
+
+    FScopeLock lock(&PoseLogMutex);
+    if (PoseLog::write(TCHAR_TO_UTF8(*path), RecordedPoses)) {
+      Ar.Logf(TEXT("Wrote %d poses to %s"), (int32)RecordedPoses.size(), *path);
+    } else {
+      Ar.Logf(TEXT("Could not write %s"), *path);
+    }
+  } else {
+    Ar.Logf(TEXT("Usage: HMD POSELOG START"));
+    Ar.Logf(TEXT("       HMD POSELOG STOP [path]"));
+  }
+}
+
+void FCardboardTethering::ReportLatency(const TCHAR* Cmd, FOutputDevice& Ar) {
+  if (FParse::Command(&Cmd, TEXT("RESET"))) {
+    Latency->reset();
+    Ar.Logf(TEXT("Latency samples cleared"));
+  } else if (FParse::Command(&Cmd, TEXT("LOG"))) {
+    if (FParse::Command(&Cmd, TEXT("START"))) {
+      Latency->startLog();
+      Ar.Logf(TEXT("Logging latency"));
+    } else if (FParse::Command(&Cmd, TEXT("STOP"))) {
+      // HMD LATENCY LOG STOP [path]; defaults to Saved/CardboardLatency.csv.
+      FString path = FString(Cmd).Trim().TrimTrailing();
+      if (path.IsEmpty()) {
+        path = FPaths::ConvertRelativePathToFull(
+          FPaths::Combine(*FPaths::GameSavedDir(), TEXT("CardboardLatency.csv")));
+      }
+
+      size_t rows = 0;
+      if (Latency->stopLog(TCHAR_TO_UTF8(*path), &rows)) {
+        Ar.Logf(TEXT("Wrote %d rows to %s"), (int32)rows, *path);
+      } else {
+        Ar.Logf(TEXT("Could not write %s"), *path);
+      }
+    } else {
+      Ar.Logf(TEXT("Usage: HMD LATENCY [RESET]"));
+      Ar.Logf(TEXT("       HMD LATENCY LOG START|STOP [path]"));
+    }
+  } else {
+    for (int stage = 0; stage < LatencyTracker::STAGE_COUNT; ++stage) {
+      LatencyTracker::Stage s = static_cast<LatencyTracker::Stage>(stage);
+      LatencyTracker::Summary summary = Latency->summarize(s);
+      Ar.Logf(TEXT("%s: p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms (%d samples)"),
+        UTF8_TO_TCHAR(LatencyTracker::stageName(s)),
+        summary.p50Ms, summary.p90Ms, summary.p99Ms, summary.maxMs,
+        (int32)summary.samples);
+    }
+  }
+}
+
+void FCardboardTethering::SetFrameSource(const TCHAR* Cmd, FOutputDevice& Ar) {
+  // Synthetic frames are the size the game would render for the phone.
+  size_t width = ViewerWidth.load() > 0 ? ViewerWidth.load() * 2 : 1920;
+  size_t height = ViewerHeight.load() > 0 ? ViewerHeight.load() : 1080;
+
+  std::shared_ptr<FrameSource> source;
+  FString label;
+  if (FParse::Command(&Cmd, TEXT("GAME"))) {
+    label = TEXT("the game");
+  } else if (FParse::Command(&Cmd, TEXT("PATTERN"))) {
+    source = std::make_shared<SyntheticFrameSource>(width, height,
+      SyntheticFrameSource::PATTERN_ANIMATED);
+    label = FString::Printf(TEXT("animated test pattern, %dx%d"), (int32)width, (int32)height);
+  } else if (FParse::Command(&Cmd, TEXT("STATIC"))) {
+    source = std::make_shared<SyntheticFrameSource>(width, height,
+      SyntheticFrameSource::PATTERN_STATIC);
+    label = FString::Printf(TEXT("static test pattern, %dx%d"), (int32)width, (int32)height);
+  } else if (FParse::Command(&Cmd, TEXT("REPLAY"))) {
+    // HMD SOURCE REPLAY [path]; defaults to Saved/CardboardFrames.ctfr, or
+    // the frames just recorded if that isn't there.
+    FString path = FString(Cmd).Trim().TrimTrailing();
+    if (path.IsEmpty()) {
+      path = FPaths::ConvertRelativePathToFull(
+        FPaths::Combine(*FPaths::GameSavedDir(), TEXT("CardboardFrames.ctfr")));
+    }
+
+    std::shared_ptr<FrameRecording> recording = FrameRecording::load(TCHAR_TO_UTF8(*path),
+      size_t(MAX_RECORDED_MEGABYTES) << 20);
+    if (!recording) {
+      FScopeLock lock(&ActiveUsbDeviceMutex);
+      recording = Recording;
+    }
+    if (!recording || recording->size() == 0) {
+      Ar.Logf(TEXT("Could not read %s"), *path);
+      return;
+    }
+    source = std::make_shared<ReplayFrameSource>(recording);
+    label = FString::Printf(TEXT("%d recorded frames, looping"), (int32)recording->size());
+  } else {
+    Ar.Logf(TEXT("Usage: HMD SOURCE GAME|PATTERN|STATIC"));
+    Ar.Logf(TEXT("       HMD SOURCE REPLAY [path]"));
+    return;
+  }
+
+  FScopeLock lock(&ActiveUsbDeviceMutex);
+  FrameSourceOverride = source;
+  Ar.Logf(TEXT("Streaming frames from %s"), *label);
+}
+
+void FCardboardTethering::RecordFrames(const TCHAR* Cmd, FOutputDevice& Ar) {
+  if (FParse::Command(&Cmd, TEXT("START"))) {
+    // HMD RECORD START [MB]; every frame sent is kept, as a JPEG, until the
+    // recording is that big.
+    int32 megabytes = FCString::Atoi(Cmd);
+    if (megabytes <= 0) {
+      megabytes = static_cast<int32>(FrameRecording::DEFAULT_MAX_BYTES >> 20);
+    } else if (megabytes > MAX_RECORDED_MEGABYTES) {
+      megabytes = MAX_RECORDED_MEGABYTES;
+    }
+    FScopeLock lock(&ActiveUsbDeviceMutex);
+    Recording = std::make_shared<FrameRecording>(size_t(megabytes) << 20);
+    Ar.Logf(TEXT("Recording up to %d MB of frames"), megabytes);
+  } else if (FParse::Command(&Cmd, TEXT("SAVE"))) {
+    // HMD RECORD SAVE [path]; defaults to Saved/CardboardFrames.ctfr.
+    FString path = FString(Cmd).Trim().TrimTrailing();
+    if (path.IsEmpty()) {
+      path = FPaths::ConvertRelativePathToFull(
+        FPaths::Combine(*FPaths::GameSavedDir(), TEXT("CardboardFrames.ctfr")));
+    }
+
+    std::shared_ptr<FrameRecording> recording;
+    {
+      FScopeLock lock(&ActiveUsbDeviceMutex);
+      recording = Recording;
+    }
+    if (!recording) {
+      Ar.Logf(TEXT("Nothing recorded; use HMD RECORD START first"));
+    } else if (recording->save(TCHAR_TO_UTF8(*path))) {
+      Ar.Logf(TEXT("Wrote %d frames to %s"), (int32)recording->size(), *path);
+    } else {
+      Ar.Logf(TEXT("Could not write %s"), *path);
+    }
+  } else {
+    {
+      FScopeLock lock(&ActiveUsbDeviceMutex);
+      if (Recording) {
+        Ar.Logf(TEXT("Recorded %d frames in %.1f MB%s"), (int32)Recording->size(),
+          Recording->bytes() / 1048576.0,
+          Recording->isFull() ? TEXT(", done") : TEXT(" so far"));
+      }
+    }
+    Ar.Logf(TEXT("Usage: HMD RECORD START [MB]"));
+    Ar.Logf(TEXT("       HMD RECORD SAVE [path]"));
+  }
+}
+
 bool FCardboardTethering::IsPositionalTrackingEnabled() const {
   return false;
 }
@@ -387,7 +860,9 @@ void FCardboardTethering::SetupViewFamily(FSceneViewFamily& InViewFamily) {
 }
 
 void FCardboardTethering::SetupView(FSceneViewFamily& InViewFamily, FSceneView& InView) {
-  InView.BaseHmdOrientation = FQuat(FRotator(0.0f, 0.0f, 0.0f));
+  // The orientation the view rotation was built from, so the render thread
+  // can swap it for a newer one.
+  InView.BaseHmdOrientation = CurHmdOrientation;
   InView.BaseHmdLocation = FVector(0.f);
   //	WorldToMetersScale = InView.WorldToMetersScale;
   InViewFamily.bUseSeparateRenderTarget = false;
@@ -395,10 +870,29 @@ void FCardboardTethering::SetupView(FSceneViewFamily& InViewFamily, FSceneView&
 
 void FCardboardTethering::PreRenderView_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneView& InView) {
   check(IsInRenderingThread());
+
+  // Replace the game thread's orientation with the late-latched one, keeping
+  // the player's yaw from DeltaControlOrientation.
+  const FQuat DeltaOrientation = InView.BaseHmdOrientation.Inverse() * RenderThreadOrientation;
+  InView.ViewRotation = FRotator(InView.ViewRotation.Quaternion() * DeltaOrientation);
+  InView.UpdateViewMatrix();
 }
 
 void FCardboardTethering::PreRenderViewFamily_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneViewFamily& ViewFamily) {
   check(IsInRenderingThread());
+
+  // The game thread sampled the pose a frame or more before the image gets
+  // to Present; sample again now, just before the scene is drawn. Both eyes
+  // use this pose, and it goes out with the frame so the phone knows
+  // exactly what was rendered.
+  PoseSample pose = PredictPose();
+  RenderThreadOrientation = ToHmdOrientation(pose);
+  RenderThreadPose.x = pose.x;
+  RenderThreadPose.y = pose.y;
+  RenderThreadPose.z = pose.z;
+  RenderThreadPose.w = pose.w;
+  RenderThreadPose.sequence = pose.sequence;
+  RenderThreadPose.receivedNs = pose.receivedNs;
 }
 
 FCardboardTethering::BridgeBaseImpl* FCardboardTethering::GetActiveRHIBridgeImpl() {
@@ -406,23 +900,28 @@ FCardboardTethering::BridgeBaseImpl* FCardboardTethering::GetActiveRHIBridgeImpl
 }
 
 FCardboardTethering::FCardboardTethering() :
+  EncodeThreads(UsbDevice::getDefaultEncodeThreads()),
+  YuvInput(false),
+  TileCoding(true),
+  TileSize(UsbDevice::DEFAULT_TILE_SIZE),
+  TileRefresh(UsbDevice::DEFAULT_TILE_REFRESH),
   CurHmdOrientation(FQuat::Identity),
   LastHmdOrientation(FQuat::Identity),
+  RenderThreadOrientation(FQuat::Identity),
   DeltaControlRotation(FRotator::ZeroRotator),
   DeltaControlOrientation(FQuat::Identity),
   LastSensorTime(-1.0),
   WindowMirrorMode(2),
   TurboJpegLibraryHandle(0),
-  CachedConnectionState(false) {
+  CachedConnectionState(false),
+  Reconnecting(false),
+  LastDisconnectMs(0.0),
+  PoseLogging(false),
+  Latency(std::make_shared<LatencyTracker>()),
+  LastDisplayedSequence(0) {
   static const FName RendererModuleName("Renderer");
   RendererModule = FModuleManager::GetModulePtr<IRendererModule>(RendererModuleName);
 
-  FQuat zero(FRotator(0.0f, 0.0f, 0.0f));
-  FeedbackOrientationX.store(zero.X);
-  FeedbackOrientationY.store(zero.Y);
-  FeedbackOrientationZ.store(zero.Z);
-  FeedbackOrientationW.store(zero.W);
-
 #if PLATFORM_WINDOWS
   if (IsPCPlatform(GMaxRHIShaderPlatform) && !IsOpenGLPlatform(GMaxRHIShaderPlatform)) {
     pD3D11Bridge = new D3D11Bridge(this);
@@ -453,6 +952,21 @@ FCardboardTethering::FCardboardTethering() :
 }
 
 FCardboardTethering::~FCardboardTethering() {
+  // Stop everything that calls back into us while we're still whole, and
+  // without the lock, which their callbacks take.
+  std::shared_ptr<WorkerThread> reconnectWorker;
+  TSharedPtr<UsbDevice, ESPMode::ThreadSafe> device;
+  {
+    FScopeLock lock(&ActiveUsbDeviceMutex);
+    reconnectWorker = ReconnectWorker;
+    device = ActiveUsbDevice;
+    ActiveUsbDevice = nullptr;
+  }
+  if (reconnectWorker) {
+    reconnectWorker->stop();
+  }
+  device = nullptr;
+
   FPlatformProcess::FreeDllHandle(TurboJpegLibraryHandle);
   TurboJpegLibraryHandle = nullptr;
   FPlatformProcess::FreeDllHandle(LibUsbLibraryHandle);
@@ -518,7 +1032,7 @@ void FCardboardTethering::ConnectUsb(uint16_t vid, uint16_t pid) {
 
   // Try to find the non-accessory device only if the ID is non-accessory.
   if (!id.isAoapId()) {
-    TSharedPtr<UsbDevice> tempDevice;
+    TSharedPtr<UsbDevice, ESPMode::ThreadSafe> tempDevice;
     status = UsbDevice::create(&tempDevice, SharedLibraryInitParams, vid, pid);
     if (status) {
       OpenErrorDialogOnGameThread(LOCTEXT("UsbConnectError", "Error connecting to USB device"),
@@ -534,7 +1048,7 @@ void FCardboardTethering::ConnectUsb(uint16_t vid, uint16_t pid) {
   }
 
   // Try to find the accessory device.
-  TSharedPtr<UsbDevice> realDevice;
+  TSharedPtr<UsbDevice, ESPMode::ThreadSafe> realDevice;
   status = UsbDevice::create(&realDevice, SharedLibraryInitParams);
   if (status) {
     OpenErrorDialogOnGameThread(LOCTEXT("UsbConnectError", "Error connecting to USB device"),
@@ -554,16 +1068,41 @@ void FCardboardTethering::ConnectUsb(uint16_t vid, uint16_t pid) {
     }
   );
 
+  // A device we replace is dropped after the lock is released, since its
+  // loops may be waiting for the lock in a callback; see DisconnectUsb.
+  TSharedPtr<UsbDevice, ESPMode::ThreadSafe> previousDevice;
   FScopeLock lock(&ActiveUsbDeviceMutex);
+  if (ReconnectWorker) {
+    ReconnectWorker->cancel();
+  }
+  ConnectedId = id;
+  previousDevice = ActiveUsbDevice;
   ActiveUsbDevice = realDevice;
-  ActiveUsbDevice->waitHandshakeAsync([this](bool success) {
-    if (success) {
+
+  // Console settings outlive any one device.
+  ActiveUsbDevice->setRateTargets(RateTargets);
+  ActiveUsbDevice->setEncodeThreads(EncodeThreads);
+  ActiveUsbDevice->setYuvInput(YuvInput);
+  ActiveUsbDevice->setTileCoding(TileCoding, TileSize, TileRefresh);
+  ActiveUsbDevice->setPacing(Pacing);
+  ActiveUsbDevice->waitHandshakeAsync([this](int status) {
+    if (status == UsbDevice::STATUS_OK) {
       FinishHandshake();
+    } else if (status == UsbDevice::STATUS_OLD_CLIENT) {
+      DisconnectUsb(0);
+      OpenErrorDialogOnGameThread(LOCTEXT("UsbHandshakeError", "Error during USB handshake"),
+        LOCTEXT("UsbHandshakeOldClient", "the phone app is too old for this plugin; please update it"),
+        status);
+    } else if (status == UsbDevice::STATUS_INCOMPATIBLE_CLIENT) {
+      DisconnectUsb(0);
+      OpenErrorDialogOnGameThread(LOCTEXT("UsbHandshakeError", "Error during USB handshake"),
+        LOCTEXT("UsbHandshakeIncompatible", "the phone app and this plugin have no protocol version or codec in common"),
+        status);
     } else {
       DisconnectUsb(0);
       OpenErrorDialogOnGameThread(LOCTEXT("UsbHandshakeError", "Error during USB handshake"),
         LOCTEXT("UsbHandshakeFailure", "handshake failed"),
-        0);
+        status);
     }
   });
 }
@@ -572,14 +1111,29 @@ void FCardboardTethering::DisconnectUsb(int reason) {
   CachedConnectionState = false;
   CloseStatusWindowOnGameThread();
 
-  FScopeLock lock(&ActiveUsbDeviceMutex);
-  if (!ActiveUsbDevice.IsValid()) {
-    UE_LOG(LogCardboardHMD, Warning, TEXT("USB already disconnected"));
-    return;
+  // Dropping the device stops and joins its loops. Do that with the lock
+  // released: a loop may be waiting for it, e.g. to report an error, and
+  // this may be running on a loop's thread.
+  TSharedPtr<UsbDevice, ESPMode::ThreadSafe> device;
+  {
+    FScopeLock lock(&ActiveUsbDeviceMutex);
+    if (ReconnectWorker) {
+      ReconnectWorker->cancel();
+    }
+    if (!ActiveUsbDevice.IsValid()) {
+      UE_LOG(LogCardboardHMD, Warning, TEXT("USB already disconnected"));
+      return;
+    }
+    device = ActiveUsbDevice;
+    ActiveUsbDevice = nullptr;
   }
 
-  ActiveUsbDevice = nullptr;
-  UE_LOG(LogCardboardHMD, Warning, TEXT("USB disconnected"));
+  auto start = std::chrono::steady_clock::now();
+  device = nullptr;
+  double ms = std::chrono::duration<double, std::milli>(
+    std::chrono::steady_clock::now() - start).count();
+  LastDisconnectMs.store(ms);
+  UE_LOG(LogCardboardHMD, Warning, TEXT("USB disconnected in %.1f ms"), ms);
 
   if (reason != 0) {
     OpenErrorDialogOnGameThread(LOCTEXT("UsbDisconnectError", "The USB connection failed"),
@@ -601,30 +1155,212 @@ void FCardboardTethering::FinishHandshake() {
   ViewerHeight.store(h);
   ViewerInterpupillary.store(ip);
 
+  StartStreaming();
+}
+
+bool FCardboardTethering::StartStreaming() {
+  FScopeLock lock(&ActiveUsbDeviceMutex);
+
   // Set up the send loop.
-  ActiveUsbDevice->beginSendLoop([this](int reason) {
-    DisconnectUsb(reason);
+  ActiveUsbDevice->setLatencyTracker(Latency);
+  bool started = ActiveUsbDevice->beginSendLoop([this](int reason) {
+    HandleStreamError(reason);
   });
 
-  // Set up the receive loop.
-  ActiveUsbDevice->beginReadLoop([this](const unsigned char* data, int reason) {
+  // Set up the receive loop. Velocities from the last connection mean
+  // nothing now.
+  FeedbackPredictor.reset();
+  LastDisplayedSequence = 0;
+  started = ActiveUsbDevice->beginReadLoop([this](uint8_t type, const unsigned char* data, size_t length, int reason) {
     if (reason) {
-      DisconnectUsb(reason);
-    } else {
-      // Don't do anything right now.
+      HandleStreamError(reason);
+    } else if (type == Message::TYPE_POSE && length >= UsbDevice::POSE_QUATERNION_LEN) {
       float floatData[4];
       std::memcpy(floatData, data, 4 * sizeof(float));
       for (int i = 0; i < 4; ++i) {
         floatData[i] = EndianUtils::bigToNativeFloat(floatData[i]);
       }
 
-      // Determined by empirical testing, this seems to convert the coord space correctly!
-      FeedbackOrientationX.store(floatData[0]);
-      FeedbackOrientationY.store(floatData[2]);
-      FeedbackOrientationZ.store(floatData[3]);
-      FeedbackOrientationW.store(floatData[1]);
+      PoseSample pose;
+      pose.x = floatData[0];
+      pose.y = floatData[1];
+      pose.z = floatData[2];
+      pose.w = floatData[3];
+      pose.receivedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+
+      if (length >= UsbDevice::POSE_TIMESTAMP_LEN) {
+        uint32_t sequence;
+        int64_t deviceNs;
+        std::memcpy(&sequence, data + 16, sizeof(sequence));
+        std::memcpy(&deviceNs, data + 20, sizeof(deviceNs));
+        pose.sequence = EndianUtils::bigToNative(sequence);
+        pose.deviceNs = EndianUtils::bigToNative(deviceNs);
+      } else {
+        // An older app; number the packets ourselves.
+        pose.sequence = FeedbackPose.load().sequence + 1;
+      }
+
+      FeedbackPredictor.addSample(&pose);
+      FeedbackPose.store(pose);
+
+      if (length >= UsbDevice::POSE_PACKET_LEN) {
+        // The phone repeats its latest measurement until it displays
+        // another frame; count each one once.
+        uint32_t displayed;
+        uint32_t displayMicros;
+        std::memcpy(&displayed, data + 28, sizeof(displayed));
+        std::memcpy(&displayMicros, data + 32, sizeof(displayMicros));
+        displayed = EndianUtils::bigToNative(displayed);
+        displayMicros = EndianUtils::bigToNative(displayMicros);
+        if (displayed != 0 && displayed != LastDisplayedSequence) {
+          LastDisplayedSequence = displayed;
+          Latency->addDisplay(displayed, static_cast<int64_t>(displayMicros) * 1000);
+        }
+      }
+
+      if (PoseLogging.load()) {
+        FScopeLock lock(&PoseLogMutex);
+        if (RecordedPoses.size() < MAX_POSE_LOG) {
+          RecordedPoses.push_back(pose);
+        }
+      }
+    }
+  }) && started;
+  return started;
+}
+
+/**
+ * Reconnector steps for the plugin's device, which ReconnectingDevice keeps
+ * alive meanwhile. Streaming only restarts if the user hasn't disconnected
+ * or connected another device in the meantime.
+ */
+class FCardboardTethering::UsbReconnectLink : public Reconnector::Link {
+public:
+  UsbReconnectLink(FCardboardTethering* plugin, UsbDevice* device,
+      UsbDeviceId connectedId, WorkerThread::SharedAtomicBool cancel)
+    : Plugin(plugin), Device(device), ConnectedId(connectedId), Cancel(cancel) {}
+
+  virtual int64_t nowNs() override {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  virtual bool wait(int64_t ns) override {
+    std::unique_lock<std::mutex> lock(Plugin->ReconnectWaitMutex);
+    return !Plugin->ReconnectWaitCv.wait_for(lock, std::chrono::nanoseconds(ns),
+      [&] { return Cancel->load(); });
+  }
+
+  virtual int open() override {
+    // While it's the ReconnectingDevice, the render thread and console
+    // commands stay away from the device (see GetSettledDevice), so its loops and handle can go
+    // without the lock; the loops take it themselves to report errors.
+    int status = Device->reopen();
+    if (status == UsbDevice::STATUS_NOT_FOUND_ERROR && !ConnectedId.isAoapId()) {
+      // The phone came back out of accessory mode. Switch it again and look
+      // for the accessory on the next attempt, after it re-enumerates.
+      TSharedPtr<UsbDevice, ESPMode::ThreadSafe> tempDevice;
+      if (UsbDevice::create(&tempDevice, Plugin->SharedLibraryInitParams,
+          ConnectedId.vid, ConnectedId.pid) == UsbDevice::STATUS_OK) {
+        tempDevice->convertToAccessory();
+      }
+    }
+    return status;
+  }
+
+  virtual int resume() override {
+    return Device->resumeHandshake(*Cancel);
+  }
+
+  virtual int start() override {
+    FScopeLock lock(&Plugin->ActiveUsbDeviceMutex);
+    if (Cancel->load() || Plugin->ActiveUsbDevice.Get() != Device) {
+      return Reconnector::CANCELLED;
     }
-  }, 4 * sizeof(float));
+    return Plugin->StartStreaming() ?
+      UsbDevice::STATUS_OK : UsbDevice::STATUS_NOT_FOUND_ERROR;
+  }
+
+  virtual bool isPermanent(int status) override {
+    return status == Reconnector::CANCELLED ||
+      status == UsbDevice::STATUS_OLD_CLIENT ||
+      status == UsbDevice::STATUS_INCOMPATIBLE_CLIENT ||
+      status == UsbDevice::STATUS_CHANGED_CLIENT;
+  }
+
+private:
+  FCardboardTethering* Plugin;
+  UsbDevice* Device;
+  UsbDeviceId ConnectedId;
+  WorkerThread::SharedAtomicBool Cancel;
+};
+
+UsbDevice* FCardboardTethering::GetSettledDevice() {
+  // A device connected after the user gave up on a reconnect is usable
+  // straight away, even while the old one's reconnect winds down.
+  if (!ActiveUsbDevice.IsValid() || ActiveUsbDevice == ReconnectingDevice) {
+    return nullptr;
+  }
+  return ActiveUsbDevice.Get();
+}
+
+void FCardboardTethering::HandleStreamError(int reason) {
+  if (!UsbDevice::isLinkError(reason)) {
+    DisconnectUsb(reason);
+    return;
+  }
+
+  FScopeLock lock(&ActiveUsbDeviceMutex);
+  if (!ActiveUsbDevice.IsValid() || Reconnecting.exchange(true)) {
+    // Disconnected meanwhile, or the other loop failed first.
+    return;
+  }
+
+  UE_LOG(LogCardboardHMD, Warning, TEXT("USB link failed (%d); reconnecting"), reason);
+  ReconnectingDevice = ActiveUsbDevice;
+  UsbDevice* device = ReconnectingDevice.Get();
+  UsbDeviceId connectedId = ConnectedId;
+
+  // We're on one of the device's loops, so the previous reconnect thread
+  // (done, or nearly) is joined by the new one rather than here: it may be
+  // dropping a device of its own, which joins that device's loops.
+  std::shared_ptr<WorkerThread> previous = ReconnectWorker;
+  ReconnectWorker = std::make_shared<WorkerThread>("reconnect",
+    [this, device, connectedId, reason, previous](const WorkerThread::SharedAtomicBool cancel) {
+      if (previous) {
+        previous->stop();
+      }
+
+      UsbReconnectLink link(this, device, connectedId, cancel);
+      int status = UsbReconnector.reconnect(&link, reason);
+
+      TSharedPtr<UsbDevice, ESPMode::ThreadSafe> reconnected;
+      bool current;
+      {
+        FScopeLock lock(&ActiveUsbDeviceMutex);
+        current = ActiveUsbDevice.Get() == device;
+        reconnected = ReconnectingDevice;
+        ReconnectingDevice = nullptr;
+        Reconnecting.store(false);
+      }
+
+      // If the user disconnected meanwhile this is the last reference, and
+      // dropping it joins the device's loops; see DisconnectUsb.
+      reconnected = nullptr;
+      if (status == UsbDevice::STATUS_OK) {
+        UE_LOG(LogCardboardHMD, Warning, TEXT("USB reconnected in %.0f ms"),
+          UsbReconnector.getStats().lastMs);
+      } else if (status != Reconnector::CANCELLED && current) {
+        DisconnectUsb(status);
+      }
+    },
+    [this]() {
+      {
+        std::lock_guard<std::mutex> lock(ReconnectWaitMutex);
+      }
+      ReconnectWaitCv.notify_all();
+    });
 }
 
 void FCardboardTethering::InstallUsbDrivers(const UsbDeviceDesc& d) {
@@ -668,7 +1404,7 @@ void FCardboardTethering::InstallUsbDrivers(const UsbDeviceDesc& d) {
   }
 
   {
-    TSharedPtr<UsbDevice> tempDevice;
+    TSharedPtr<UsbDevice, ESPMode::ThreadSafe> tempDevice;
     int status = UsbDevice::create(&tempDevice, SharedLibraryInitParams, d.id.vid, d.id.pid);
     if (status) {
       OpenErrorDialogOnGameThread(LOCTEXT("DriverInstallError", "Error during driver installation"),
@@ -7,13 +7,21 @@
 #include "SceneViewExtension.h"
 #include "LibraryInitParams.h"
 #include "UsbDevice.h"
+#include "PoseChannel.h"
+#include "PosePredictor.h"
+#include "Reconnector.h"
+#include "FrameSource.h"
+#include "FrameRecording.h"
 #include <atomic>
 #include <cstdint>
+#include <mutex>
+#include <condition_variable>
 
 #if PLATFORM_WINDOWS
 #include "AllowWindowsPlatformTypes.h"
 #include <d3d11.h>
 #include "HideWindowsPlatformTypes.h"
+#include "D3D11FrameReadback.h"
 #endif
 
 /**
@@ -133,8 +141,15 @@ public:
       Reset();
     }
 
+    /** Safe from any thread. */
+    FrameReadback::Stats GetReadbackStats() const;
+    uint64_t GetStagingBytes() const;
+
   protected:
+    static constexpr size_t READBACK_LATENCY = 2;
+
     ID3D11Texture2D* RenderTargetTexture = NULL;
+    std::unique_ptr<D3D11FrameReadback> Readback; /* Render thread only. */
   };
 #endif // PLATFORM_WINDOWS
 
@@ -152,7 +167,14 @@ public:
 
   TSharedPtr<LibraryInitParams> SharedLibraryInitParams;
   FCriticalSection ActiveUsbDeviceMutex;
-  TSharedPtr<UsbDevice> ActiveUsbDevice;
+  TSharedPtr<UsbDevice, ESPMode::ThreadSafe> ActiveUsbDevice;
+  RateController::Targets RateTargets; /* Guarded by ActiveUsbDeviceMutex. */
+  size_t EncodeThreads; /* Guarded by ActiveUsbDeviceMutex. */
+  bool YuvInput; /* Guarded by ActiveUsbDeviceMutex. */
+  bool TileCoding; /* These three guarded by ActiveUsbDeviceMutex. */
+  size_t TileSize;
+  size_t TileRefresh;
+  FramePacer::Settings Pacing; /* Guarded by ActiveUsbDeviceMutex. */
 
   bool GetCachedConnectionState() const;
   void ShowConnectUsbDialog();
@@ -163,6 +185,10 @@ private:
   FQuat CurHmdOrientation;
   FQuat LastHmdOrientation;
 
+  /** Late-latched pose for the frame being rendered; render thread only. */
+  FQuat RenderThreadOrientation;
+  RenderPose RenderThreadPose;
+
   FRotator DeltaControlRotation;    // same as DeltaControlOrientation but as rotator
   FQuat DeltaControlOrientation; // same as DeltaControlRotation but as quat
 
@@ -173,10 +199,37 @@ private:
   void* LibUsbLibraryHandle;
   void* LibWdiLibraryHandle;
 
-  std::atomic<float> FeedbackOrientationX;
-  std::atomic<float> FeedbackOrientationY;
-  std::atomic<float> FeedbackOrientationZ;
-  std::atomic<float> FeedbackOrientationW;
+  PoseChannel FeedbackPose; /* Written by the USB read loop. */
+  PosePredictor FeedbackPredictor;
+
+  /** Poses recorded by HMD POSELOG for offline prediction tuning. */
+  static constexpr size_t MAX_POSE_LOG = 100000;
+  std::atomic_bool PoseLogging;
+  FCriticalSection PoseLogMutex;
+  std::vector<PoseSample> RecordedPoses;
+
+  /** Shared with the send loop of each connection; see HMD LATENCY. */
+  std::shared_ptr<LatencyTracker> Latency;
+  uint32_t LastDisplayedSequence; /* USB read loop only. */
+
+  /** Brings the link back after USB errors; see HandleStreamError. */
+  class UsbReconnectLink;
+  Reconnector UsbReconnector;
+  std::atomic_bool Reconnecting;
+  UsbDeviceId ConnectedId; /* As chosen by the user; for converting again. */
+  std::shared_ptr<WorkerThread> ReconnectWorker; /* Guarded by ActiveUsbDeviceMutex. */
+  TSharedPtr<UsbDevice, ESPMode::ThreadSafe> ReconnectingDevice; /* Guarded by ActiveUsbDeviceMutex. */
+  std::mutex ReconnectWaitMutex; /* Backoff waits end early when cancelled. */
+  std::condition_variable ReconnectWaitCv;
+
+  /** Stand-in for the game's frames, see HMD SOURCE; guarded by ActiveUsbDeviceMutex. */
+  std::shared_ptr<FrameSource> FrameSourceOverride;
+  /** Frames being captured by HMD RECORD; guarded by ActiveUsbDeviceMutex. */
+  std::shared_ptr<FrameRecording> Recording;
+  static constexpr int32 MAX_RECORDED_MEGABYTES = 128;
+
+  /** Dropping the device stops and joins its loops; see DisconnectUsb. */
+  std::atomic<double> LastDisconnectMs;
 
   std::atomic<int32_t> ViewerWidth;
   std::atomic<int32_t> ViewerHeight;
@@ -214,10 +267,30 @@ private:
 #endif
 
   void GetCurrentPose(FQuat& CurrentOrientation);
+  PoseSample PredictPose() const;
+  static FQuat ToHmdOrientation(const PoseSample& pose);
   void ConnectUsb(uint16_t vid = 0x18d1, uint16_t pid = 0x4ee2);
   void InstallUsbDrivers(const UsbDeviceDesc& d);
   void DisconnectUsb(int reason);
   void FinishHandshake();
+  bool StartStreaming();
+  void HandleStreamError(int reason);
+
+  /**
+   * The active device, or null while a reconnect is tearing it down and
+   * reopening it; only the reconnect thread may touch it then. Call with
+   * ActiveUsbDeviceMutex held.
+   */
+  UsbDevice* GetSettledDevice();
+
+  void PrintStats(FOutputDevice& Ar);
+  void SetRateTargets(const TCHAR* Cmd, FOutputDevice& Ar);
+  void SetPrediction(const TCHAR* Cmd, FOutputDevice& Ar);
+  void SetReconnect(const TCHAR* Cmd, FOutputDevice& Ar);
+  void RecordPoses(const TCHAR* Cmd, FOutputDevice& Ar);
+  void ReportLatency(const TCHAR* Cmd, FOutputDevice& Ar);
+  void SetFrameSource(const TCHAR* Cmd, FOutputDevice& Ar);
+  void RecordFrames(const TCHAR* Cmd, FOutputDevice& Ar);
 
   void OpenDialogOnGameThread(FText msg);
   void OpenErrorDialogOnGameThread(FText msg, FText reason, int code);
@@ -0,0 +1,380 @@
+#include "ColorConvert.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <boost/predef/hardware/simd.h>
+
+// SSE2 is part of every x64 target, so it's a compile-time decision. AVX2
+// isn't, so its kernel is built for a specific target and only picked if
+// the CPU and OS support it.
+#if defined(BOOST_HW_SIMD_X86) && BOOST_HW_SIMD_X86 >= BOOST_HW_SIMD_X86_SSE2_VERSION
+#define COLORCONVERT_SSE2 1
+#include <emmintrin.h>
+#else
+#define COLORCONVERT_SSE2 0
+#endif
+
+#if COLORCONVERT_SSE2 && (defined(_MSC_VER) || defined(__GNUC__))
+#define COLORCONVERT_AVX2 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define COLORCONVERT_AVX2_TARGET
+#else
+#define COLORCONVERT_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#else
+#define COLORCONVERT_AVX2 0
+#endif
+
+namespace {
+
+  // Full-range JFIF coefficients scaled by 256. Chroma is computed from the
+  // sum of a 2x2 block, so it's scaled by another 4; the offset folds in the
+  // +128 bias and rounding and keeps the result in [0, 2^18).
+  const int Y_R = 77, Y_G = 150, Y_B = 29, Y_ROUND = 128;
+  const int CB_R = -43, CB_G = -85, CB_B = 128;
+  const int CR_R = 128, CR_G = -107, CR_B = -21;
+  const int C_OFFSET_4 = 128 * 1024 + 511;
+
+  inline unsigned char luma(const unsigned char* px) {
+    return static_cast<unsigned char>(
+      (Y_R * px[2] + Y_G * px[1] + Y_B * px[0] + Y_ROUND) >> 8);
+  }
+
+  /**
+   * Converts columns [xBegin, width) of one pair of rows; xBegin must be
+   * even. row1/y1 are the second row, or row0/nullptr for a lone last row.
+   */
+  void convertRowPairScalar(const unsigned char* row0,
+      const unsigned char* row1, size_t width, size_t xBegin,
+      unsigned char* y0, unsigned char* y1, unsigned char* u,
+      unsigned char* v) {
+    for (size_t x = xBegin; x < width; x += 2) {
+      size_t x1 = std::min(x + 1, width - 1);
+      const unsigned char* p00 = row0 + x * 4;
+      const unsigned char* p01 = row0 + x1 * 4;
+      const unsigned char* p10 = row1 + x * 4;
+      const unsigned char* p11 = row1 + x1 * 4;
+
+      y0[x] = luma(p00);
+      if (x + 1 < width) {
+        y0[x + 1] = luma(p01);
+      }
+      if (y1 != nullptr) {
+        y1[x] = luma(p10);
+        if (x + 1 < width) {
+          y1[x + 1] = luma(p11);
+        }
+      }
+
+      int b = p00[0] + p01[0] + p10[0] + p11[0];
+      int g = p00[1] + p01[1] + p10[1] + p11[1];
+      int r = p00[2] + p01[2] + p10[2] + p11[2];
+      u[x / 2] = static_cast<unsigned char>(
+        (CB_R * r + CB_G * g + CB_B * b + C_OFFSET_4) >> 10);
+      v[x / 2] = static_cast<unsigned char>(
+        (CR_R * r + CR_G * g + CR_B * b + C_OFFSET_4) >> 10);
+    }
+  }
+
+  using RowPairKernel = size_t (*)(const unsigned char* row0,
+    const unsigned char* row1, size_t width, unsigned char* y0,
+    unsigned char* y1, unsigned char* u, unsigned char* v);
+
+  /** Runs kernel over each row pair, then finishes its columns in scalar. */
+  void convertFrame(RowPairKernel kernel, const unsigned char* bgrx,
+      size_t width, size_t widthPitch, size_t height,
+      const ColorConvert::YuvPlanes& out) {
+    for (size_t y = 0; y < height; y += 2) {
+      const unsigned char* row0 = bgrx + y * widthPitch;
+      bool pair = y + 1 < height;
+      const unsigned char* row1 = pair ? row0 + widthPitch : row0;
+      unsigned char* y0 = out.y + y * out.yStride;
+      unsigned char* y1 = pair ? y0 + out.yStride : nullptr;
+      unsigned char* u = out.u + (y / 2) * out.uvStride;
+      unsigned char* v = out.v + (y / 2) * out.uvStride;
+
+      size_t done = kernel ? kernel(row0, row1, width, y0, y1, u, v) : 0;
+      convertRowPairScalar(row0, row1, width, done, y0, y1, u, v);
+    }
+  }
+
+#if COLORCONVERT_SSE2
+  /** Two signed 16-bit coefficients, for _mm_madd_epi16 over lane pairs. */
+  inline __m128i coefficientPair(int low, int high) {
+    return _mm_set1_epi32(static_cast<int>(
+      (static_cast<uint32_t>(high & 0xFFFF) << 16) | (low & 0xFFFF)));
+  }
+
+  /**
+   * Splits four BGRX pixels into 16-bit (B, R) and (G, X) lane pairs, one
+   * pair per pixel, so that one madd per vector gives a weighted sum.
+   */
+  inline void splitPixels(__m128i px, __m128i* br, __m128i* gx) {
+    *br = _mm_and_si128(px, _mm_set1_epi16(0x00FF));
+    *gx = _mm_srli_epi16(px, 8);
+  }
+
+  inline __m128i weigh(__m128i br, __m128i gx, __m128i kBr, __m128i kG) {
+    return _mm_add_epi32(_mm_madd_epi16(br, kBr), _mm_madd_epi16(gx, kG));
+  }
+
+  /** Luma for four pixels, as 32-bit lanes. */
+  inline __m128i luma4(__m128i br, __m128i gx) {
+    __m128i sum = weigh(br, gx, coefficientPair(Y_B, Y_R), coefficientPair(Y_G, 0));
+    return _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(Y_ROUND)), 8);
+  }
+
+  /** Chroma for two 2x2 blocks given their (B, R)/(G, X) sums in lanes 0, 2. */
+  inline __m128i chroma2(__m128i br, __m128i gx, int wr, int wg, int wb) {
+    __m128i sum = weigh(br, gx, coefficientPair(wb, wr), coefficientPair(wg, 0));
+    sum = _mm_add_epi32(sum, _mm_set1_epi32(C_OFFSET_4));
+    sum = _mm_srli_epi32(sum, 10);
+    // Keep lanes 0 and 2.
+    return _mm_shuffle_epi32(sum, _MM_SHUFFLE(3, 1, 2, 0));
+  }
+
+  size_t rowPairSse2(const unsigned char* row0, const unsigned char* row1,
+      size_t width, unsigned char* y0, unsigned char* y1, unsigned char* u,
+      unsigned char* v) {
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+      __m128i br[2][2], gx[2][2];
+      const unsigned char* rows[2] = { row0, row1 };
+      for (int r = 0; r < 2; ++r) {
+        const __m128i* p = reinterpret_cast<const __m128i*>(rows[r] + x * 4);
+        splitPixels(_mm_loadu_si128(p), &br[r][0], &gx[r][0]);
+        splitPixels(_mm_loadu_si128(p + 1), &br[r][1], &gx[r][1]);
+      }
+
+      __m128i luma0 = _mm_packs_epi32(luma4(br[0][0], gx[0][0]),
+        luma4(br[0][1], gx[0][1]));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(y0 + x),
+        _mm_packus_epi16(luma0, luma0));
+      if (y1 != nullptr) {
+        __m128i luma1 = _mm_packs_epi32(luma4(br[1][0], gx[1][0]),
+          luma4(br[1][1], gx[1][1]));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(y1 + x),
+          _mm_packus_epi16(luma1, luma1));
+      }
+
+      // Sum each 2x2 block: add the rows, then each pixel to its neighbour.
+      __m128i cb[2], cr[2];
+      for (int half = 0; half < 2; ++half) {
+        __m128i sumBr = _mm_add_epi16(br[0][half], br[1][half]);
+        __m128i sumGx = _mm_add_epi16(gx[0][half], gx[1][half]);
+        sumBr = _mm_add_epi16(sumBr, _mm_srli_epi64(sumBr, 32));
+        sumGx = _mm_add_epi16(sumGx, _mm_srli_epi64(sumGx, 32));
+        cb[half] = chroma2(sumBr, sumGx, CB_R, CB_G, CB_B);
+        cr[half] = chroma2(sumBr, sumGx, CR_R, CR_G, CR_B);
+      }
+
+      __m128i chroma = _mm_packs_epi32(_mm_unpacklo_epi64(cb[0], cb[1]),
+        _mm_unpacklo_epi64(cr[0], cr[1]));
+      chroma = _mm_packus_epi16(chroma, chroma);
+      int32_t cb4 = _mm_cvtsi128_si32(chroma);
+      int32_t cr4 = _mm_cvtsi128_si32(_mm_srli_si128(chroma, 4));
+      std::memcpy(u + x / 2, &cb4, sizeof(cb4));
+      std::memcpy(v + x / 2, &cr4, sizeof(cr4));
+    }
+    return x;
+  }
+#endif
+
+#if COLORCONVERT_AVX2
+  COLORCONVERT_AVX2_TARGET
+  inline __m256i coefficientPair256(int low, int high) {
+    return _mm256_set1_epi32(static_cast<int>(
+      (static_cast<uint32_t>(high & 0xFFFF) << 16) | (low & 0xFFFF)));
+  }
+
+  COLORCONVERT_AVX2_TARGET
+  inline __m256i weigh256(__m256i br, __m256i gx, __m256i kBr, __m256i kG) {
+    return _mm256_add_epi32(_mm256_madd_epi16(br, kBr), _mm256_madd_epi16(gx, kG));
+  }
+
+  /** Luma for eight pixels, as 32-bit lanes. */
+  COLORCONVERT_AVX2_TARGET
+  inline __m256i luma8(__m256i br, __m256i gx) {
+    __m256i sum = weigh256(br, gx, coefficientPair256(Y_B, Y_R),
+      coefficientPair256(Y_G, 0));
+    return _mm256_srli_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(Y_ROUND)), 8);
+  }
+
+  /** Sixteen luma values from two luma8 results, stored in order. */
+  COLORCONVERT_AVX2_TARGET
+  inline void storeLuma16(unsigned char* out, __m256i lo, __m256i hi) {
+    // Packing works within 128-bit lanes, so put the 64-bit chunks back in
+    // pixel order after each step.
+    __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi),
+      _MM_SHUFFLE(3, 1, 2, 0));
+    __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words),
+      _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+      _mm256_castsi256_si128(bytes));
+  }
+
+  /** Chroma for four 2x2 blocks given their sums in lanes 0, 2, 4 and 6. */
+  COLORCONVERT_AVX2_TARGET
+  inline __m256i chroma4(__m256i br, __m256i gx, int wr, int wg, int wb) {
+    __m256i sum = weigh256(br, gx, coefficientPair256(wb, wr),
+      coefficientPair256(wg, 0));
+    sum = _mm256_add_epi32(sum, _mm256_set1_epi32(C_OFFSET_4));
+    sum = _mm256_srli_epi32(sum, 10);
+    // Gather lanes 0, 2, 4, 6 into the low half.
+    return _mm256_permutevar8x32_epi32(sum, _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7));
+  }
+
+  COLORCONVERT_AVX2_TARGET
+  size_t rowPairAvx2(const unsigned char* row0, const unsigned char* row1,
+      size_t width, unsigned char* y0, unsigned char* y1, unsigned char* u,
+      unsigned char* v) {
+    const __m256i lowBytes = _mm256_set1_epi16(0x00FF);
+
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+      __m256i br[2][2], gx[2][2];
+      const unsigned char* rows[2] = { row0, row1 };
+      for (int r = 0; r < 2; ++r) {
+        const __m256i* p = reinterpret_cast<const __m256i*>(rows[r] + x * 4);
+        __m256i px0 = _mm256_loadu_si256(p);
+        __m256i px1 = _mm256_loadu_si256(p + 1);
+        br[r][0] = _mm256_and_si256(px0, lowBytes);
+        gx[r][0] = _mm256_srli_epi16(px0, 8);
+        br[r][1] = _mm256_and_si256(px1, lowBytes);
+        gx[r][1] = _mm256_srli_epi16(px1, 8);
+      }
+
+      storeLuma16(y0 + x, luma8(br[0][0], gx[0][0]), luma8(br[0][1], gx[0][1]));
+      if (y1 != nullptr) {
+        storeLuma16(y1 + x, luma8(br[1][0], gx[1][0]), luma8(br[1][1], gx[1][1]));
+      }
+
+      __m256i cb[2], cr[2];
+      for (int half = 0; half < 2; ++half) {
+        __m256i sumBr = _mm256_add_epi16(br[0][half], br[1][half]);
+        __m256i sumGx = _mm256_add_epi16(gx[0][half], gx[1][half]);
+        sumBr = _mm256_add_epi16(sumBr, _mm256_srli_epi64(sumBr, 32));
+        sumGx = _mm256_add_epi16(sumGx, _mm256_srli_epi64(sumGx, 32));
+        cb[half] = chroma4(sumBr, sumGx, CB_R, CB_G, CB_B);
+        cr[half] = chroma4(sumBr, sumGx, CR_R, CR_G, CR_B);
+      }
+
+      // Eight blocks of each as 32-bit lanes, then packed so the low eight
+      // bytes are Cb and the next eight are Cr.
+      __m256i cb8 = _mm256_permute2x128_si256(cb[0], cb[1], 0x20);
+      __m256i cr8 = _mm256_permute2x128_si256(cr[0], cr[1], 0x20);
+      __m256i words = _mm256_packs_epi32(cb8, cr8);
+      __m256i bytes = _mm256_packus_epi16(words, words);
+      bytes = _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+      __m128i chroma = _mm256_castsi256_si128(bytes);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(u + x / 2), chroma);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(v + x / 2),
+        _mm_unpackhi_epi64(chroma, chroma));
+    }
+    return x;
+  }
+
+  bool cpuHasAvx2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+      return false;
+    }
+
+    // The OS must also save YMM registers on context switches.
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+      return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+  }
+#endif
+
+  RowPairKernel rowPairKernel(ColorConvert::Kernel kernel) {
+    switch (kernel) {
+#if COLORCONVERT_SSE2
+      case ColorConvert::KERNEL_SSE2:
+        return rowPairSse2;
+#endif
+#if COLORCONVERT_AVX2
+      case ColorConvert::KERNEL_AVX2:
+        return rowPairAvx2;
+#endif
+      default:
+        return nullptr;
+    }
+  }
+
+  ColorConvert::Kernel pickKernel() {
+    ColorConvert::Kernel best = ColorConvert::KERNEL_SCALAR;
+    for (int kernel = ColorConvert::KERNEL_SCALAR; kernel < ColorConvert::KERNEL_COUNT; ++kernel) {
+      if (ColorConvert::isSupported(static_cast<ColorConvert::Kernel>(kernel))) {
+        best = static_cast<ColorConvert::Kernel>(kernel);
+      }
+    }
+
+    std::cout << "Colour conversion kernel: " << ColorConvert::kernelName(best) << std::endl;
+    return best;
+  }
+
+}
+
+namespace ColorConvert {
+
+  const char* kernelName(Kernel kernel) {
+    switch (kernel) {
+      case KERNEL_SCALAR: return "scalar";
+      case KERNEL_SSE2: return "SSE2";
+      case KERNEL_AVX2: return "AVX2";
+      default: return "unknown";
+    }
+  }
+
+  bool isSupported(Kernel kernel) {
+    switch (kernel) {
+      case KERNEL_SCALAR:
+        return true;
+      case KERNEL_SSE2:
+        return COLORCONVERT_SSE2 != 0;
+      case KERNEL_AVX2: {
+#if COLORCONVERT_AVX2
+        static const bool hasAvx2 = cpuHasAvx2();
+        return hasAvx2;
+#else
+        return false;
+#endif
+      }
+      default:
+        return false;
+    }
+  }
+
+  Kernel bestKernel() {
+    static const Kernel best = pickKernel();
+    return best;
+  }
+
+  void bgrxToI420(const unsigned char* bgrx, size_t width, size_t widthPitch,
+      size_t height, const YuvPlanes& out) {
+    bgrxToI420(bestKernel(), bgrx, width, widthPitch, height, out);
+  }
+
+  void bgrxToI420(Kernel kernel, const unsigned char* bgrx, size_t width,
+      size_t widthPitch, size_t height, const YuvPlanes& out) {
+    RowPairKernel rowPair = isSupported(kernel) ? rowPairKernel(kernel) : nullptr;
+    convertFrame(rowPair, bgrx, width, widthPitch, height, out);
+  }
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * BGRX to planar YCbCr 4:2:0 (I420) conversion, so that TurboJPEG can skip
+ * its own colour conversion and downsampling. Uses the full-range JFIF
+ * matrix in 8-bit fixed point; chroma is taken from the average of each 2x2
+ * block, with the last row/column repeated for odd sizes.
+ *
+ * Every implementation produces bit-identical output.
+ */
+namespace ColorConvert {
+
+  enum Kernel {
+    KERNEL_SCALAR,
+    KERNEL_SSE2,
+    KERNEL_AVX2,
+    KERNEL_COUNT
+  };
+
+  struct YuvPlanes {
+    unsigned char* y;
+    unsigned char* u; /* Cb */
+    unsigned char* v; /* Cr */
+    size_t yStride;
+    size_t uvStride;
+  };
+
+  const char* kernelName(Kernel kernel);
+
+  /** True if the kernel was compiled in and this CPU can run it. */
+  bool isSupported(Kernel kernel);
+
+  /** The fastest supported kernel, picked once on first use. */
+  Kernel bestKernel();
+
+  /** Converts with bestKernel(). */
+  void bgrxToI420(const unsigned char* bgrx, size_t width, size_t widthPitch,
+    size_t height, const YuvPlanes& out);
+
+  /** Converts with the given kernel, or scalar if it isn't supported. */
+  void bgrxToI420(Kernel kernel, const unsigned char* bgrx, size_t width,
+    size_t widthPitch, size_t height, const YuvPlanes& out);
+
+}
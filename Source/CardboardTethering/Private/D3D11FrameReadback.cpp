@@ -0,0 +1,164 @@
+#include "CardboardTetheringPrivatePCH.h"
+#include "D3D11FrameReadback.h"
+
+using WindowsHelpers::ComPtr;
+
+ComPtr<ID3D11Texture2D> StagingTexturePool::acquire(ID3D11Device* device,
+    const D3D11_TEXTURE2D_DESC& sourceDesc) {
+  for (size_t i = 0; i < _free.size(); ++i) {
+    const Entry& entry = _free[i];
+    if (entry.width == sourceDesc.Width &&
+        entry.height == sourceDesc.Height &&
+        entry.format == sourceDesc.Format) {
+      ComPtr<ID3D11Texture2D> texture = entry.texture;
+      _free.erase(_free.begin() + i);
+      return texture;
+    }
+  }
+
+  // Nothing matches, so the source was resized; textures of the old size
+  // won't be needed again.
+  _free.clear();
+
+  D3D11_TEXTURE2D_DESC desc = sourceDesc;
+  desc.BindFlags = 0;
+  desc.MiscFlags = 0;
+  desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+  desc.Usage = D3D11_USAGE_STAGING;
+
+  ComPtr<ID3D11Texture2D> texture;
+  if (SUCCEEDED(device->CreateTexture2D(&desc, nullptr, &texture))) {
+    _created++;
+  }
+  return texture;
+}
+
+void StagingTexturePool::release(ComPtr<ID3D11Texture2D> texture) {
+  if (texture.Get() == nullptr) {
+    return;
+  }
+
+  D3D11_TEXTURE2D_DESC desc;
+  texture->GetDesc(&desc);
+
+  Entry entry;
+  entry.width = desc.Width;
+  entry.height = desc.Height;
+  entry.format = desc.Format;
+  entry.texture = texture;
+  _free.push_back(entry);
+}
+
+uint64_t StagingTexturePool::freeBytes() const {
+  // Only 32-bit formats are read back.
+  uint64_t bytes = 0;
+  for (const Entry& entry : _free) {
+    bytes += static_cast<uint64_t>(entry.width) * entry.height * 4;
+  }
+  return bytes;
+}
+
+D3D11FrameReadback::D3D11FrameReadback(size_t latency)
+  : FrameReadback(latency),
+    _stagingBytes(0) {
+  _copies.resize(slotCount());
+  for (Copy& copy : _copies) {
+    copy.width = 0;
+    copy.height = 0;
+    copy.mapped = false;
+  }
+}
+
+D3D11FrameReadback::~D3D11FrameReadback() {
+  for (size_t i = 0; i < _copies.size(); ++i) {
+    release(i);
+  }
+}
+
+bool D3D11FrameReadback::supportsFormat(DXGI_FORMAT format) {
+  // We can only deal with BGRA/BGRX 32-bit formats.
+  switch (format) {
+    case DXGI_FORMAT_B8G8R8A8_TYPELESS:
+    case DXGI_FORMAT_B8G8R8X8_TYPELESS:
+    case DXGI_FORMAT_B8G8R8A8_UNORM:
+    case DXGI_FORMAT_B8G8R8X8_UNORM:
+    case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+    case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool D3D11FrameReadback::submit(ID3D11Texture2D* source,
+    const RenderPose& pose) {
+  D3D11_TEXTURE2D_DESC desc;
+  source->GetDesc(&desc);
+
+  if (desc.Width == 0 || desc.Height == 0 || !supportsFormat(desc.Format)) {
+    return false;
+  }
+
+  ComPtr<ID3D11Device> device;
+  source->GetDevice(&device);
+
+  if (_context.Get() == nullptr) {
+    device->GetImmediateContext(&_context);
+  }
+
+  int slot = beginSubmit();
+  if (slot < 0) {
+    return false;
+  }
+
+  Copy& copy = _copies[slot];
+  copy.staging = _pool.acquire(device.Get(), desc);
+  if (copy.staging.Get() == nullptr) {
+    endSubmit(slot, false, pose);
+    return false;
+  }
+
+  _context->CopyResource(copy.staging.Get(), source);
+  copy.width = desc.Width;
+  copy.height = desc.Height;
+
+  uint64_t bytes = _pool.freeBytes();
+  for (const Copy& other : _copies) {
+    if (other.staging.Get() != nullptr) {
+      bytes += static_cast<uint64_t>(other.width) * other.height * 4;
+    }
+  }
+  _stagingBytes.store(bytes);
+
+  endSubmit(slot, true, pose);
+  return true;
+}
+
+bool D3D11FrameReadback::tryResolve(size_t slot, FrameView* view) {
+  Copy& copy = _copies[slot];
+
+  D3D11_MAPPED_SUBRESOURCE mapped;
+  HRESULT hr = _context->Map(copy.staging.Get(), 0, D3D11_MAP_READ,
+    D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped);
+  if (hr == DXGI_ERROR_WAS_STILL_DRAWING || FAILED(hr)) {
+    return false;
+  }
+
+  copy.mapped = true;
+  view->data = static_cast<const unsigned char*>(mapped.pData);
+  view->width = copy.width;
+  view->widthPitch = mapped.RowPitch;
+  view->height = copy.height;
+  return true;
+}
+
+void D3D11FrameReadback::release(size_t slot) {
+  Copy& copy = _copies[slot];
+  if (copy.mapped) {
+    _context->Unmap(copy.staging.Get(), 0);
+    copy.mapped = false;
+  }
+
+  _pool.release(copy.staging);
+  copy.staging.Reset();
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include "FrameReadback.h"
+#include "WindowsHelpers.h"
+
+#include "AllowWindowsPlatformTypes.h"
+#define NOMINMAX
+#include <d3d11.h>
+#include "HideWindowsPlatformTypes.h"
+
+/**
+ * Staging textures kept alive across frames so that readback doesn't create
+ * a new texture every frame. Textures are keyed by size and format; when the
+ * source is resized, textures of the old size are dropped.
+ */
+class StagingTexturePool {
+  struct Entry {
+    UINT width;
+    UINT height;
+    DXGI_FORMAT format;
+    WindowsHelpers::ComPtr<ID3D11Texture2D> texture;
+  };
+
+  std::vector<Entry> _free;
+  size_t _created;
+
+public:
+  StagingTexturePool() : _created(0) {}
+
+  /** Returns a CPU-readable texture matching the source description. */
+  WindowsHelpers::ComPtr<ID3D11Texture2D> acquire(ID3D11Device* device,
+    const D3D11_TEXTURE2D_DESC& sourceDesc);
+  void release(WindowsHelpers::ComPtr<ID3D11Texture2D> texture);
+
+  size_t freeCount() const { return _free.size(); }
+  uint64_t freeBytes() const;
+  size_t createdCount() const { return _created; }
+};
+
+/**
+ * Reads back BGRA/BGRX render targets through pooled staging textures. Maps
+ * use D3D11_MAP_FLAG_DO_NOT_WAIT, so a copy the GPU hasn't finished yet is
+ * simply retried next frame instead of stalling the render thread.
+ *
+ * Must only be used from the thread that owns the immediate context.
+ */
+class D3D11FrameReadback : public FrameReadback {
+public:
+  explicit D3D11FrameReadback(size_t latency);
+  virtual ~D3D11FrameReadback();
+
+  /**
+   * Issues a copy of the source, remembering the pose it was rendered with;
+   * false if skipped or unsupported.
+   */
+  bool submit(ID3D11Texture2D* source, const RenderPose& pose);
+
+  static bool supportsFormat(DXGI_FORMAT format);
+  size_t pooledTextureCount() const { return _pool.createdCount(); }
+
+  /** Staging memory held, pooled or in flight; safe from any thread. */
+  uint64_t stagingBytes() const { return _stagingBytes.load(); }
+
+protected:
+  virtual bool tryResolve(size_t slot, FrameView* view) override;
+  virtual void release(size_t slot) override;
+
+private:
+  struct Copy {
+    WindowsHelpers::ComPtr<ID3D11Texture2D> staging;
+    size_t width;
+    size_t height;
+    bool mapped;
+  };
+
+  StagingTexturePool _pool;
+  WindowsHelpers::ComPtr<ID3D11DeviceContext> _context;
+  std::vector<Copy> _copies;
+  std::atomic<uint64_t> _stagingBytes;
+};
@@ -0,0 +1,147 @@
+#include "FrameHeader.h"
+#include <cstring>
+
+namespace {
+
+  void putBig(unsigned char* out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+      out[i] = static_cast<unsigned char>(value >> (8 * (bytes - 1 - i)));
+    }
+  }
+
+  uint64_t getBig(const unsigned char* p, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+      value = (value << 8) | p[i];
+    }
+    return value;
+  }
+
+  void putFloat(unsigned char* out, float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    putBig(out, bits, 4);
+  }
+
+  float getFloat(const unsigned char* p) {
+    uint32_t bits = static_cast<uint32_t>(getBig(p, 4));
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+}
+
+FrameHeader::FrameHeader()
+  : payloadLength(0),
+    version(VERSION),
+    eye(0),
+    eyeLayout(EYE_LAYOUT_SEPARATE),
+    codec(CODEC_JPEG),
+    frameId(0),
+    captureNs(0),
+    encodeNs(0),
+    sendNs(0) {}
+
+void FrameHeader::write(unsigned char* out) const {
+  std::memset(out, 0, LENGTH);
+  putBig(out, payloadLength, 4);
+  out[4] = version;
+  out[5] = static_cast<unsigned char>(LENGTH);
+  out[6] = eye;
+  out[7] = eyeLayout;
+  out[8] = codec;
+  putBig(out + 12, frameId, 8);
+  putBig(out + 20, pose.sequence, 4);
+  putFloat(out + 24, pose.x);
+  putFloat(out + 28, pose.y);
+  putFloat(out + 32, pose.z);
+  putFloat(out + 36, pose.w);
+  putBig(out + 40, static_cast<uint64_t>(captureNs), 8);
+  putBig(out + 48, static_cast<uint64_t>(encodeNs), 8);
+  putBig(out + 56, static_cast<uint64_t>(sendNs), 8);
+}
+
+int FrameHeader::parse(const unsigned char* data, size_t size,
+    FrameHeader* out) {
+  if (size < LENGTH) {
+    return -1;
+  }
+
+  FrameHeader header;
+  header.payloadLength = static_cast<uint32_t>(getBig(data, 4));
+  header.version = data[4];
+  size_t headerLength = data[5];
+  if (header.version < 1 || headerLength < LENGTH ||
+      size < headerLength + header.payloadLength) {
+    return -1;
+  }
+
+  header.eye = data[6];
+  header.eyeLayout = data[7];
+  header.codec = data[8];
+  if (header.eye >= EYE_COUNT || header.eyeLayout != EYE_LAYOUT_SEPARATE) {
+    return -1;
+  }
+
+  header.frameId = getBig(data + 12, 8);
+  header.pose.sequence = static_cast<uint32_t>(getBig(data + 20, 4));
+  header.pose.x = getFloat(data + 24);
+  header.pose.y = getFloat(data + 28);
+  header.pose.z = getFloat(data + 32);
+  header.pose.w = getFloat(data + 36);
+  header.captureNs = static_cast<int64_t>(getBig(data + 40, 8));
+  header.encodeNs = static_cast<int64_t>(getBig(data + 48, 8));
+  header.sendNs = static_cast<int64_t>(getBig(data + 56, 8));
+
+  *out = header;
+  return static_cast<int>(headerLength);
+}
+
+FrameReceiver::FrameReceiver()
+  : _started(false), _lastFrameId(0), _state(0) {}
+
+int FrameReceiver::feed(const unsigned char* data, size_t size) {
+  if (_state != 0) {
+    return _state;
+  }
+
+  int status = _parser.feed(data, size,
+    [this](const Message::Header& message, const unsigned char* payload) {
+      if (_state != 0) {
+        return;
+      } else if (message.type == Message::TYPE_END) {
+        _state = 1;
+        return;
+      } else if (message.type != Message::TYPE_FRAME) {
+        return;
+      }
+
+      FrameHeader header;
+      int headerLength = FrameHeader::parse(payload, message.length, &header);
+      if (headerLength < 0) {
+        _state = -1;
+        return;
+      }
+
+      const unsigned char* body = payload + headerLength;
+      if (_eyes[header.eye].apply(header.codec, body, header.payloadLength) != 0) {
+        _stats.rejected++;
+      }
+      _lastHeaders[header.eye] = header;
+      _stats.payloads++;
+
+      if (!_started || header.frameId > _lastFrameId) {
+        if (_started && header.frameId > _lastFrameId + 1) {
+          _stats.missingFrames += header.frameId - _lastFrameId - 1;
+        }
+        _started = true;
+        _lastFrameId = header.frameId;
+        _stats.frames++;
+      }
+    });
+  if (status != 0) {
+    _state = -1;
+  }
+  return _state;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "FramePipeline.h"
+#include "TileCodec.h"
+#include "MessageCodec.h"
+
+/**
+ * Versioned header at the start of every Message::TYPE_FRAME payload, in
+ * front of one eye's body. All integers are big-endian; times are the host's
+ * steady clock in ns, so only differences between them mean anything to the
+ * phone.
+ *
+ *   u32 payloadLength   Body bytes after the header.
+ *   u8  version         FrameHeader::VERSION.
+ *   u8  headerLength    Bytes in the whole header. Later versions only
+ *                       append fields, so receivers skip what they don't
+ *                       know.
+ *   u8  eye             EYE_LEFT or EYE_RIGHT.
+ *   u8  eyeLayout       EYE_LAYOUT_SEPARATE.
+ *   u8  codec           CODEC_JPEG or CODEC_TILES.
+ *   u8  reserved[3]     0.
+ *   u64 frameId         Counts captured frames; a gap means frames that
+ *                       were captured but never sent.
+ *   u32 poseSequence    Pose packet the render pose was predicted from.
+ *   f32 pose[4]         Render pose x, y, z, w, in the phone's axes.
+ *   i64 captureNs       Frame copied out of the render target.
+ *   i64 encodeNs        Both eyes encoded.
+ *   i64 sendNs          This payload handed to USB.
+ */
+struct FrameHeader {
+  static constexpr uint8_t VERSION = 1;
+  static constexpr size_t LENGTH = 64;
+
+  /** Each eye is its own payload; the only layout so far. */
+  static constexpr uint8_t EYE_LAYOUT_SEPARATE = 0;
+
+  uint32_t payloadLength;
+  uint8_t version;
+  uint8_t eye;
+  uint8_t eyeLayout;
+  uint8_t codec;
+  uint64_t frameId;
+  RenderPose pose;
+  int64_t captureNs;
+  int64_t encodeNs;
+  int64_t sendNs;
+
+  FrameHeader();
+
+  /** Writes LENGTH bytes. */
+  void write(unsigned char* out) const;
+
+  /**
+   * Reads a header from the start of a message payload. Returns the bytes
+   * it takes up, or -1 if it is malformed or the body doesn't fit in size.
+   */
+  static int parse(const unsigned char* data, size_t size, FrameHeader* out);
+};
+
+/**
+ * Reference receiver for the host's message stream: applies frame messages
+ * to a TileCompositor per eye, the way the phone does, while counting
+ * frames and the gaps between them. Other message types are skipped.
+ */
+class FrameReceiver {
+public:
+  struct Stats {
+    uint64_t payloads;
+    uint64_t frames;
+    uint64_t missingFrames; /* Gaps in frameId. */
+    uint64_t rejected;      /* Bodies the compositor couldn't apply. */
+
+    Stats() : payloads(0), frames(0), missingFrames(0), rejected(0) {}
+  };
+
+  FrameReceiver();
+
+  FrameReceiver(const FrameReceiver&) = delete;
+  FrameReceiver& operator=(const FrameReceiver&) = delete;
+
+  /**
+   * Appends stream bytes and applies every complete message. Returns 0, 1
+   * once Message::TYPE_END has been read, or -1 if a message was malformed;
+   * the stream can't be resynchronized after that.
+   */
+  int feed(const unsigned char* data, size_t size);
+
+  const TileCompositor& eye(size_t eye) const { return _eyes[eye]; }
+  const FrameHeader& lastHeader(size_t eye) const { return _lastHeaders[eye]; }
+  Stats getStats() const { return _stats; }
+
+private:
+  Message::Parser _parser;
+  TileCompositor _eyes[EYE_COUNT];
+  FrameHeader _lastHeaders[EYE_COUNT];
+  bool _started;
+  uint64_t _lastFrameId;
+  int _state;
+  Stats _stats;
+};
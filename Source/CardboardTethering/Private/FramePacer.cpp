@@ -0,0 +1,198 @@
+#include "FramePacer.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+  /** Rounds towards negative infinity, unlike integer division. */
+  int64_t floorDiv(int64_t a, int64_t b) {
+    int64_t q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+  }
+}
+
+FramePacer::FramePacer() : _hintPeriodNs(0) {
+  reset();
+}
+
+void FramePacer::setSettings(const Settings& settings) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _settings = settings;
+  _settings.leadMs = std::max(settings.leadMs, 0.0);
+}
+
+FramePacer::Settings FramePacer::getSettings() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _settings;
+}
+
+void FramePacer::reset() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _periodNs = _hintPeriodNs;
+  _lastVsyncNs = 0;
+  _vsyncs = 0;
+  _offsets.clear();
+  _offsetNs = 0;
+
+  _releases.clear();
+  _scheduledAtNs = 0;
+  _pendingTargetNs = 0;
+  _lastTargetNs = 0;
+  _totalWaitNs = 0;
+  _releaseCount = 0;
+
+  _pipelines.clear();
+  _pipelineNs = 0;
+
+  _errors.clear();
+  _lastArrivedFrameId = 0;
+  _haveArrival = false;
+  _arrivals = 0;
+  _missed = 0;
+}
+
+void FramePacer::setRefreshHint(uint32_t refreshMilliHz) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _hintPeriodNs = refreshMilliHz > 0 ?
+    static_cast<int64_t>(1e12 / refreshMilliHz) : 0;
+  if (_vsyncs == 0) {
+    _periodNs = _hintPeriodNs;
+  }
+}
+
+bool FramePacer::locked() const {
+  return _periodNs > 0 && _vsyncs > 0 && _pipelines.size() >= MIN_PIPELINE_SAMPLES;
+}
+
+int64_t FramePacer::nextVsync(int64_t deviceNs) const {
+  // The first vsync at or after deviceNs, extrapolated from the latest one.
+  int64_t periods = floorDiv(deviceNs - _lastVsyncNs + _periodNs - 1, _periodNs);
+  return _lastVsyncNs + periods * _periodNs;
+}
+
+void FramePacer::addVsync(int64_t deviceVsyncNs, uint32_t periodNs,
+    int64_t hostReceivedNs) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (periodNs > 0) {
+    _periodNs = periodNs;
+  } else if (_vsyncs > 0 && _hintPeriodNs == 0 && deviceVsyncNs > _lastVsyncNs) {
+    // No period from anywhere; take the shortest gap between reports.
+    int64_t gap = deviceVsyncNs - _lastVsyncNs;
+    _periodNs = _periodNs > 0 ? std::min(_periodNs, gap) : gap;
+  }
+  if (deviceVsyncNs > _lastVsyncNs) {
+    _lastVsyncNs = deviceVsyncNs;
+  }
+  _vsyncs++;
+
+  _offsets.push(hostReceivedNs - deviceVsyncNs);
+  _offsetNs = *std::min_element(_offsets.values().begin(), _offsets.values().end());
+}
+
+void FramePacer::addArrival(uint64_t frameId, int64_t deviceArrivalNs) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (_haveArrival && frameId == _lastArrivedFrameId) {
+    return;
+  }
+  _haveArrival = true;
+  _lastArrivedFrameId = frameId;
+
+  const std::vector<Release>& releases = _releases.values();
+  auto release = std::find_if(releases.begin(), releases.end(),
+    [&](const Release& r) { return r.frameId == frameId; });
+  if (release == releases.end() || _offsets.empty()) {
+    return;
+  }
+  _arrivals++;
+
+  _pipelines.push(deviceArrivalNs + _offsetNs - release->hostNs);
+  _pipelineNs = percentileOf(_pipelines.values(), PIPELINE_PERCENTILE);
+
+  // Unpaced frames are measured against the vsync that will show them.
+  if (_periodNs <= 0 || _vsyncs == 0) {
+    return;
+  }
+  int64_t leadNs = static_cast<int64_t>(_settings.leadMs * 1e6);
+  int64_t targetNs = release->targetNs;
+  if (targetNs == 0) {
+    targetNs = nextVsync(deviceArrivalNs + leadNs);
+  } else if (deviceArrivalNs > targetNs) {
+    _missed++;
+  }
+  _errors.push(deviceArrivalNs - (targetNs - leadNs));
+}
+
+int64_t FramePacer::releaseTime(int64_t hostNowNs) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _scheduledAtNs = hostNowNs;
+  _pendingTargetNs = 0;
+  if (!_settings.enabled || !locked()) {
+    return hostNowNs;
+  }
+
+  // Aim for the first vsync the frame can make if released now, but never
+  // the same one as the previous frame.
+  int64_t leadNs = static_cast<int64_t>(_settings.leadMs * 1e6);
+  int64_t earliestNs = hostNowNs - _offsetNs + _pipelineNs;
+  int64_t targetNs = nextVsync(earliestNs + leadNs);
+  if (_lastTargetNs != 0 && targetNs < _lastTargetNs + _periodNs / 2) {
+    targetNs = nextVsync(_lastTargetNs + _periodNs / 2);
+  }
+
+  int64_t releaseNs = targetNs - leadNs - _pipelineNs + _offsetNs;
+  if (releaseNs - hostNowNs > 2 * _periodNs) {
+    // The reports have gone stale or jumped; don't stall the stream on them.
+    return hostNowNs;
+  }
+  _pendingTargetNs = targetNs;
+  return std::max(releaseNs, hostNowNs);
+}
+
+void FramePacer::released(uint64_t frameId, int64_t hostNs) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  Release release = { frameId, hostNs, _pendingTargetNs };
+  _releases.push(release);
+  if (_pendingTargetNs != 0) {
+    _lastTargetNs = _pendingTargetNs;
+  }
+  if (_scheduledAtNs != 0) {
+    _totalWaitNs += std::max<int64_t>(hostNs - _scheduledAtNs, 0);
+  }
+  _releaseCount++;
+  _pendingTargetNs = 0;
+  _scheduledAtNs = 0;
+}
+
+FramePacer::Stats FramePacer::getStats() const {
+  std::vector<int64_t> errors;
+  Stats stats = {};
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    errors = _errors.values();
+    stats.locked = locked();
+    stats.refreshHz = _periodNs > 0 ? 1e9 / _periodNs : 0.0;
+    stats.pipelineMs = _pipelineNs / 1e6;
+    stats.vsyncs = _vsyncs;
+    stats.arrivals = _arrivals;
+    stats.missed = _missed;
+    stats.averageWaitMs = _releaseCount > 0 ?
+      _totalWaitNs / 1e6 / _releaseCount : 0.0;
+  }
+
+  stats.samples = errors.size();
+  if (errors.empty()) {
+    return stats;
+  }
+
+  double sum = 0.0;
+  for (int64_t& error : errors) {
+    sum += error;
+    error = std::abs(error);
+  }
+  stats.meanErrorMs = sum / errors.size() / 1e6;
+
+  std::sort(errors.begin(), errors.end());
+  stats.p50Ms = percentileOfSorted(errors, 50) / 1e6;
+  stats.p90Ms = percentileOfSorted(errors, 90) / 1e6;
+  stats.p99Ms = percentileOfSorted(errors, 99) / 1e6;
+  return stats;
+}
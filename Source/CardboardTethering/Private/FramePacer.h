@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include "SampleWindow.h"
+
+/**
+ * Times frames to reach the phone just before its display refreshes. The
+ * phone reports every vsync (Message::TYPE_VSYNC) on its own clock, along
+ * with when the last complete frame arrived. From those the pacer tracks:
+ *
+ *   - the vsync period and phase, on the phone's clock;
+ *   - the phone-to-host clock offset, as the smallest (host receive time -
+ *     phone vsync time) seen recently. It includes the report's transit
+ *     time, but every time converted with it does too, so that cancels out;
+ *   - how long a frame takes from being released to the encoder until it
+ *     has arrived on the phone, at a high percentile.
+ *
+ * The encode worker asks releaseTime() when to take the newest captured
+ * frame so that it arrives leadMs before a vsync, one frame per vsync, and
+ * says when it actually did with released(). Pacing error is how far each
+ * arrival was from the point it was aimed at (positive is late).
+ *
+ * All times are in ns; host times are steadyClockNs(). Thread-safe: the read
+ * loop reports vsyncs while the encode worker asks for release times.
+ */
+class FramePacer {
+public:
+  struct Settings {
+    bool enabled;
+    double leadMs; /* How long before the vsync a frame should arrive. */
+
+    Settings() : enabled(true), leadMs(2.0) {}
+  };
+
+  struct Stats {
+    bool locked;         /* Enough reports to pace by. */
+    double refreshHz;
+    double pipelineMs;   /* Release to arrival, as used for pacing. */
+    uint64_t vsyncs;
+    uint64_t arrivals;
+    uint64_t missed;     /* Arrived after the vsync they were aimed at. */
+    double averageWaitMs; /* Time frames were held back for pacing. */
+
+    /** Pacing error over the last WINDOW arrivals. */
+    size_t samples;
+    double meanErrorMs;
+    double p50Ms;        /* Of the absolute error. */
+    double p90Ms;
+    double p99Ms;
+  };
+
+  /** Reports, releases and arrivals remembered. */
+  static constexpr size_t WINDOW = 240;
+
+  /** Arrivals measured before pacing starts. */
+  static constexpr size_t MIN_PIPELINE_SAMPLES = 8;
+
+  /** Percentile of the release-to-arrival times that is paced for. */
+  static constexpr size_t PIPELINE_PERCENTILE = 90;
+
+  FramePacer();
+
+  FramePacer(const FramePacer&) = delete;
+  FramePacer& operator=(const FramePacer&) = delete;
+
+  void setSettings(const Settings& settings);
+  Settings getSettings() const;
+
+  /** Forgets everything measured, e.g. for a new connection; keeps settings. */
+  void reset();
+
+  /** The refresh rate from the handshake, until reports say otherwise. */
+  void setRefreshHint(uint32_t refreshMilliHz);
+
+  /** A vsync report; periodNs is 0 if the phone doesn't know it. */
+  void addVsync(int64_t deviceVsyncNs, uint32_t periodNs, int64_t hostReceivedNs);
+
+  /** The phone received all of a frame; repeated reports are ignored. */
+  void addArrival(uint64_t frameId, int64_t deviceArrivalNs);
+
+  /**
+   * When to release the next frame to the encoder, given the host time now.
+   * Returns hostNowNs when not pacing (disabled, or not locked yet).
+   */
+  int64_t releaseTime(int64_t hostNowNs);
+
+  /** The encoder took frameId at hostNs, after the last releaseTime(). */
+  void released(uint64_t frameId, int64_t hostNs);
+
+  Stats getStats() const;
+
+private:
+  struct Release {
+    uint64_t frameId;
+    int64_t hostNs;
+    int64_t targetNs; /* Phone vsync aimed at, or 0 if unpaced. */
+  };
+
+  mutable std::mutex _mutex;
+  Settings _settings;
+
+  int64_t _hintPeriodNs;
+  int64_t _periodNs;   /* 0 until known. */
+  int64_t _lastVsyncNs;
+  uint64_t _vsyncs;
+  SampleWindow<int64_t, WINDOW> _offsets; /* Host minus phone. */
+  int64_t _offsetNs;
+
+  SampleWindow<Release, WINDOW> _releases;
+  int64_t _scheduledAtNs;
+  int64_t _pendingTargetNs;
+  int64_t _lastTargetNs;
+  int64_t _totalWaitNs;
+  uint64_t _releaseCount;
+
+  SampleWindow<int64_t, WINDOW> _pipelines;
+  int64_t _pipelineNs;
+
+  SampleWindow<int64_t, WINDOW> _errors;
+  uint64_t _lastArrivedFrameId;
+  bool _haveArrival;
+  uint64_t _arrivals;
+  uint64_t _missed;
+
+  bool locked() const;
+  int64_t nextVsync(int64_t deviceNs) const;
+};
@@ -0,0 +1,106 @@
+#include "FramePipeline.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "turbojpeg.h"
+
+int64_t steadyClockNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FrameView eyeView(const FrameView& frame, size_t eye) {
+  // An odd width gives the extra column to the right eye.
+  size_t leftWidth = frame.width / 2;
+
+  FrameView view = frame;
+  if (eye == EYE_LEFT) {
+    view.width = leftWidth;
+  } else {
+    view.data = frame.data + leftWidth * 4;
+    view.width = frame.width - leftWidth;
+  }
+  return view;
+}
+
+void copyAsBgrx(const FrameView& frame, unsigned char* out) {
+  std::memcpy(out, frame.data, frame.widthPitch * frame.height);
+  if (frame.format == FORMAT_BGRX) {
+    return;
+  }
+
+  for (size_t y = 0; y < frame.height; ++y) {
+    unsigned char* row = out + y * frame.widthPitch;
+    for (size_t x = 0; x < frame.width; ++x) {
+      std::swap(row[x * 4], row[x * 4 + 2]);
+    }
+  }
+}
+
+FrameView downscaleFrame(const FrameView& frame, size_t factor,
+    AlignedBuffer* storage) {
+  if (factor <= 1) {
+    return frame;
+  }
+
+  FrameView view = frame;
+  view.width = std::max<size_t>(frame.width / factor, 1);
+  view.height = std::max<size_t>(frame.height / factor, 1);
+  view.widthPitch = view.width * 4;
+  if (!storage->reserve(view.widthPitch * view.height)) {
+    return frame;
+  }
+  view.data = storage->data();
+
+  // Clamp the box to the source so odd sizes don't read past the edge.
+  unsigned char* out = storage->data();
+  for (size_t y = 0; y < view.height; ++y) {
+    size_t y0 = y * factor;
+    size_t y1 = std::min(y0 + factor, frame.height);
+    for (size_t x = 0; x < view.width; ++x) {
+      size_t x0 = x * factor;
+      size_t x1 = std::min(x0 + factor, frame.width);
+
+      uint32_t sum[4] = {};
+      for (size_t sy = y0; sy < y1; ++sy) {
+        const unsigned char* px = frame.data + sy * frame.widthPitch + x0 * 4;
+        for (size_t sx = x0; sx < x1; ++sx, px += 4) {
+          sum[0] += px[0];
+          sum[1] += px[1];
+          sum[2] += px[2];
+          sum[3] += px[3];
+        }
+      }
+
+      uint32_t count = static_cast<uint32_t>((y1 - y0) * (x1 - x0));
+      for (int c = 0; c < 4; ++c) {
+        *out++ = static_cast<unsigned char>((sum[c] + count / 2) / count);
+      }
+    }
+  }
+
+  return view;
+}
+
+EncodedEye::EncodedEye()
+  : codec(CODEC_JPEG), jpegBuffer(nullptr), jpegBufferCapacity(0),
+    jpegBufferSize(0), encodeMs(0.0), sequence(0) {}
+
+EncodedEye::~EncodedEye() {
+  if (jpegBuffer != nullptr) {
+    tjFree(jpegBuffer);
+  }
+}
+
+double EyeStats::averageBytes() const {
+  return payloads == 0 ? 0.0 : static_cast<double>(bytes) / payloads;
+}
+
+double EyeStats::averageEncodeMs() const {
+  return payloads == 0 ? 0.0 : encodeMs / payloads;
+}
+
+double EyeStats::averageSendMs() const {
+  return payloads == 0 ? 0.0 : sendMs / payloads;
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "AlignedBuffer.h"
+
+/**
+ * Head orientation a frame was rendered with, in the phone's axes (see
+ * PoseSample) so the phone can compare it directly with its own sensor.
+ */
+struct RenderPose {
+  float x;
+  float y;
+  float z;
+  float w;
+  uint32_t sequence; /* Pose packet the orientation came from; 0 for none. */
+  int64_t receivedNs; /* When that packet arrived; not sent to the phone. */
+
+  RenderPose() : x(0.0f), y(0.0f), z(0.0f), w(1.0f), sequence(0),
+      receivedNs(0) {}
+};
+
+/** Byte order of a captured pixel; the encoder works on FORMAT_BGRX. */
+enum PixelFormat : uint8_t {
+  FORMAT_BGRX, /* D3D11 render targets. */
+  FORMAT_RGBX  /* GL and most image files; swizzled on the way in. */
+};
+
+/** CPU-visible frame owned by someone else, e.g. a mapped texture. */
+struct FrameView {
+  const unsigned char* data;
+  size_t width;
+  size_t widthPitch;
+  size_t height;
+  PixelFormat format;
+  uint64_t frameId;
+  RenderPose pose;
+  int64_t captureNs; /* steadyClockNs() when captured; 0 for when published. */
+
+  FrameView() : data(nullptr), width(0), widthPitch(0), height(0),
+      format(FORMAT_BGRX), frameId(0), captureNs(0) {}
+};
+
+/** BGRX frame copied out of the render target, waiting to be encoded. */
+struct RawFrame {
+  AlignedBuffer pixels;
+  size_t width;
+  size_t widthPitch;
+  size_t height;
+  uint64_t frameId;
+  RenderPose pose;
+  int64_t captureNs; /* steadyClockNs() when copied out of the readback. */
+
+  RawFrame() : width(0), widthPitch(0), height(0), frameId(0), captureNs(0) {}
+};
+
+/** Nanoseconds on the host's steady clock, for frame timestamps. */
+int64_t steadyClockNs();
+
+/** Eyes in a side-by-side frame; the left eye is the left half. */
+static constexpr size_t EYE_LEFT = 0;
+static constexpr size_t EYE_RIGHT = 1;
+static constexpr size_t EYE_COUNT = 2;
+
+/** The half of a side-by-side frame that belongs to the given eye. */
+FrameView eyeView(const FrameView& frame, size_t eye);
+
+/**
+ * Copies the frame's widthPitch * height bytes to out as FORMAT_BGRX,
+ * swapping red and blue if needed. Padding at the end of rows is copied as is.
+ */
+void copyAsBgrx(const FrameView& frame, unsigned char* out);
+
+/**
+ * Box-filters the frame down by an integer factor into storage and returns a
+ * view of the result. A factor of 1 returns the frame unchanged.
+ */
+FrameView downscaleFrame(const FrameView& frame, size_t factor,
+  AlignedBuffer* storage);
+
+/** How an eye payload's body is encoded; see TileCodec.h for CODEC_TILES. */
+static constexpr uint8_t CODEC_JPEG = 0;  /* The whole eye as one JPEG. */
+static constexpr uint8_t CODEC_TILES = 1; /* Changed tiles only. */
+
+/**
+ * One eye's compressed image. The body on the wire is the prefix (codec
+ * specific, may be empty) followed by the JPEG.
+ */
+struct EncodedEye {
+  uint8_t codec;
+  std::vector<unsigned char> prefix;
+  unsigned char* jpegBuffer; /* Allocated by TurboJPEG. */
+  unsigned long jpegBufferCapacity;
+  size_t jpegBufferSize;
+  double encodeMs;
+  uint64_t sequence; /* From TileEncoder; 0 if it wasn't used. */
+
+  size_t bodySize() const { return prefix.size() + jpegBufferSize; }
+
+  EncodedEye();
+  ~EncodedEye();
+
+  EncodedEye(const EncodedEye&) = delete;
+  EncodedEye& operator=(const EncodedEye&) = delete;
+};
+
+/**
+ * Compressed frame waiting to be transmitted. The eyes are encoded and sent
+ * as separate payloads so the receiver can decode one while the other is
+ * still in flight.
+ */
+struct EncodedFrame {
+  EncodedEye eyes[EYE_COUNT];
+  uint64_t frameId;
+  double encodeMs; /* Wall time for both eyes. */
+  uint64_t settingsGeneration; /* See RateController::Settings. */
+  RenderPose pose;
+  int64_t captureNs;
+  int64_t encodedNs; /* steadyClockNs() when both eyes were done. */
+
+  EncodedFrame() : frameId(0), encodeMs(0.0), settingsGeneration(0),
+      captureNs(0), encodedNs(0) {}
+};
+
+/** Totals for one eye's payloads, for finding imbalance between the eyes. */
+struct EyeStats {
+  uint64_t payloads;
+  uint64_t keyframes; /* Payloads sent as a whole CODEC_JPEG image. */
+  uint64_t bytes;
+  double encodeMs;
+  double sendMs;
+
+  EyeStats() : payloads(0), keyframes(0), bytes(0), encodeMs(0.0), sendMs(0.0) {}
+
+  double averageBytes() const;
+  double averageEncodeMs() const;
+  double averageSendMs() const;
+};
+
+/**
+ * Bytes held by one device's streaming buffers. Everything is sized from the
+ * frames actually streamed and reused from frame to frame, so this settles
+ * after the first few frames and only grows again on a resize.
+ */
+struct MemoryStats {
+  uint64_t staging; /* GPU readback textures. */
+  uint64_t frames;  /* Raw frames between readback and encode. */
+  uint64_t encoder; /* Downscale, colour conversion, strip and tile scratch. */
+  uint64_t jpeg;    /* Encoded eyes between encode and send. */
+
+  MemoryStats() : staging(0), frames(0), encoder(0), jpeg(0) {}
+
+  uint64_t total() const { return staging + frames + encoder + jpeg; }
+};
+
+/**
+ * Per-stage counters for the readback -> encode -> transmit pipeline. A frame
+ * dropped before a stage was overwritten by a newer frame while that stage
+ * was still busy, so the stage with the most drops behind it is the
+ * bottleneck.
+ */
+struct PipelineStats {
+  uint64_t captured;            /* Frames read back on the render thread. */
+  uint64_t captureRejected;     /* Frames the source couldn't read back. */
+  uint64_t droppedBeforeEncode;
+  uint64_t encoded;
+  uint64_t droppedBeforeSend;
+  uint64_t sent;
+
+  PipelineStats() : captured(0), captureRejected(0), droppedBeforeEncode(0),
+      encoded(0), droppedBeforeSend(0), sent(0) {}
+};
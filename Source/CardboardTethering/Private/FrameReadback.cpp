@@ -0,0 +1,167 @@
+#include "FrameReadback.h"
+#include <algorithm>
+#include <cstring>
+
+double FrameReadback::Stats::averageLatencyFrames() const {
+  if (delivered == 0) {
+    return 0.0;
+  }
+  return static_cast<double>(latencyFramesTotal) / delivered;
+}
+
+FrameReadback::FrameReadback(size_t latency)
+  : _latency(std::max<size_t>(latency, 1)),
+    _oldest(0),
+    _next(0),
+    _inFlight(0),
+    _tick(0),
+    _nextFrameId(0),
+    _submitted(0),
+    _skipped(0),
+    _delivered(0),
+    _superseded(0),
+    _notReady(0),
+    _latencyFramesTotal(0) {
+  // One slot per frame of latency, plus the one being submitted this frame.
+  _slots.resize(_latency + 1);
+  for (Slot& slot : _slots) {
+    slot.inFlight = false;
+    slot.tick = 0;
+    slot.frameId = 0;
+  }
+}
+
+FrameReadback::~FrameReadback() {}
+
+int FrameReadback::beginSubmit() {
+  ++_tick;
+
+  if (_slots[_next].inFlight) {
+    // The oldest copy still hasn't resolved; don't wait for it.
+    _skipped++;
+    return -1;
+  }
+
+  return static_cast<int>(_next);
+}
+
+void FrameReadback::endSubmit(size_t slot, bool issued,
+    const RenderPose& pose) {
+  if (!issued) {
+    return;
+  }
+
+  Slot& s = _slots[slot];
+  s.inFlight = true;
+  s.tick = _tick;
+  s.frameId = _nextFrameId++;
+  s.pose = pose;
+
+  _next = (_next + 1) % _slots.size();
+  ++_inFlight;
+  _submitted++;
+}
+
+void FrameReadback::poll(const Consumer& consumer) {
+  int newest = -1;
+  FrameView newestView;
+  uint64_t newestAge = 0;
+
+  while (_inFlight > 0) {
+    Slot& slot = _slots[_oldest];
+    uint64_t age = _tick - slot.tick;
+    if (age < _latency) {
+      break;
+    }
+
+    FrameView view;
+    if (!tryResolve(_oldest, &view)) {
+      _notReady++;
+      break;
+    }
+    view.frameId = slot.frameId;
+    view.pose = slot.pose;
+
+    // Only the newest ready frame is worth copying out; downstream stages
+    // would drop the older ones anyway.
+    if (newest >= 0) {
+      release(newest);
+      _superseded++;
+    }
+    newest = static_cast<int>(_oldest);
+    newestView = view;
+    newestAge = age;
+
+    slot.inFlight = false;
+    _oldest = (_oldest + 1) % _slots.size();
+    --_inFlight;
+  }
+
+  if (newest >= 0) {
+    consumer(newestView);
+    release(newest);
+    _delivered++;
+    _latencyFramesTotal += newestAge;
+  }
+}
+
+bool FrameReadback::deliver(FrameSink* sink) {
+  bool delivered = false;
+  poll([&](const FrameView& view) {
+    sink->publishFrame(view);
+    delivered = true;
+  });
+  return delivered;
+}
+
+FrameReadback::Stats FrameReadback::getStats() const {
+  Stats stats;
+  stats.submitted = _submitted.load();
+  stats.skipped = _skipped.load();
+  stats.delivered = _delivered.load();
+  stats.superseded = _superseded.load();
+  stats.notReady = _notReady.load();
+  stats.latencyFramesTotal = _latencyFramesTotal.load();
+  return stats;
+}
+
+CpuFrameReadback::CpuFrameReadback(size_t latency, size_t readyDelay)
+  : FrameReadback(latency),
+    _readyDelay(readyDelay) {
+  _copies.resize(slotCount());
+}
+
+bool CpuFrameReadback::submit(const unsigned char* data,
+    size_t width, size_t widthPitch, size_t height,
+    const RenderPose& pose) {
+  int slot = beginSubmit();
+  if (slot < 0) {
+    return false;
+  }
+
+  Copy& copy = _copies[slot];
+  size_t sizeNeeded = widthPitch * height;
+  if (copy.pixels.size() < sizeNeeded) {
+    copy.pixels.resize(sizeNeeded);
+  }
+  std::memcpy(copy.pixels.data(), data, sizeNeeded);
+  copy.width = width;
+  copy.widthPitch = widthPitch;
+  copy.height = height;
+
+  endSubmit(slot, true, pose);
+  return true;
+}
+
+bool CpuFrameReadback::tryResolve(size_t slot, FrameView* view) {
+  if (currentTick() - submitTick(slot) < _readyDelay) {
+    return false;
+  }
+
+  const Copy& copy = _copies[slot];
+  view->data = copy.pixels.data();
+  view->width = copy.width;
+  view->widthPitch = copy.widthPitch;
+  view->height = copy.height;
+  return true;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <vector>
+#include <functional>
+#include "FrameSource.h"
+
+/**
+ * Ring of in-flight frame copies. Each rendered frame, the owner submits a
+ * copy into the next free slot and then polls; a copy is only resolved (e.g.
+ * mapped) once it is at least `latency` frames old, and resolving never
+ * waits, so the caller is never stalled on a copy that hasn't finished.
+ *
+ * Subclasses supply the actual copy mechanism. Submitting is subclass
+ * specific since the source type differs, but always goes through
+ * beginSubmit/endSubmit so that the ring accounting lives here.
+ */
+class FrameReadback : public FrameSource {
+public:
+  using Consumer = std::function<void(const FrameView&)>;
+
+  struct Stats {
+    uint64_t submitted;  /* Copies issued. */
+    uint64_t skipped;    /* Frames not copied because every slot was busy. */
+    uint64_t delivered;  /* Frames handed to the consumer. */
+    uint64_t superseded; /* Resolved, but a newer frame was also ready. */
+    uint64_t notReady;   /* Polls where the oldest copy was still pending. */
+    uint64_t latencyFramesTotal;
+
+    /** Average age, in frames, of a copy when it is delivered. */
+    double averageLatencyFrames() const;
+  };
+
+  explicit FrameReadback(size_t latency);
+  virtual ~FrameReadback();
+
+  FrameReadback(const FrameReadback&) = delete;
+  FrameReadback& operator=(const FrameReadback&) = delete;
+
+  /**
+   * Resolves every copy that is old enough and ready, and hands the newest of
+   * them to the consumer. The view is only valid during the callback.
+   */
+  void poll(const Consumer& consumer);
+
+  /** poll() into the sink. */
+  virtual bool deliver(FrameSink* sink) override;
+
+  size_t latency() const { return _latency; }
+  size_t slotCount() const { return _slots.size(); }
+  size_t inFlight() const { return _inFlight; }
+  Stats getStats() const;
+
+protected:
+  /**
+   * Advances the frame clock and returns the slot the next copy should go
+   * into, or -1 if the ring is full and this frame must be skipped.
+   */
+  int beginSubmit();
+
+  /**
+   * Marks a slot from beginSubmit as in flight (or as unused on failure).
+   * The pose is handed back with the frame when it is delivered.
+   */
+  void endSubmit(size_t slot, bool issued, const RenderPose& pose);
+
+  uint64_t currentTick() const { return _tick; }
+  uint64_t submitTick(size_t slot) const { return _slots[slot].tick; }
+
+  /** Makes the slot's copy readable without blocking; false if not done. */
+  virtual bool tryResolve(size_t slot, FrameView* view) = 0;
+
+  /** Undoes tryResolve once the frame has been consumed or discarded. */
+  virtual void release(size_t slot) = 0;
+
+private:
+  struct Slot {
+    bool inFlight;
+    uint64_t tick;
+    uint64_t frameId;
+    RenderPose pose;
+  };
+
+  size_t _latency;
+  std::vector<Slot> _slots;
+  size_t _oldest;
+  size_t _next;
+  size_t _inFlight;
+  uint64_t _tick;
+  uint64_t _nextFrameId;
+
+  // Read from other threads for stats.
+  std::atomic<uint64_t> _submitted;
+  std::atomic<uint64_t> _skipped;
+  std::atomic<uint64_t> _delivered;
+  std::atomic<uint64_t> _superseded;
+  std::atomic<uint64_t> _notReady;
+  std::atomic<uint64_t> _latencyFramesTotal;
+};
+
+/**
+ * Readback that copies from CPU memory. Copies become ready after a
+ * configurable number of frames, simulating a GPU that runs behind the CPU,
+ * which makes the ring and latency accounting testable without a GPU.
+ */
+class CpuFrameReadback : public FrameReadback {
+public:
+  CpuFrameReadback(size_t latency, size_t readyDelay);
+
+  bool submit(const unsigned char* data,
+    size_t width, size_t widthPitch, size_t height,
+    const RenderPose& pose = RenderPose());
+
+protected:
+  virtual bool tryResolve(size_t slot, FrameView* view) override;
+  virtual void release(size_t /*slot*/) override {}
+
+private:
+  struct Copy {
+    std::vector<unsigned char> pixels;
+    size_t width;
+    size_t widthPitch;
+    size_t height;
+  };
+
+  size_t _readyDelay;
+  std::vector<Copy> _copies;
+};
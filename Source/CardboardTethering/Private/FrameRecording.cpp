@@ -0,0 +1,246 @@
+#include "FrameRecording.h"
+#include "EndianUtils.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include "turbojpeg.h"
+
+namespace {
+
+const char FILE_MAGIC[4] = { 'C', 'T', 'F', 'R' };
+constexpr uint32_t MAX_FILE_DIMENSION = 16384;
+
+// Two strips take the edge off compressing on the render thread without
+// taking cores from the game.
+constexpr size_t ENCODE_THREADS = 2;
+
+void writeU32(std::ofstream& out, uint32_t value) {
+  value = EndianUtils::nativeToBig(value);
+  out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void writeFloat(std::ofstream& out, float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  writeU32(out, bits);
+}
+
+bool readU32(std::ifstream& in, uint32_t* value) {
+  if (!in.read(reinterpret_cast<char*>(value), sizeof(*value))) {
+    return false;
+  }
+  *value = EndianUtils::bigToNative(*value);
+  return true;
+}
+
+bool readFloat(std::ifstream& in, float* value) {
+  uint32_t bits;
+  if (!readU32(in, &bits)) {
+    return false;
+  }
+  std::memcpy(value, &bits, sizeof(bits));
+  return true;
+}
+
+}
+
+FrameRecording::FrameRecording(size_t maxBytes)
+  : _maxBytes(maxBytes),
+    _bytes(0),
+    _full(false),
+    _jpegBuffer(nullptr),
+    _jpegCapacity(0) {}
+
+FrameRecording::~FrameRecording() {
+  tjFree(_jpegBuffer);
+}
+
+bool FrameRecording::publishFrame(const FrameView& view) {
+  if (isFull()) {
+    return false;
+  }
+
+  // Swizzle and pack into our own copy first; the encoder only takes BGRX.
+  _pixels.resize(view.width * 4 * view.height);
+  FrameView tight = view;
+  for (size_t y = 0; y < view.height; ++y) {
+    tight.data = view.data + y * view.widthPitch;
+    tight.widthPitch = view.width * 4;
+    tight.height = 1;
+    copyAsBgrx(tight, _pixels.data() + y * view.width * 4);
+  }
+  tight.data = _pixels.data();
+  tight.height = view.height;
+  tight.format = FORMAT_BGRX;
+
+  if (!_encoder) {
+    _encoder.reset(new JpegEncoder(ENCODE_THREADS));
+  }
+  unsigned long jpegSize = 0;
+  if (_encoder->encode(tight, QUALITY, TJSAMP_444,
+      &_jpegBuffer, &_jpegCapacity, &jpegSize) != 0) {
+    return false;
+  }
+
+  std::shared_ptr<Frame> frame = std::make_shared<Frame>();
+  frame->jpeg.assign(_jpegBuffer, _jpegBuffer + jpegSize);
+  frame->width = view.width;
+  frame->height = view.height;
+  frame->pose = view.pose;
+  return add(frame);
+}
+
+bool FrameRecording::add(std::shared_ptr<const Frame> frame) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_full || frame->jpeg.size() > _maxBytes - _bytes) {
+    _full = true;
+    return false;
+  }
+  _bytes += frame->jpeg.size();
+  _frames.push_back(frame);
+  return true;
+}
+
+size_t FrameRecording::size() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _frames.size();
+}
+
+size_t FrameRecording::bytes() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _bytes;
+}
+
+bool FrameRecording::isFull() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _full;
+}
+
+std::shared_ptr<const FrameRecording::Frame> FrameRecording::frame(
+    size_t index) const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (index >= _frames.size()) {
+    return nullptr;
+  }
+  return _frames[index];
+}
+
+bool FrameRecording::save(const std::string& path) const {
+  std::vector<std::shared_ptr<const Frame>> frames;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    frames = _frames;
+  }
+
+  std::ofstream out(path.c_str(), std::ios::binary);
+  if (!out) {
+    return false;
+  }
+
+  out.write(FILE_MAGIC, sizeof(FILE_MAGIC));
+  writeU32(out, FILE_VERSION);
+  writeU32(out, uint32_t(frames.size()));
+  for (const std::shared_ptr<const Frame>& frame : frames) {
+    writeU32(out, uint32_t(frame->width));
+    writeU32(out, uint32_t(frame->height));
+    writeFloat(out, frame->pose.x);
+    writeFloat(out, frame->pose.y);
+    writeFloat(out, frame->pose.z);
+    writeFloat(out, frame->pose.w);
+    writeU32(out, uint32_t(frame->jpeg.size()));
+    out.write(reinterpret_cast<const char*>(frame->jpeg.data()),
+      frame->jpeg.size());
+  }
+  return bool(out);
+}
+
+std::shared_ptr<FrameRecording> FrameRecording::load(const std::string& path,
+    size_t maxBytes) {
+  std::ifstream in(path.c_str(), std::ios::binary);
+  char magic[sizeof(FILE_MAGIC)];
+  uint32_t version;
+  uint32_t count;
+  if (!in.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, FILE_MAGIC, sizeof(magic)) != 0 ||
+      !readU32(in, &version) || version != FILE_VERSION ||
+      !readU32(in, &count)) {
+    return nullptr;
+  }
+
+  std::shared_ptr<FrameRecording> recording =
+    std::make_shared<FrameRecording>(maxBytes);
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t width;
+    uint32_t height;
+    uint32_t length;
+    std::shared_ptr<Frame> frame = std::make_shared<Frame>();
+    if (!readU32(in, &width) || !readU32(in, &height) ||
+        width == 0 || height == 0 ||
+        width > MAX_FILE_DIMENSION || height > MAX_FILE_DIMENSION ||
+        !readFloat(in, &frame->pose.x) || !readFloat(in, &frame->pose.y) ||
+        !readFloat(in, &frame->pose.z) || !readFloat(in, &frame->pose.w) ||
+        !readU32(in, &length) || length == 0) {
+      return nullptr;
+    }
+    if (length > maxBytes - recording->bytes()) {
+      // Keep what fits rather than reading the rest.
+      recording->_full = true;
+      break;
+    }
+
+    frame->width = width;
+    frame->height = height;
+    frame->jpeg.resize(length);
+    if (!in.read(reinterpret_cast<char*>(frame->jpeg.data()), length)) {
+      return nullptr;
+    }
+    recording->add(frame);
+  }
+  return recording;
+}
+
+ReplayFrameSource::ReplayFrameSource(
+    std::shared_ptr<const FrameRecording> recording, bool loop)
+  : _recording(recording),
+    _loop(loop),
+    _next(0),
+    _nextFrameId(1),
+    _decoder(tjInitDecompress()) {}
+
+ReplayFrameSource::~ReplayFrameSource() {
+  tjDestroy(_decoder);
+}
+
+bool ReplayFrameSource::deliver(FrameSink* sink) {
+  size_t count = _recording ? _recording->size() : 0;
+  if (count == 0 || (!_loop && _next >= count)) {
+    return false;
+  }
+
+  std::shared_ptr<const FrameRecording::Frame> frame =
+    _recording->frame(_next % count);
+  _next++;
+
+  _pixels.resize(frame->width * 4 * frame->height);
+  if (tjDecompress2(_decoder, frame->jpeg.data(),
+      static_cast<unsigned long>(frame->jpeg.size()), _pixels.data(),
+      static_cast<int>(frame->width), 0, static_cast<int>(frame->height),
+      TJPF_BGRX, 0) != 0) {
+    return false;
+  }
+
+  FrameView view;
+  view.data = _pixels.data();
+  view.width = frame->width;
+  view.widthPitch = frame->width * 4;
+  view.height = frame->height;
+  view.format = FORMAT_BGRX;
+  view.frameId = _nextFrameId++;
+  view.pose.x = frame->pose.x;
+  view.pose.y = frame->pose.y;
+  view.pose.z = frame->pose.z;
+  view.pose.w = frame->pose.w;
+  view.captureNs = steadyClockNs();
+  sink->publishFrame(view);
+  return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include "FrameSource.h"
+#include "JpegEncoder.h"
+
+/**
+ * Captured frames kept for replay, as a sink that compresses the frames it is
+ * given until maxBytes of JPEG are stored. Frames are near-lossless JPEGs,
+ * so a recording costs a few hundred kilobytes to a couple of megabytes per
+ * frame rather than the 16 MB of raw 1080p side-by-side pixels.
+ *
+ * Files hold "CTFR", then big-endian u32 version and frame count, then per
+ * frame u32 width and height, the pose as four f32s (x, y, z, w), u32 JPEG
+ * length and the JPEG itself.
+ */
+class FrameRecording : public FrameSink {
+public:
+  struct Frame {
+    std::vector<unsigned char> jpeg;
+    size_t width;
+    size_t height;
+    RenderPose pose;
+  };
+
+  static constexpr uint32_t FILE_VERSION = 2;
+  static constexpr size_t DEFAULT_MAX_BYTES = 64 << 20;
+  static constexpr int QUALITY = 95; /* With 4:4:4, close enough to lossless. */
+
+  explicit FrameRecording(size_t maxBytes = DEFAULT_MAX_BYTES);
+  ~FrameRecording();
+
+  /**
+   * Compresses the frame on the caller's thread; false once the recording
+   * is full. Only one thread may publish.
+   */
+  virtual bool publishFrame(const FrameView& view) override;
+
+  size_t size() const;
+  size_t bytes() const;
+  bool isFull() const;
+
+  /** A recorded frame, which never changes; nullptr past the end. */
+  std::shared_ptr<const Frame> frame(size_t index) const;
+
+  bool save(const std::string& path) const;
+
+  /**
+   * nullptr if the file is missing or isn't a recording; frames past
+   * maxBytes are left out.
+   */
+  static std::shared_ptr<FrameRecording> load(const std::string& path,
+    size_t maxBytes = DEFAULT_MAX_BYTES);
+
+private:
+  mutable std::mutex _mutex;
+  size_t _maxBytes;
+  size_t _bytes;
+  bool _full;
+  std::vector<std::shared_ptr<const Frame>> _frames;
+
+  // Publisher only.
+  std::unique_ptr<JpegEncoder> _encoder;
+  std::vector<unsigned char> _pixels;
+  unsigned char* _jpegBuffer;
+  unsigned long _jpegCapacity;
+
+  /** False, and the recording full, if the frame doesn't fit. */
+  bool add(std::shared_ptr<const Frame> frame);
+};
+
+/**
+ * Plays a FrameRecording back as if the game were rendering it, once or over
+ * and over. Frames get fresh ids and capture times, so the stream looks
+ * live to the session and the phone.
+ */
+class ReplayFrameSource : public FrameSource {
+public:
+  ReplayFrameSource(std::shared_ptr<const FrameRecording> recording,
+    bool loop = true);
+  ~ReplayFrameSource();
+
+  /**
+   * Decompresses the next frame on the caller's thread. False once a
+   * recording that doesn't loop has run out, or if a frame won't decompress.
+   */
+  virtual bool deliver(FrameSink* sink) override;
+
+private:
+  std::shared_ptr<const FrameRecording> _recording;
+  bool _loop;
+  size_t _next;
+  uint64_t _nextFrameId;
+  tjhandle _decoder;
+  std::vector<unsigned char> _pixels;
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * Single-producer/single-consumer hand-off of frames between two pipeline
+ * stages, with "latest wins" semantics. The ring holds three slots: one being
+ * filled by the producer, one being read by the consumer, and one holding the
+ * most recently published frame. Publishing never blocks; if the consumer
+ * hasn't picked up the previous frame yet, that frame is dropped and counted.
+ *
+ * Slots are swapped by index with a single atomic, so the hand-off itself is
+ * lock-free. The mutex and condition variable are only used to put an idle
+ * consumer to sleep.
+ */
+template <typename T>
+class FrameRing {
+  static constexpr uint8_t INDEX_MASK = 0x3;
+  static constexpr uint8_t FRESH = 0x4;
+
+  T _slots[3];
+  std::atomic<uint8_t> _ready;
+  uint8_t _write; /* Owned by the producer. */
+  uint8_t _read;  /* Owned by the consumer. */
+
+  std::atomic<uint64_t> _published;
+  std::atomic<uint64_t> _consumed;
+  std::atomic<uint64_t> _dropped;
+
+  std::mutex _waitMutex;
+  std::condition_variable _waitCv;
+
+public:
+  FrameRing() : _ready(1), _write(0), _read(2),
+      _published(0), _consumed(0), _dropped(0) {}
+
+  FrameRing(const FrameRing&) = delete;
+  FrameRing& operator=(const FrameRing&) = delete;
+
+  /** Slot the producer may fill; valid until the next publish(). */
+  T& writeSlot() { return _slots[_write]; }
+
+  /** Makes the write slot visible to the consumer. */
+  void publish() {
+    uint8_t prev = _ready.exchange(_write | FRESH, std::memory_order_acq_rel);
+    _write = prev & INDEX_MASK;
+    _published++;
+    if (prev & FRESH) {
+      _dropped++;
+    }
+
+    wake();
+  }
+
+  /** Slot the consumer may read; valid until the next acquire(). */
+  T& readSlot() { return _slots[_read]; }
+
+  /** Takes the latest published frame, if there's one not yet consumed. */
+  bool acquire() {
+    if (!(_ready.load(std::memory_order_acquire) & FRESH)) {
+      return false;
+    }
+
+    uint8_t prev = _ready.exchange(_read, std::memory_order_acq_rel);
+    _read = prev & INDEX_MASK;
+    _consumed++;
+    return true;
+  }
+
+  /**
+   * Blocks until a frame can be acquired or cancel is set. Returns true if a
+   * frame was acquired.
+   */
+  bool waitAcquire(const std::atomic_bool& cancel) {
+    {
+      std::unique_lock<std::mutex> lock(_waitMutex);
+      _waitCv.wait(lock, [&] {
+        return (_ready.load(std::memory_order_acquire) & FRESH) || cancel.load();
+      });
+    }
+
+    if (cancel.load()) {
+      return false;
+    }
+    return acquire();
+  }
+
+  /** Wakes a consumer blocked in waitAcquire, e.g. after cancelling it. */
+  void wake() {
+    {
+      std::lock_guard<std::mutex> lock(_waitMutex);
+    }
+    _waitCv.notify_all();
+  }
+
+  uint64_t published() const { return _published.load(); }
+  uint64_t consumed() const { return _consumed.load(); }
+  uint64_t dropped() const { return _dropped.load(); }
+};
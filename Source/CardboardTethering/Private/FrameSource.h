@@ -0,0 +1,51 @@
+#pragma once
+
+#include "FramePipeline.h"
+
+/**
+ * Where captured frames go: a StreamSession, on its way to the phone, or a
+ * FrameRecording.
+ */
+class FrameSink {
+public:
+  virtual ~FrameSink() {}
+
+  /**
+   * Takes a copy of the frame, which is only valid during the call; false
+   * if it was refused. Called from one thread at a time.
+   */
+  virtual bool publishFrame(const FrameView& view) = 0;
+};
+
+/**
+ * Where frames come from: the GPU readback in the plugin, or a
+ * SyntheticFrameSource or ReplayFrameSource standing in for the game. The
+ * encoder only ever sees the FrameView, so it runs without a GPU.
+ */
+class FrameSource {
+public:
+  virtual ~FrameSource() {}
+
+  /**
+   * Hands the newest frame that is ready, if any, to the sink, and returns
+   * whether there was one. Called from one thread, once per rendered frame.
+   */
+  virtual bool deliver(FrameSink* sink) = 0;
+};
+
+/** Passes every frame on to two sinks, e.g. the session and a recording. */
+class FrameTee : public FrameSink {
+public:
+  FrameTee(FrameSink* first, FrameSink* second) : _first(first), _second(second) {}
+
+  /** What the first sink said; the second's answer is ignored. */
+  virtual bool publishFrame(const FrameView& view) override {
+    bool published = _first->publishFrame(view);
+    _second->publishFrame(view);
+    return published;
+  }
+
+private:
+  FrameSink* _first;
+  FrameSink* _second;
+};
@@ -0,0 +1,330 @@
+#include "JpegEncoder.h"
+#include "ColorConvert.h"
+#include <algorithm>
+#include <cstring>
+
+#include "turbojpeg.h"
+
+namespace {
+
+  const unsigned char MARKER_SOI = 0xD8;
+  const unsigned char MARKER_EOI = 0xD9;
+  const unsigned char MARKER_SOS = 0xDA;
+  const unsigned char MARKER_DRI = 0xDD;
+  const unsigned char MARKER_RST0 = 0xD0;
+  const unsigned char MARKER_SOF0 = 0xC0;
+  const unsigned char MARKER_SOF2 = 0xC2;
+
+  /** Offsets of the pieces of a TurboJPEG-produced baseline JPEG. */
+  struct JpegLayout {
+    size_t sofHeightOffset; /* Big-endian image height in the SOF segment. */
+    size_t sosOffset;       /* Start of the SOS marker. */
+    size_t scanOffset;      /* First byte of entropy-coded data. */
+    size_t scanEnd;         /* The EOI marker. */
+  };
+
+  size_t readBig16(const unsigned char* p) {
+    return (static_cast<size_t>(p[0]) << 8) | p[1];
+  }
+
+  void writeBig16(unsigned char* p, size_t value) {
+    p[0] = static_cast<unsigned char>((value >> 8) & 0xFF);
+    p[1] = static_cast<unsigned char>(value & 0xFF);
+  }
+
+  bool parseJpeg(const unsigned char* buf, size_t size, JpegLayout* layout) {
+    if (size < 4 || buf[0] != 0xFF || buf[1] != MARKER_SOI) {
+      return false;
+    }
+    if (buf[size - 2] != 0xFF || buf[size - 1] != MARKER_EOI) {
+      return false;
+    }
+
+    bool haveSof = false;
+    size_t pos = 2;
+    while (pos + 4 <= size) {
+      if (buf[pos] != 0xFF) {
+        return false;
+      }
+
+      unsigned char marker = buf[pos + 1];
+      size_t len = readBig16(&buf[pos + 2]);
+      if (len < 2 || pos + 2 + len > size) {
+        return false;
+      }
+
+      if (marker >= MARKER_SOF0 && marker <= MARKER_SOF2) {
+        layout->sofHeightOffset = pos + 5;
+        haveSof = true;
+      } else if (marker == MARKER_DRI) {
+        // Already has restart markers; we can't renumber them.
+        return false;
+      } else if (marker == MARKER_SOS) {
+        layout->sosOffset = pos;
+        layout->scanOffset = pos + 2 + len;
+        layout->scanEnd = size - 2;
+        return haveSof && layout->scanOffset <= layout->scanEnd;
+      }
+
+      pos += 2 + len;
+    }
+
+    return false;
+  }
+
+  /** True if both headers are identical apart from the image height. */
+  bool headersMatch(const unsigned char* a, const JpegLayout& la,
+      const unsigned char* b, const JpegLayout& lb) {
+    if (la.scanOffset != lb.scanOffset || la.sofHeightOffset != lb.sofHeightOffset) {
+      return false;
+    }
+
+    size_t h = la.sofHeightOffset;
+    return std::memcmp(a, b, h) == 0 &&
+      std::memcmp(a + h + 2, b + h + 2, la.scanOffset - h - 2) == 0;
+  }
+
+  bool ensureCapacity(unsigned char** buf, unsigned long* capacity,
+      unsigned long needed) {
+    if (*buf != nullptr && *capacity >= needed) {
+      return true;
+    }
+
+    if (*buf != nullptr) {
+      tjFree(*buf);
+    }
+    *buf = tjAlloc(needed);
+    *capacity = (*buf != nullptr) ? needed : 0;
+    return *buf != nullptr;
+  }
+
+}
+
+JpegEncoder::JpegEncoder(size_t threads, InputFormat input)
+  : _input(input) {
+  threads = std::max<size_t>(threads, 1);
+  for (size_t i = 0; i < threads; ++i) {
+    _handles.push_back(tjInitCompress());
+  }
+  _planes.reset(new AlignedBuffer[threads]);
+
+  if (threads > 1) {
+    _pool.reset(new WorkerPool(threads));
+  }
+}
+
+JpegEncoder::~JpegEncoder() {
+  _pool.reset();
+
+  for (tjhandle handle : _handles) {
+    tjDestroy(handle);
+  }
+  for (Strip& strip : _strips) {
+    if (strip.jpegBuffer != nullptr) {
+      tjFree(strip.jpegBuffer);
+    }
+  }
+}
+
+int JpegEncoder::encodeSingle(size_t worker, const unsigned char* data,
+    size_t width, size_t widthPitch, size_t height, int quality, int subsamp,
+    unsigned char** jpegBuf, unsigned long* jpegCapacity,
+    unsigned long* jpegSize) {
+  // With room for the worst case, TurboJPEG never has to reallocate.
+  if (!ensureCapacity(jpegBuf, jpegCapacity, tjBufSize(static_cast<int>(width),
+      static_cast<int>(height), subsamp))) {
+    return -1;
+  }
+
+  unsigned long size = *jpegCapacity;
+  int status;
+  if (_input == INPUT_YUV420 && subsamp == TJSAMP_420) {
+    size_t chromaWidth = (width + 1) / 2;
+    size_t chromaHeight = (height + 1) / 2;
+    AlignedBuffer& planes = _planes[worker];
+    if (!planes.reserve(width * height + 2 * chromaWidth * chromaHeight)) {
+      return -1;
+    }
+
+    ColorConvert::YuvPlanes yuv;
+    yuv.y = planes.data();
+    yuv.u = yuv.y + width * height;
+    yuv.v = yuv.u + chromaWidth * chromaHeight;
+    yuv.yStride = width;
+    yuv.uvStride = chromaWidth;
+    ColorConvert::bgrxToI420(data, width, widthPitch, height, yuv);
+
+    const unsigned char* srcPlanes[3] = { yuv.y, yuv.u, yuv.v };
+    int strides[3] = {
+      static_cast<int>(yuv.yStride),
+      static_cast<int>(yuv.uvStride),
+      static_cast<int>(yuv.uvStride)
+    };
+    status = tjCompressFromYUVPlanes(_handles[worker],
+      srcPlanes,
+      static_cast<int>(width),
+      strides,
+      static_cast<int>(height),
+      subsamp,
+      jpegBuf,
+      &size,
+      quality,
+      TJFLAG_NOREALLOC);
+  } else {
+    status = tjCompress2(_handles[worker],
+      const_cast<unsigned char*>(data),
+      static_cast<int>(width),
+      static_cast<int>(widthPitch),
+      static_cast<int>(height),
+      TJPF_BGRX,
+      jpegBuf,
+      &size,
+      subsamp,
+      quality,
+      TJFLAG_NOREALLOC);
+  }
+  if (status != 0) {
+    return status;
+  }
+
+  *jpegSize = size;
+  return 0;
+}
+
+size_t JpegEncoder::memoryBytes() const {
+  size_t bytes = 0;
+  for (size_t i = 0; i < _handles.size(); ++i) {
+    bytes += _planes[i].capacity();
+  }
+  for (const Strip& strip : _strips) {
+    bytes += strip.jpegCapacity;
+  }
+  return bytes;
+}
+
+int JpegEncoder::encode(const FrameView& frame, int quality, int subsamp,
+    unsigned char** jpegBuf, unsigned long* jpegCapacity,
+    unsigned long* jpegSize) {
+  size_t mcuWidth = tjMCUWidth[subsamp];
+  size_t mcuHeight = tjMCUHeight[subsamp];
+  size_t mcusPerRow = (frame.width + mcuWidth - 1) / mcuWidth;
+  size_t mcuRows = (frame.height + mcuHeight - 1) / mcuHeight;
+
+  // The restart interval is a 16-bit MCU count, which bounds strip height.
+  size_t rowsPerStrip = (mcuRows + _handles.size() - 1) / _handles.size();
+  rowsPerStrip = std::min(rowsPerStrip, 0xFFFF / std::max<size_t>(mcusPerRow, 1));
+  size_t stripCount = rowsPerStrip == 0 ? 0 : (mcuRows + rowsPerStrip - 1) / rowsPerStrip;
+
+  if (!_pool || stripCount <= 1) {
+    return encodeSingle(0, frame.data,
+      frame.width, frame.widthPitch, frame.height, quality, subsamp,
+      jpegBuf, jpegCapacity, jpegSize);
+  }
+
+  // Room for the whole frame, so stitching doesn't reallocate either.
+  if (!ensureCapacity(jpegBuf, jpegCapacity, tjBufSize(static_cast<int>(frame.width),
+      static_cast<int>(frame.height), subsamp))) {
+    return -1;
+  }
+
+  if (_strips.size() < stripCount) {
+    Strip empty = { nullptr, 0, 0, 0 };
+    _strips.resize(stripCount, empty);
+  }
+
+  size_t stripHeight = rowsPerStrip * mcuHeight;
+  _pool->run(stripCount, [&](size_t task, size_t worker) {
+    size_t y = task * stripHeight;
+    size_t height = std::min(stripHeight, frame.height - y);
+
+    Strip& strip = _strips[task];
+    strip.status = encodeSingle(worker,
+      frame.data + y * frame.widthPitch,
+      frame.width, frame.widthPitch, height, quality, subsamp,
+      &strip.jpegBuffer, &strip.jpegCapacity, &strip.jpegSize);
+  });
+
+  for (size_t i = 0; i < stripCount; ++i) {
+    if (_strips[i].status != 0) {
+      return _strips[i].status;
+    }
+  }
+
+  int status = stitch(stripCount, frame.height, rowsPerStrip * mcusPerRow,
+    jpegBuf, jpegCapacity, jpegSize);
+  if (status != 0) {
+    // Couldn't stitch (unexpected strip layout); encode the frame in one go.
+    return encodeSingle(0, frame.data,
+      frame.width, frame.widthPitch, frame.height, quality, subsamp,
+      jpegBuf, jpegCapacity, jpegSize);
+  }
+
+  return 0;
+}
+
+int JpegEncoder::stitch(size_t stripCount, size_t fullHeight,
+    size_t restartInterval, unsigned char** jpegBuf,
+    unsigned long* jpegCapacity, unsigned long* jpegSize) {
+  std::vector<JpegLayout> layouts(stripCount);
+  for (size_t i = 0; i < stripCount; ++i) {
+    const Strip& strip = _strips[i];
+    if (!parseJpeg(strip.jpegBuffer, strip.jpegSize, &layouts[i])) {
+      return -1;
+    }
+    // Every strip must share quantization and Huffman tables with the first.
+    if (i > 0 && !headersMatch(_strips[0].jpegBuffer, layouts[0],
+        strip.jpegBuffer, layouts[i])) {
+      return -1;
+    }
+  }
+
+  const JpegLayout& first = layouts[0];
+  unsigned long needed = first.scanOffset + 6 /* DRI */ + 2 /* EOI */;
+  for (size_t i = 0; i < stripCount; ++i) {
+    needed += layouts[i].scanEnd - layouts[i].scanOffset;
+    needed += 2; /* RSTn */
+  }
+
+  if (!ensureCapacity(jpegBuf, jpegCapacity, needed)) {
+    return -1;
+  }
+
+  unsigned char* out = *jpegBuf;
+  const unsigned char* header = _strips[0].jpegBuffer;
+
+  // Tables and frame header, with the height patched to the full frame.
+  std::memcpy(out, header, first.sosOffset);
+  writeBig16(out + first.sofHeightOffset, fullHeight);
+  out += first.sosOffset;
+
+  out[0] = 0xFF;
+  out[1] = MARKER_DRI;
+  writeBig16(out + 2, 4);
+  writeBig16(out + 4, restartInterval);
+  out += 6;
+
+  std::memcpy(out, header + first.sosOffset, first.scanOffset - first.sosOffset);
+  out += first.scanOffset - first.sosOffset;
+
+  // Each strip's entropy-coded data starts with fresh DC predictors and ends
+  // byte-aligned, which is exactly what a restart marker boundary needs.
+  for (size_t i = 0; i < stripCount; ++i) {
+    const Strip& strip = _strips[i];
+    size_t scanLength = layouts[i].scanEnd - layouts[i].scanOffset;
+    std::memcpy(out, strip.jpegBuffer + layouts[i].scanOffset, scanLength);
+    out += scanLength;
+
+    if (i + 1 < stripCount) {
+      out[0] = 0xFF;
+      out[1] = static_cast<unsigned char>(MARKER_RST0 + (i % 8));
+      out += 2;
+    }
+  }
+
+  out[0] = 0xFF;
+  out[1] = MARKER_EOI;
+  out += 2;
+
+  *jpegSize = static_cast<unsigned long>(out - *jpegBuf);
+  return 0;
+}
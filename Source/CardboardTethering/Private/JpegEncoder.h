@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "FramePipeline.h"
+#include "AlignedBuffer.h"
+#include "WorkerPool.h"
+
+typedef void* tjhandle;
+
+/**
+ * BGRX to JPEG compressor. With a single thread this is one tjCompress2 call.
+ * With more, the frame is split into horizontal strips aligned to MCU rows,
+ * the strips are compressed concurrently (one TurboJPEG handle per worker),
+ * and the results are stitched into one baseline JPEG: the strips' entropy
+ * coded segments are joined with RSTn markers and a DRI segment sets the
+ * restart interval to one strip's worth of MCUs. Any standard decoder reads
+ * the result, so the receiver doesn't need to know.
+ *
+ * With YUV input, 4:2:0 frames are converted to planar YCbCr
+ * by ColorConvert, strip by strip on the worker that encodes the strip, and
+ * handed to tjCompressFromYUVPlanes so libjpeg-turbo skips its own colour
+ * conversion and downsampling. Other subsamplings always use BGRX input.
+ *
+ * Output and strip buffers are sized up front with tjBufSize and compressed
+ * into with TJFLAG_NOREALLOC, so after the first frame at a given size and
+ * subsampling nothing is allocated.
+ */
+class JpegEncoder {
+public:
+  enum InputFormat {
+    INPUT_BGRX,
+    INPUT_YUV420
+  };
+
+  explicit JpegEncoder(size_t threads, InputFormat input = INPUT_BGRX);
+  ~JpegEncoder();
+
+  JpegEncoder(const JpegEncoder&) = delete;
+  JpegEncoder& operator=(const JpegEncoder&) = delete;
+
+  size_t threadCount() const { return _handles.size(); }
+  InputFormat inputFormat() const { return _input; }
+
+  /** Scratch memory held for strips and colour conversion. */
+  size_t memoryBytes() const;
+
+  /**
+   * Compresses the frame into *jpegBuf, which must be null or allocated with
+   * tjAlloc; *jpegCapacity is its size, and both are updated if the buffer
+   * has to grow. Returns 0 on success or -1 on failure, like tjCompress2.
+   */
+  int encode(const FrameView& frame, int quality, int subsamp,
+    unsigned char** jpegBuf, unsigned long* jpegCapacity,
+    unsigned long* jpegSize);
+
+private:
+  struct Strip {
+    unsigned char* jpegBuffer;
+    unsigned long jpegCapacity;
+    unsigned long jpegSize;
+    int status;
+  };
+
+  InputFormat _input;
+  std::vector<tjhandle> _handles;
+  std::unique_ptr<AlignedBuffer[]> _planes; /* Per worker. */
+  std::vector<Strip> _strips;
+  std::unique_ptr<WorkerPool> _pool;
+
+  int encodeSingle(size_t worker, const unsigned char* data,
+    size_t width, size_t widthPitch, size_t height, int quality, int subsamp,
+    unsigned char** jpegBuf, unsigned long* jpegCapacity,
+    unsigned long* jpegSize);
+  int stitch(size_t stripCount, size_t fullHeight, size_t restartInterval,
+    unsigned char** jpegBuf, unsigned long* jpegCapacity,
+    unsigned long* jpegSize);
+};
@@ -0,0 +1,97 @@
+#include "KeyframeRequests.h"
+#include <algorithm>
+
+KeyframeRequests::KeyframeRequests() {
+  reset();
+}
+
+const char* KeyframeRequests::reasonName(uint8_t reason) {
+  switch (reason) {
+    case REASON_LOST: return "lost payload";
+    case REASON_DECODE_FAILED: return "decode failed";
+    case REASON_DELTA_REJECTED: return "delta rejected";
+    default: return "unknown";
+  }
+}
+
+void KeyframeRequests::reset() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  for (size_t eye = 0; eye < EYE_COUNT; ++eye) {
+    _pending[eye] = false;
+    _requestNs[eye] = 0;
+    _lastKeyframe[eye] = 0;
+    _haveKeyframe[eye] = false;
+  }
+  _requests = 0;
+  _stale = 0;
+  _recovered = 0;
+  _totalRecoveryNs = 0;
+  _maxRecoveryNs = 0;
+}
+
+bool KeyframeRequests::request(uint8_t eye, uint64_t frameId, int64_t nowNs) {
+  if (eye >= EYE_COUNT && eye != ALL_EYES) {
+    return false;
+  }
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  _requests++;
+  bool forced = false;
+  for (size_t e = 0; e < EYE_COUNT; ++e) {
+    if (eye != ALL_EYES && e != eye) {
+      continue;
+    }
+    if (frameId != 0 && _haveKeyframe[e] && _lastKeyframe[e] > frameId) {
+      continue;
+    }
+    _pending[e] = true;
+    if (_requestNs[e] == 0) {
+      _requestNs[e] = nowNs;
+    }
+    forced = true;
+  }
+  if (!forced) {
+    _stale++;
+  }
+  return forced;
+}
+
+bool KeyframeRequests::take(size_t eye) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  bool pending = _pending[eye];
+  _pending[eye] = false;
+  return pending;
+}
+
+void KeyframeRequests::sent(size_t eye, uint64_t frameId, bool keyframe,
+    int64_t nowNs) {
+  if (!keyframe) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  _lastKeyframe[eye] = frameId;
+  _haveKeyframe[eye] = true;
+
+  // The payload that went wrong was sent before the request came in, so any
+  // keyframe sent since repairs the eye, forced or not.
+  _pending[eye] = false;
+  if (_requestNs[eye] != 0) {
+    int64_t recoveryNs = std::max<int64_t>(nowNs - _requestNs[eye], 0);
+    _totalRecoveryNs += recoveryNs;
+    _maxRecoveryNs = std::max(_maxRecoveryNs, recoveryNs);
+    _recovered++;
+    _requestNs[eye] = 0;
+  }
+}
+
+KeyframeRequests::Stats KeyframeRequests::getStats() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  Stats stats;
+  stats.requests = _requests;
+  stats.stale = _stale;
+  stats.recovered = _recovered;
+  stats.averageRecoveryMs = _recovered > 0 ? _totalRecoveryNs / 1e6 / _recovered : 0.0;
+  stats.maxRecoveryMs = _maxRecoveryNs / 1e6;
+  return stats;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include "FramePipeline.h"
+
+/**
+ * Keyframes on demand. The phone asks for one (Message::TYPE_REFRESH) when
+ * it loses a payload or can't decode or composite one, naming a frame at or
+ * before which its image for the eye went wrong. Any keyframe for that eye
+ * from a later frame repairs it, so a request is dropped if such a keyframe
+ * has already gone out: the phone just hadn't seen it yet.
+ * Otherwise the eye's next encode is forced to a keyframe.
+ *
+ * Thread-safe: the read loop files requests, the encode worker takes them
+ * and the send worker reports what went out.
+ */
+class KeyframeRequests {
+public:
+  /** Stands for every eye in a request. */
+  static constexpr uint8_t ALL_EYES = 0xFF;
+
+  /** Why the phone asked; only logged. */
+  enum Reason : uint8_t {
+    REASON_LOST = 1,           /* A gap in the message sequence. */
+    REASON_DECODE_FAILED = 2,  /* A JPEG that wouldn't decode. */
+    REASON_DELTA_REJECTED = 3  /* Tiles that couldn't be composited. */
+  };
+
+  static const char* reasonName(uint8_t reason);
+
+  struct Stats {
+    uint64_t requests;
+    uint64_t stale;      /* Already repaired by a keyframe in flight. */
+    uint64_t recovered;  /* Eyes repaired by a keyframe after a request. */
+    double averageRecoveryMs; /* Request to the repairing keyframe sent. */
+    double maxRecoveryMs;
+  };
+
+  KeyframeRequests();
+
+  KeyframeRequests(const KeyframeRequests&) = delete;
+  KeyframeRequests& operator=(const KeyframeRequests&) = delete;
+
+  /** Forgets pending requests and history, e.g. for a new connection. */
+  void reset();
+
+  /**
+   * A request for eye (or ALL_EYES) whose image went wrong at or before
+   * frameId; frameId 0 always forces a keyframe. Returns whether one was
+   * forced.
+   */
+  bool request(uint8_t eye, uint64_t frameId, int64_t nowNs);
+
+  /** Whether the eye's next frame must be a keyframe; clears the request. */
+  bool take(size_t eye);
+
+  /** A payload for the eye went out. */
+  void sent(size_t eye, uint64_t frameId, bool keyframe, int64_t nowNs);
+
+  Stats getStats() const;
+
+private:
+  mutable std::mutex _mutex;
+  bool _pending[EYE_COUNT];   /* Not yet taken by the encoder. */
+  int64_t _requestNs[EYE_COUNT]; /* Oldest unanswered request, or 0. */
+  uint64_t _lastKeyframe[EYE_COUNT]; /* Frame id of the last keyframe sent. */
+  bool _haveKeyframe[EYE_COUNT];
+
+  uint64_t _requests;
+  uint64_t _stale;
+  uint64_t _recovered;
+  int64_t _totalRecoveryNs;
+  int64_t _maxRecoveryNs;
+};
@@ -0,0 +1,107 @@
+#include "LatencyTracker.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+LatencyTracker::LatencyTracker() : _logging(false) {}
+
+const char* LatencyTracker::stageName(Stage stage) {
+  switch (stage) {
+    case STAGE_CAPTURE: return "Pose to capture";
+    case STAGE_ENCODE: return "Pose to encode";
+    case STAGE_SEND: return "Pose to send";
+    case STAGE_DISPLAY: return "Pose to display";
+    default: return "Unknown";
+  }
+}
+
+void LatencyTracker::addFrame(uint32_t poseSequence, uint64_t frameId,
+    int64_t captureNs, int64_t encodeNs, int64_t sendNs) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _windows[STAGE_CAPTURE].push(captureNs);
+  _windows[STAGE_ENCODE].push(encodeNs);
+  _windows[STAGE_SEND].push(sendNs);
+
+  if (_logging && _log.size() < MAX_LOG) {
+    Row row = { poseSequence, frameId, { captureNs, encodeNs, sendNs, -1 } };
+    _log.push_back(row);
+  }
+}
+
+void LatencyTracker::addDisplay(uint32_t poseSequence, int64_t displayNs) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _windows[STAGE_DISPLAY].push(displayNs);
+
+  if (_logging && _log.size() < MAX_LOG) {
+    Row row = { poseSequence, 0, { -1, -1, -1, displayNs } };
+    _log.push_back(row);
+  }
+}
+
+LatencyTracker::Summary LatencyTracker::summarize(Stage stage) const {
+  std::vector<int64_t> samples;
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    samples = _windows[stage].values();
+  }
+
+  Summary summary = {};
+  summary.samples = samples.size();
+  if (samples.empty()) {
+    return summary;
+  }
+
+  std::sort(samples.begin(), samples.end());
+  summary.p50Ms = percentileOfSorted(samples, 50) / 1e6;
+  summary.p90Ms = percentileOfSorted(samples, 90) / 1e6;
+  summary.p99Ms = percentileOfSorted(samples, 99) / 1e6;
+  summary.maxMs = samples.back() / 1e6;
+  return summary;
+}
+
+void LatencyTracker::reset() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  for (size_t i = 0; i < STAGE_COUNT; ++i) {
+    _windows[i].clear();
+  }
+}
+
+void LatencyTracker::startLog() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _log.clear();
+  _logging = true;
+}
+
+bool LatencyTracker::stopLog(const std::string& path, size_t* rows) {
+  std::vector<Row> log;
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _logging = false;
+    log.swap(_log);
+  }
+  *rows = log.size();
+
+  std::ofstream out(path.c_str());
+  if (!out) {
+    return false;
+  }
+
+  // Empty fields weren't measured for that row.
+  out << "pose_sequence,frame_id,capture_ms,encode_ms,send_ms,display_ms\n";
+  char field[32];
+  for (const Row& row : log) {
+    out << row.poseSequence << ',';
+    if (row.frameId != 0 || row.stageNs[STAGE_CAPTURE] >= 0) {
+      out << row.frameId;
+    }
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+      out << ',';
+      if (row.stageNs[i] >= 0) {
+        std::snprintf(field, sizeof(field), "%.3f", row.stageNs[i] / 1e6);
+        out << field;
+      }
+    }
+    out << '\n';
+  }
+  return static_cast<bool>(out);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "SampleWindow.h"
+
+/**
+ * Motion-to-photon latency, measured with the pose sequence numbers that
+ * already go both ways: the phone numbers each pose packet, the host echoes
+ * the number of the pose a frame was rendered with in its FrameHeader, and
+ * the phone reports back how long that pose took to reach the display.
+ *
+ * The two clocks are never compared. Host stages are timed from when the
+ * pose packet arrived at the host; the display stage is timed by the phone
+ * from when it sampled the pose.
+ */
+class LatencyTracker {
+public:
+  enum Stage {
+    STAGE_CAPTURE, /* Pose arrival to the frame copied out of the GPU. */
+    STAGE_ENCODE,  /* Pose arrival to both eyes encoded. */
+    STAGE_SEND,    /* Pose arrival to the left eye handed to USB. */
+    STAGE_DISPLAY, /* Pose sampled to frame displayed, on the phone. */
+    STAGE_COUNT
+  };
+
+  /** Percentiles over the most recent WINDOW samples of a stage. */
+  static constexpr size_t WINDOW = 1000;
+
+  /** Rows kept while logging; further rows are dropped. */
+  static constexpr size_t MAX_LOG = 100000;
+
+  struct Summary {
+    size_t samples;
+    double p50Ms;
+    double p90Ms;
+    double p99Ms;
+    double maxMs;
+  };
+
+  LatencyTracker();
+
+  LatencyTracker(const LatencyTracker&) = delete;
+  LatencyTracker& operator=(const LatencyTracker&) = delete;
+
+  static const char* stageName(Stage stage);
+
+  /** Host stages of one frame, in ns since its pose arrived. */
+  void addFrame(uint32_t poseSequence, uint64_t frameId,
+    int64_t captureNs, int64_t encodeNs, int64_t sendNs);
+
+  /** A pose-to-display time reported by the phone. */
+  void addDisplay(uint32_t poseSequence, int64_t displayNs);
+
+  Summary summarize(Stage stage) const;
+  void reset();
+
+  /** Starts collecting rows for stopLog, discarding any previous ones. */
+  void startLog();
+
+  /** Stops collecting and writes the rows as CSV; false if it can't. */
+  bool stopLog(const std::string& path, size_t* rows);
+
+private:
+  struct Row {
+    uint32_t poseSequence;
+    uint64_t frameId;     /* 0 for display rows. */
+    int64_t stageNs[STAGE_COUNT]; /* -1 where not measured. */
+  };
+
+  mutable std::mutex _mutex;
+  SampleWindow<int64_t, WINDOW> _windows[STAGE_COUNT];
+  bool _logging;
+  std::vector<Row> _log;
+};
@@ -1,5 +1,6 @@
 #include "CardboardTetheringPrivatePCH.h"
 #include "LibraryInitParams.h"
+#include "UsbEventThread.h"
 
 #include "AllowWindowsPlatformTypes.h"
 #include "turbojpeg.h"
@@ -9,9 +10,11 @@
 LibraryInitParams::LibraryInitParams() {
   TurboJpegCompressor = tjInitCompress();
   libusb_init(&UsbContext);
+  UsbEvents.reset(new UsbEventThread(UsbContext));
 }
 
 LibraryInitParams::~LibraryInitParams() {
   tjDestroy(TurboJpegCompressor);
+  UsbEvents.reset();
   libusb_exit(UsbContext);
 }
\ No newline at end of file
@@ -1,11 +1,15 @@
 #pragma once
 
+#include <memory>
+
 typedef void* tjhandle;
 struct libusb_context;
+class UsbEventThread;
 
 struct LibraryInitParams {
   tjhandle TurboJpegCompressor;
   libusb_context* UsbContext;
+  std::unique_ptr<UsbEventThread> UsbEvents; /* Completes UsbContext's async transfers. */
 
   LibraryInitParams();
   ~LibraryInitParams();
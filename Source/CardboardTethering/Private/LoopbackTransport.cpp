@@ -0,0 +1,198 @@
+#include "LoopbackTransport.h"
+#include <algorithm>
+#include <cstring>
+
+LoopbackTransport::Pipe::Pipe(size_t capacity, const Shape& shape)
+  : buffer(std::max<size_t>(capacity, 1)),
+    head(0),
+    size(0),
+    shape(shape),
+    written(0),
+    arrived(0),
+    consumed(0),
+    readCancelled(false),
+    writeInterrupted(false),
+    disconnected(false) {}
+
+size_t LoopbackTransport::Pipe::readable(Clock::time_point now) {
+  while (!arrivals.empty() && arrivals.front().second <= now) {
+    arrived = arrivals.front().first;
+    arrivals.pop_front();
+  }
+  return static_cast<size_t>(arrived - consumed);
+}
+
+LoopbackTransport::LoopbackTransport(std::shared_ptr<Pipe> in,
+  std::shared_ptr<Pipe> out
+) : _in(in), _out(out) {}
+
+void LoopbackTransport::createPair(std::shared_ptr<LoopbackTransport>* a,
+    std::shared_ptr<LoopbackTransport>* b, size_t capacity,
+    const Shape& shape) {
+  auto ab = std::make_shared<Pipe>(capacity, shape);
+  auto ba = std::make_shared<Pipe>(capacity, shape);
+  a->reset(new LoopbackTransport(ba, ab));
+  b->reset(new LoopbackTransport(ab, ba));
+}
+
+void LoopbackTransport::disconnect() {
+  for (Pipe* pipe : { _in.get(), _out.get() }) {
+    std::lock_guard<std::mutex> lock(pipe->mutex);
+    pipe->disconnected = true;
+    pipe->cv.notify_all();
+  }
+}
+
+size_t LoopbackTransport::outstanding() {
+  std::lock_guard<std::mutex> lock(_out->mutex);
+  return _out->size;
+}
+
+int LoopbackTransport::read(unsigned char* data, int length, int* transferred,
+    unsigned int timeoutMs) {
+  *transferred = 0;
+  Pipe& pipe = *_in;
+  auto deadline = std::chrono::steady_clock::now() +
+    std::chrono::milliseconds(timeoutMs);
+
+  // Waits on the cv, and on a shaped link also for the next bytes in flight
+  // to land.
+  std::unique_lock<std::mutex> lock(pipe.mutex);
+  size_t available = 0;
+  for (;;) {
+    if (pipe.readCancelled) {
+      return ERROR_INTERRUPTED;
+    }
+    Clock::time_point now = Clock::now();
+    available = pipe.readable(now);
+    if (available > 0) {
+      break;
+    }
+    if (pipe.disconnected && pipe.size == 0) {
+      return ERROR_NO_DEVICE;
+    }
+    if (timeoutMs != 0 && now >= deadline) {
+      return ERROR_TIMEOUT;
+    }
+
+    if (!pipe.arrivals.empty()) {
+      Clock::time_point landing = pipe.arrivals.front().second;
+      pipe.cv.wait_until(lock, timeoutMs == 0 ? landing : std::min(landing, deadline));
+    } else if (timeoutMs == 0) {
+      pipe.cv.wait(lock);
+    } else {
+      pipe.cv.wait_until(lock, deadline);
+    }
+  }
+
+  // At most two copies, for the part of the ring before and after the end.
+  size_t capacity = pipe.buffer.size();
+  size_t count = std::min(available, static_cast<size_t>(std::max(length, 0)));
+  size_t first = std::min(count, capacity - pipe.head);
+  std::memcpy(data, pipe.buffer.data() + pipe.head, first);
+  std::memcpy(data + first, pipe.buffer.data(), count - first);
+  pipe.head = (pipe.head + count) % capacity;
+  pipe.size -= count;
+  pipe.consumed += count;
+  pipe.cv.notify_all();
+
+  *transferred = static_cast<int>(count);
+  return SUCCESS;
+}
+
+int LoopbackTransport::write(const unsigned char* header, size_t headerLen,
+    const unsigned char* payload, size_t payloadLen,
+    unsigned int timeoutMs) {
+  auto deadline = std::chrono::steady_clock::now() +
+    std::chrono::milliseconds(timeoutMs);
+  int status = writeBytes(header, headerLen, deadline, timeoutMs == 0);
+  if (status == SUCCESS) {
+    status = writeBytes(payload, payloadLen, deadline, timeoutMs == 0);
+  }
+  return status;
+}
+
+int LoopbackTransport::writeBytes(const unsigned char* data, size_t length,
+    std::chrono::steady_clock::time_point deadline, bool forever) {
+  Pipe& pipe = *_out;
+  size_t capacity = pipe.buffer.size();
+  std::unique_lock<std::mutex> lock(pipe.mutex);
+  while (length > 0) {
+    auto ready = [&] {
+      return pipe.writeInterrupted || pipe.disconnected || pipe.size < capacity;
+    };
+    if (forever) {
+      pipe.cv.wait(lock, ready);
+    } else if (!pipe.cv.wait_until(lock, deadline, ready)) {
+      return ERROR_TIMEOUT;
+    }
+
+    if (pipe.writeInterrupted) {
+      return ERROR_INTERRUPTED;
+    }
+    if (pipe.disconnected) {
+      return ERROR_NO_DEVICE;
+    }
+
+    // Fill whatever space there is, then let the reader drain it.
+    size_t count = std::min(length, capacity - pipe.size);
+    if (pipe.shape.shaped()) {
+      count = std::min(count, SHAPED_CHUNK_LEN);
+    }
+
+    if (pipe.shape.megabytesPerSecond > 0.0) {
+      // Hold the sender for as long as the chunk takes on the wire.
+      Clock::time_point sent = std::max(Clock::now(), pipe.busyUntil) +
+        std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(
+          count / (pipe.shape.megabytesPerSecond * 1024.0 * 1024.0)));
+      auto stopped = [&] { return pipe.writeInterrupted || pipe.disconnected; };
+      if (pipe.cv.wait_until(lock, forever ? sent : std::min(sent, deadline), stopped)) {
+        continue;
+      }
+      if (!forever && sent > deadline) {
+        return ERROR_TIMEOUT;
+      }
+      pipe.busyUntil = sent;
+    }
+
+    size_t tail = (pipe.head + pipe.size) % capacity;
+    size_t first = std::min(count, capacity - tail);
+    std::memcpy(pipe.buffer.data() + tail, data, first);
+    std::memcpy(pipe.buffer.data(), data + first, count - first);
+    pipe.size += count;
+    pipe.written += count;
+    if (pipe.shape.shaped()) {
+      pipe.arrivals.emplace_back(pipe.written, Clock::now() +
+        std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double, std::milli>(pipe.shape.latencyMs)));
+    } else {
+      pipe.arrived = pipe.written;
+    }
+    data += count;
+    length -= count;
+    pipe.cv.notify_all();
+  }
+  return SUCCESS;
+}
+
+void LoopbackTransport::cancelReads() {
+  std::lock_guard<std::mutex> lock(_in->mutex);
+  _in->readCancelled = true;
+  _in->cv.notify_all();
+}
+
+void LoopbackTransport::resetReads() {
+  std::lock_guard<std::mutex> lock(_in->mutex);
+  _in->readCancelled = false;
+}
+
+void LoopbackTransport::interruptSends() {
+  std::lock_guard<std::mutex> lock(_out->mutex);
+  _out->writeInterrupted = true;
+  _out->cv.notify_all();
+}
+
+void LoopbackTransport::resetSends() {
+  std::lock_guard<std::mutex> lock(_out->mutex);
+  _out->writeInterrupted = false;
+}
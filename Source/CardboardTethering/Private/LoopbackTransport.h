@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <mutex>
+#include <condition_variable>
+#include "Transport.h"
+
+/**
+ * One end of an in-process link, for running a StreamSession and a stand-in
+ * phone in the same process: whatever one end sends, the other reads, byte
+ * for byte and in order, with reads returning whatever has arrived so far.
+ * Each direction buffers up to capacity bytes and a sender blocks while its
+ * buffer is full, as a USB sender does while the phone isn't reading.
+ *
+ * The link can also be shaped like a slower cable: a sender is held for as
+ * long as its bytes take at the given bandwidth, and they only become
+ * readable the given latency after that.
+ */
+class LoopbackTransport : public Transport {
+public:
+  static constexpr size_t DEFAULT_CAPACITY = 1 << 20;
+
+  /** Bytes serialized at a time on a shaped link, like a USB transfer. */
+  static constexpr size_t SHAPED_CHUNK_LEN = 16384;
+
+  /** Applies to each direction on its own. */
+  struct Shape {
+    double megabytesPerSecond; /* 0 for no limit. */
+    double latencyMs;          /* One way. */
+
+    Shape() : megabytesPerSecond(0.0), latencyMs(0.0) {}
+    bool shaped() const { return megabytesPerSecond > 0.0 || latencyMs > 0.0; }
+  };
+
+  /** Creates the two ends of a link. */
+  static void createPair(std::shared_ptr<LoopbackTransport>* a,
+    std::shared_ptr<LoopbackTransport>* b,
+    size_t capacity = DEFAULT_CAPACITY, const Shape& shape = Shape());
+
+  /** Bytes sent from this end that the other hasn't read, in flight or not. */
+  size_t outstanding();
+
+  /**
+   * Fails everything at both ends with ERROR_NO_DEVICE from now on, as if
+   * the cable was pulled; bytes already buffered can still be read.
+   */
+  void disconnect();
+
+  virtual int read(unsigned char* data, int length, int* transferred,
+    unsigned int timeoutMs) override;
+  virtual void cancelReads() override;
+  virtual void resetReads() override;
+  virtual void interruptSends() override;
+  virtual void resetSends() override;
+
+protected:
+  virtual int write(const unsigned char* header, size_t headerLen,
+    const unsigned char* payload, size_t payloadLen,
+    unsigned int timeoutMs) override;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  /**
+   * One direction; a ring of bytes shared by its sender and its reader. On
+   * a shaped link the newest bytes may still be in flight: arrivals holds
+   * when each later chunk lands, by its end in bytes ever written.
+   */
+  struct Pipe {
+    std::mutex mutex;
+    std::condition_variable cv; /* Bytes or space appeared, or a flag changed. */
+    std::vector<unsigned char> buffer;
+    size_t head;
+    size_t size;
+    Shape shape;
+    Clock::time_point busyUntil; /* When the sender's last chunk is on the wire. */
+    std::deque<std::pair<uint64_t, Clock::time_point>> arrivals;
+    uint64_t written;
+    uint64_t arrived;
+    uint64_t consumed;
+    bool readCancelled;
+    bool writeInterrupted;
+    bool disconnected;
+
+    Pipe(size_t capacity, const Shape& shape);
+
+    /** Bytes the reader can take now, after landing what has arrived. */
+    size_t readable(Clock::time_point now);
+  };
+
+  std::shared_ptr<Pipe> _in;
+  std::shared_ptr<Pipe> _out;
+
+  LoopbackTransport(std::shared_ptr<Pipe> in, std::shared_ptr<Pipe> out);
+
+  int writeBytes(const unsigned char* data, size_t length,
+    std::chrono::steady_clock::time_point deadline, bool forever);
+};
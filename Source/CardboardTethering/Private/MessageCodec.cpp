@@ -0,0 +1,119 @@
+#include "MessageCodec.h"
+#include <algorithm>
+#include <cstring>
+
+namespace Message {
+
+  namespace {
+
+    void putBig32(unsigned char* out, uint32_t value) {
+      out[0] = static_cast<unsigned char>(value >> 24);
+      out[1] = static_cast<unsigned char>(value >> 16);
+      out[2] = static_cast<unsigned char>(value >> 8);
+      out[3] = static_cast<unsigned char>(value);
+    }
+
+    uint32_t getBig32(const unsigned char* p) {
+      return (static_cast<uint32_t>(p[0]) << 24) |
+        (static_cast<uint32_t>(p[1]) << 16) |
+        (static_cast<uint32_t>(p[2]) << 8) |
+        static_cast<uint32_t>(p[3]);
+    }
+
+  }
+
+  int negotiateVersion(uint8_t peerMin, uint8_t peerMax) {
+    uint8_t high = std::min(peerMax, VERSION_MAX);
+    uint8_t low = std::max(peerMin, VERSION_MIN);
+    return high >= low ? high : -1;
+  }
+
+  void writeHeader(const Header& header, unsigned char* out) {
+    out[0] = MAGIC;
+    out[1] = header.version;
+    out[2] = header.type;
+    out[3] = header.flags;
+    putBig32(out + 4, header.sequence);
+    putBig32(out + 8, header.length);
+  }
+
+  int readHeader(const unsigned char* data, Header* out) {
+    if (data[0] != MAGIC) {
+      return ERROR_MAGIC;
+    }
+
+    Header header;
+    header.version = data[1];
+    header.type = data[2];
+    header.flags = data[3];
+    header.sequence = getBig32(data + 4);
+    header.length = getBig32(data + 8);
+    if (header.version < VERSION_MIN || header.version > VERSION_MAX) {
+      return ERROR_VERSION;
+    }
+    if (header.length > MAX_PAYLOAD) {
+      return ERROR_LENGTH;
+    }
+
+    *out = header;
+    return 0;
+  }
+
+  Writer::Writer(uint8_t version) : _version(version), _sequence(0) {}
+
+  void Writer::header(uint8_t type, size_t length, unsigned char* out,
+      uint8_t flags) {
+    Header header;
+    header.version = _version;
+    header.type = type;
+    header.flags = flags;
+    header.sequence = ++_sequence;
+    header.length = static_cast<uint32_t>(length);
+    writeHeader(header, out);
+  }
+
+  void Writer::append(uint8_t type, const unsigned char* payload,
+      size_t length, std::vector<unsigned char>* out, uint8_t flags) {
+    size_t start = out->size();
+    out->resize(start + HEADER_LEN);
+    header(type, length, out->data() + start, flags);
+    out->insert(out->end(), payload, payload + length);
+  }
+
+  Parser::Parser() : _lastSequence(0), _error(0) {}
+
+  int Parser::feed(const unsigned char* data, size_t size,
+      const Handler& handler) {
+    if (_error != 0) {
+      return _error;
+    }
+
+    _pending.insert(_pending.end(), data, data + size);
+
+    size_t offset = 0;
+    while (_pending.size() - offset >= HEADER_LEN) {
+      Header header;
+      int status = readHeader(_pending.data() + offset, &header);
+      if (status != 0) {
+        _error = status;
+        break;
+      }
+      if (_pending.size() - offset - HEADER_LEN < header.length) {
+        break;
+      }
+
+      if (_lastSequence != 0 && header.sequence > _lastSequence + 1) {
+        _stats.missing += header.sequence - _lastSequence - 1;
+      }
+      _lastSequence = header.sequence;
+      _stats.messages++;
+
+      handler(header, _pending.data() + offset + HEADER_LEN);
+      offset += HEADER_LEN + header.length;
+    }
+
+    _pending.erase(_pending.begin(), _pending.begin() + offset);
+    return _error;
+  }
+
+}
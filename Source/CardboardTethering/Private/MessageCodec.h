@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+/**
+ * Framing for everything sent after the handshake, in both directions, so
+ * that new kinds of message can share the link with old ones. Every message
+ * is a 12-byte header and a payload (all integers big-endian):
+ *
+ *   u8  magic      MAGIC; anything else means the stream lost sync.
+ *   u8  version    Protocol version the sender is speaking.
+ *   u8  type       A Type below. Receivers skip types they don't know.
+ *   u8  flags      FLAG_* bits; 0 unless a type says otherwise.
+ *   u32 sequence   Counted by each sender from 1, across all types; a gap
+ *                  means messages were lost.
+ *   u32 length     Payload bytes that follow, at most MAX_PAYLOAD.
+ *
+ * The phone offers the range of versions it speaks in its TYPE_HELLO, the
+ * host picks one with negotiateVersion, and both sides stamp it on every
+ * message from then on. The phone's TYPE_HELLO itself uses the lowest
+ * version it speaks.
+ */
+namespace Message {
+
+  static constexpr uint8_t MAGIC = 0xCB;
+  static constexpr uint8_t VERSION_MIN = 1;
+  static constexpr uint8_t VERSION_MAX = 1;
+  static constexpr size_t HEADER_LEN = 12;
+  static constexpr size_t MAX_PAYLOAD = 16 * 1024 * 1024;
+
+  enum Type : uint8_t {
+    TYPE_POSE = 1,  /* Phone to host: pose packet, see UsbDevice. */
+    TYPE_FRAME = 2, /* Host to phone: FrameHeader, then the eye body. */
+    TYPE_END = 3,   /* Either way: no more messages; empty payload. */
+    TYPE_HELLO = 4, /* Either way, first: see Capabilities. */
+    TYPE_VSYNC = 5, /* Phone to host: vsync report, see UsbDevice. */
+    TYPE_REFRESH = 6 /* Phone to host: keyframe request, see UsbDevice. */
+  };
+
+  /**
+   * On a host TYPE_HELLO sent before the phone's: the host lost the link
+   * and is resuming it with the parameters already agreed. The phone answers
+   * with its own TYPE_HELLO again, and the host's usual reply follows.
+   */
+  static constexpr uint8_t FLAG_RESUME = 0x01;
+
+  static constexpr int ERROR_MAGIC = -1;
+  static constexpr int ERROR_VERSION = -2;
+  static constexpr int ERROR_LENGTH = -3;
+
+  struct Header {
+    uint8_t version;
+    uint8_t type;
+    uint8_t flags;
+    uint32_t sequence;
+    uint32_t length;
+
+    Header() : version(VERSION_MAX), type(0), flags(0), sequence(0), length(0) {}
+  };
+
+  /**
+   * The highest version both sides speak, given the peer's range, or -1 if
+   * there is none.
+   */
+  int negotiateVersion(uint8_t peerMin, uint8_t peerMax);
+
+  /** Writes HEADER_LEN bytes. */
+  void writeHeader(const Header& header, unsigned char* out);
+
+  /**
+   * Reads a header; returns 0, or an ERROR_* if the magic, version or
+   * length is wrong. Needs HEADER_LEN bytes.
+   */
+  int readHeader(const unsigned char* data, Header* out);
+
+  /** Stamps outgoing messages with the version and the next sequence number. */
+  class Writer {
+  public:
+    explicit Writer(uint8_t version = VERSION_MAX);
+
+    uint8_t version() const { return _version; }
+
+    /** Writes the header for a payload of the given length. */
+    void header(uint8_t type, size_t length, unsigned char* out,
+      uint8_t flags = 0);
+
+    /** Appends a header and payload to out. */
+    void append(uint8_t type, const unsigned char* payload, size_t length,
+      std::vector<unsigned char>* out, uint8_t flags = 0);
+
+  private:
+    uint8_t _version;
+    uint32_t _sequence;
+  };
+
+  /**
+   * Splits a byte stream, arriving in chunks of any size, into messages.
+   * Once a header is bad the stream can't be trusted, so every later call
+   * returns the same error.
+   */
+  class Parser {
+  public:
+    using Handler = std::function<void(const Header&, const unsigned char*)>;
+
+    struct Stats {
+      uint64_t messages;
+      uint64_t missing; /* Sequence numbers skipped by the sender's count. */
+
+      Stats() : messages(0), missing(0) {}
+    };
+
+    Parser();
+
+    /** Calls the handler for each complete message; returns 0 or ERROR_*. */
+    int feed(const unsigned char* data, size_t size, const Handler& handler);
+
+    Stats getStats() const { return _stats; }
+
+  private:
+    std::vector<unsigned char> _pending;
+    uint32_t _lastSequence;
+    int _error;
+    Stats _stats;
+  };
+
+}
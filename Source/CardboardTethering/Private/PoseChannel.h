@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <atomic>
+#include <thread>
+
+/**
+ * One head orientation reported by the phone, as the phone sends it (its
+ * axes, not Unreal's).
+ */
+struct PoseSample {
+  float x;
+  float y;
+  float z;
+  float w;
+  float velocity[3];  /* Angular velocity in rad/s, body frame; see PosePredictor. */
+  uint32_t sequence;  /* Counted by the phone, one per packet. */
+  int64_t deviceNs;   /* Phone's monotonic clock when the pose was sampled. */
+  int64_t receivedNs; /* Our steady_clock when the packet arrived. */
+
+  PoseSample() : x(0.0f), y(0.0f), z(0.0f), w(1.0f),
+      velocity(), sequence(0), deviceNs(0), receivedNs(0) {}
+};
+
+/**
+ * Single-writer, multi-reader hand-off of the latest pose, as a seqlock. The
+ * writer (the USB read loop) bumps a sequence counter to odd, writes the
+ * sample and bumps it to even; readers retry if the counter was odd or
+ * changed while they copied. Readers never block the writer and never see a
+ * quaternion mixed from two samples.
+ *
+ * The sample is stored as relaxed atomic words, with fences ordering them
+ * against the counter, so the racing copy is well defined.
+ */
+class PoseChannel {
+  static constexpr size_t WORDS = (sizeof(PoseSample) + 3) / 4;
+
+  std::atomic<uint32_t> _version;
+  std::atomic<uint32_t> _words[WORDS];
+  std::atomic<uint64_t> _updates;
+
+public:
+  PoseChannel() : _version(0), _updates(0) {
+    PoseSample identity;
+    uint32_t words[WORDS] = {};
+    std::memcpy(words, &identity, sizeof(identity));
+    for (size_t i = 0; i < WORDS; ++i) {
+      _words[i].store(words[i], std::memory_order_relaxed);
+    }
+  }
+
+  PoseChannel(const PoseChannel&) = delete;
+  PoseChannel& operator=(const PoseChannel&) = delete;
+
+  /** Publishes a sample; only one thread may call this at a time. */
+  void store(const PoseSample& sample) {
+    uint32_t words[WORDS] = {};
+    std::memcpy(words, &sample, sizeof(sample));
+
+    uint32_t version = _version.load(std::memory_order_relaxed);
+    _version.store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < WORDS; ++i) {
+      _words[i].store(words[i], std::memory_order_relaxed);
+    }
+    _version.store(version + 2, std::memory_order_release);
+    _updates++;
+  }
+
+  /** Returns the latest complete sample. */
+  PoseSample load() const {
+    uint32_t words[WORDS];
+    while (true) {
+      uint32_t before = _version.load(std::memory_order_acquire);
+      if (before & 1) {
+        // The writer is mid-store; it only has a few words left to write.
+        std::this_thread::yield();
+        continue;
+      }
+
+      for (size_t i = 0; i < WORDS; ++i) {
+        words[i] = _words[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (_version.load(std::memory_order_relaxed) == before) {
+        break;
+      }
+    }
+
+    PoseSample sample;
+    std::memcpy(&sample, words, sizeof(sample));
+    return sample;
+  }
+
+  uint64_t updates() const { return _updates.load(); }
+};
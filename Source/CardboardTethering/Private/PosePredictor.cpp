@@ -0,0 +1,349 @@
+#include "PosePredictor.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+namespace {
+
+  struct Quat {
+    double x, y, z, w;
+  };
+
+  Quat toQuat(const PoseSample& sample) {
+    Quat q = { sample.x, sample.y, sample.z, sample.w };
+    return q;
+  }
+
+  void fromQuat(const Quat& q, PoseSample* sample) {
+    sample->x = static_cast<float>(q.x);
+    sample->y = static_cast<float>(q.y);
+    sample->z = static_cast<float>(q.z);
+    sample->w = static_cast<float>(q.w);
+  }
+
+  Quat multiply(const Quat& a, const Quat& b) {
+    Quat q;
+    q.w = a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z;
+    q.x = a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y;
+    q.y = a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x;
+    q.z = a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w;
+    return q;
+  }
+
+  Quat conjugate(const Quat& q) {
+    Quat c = { -q.x, -q.y, -q.z, q.w };
+    return c;
+  }
+
+  Quat normalize(const Quat& q) {
+    double n = std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+    if (n <= 0.0) {
+      Quat identity = { 0.0, 0.0, 0.0, 1.0 };
+      return identity;
+    }
+    Quat r = { q.x / n, q.y / n, q.z / n, q.w / n };
+    return r;
+  }
+
+  /** Rotation vector (axis times angle) of a unit quaternion. */
+  void toRotationVector(Quat q, double out[3]) {
+    if (q.w < 0.0) {
+      q.x = -q.x; q.y = -q.y; q.z = -q.z; q.w = -q.w;
+    }
+    double s = std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z);
+    double scale = s < 1e-9 ? 2.0 : 2.0 * std::atan2(s, q.w) / s;
+    out[0] = q.x * scale;
+    out[1] = q.y * scale;
+    out[2] = q.z * scale;
+  }
+
+  Quat fromRotationVector(const double v[3]) {
+    double angle = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    double scale = angle < 1e-9 ? 0.5 : std::sin(angle / 2.0) / angle;
+    Quat q = { v[0] * scale, v[1] * scale, v[2] * scale, std::cos(angle / 2.0) };
+    return normalize(q);
+  }
+
+  Quat slerp(const Quat& a, Quat b, double t) {
+    double dot = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+    if (dot < 0.0) {
+      b.x = -b.x; b.y = -b.y; b.z = -b.z; b.w = -b.w;
+      dot = -dot;
+    }
+    if (dot > 0.9995) {
+      Quat q = { a.x + t * (b.x - a.x), a.y + t * (b.y - a.y),
+        a.z + t * (b.z - a.z), a.w + t * (b.w - a.w) };
+      return normalize(q);
+    }
+    double theta = std::acos(dot);
+    double wa = std::sin((1.0 - t) * theta) / std::sin(theta);
+    double wb = std::sin(t * theta) / std::sin(theta);
+    Quat q = { wa * a.x + wb * b.x, wa * a.y + wb * b.y,
+      wa * a.z + wb * b.z, wa * a.w + wb * b.w };
+    return q;
+  }
+
+}
+
+PosePredictor::PosePredictor() {
+  reset();
+}
+
+void PosePredictor::setSettings(const Settings& settings) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _settings = settings;
+  _settings.filter = std::min(std::max(_settings.filter, 0.0), 1.0);
+  _settings.horizonMs = std::max(_settings.horizonMs, 0.0);
+  _settings.windowMs = std::max(_settings.windowMs, 0.0);
+  _settings.maxExtrapolationMs = std::max(_settings.maxExtrapolationMs, 0.0);
+}
+
+PosePredictor::Settings PosePredictor::getSettings() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _settings;
+}
+
+void PosePredictor::reset() {
+  _count = 0;
+  _next = 0;
+  _velocity[0] = _velocity[1] = _velocity[2] = 0.0f;
+}
+
+int64_t PosePredictor::sampleTimeNs(const PoseSample& sample) {
+  return sample.deviceNs != 0 ? sample.deviceNs : sample.receivedNs;
+}
+
+void PosePredictor::addSample(PoseSample* sample) {
+  Settings settings = getSettings();
+  int64_t now = sampleTimeNs(*sample);
+
+  // Measure against the oldest sample inside the window, but always at
+  // least the previous one.
+  const PoseSample* base = nullptr;
+  for (size_t i = 1; i <= _count; ++i) {
+    const PoseSample& older = _history[(_next + HISTORY - i) % HISTORY];
+    int64_t age = now - sampleTimeNs(older);
+    if (age <= 0) {
+      break;
+    }
+    if (base != nullptr && age > settings.windowMs * 1e6) {
+      break;
+    }
+    base = &older;
+  }
+
+  if (base != nullptr) {
+    double dt = (now - sampleTimeNs(*base)) / 1e9;
+    double measured[3] = { 0.0, 0.0, 0.0 };
+    if (dt * 1000.0 <= settings.maxExtrapolationMs) {
+      toRotationVector(multiply(conjugate(toQuat(*base)), toQuat(*sample)), measured);
+      for (double& v : measured) {
+        v /= dt;
+      }
+    }
+
+    // The first estimate after a reset is taken as is.
+    double filter = _count == 1 ? 1.0 : settings.filter;
+    for (int i = 0; i < 3; ++i) {
+      _velocity[i] += static_cast<float>(filter * (measured[i] - _velocity[i]));
+    }
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    sample->velocity[i] = _velocity[i];
+  }
+
+  _history[_next] = *sample;
+  _next = (_next + 1) % HISTORY;
+  _count = std::min(_count + 1, HISTORY);
+}
+
+PoseSample PosePredictor::extrapolate(const PoseSample& sample, double seconds) {
+  double rotation[3];
+  for (int i = 0; i < 3; ++i) {
+    rotation[i] = sample.velocity[i] * seconds;
+  }
+
+  PoseSample predicted = sample;
+  fromQuat(normalize(multiply(toQuat(sample), fromRotationVector(rotation))), &predicted);
+  return predicted;
+}
+
+PoseSample PosePredictor::predict(const PoseSample& sample, int64_t nowNs) const {
+  Settings settings = getSettings();
+  if (!settings.enabled) {
+    return sample;
+  }
+
+  double ageMs = sample.receivedNs > 0 ? (nowNs - sample.receivedNs) / 1e6 : 0.0;
+  double aheadMs = std::min(std::max(ageMs, 0.0) + settings.horizonMs,
+    settings.maxExtrapolationMs);
+  return extrapolate(sample, aheadMs / 1000.0);
+}
+
+double PosePredictor::angleDegrees(const PoseSample& a, const PoseSample& b) {
+  double rotation[3];
+  toRotationVector(multiply(conjugate(normalize(toQuat(a))), normalize(toQuat(b))), rotation);
+  double angle = std::sqrt(rotation[0] * rotation[0] +
+    rotation[1] * rotation[1] + rotation[2] * rotation[2]);
+  return angle * 180.0 / 3.14159265358979323846;
+}
+
+PoseSample PosePredictor::interpolate(const std::vector<PoseSample>& samples,
+    int64_t timeNs) {
+  if (samples.empty()) {
+    return PoseSample();
+  }
+
+  auto after = std::lower_bound(samples.begin(), samples.end(), timeNs,
+    [](const PoseSample& sample, int64_t t) { return sampleTimeNs(sample) < t; });
+  if (after == samples.begin()) {
+    return samples.front();
+  }
+  if (after == samples.end()) {
+    return samples.back();
+  }
+
+  const PoseSample& before = *(after - 1);
+  int64_t span = sampleTimeNs(*after) - sampleTimeNs(before);
+  double t = span > 0 ? static_cast<double>(timeNs - sampleTimeNs(before)) / span : 0.0;
+
+  PoseSample result = before;
+  fromQuat(slerp(toQuat(before), toQuat(*after), t), &result);
+  return result;
+}
+
+namespace PoseLog {
+
+  bool write(const std::string& path, const std::vector<PoseSample>& samples) {
+    std::ofstream out(path.c_str());
+    if (!out) {
+      return false;
+    }
+
+    out << "sequence,device_ns,received_ns,x,y,z,w\n";
+    char line[256];
+    for (const PoseSample& sample : samples) {
+      std::snprintf(line, sizeof(line), "%u,%lld,%lld,%.9g,%.9g,%.9g,%.9g\n",
+        sample.sequence,
+        static_cast<long long>(sample.deviceNs),
+        static_cast<long long>(sample.receivedNs),
+        sample.x, sample.y, sample.z, sample.w);
+      out << line;
+    }
+    return static_cast<bool>(out);
+  }
+
+  bool read(const std::string& path, std::vector<PoseSample>* samples) {
+    std::ifstream in(path.c_str());
+    if (!in) {
+      return false;
+    }
+
+    samples->clear();
+    std::string line;
+    while (std::getline(in, line)) {
+      PoseSample sample;
+      long long deviceNs, receivedNs;
+      if (std::sscanf(line.c_str(), "%u,%lld,%lld,%f,%f,%f,%f",
+          &sample.sequence, &deviceNs, &receivedNs,
+          &sample.x, &sample.y, &sample.z, &sample.w) == 7) {
+        sample.deviceNs = deviceNs;
+        sample.receivedNs = receivedNs;
+        samples->push_back(sample);
+      }
+    }
+    return true;
+  }
+
+  Error evaluate(const std::vector<PoseSample>& samples,
+      const PosePredictor::Settings& settings) {
+    Error error = {};
+    if (samples.size() < 2) {
+      return error;
+    }
+
+    PosePredictor predictor;
+    predictor.setSettings(settings);
+    int64_t horizonNs = static_cast<int64_t>(settings.horizonMs * 1e6);
+    int64_t lastNs = PosePredictor::sampleTimeNs(samples.back());
+
+    std::vector<double> errors;
+    double unpredicted = 0.0;
+    for (const PoseSample& recorded : samples) {
+      PoseSample sample = recorded;
+      predictor.addSample(&sample);
+
+      int64_t targetNs = PosePredictor::sampleTimeNs(sample) + horizonNs;
+      if (targetNs > lastNs) {
+        break;
+      }
+
+      PoseSample actual = PosePredictor::interpolate(samples, targetNs);
+      PoseSample predicted = settings.enabled ?
+        PosePredictor::extrapolate(sample, settings.horizonMs / 1000.0) : sample;
+      errors.push_back(PosePredictor::angleDegrees(predicted, actual));
+      unpredicted += PosePredictor::angleDegrees(sample, actual);
+    }
+
+    if (errors.empty()) {
+      return error;
+    }
+
+    error.samples = errors.size();
+    double total = 0.0;
+    for (double e : errors) {
+      total += e;
+    }
+    error.meanDegrees = total / errors.size();
+    error.unpredictedMeanDegrees = unpredicted / errors.size();
+    std::sort(errors.begin(), errors.end());
+    error.p95Degrees = errors[std::min(errors.size() - 1, errors.size() * 95 / 100)];
+    error.maxDegrees = errors.back();
+    return error;
+  }
+
+  std::vector<PoseSample> synthesize(double seconds, double rateHz,
+      uint32_t seed) {
+    const double PI = 3.14159265358979323846;
+    std::vector<PoseSample> samples;
+    uint32_t noise = seed | 1;
+    auto random = [&]() {
+      noise ^= noise << 13;
+      noise ^= noise >> 17;
+      noise ^= noise << 5;
+      return (noise & 0xFFFF) / 65535.0 - 0.5;
+    };
+
+    size_t count = static_cast<size_t>(seconds * rateHz);
+    for (size_t i = 0; i < count; ++i) {
+      double t = i / rateHz;
+      double yaw = 0.6 * std::sin(2.0 * PI * 0.5 * t) + 0.2 * std::sin(2.0 * PI * 1.3 * t);
+      double pitch = 0.3 * std::sin(2.0 * PI * 0.7 * t + 1.0);
+      double roll = 0.05 * std::sin(2.0 * PI * 0.9 * t);
+
+      // Yaw about y, then pitch about x, then roll about z, as on a phone
+      // held in landscape.
+      double yawAxis[3] = { 0.0, yaw, 0.0 };
+      double pitchAxis[3] = { pitch, 0.0, 0.0 };
+      double rollAxis[3] = { 0.0, 0.0, roll };
+      Quat q = multiply(multiply(fromRotationVector(yawAxis),
+        fromRotationVector(pitchAxis)), fromRotationVector(rollAxis));
+      q.x += random() * 0.002;
+      q.y += random() * 0.002;
+      q.z += random() * 0.002;
+      q = normalize(q);
+
+      PoseSample sample;
+      fromQuat(q, &sample);
+      sample.sequence = static_cast<uint32_t>(i + 1);
+      sample.deviceNs = static_cast<int64_t>(t * 1e9) + 1;
+      sample.receivedNs = sample.deviceNs + 2000000 +
+        static_cast<int64_t>((random() + 0.5) * 3e6);
+      samples.push_back(sample);
+    }
+    return samples;
+  }
+
+}
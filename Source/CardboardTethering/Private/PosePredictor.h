@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "PoseChannel.h"
+
+/**
+ * Extrapolates head orientation to the time a frame will be displayed.
+ *
+ * The read loop feeds every pose through addSample, which keeps a short
+ * history, estimates angular velocity over a window of it (using the
+ * phone's timestamps, so USB jitter doesn't show up as motion), smooths the
+ * estimate and stores it in the sample before it is published. Readers then
+ * call predict with the published sample, which rotates it forward by its
+ * age plus the prediction horizon.
+ *
+ * Quaternions are in the phone's frame, as sent; no axis remapping here.
+ */
+class PosePredictor {
+public:
+  static constexpr size_t HISTORY = 64;
+
+  struct Settings {
+    bool enabled;
+    double horizonMs;          /* From receipt to photons, roughly. */
+    double windowMs;           /* History used for each velocity estimate. */
+    double filter;             /* Weight of a new estimate, 0..1. */
+    double maxExtrapolationMs; /* Stale poses are not pushed further. */
+
+    Settings() : enabled(true), horizonMs(30.0), windowMs(20.0),
+        filter(0.5), maxExtrapolationMs(100.0) {}
+  };
+
+  PosePredictor();
+
+  void setSettings(const Settings& settings);
+  Settings getSettings() const;
+
+  /** Fills in the sample's angular velocity; single caller at a time. */
+  void addSample(PoseSample* sample);
+
+  /** Forgets the history, e.g. for a new connection. */
+  void reset();
+
+  /** The sample's orientation extrapolated to nowNs plus the horizon. */
+  PoseSample predict(const PoseSample& sample, int64_t nowNs) const;
+
+  /** Rotates the orientation by its angular velocity for the given time. */
+  static PoseSample extrapolate(const PoseSample& sample, double seconds);
+
+  /** Angle between two orientations, in degrees. */
+  static double angleDegrees(const PoseSample& a, const PoseSample& b);
+
+  /** Orientation at timeNs, slerped between the samples around it. */
+  static PoseSample interpolate(const std::vector<PoseSample>& samples,
+    int64_t timeNs);
+
+  /** Device time if the phone sent it, otherwise receive time. */
+  static int64_t sampleTimeNs(const PoseSample& sample);
+
+private:
+  mutable std::mutex _mutex;
+  Settings _settings;
+
+  PoseSample _history[HISTORY];
+  size_t _count;
+  size_t _next;
+  float _velocity[3];
+};
+
+/**
+ * Recorded poses as CSV (sequence, device ns, received ns, x, y, z, w), for
+ * checking prediction offline.
+ */
+namespace PoseLog {
+
+  bool write(const std::string& path, const std::vector<PoseSample>& samples);
+  bool read(const std::string& path, std::vector<PoseSample>* samples);
+
+  struct Error {
+    size_t samples;
+    double meanDegrees;
+    double p95Degrees;
+    double maxDegrees;
+    double unpredictedMeanDegrees; /* Just using the latest pose. */
+  };
+
+  /**
+   * Replays the log through a PosePredictor and compares each prediction,
+   * horizonMs ahead of its sample, with the recorded pose at that time.
+   */
+  Error evaluate(const std::vector<PoseSample>& samples,
+    const PosePredictor::Settings& settings);
+
+  /** Head-like motion: a few overlapping sinusoids with sensor noise. */
+  std::vector<PoseSample> synthesize(double seconds, double rateHz,
+    uint32_t seed);
+
+}
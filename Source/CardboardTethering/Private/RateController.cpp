@@ -0,0 +1,196 @@
+#include "RateController.h"
+#include <algorithm>
+
+#include "turbojpeg.h"
+
+namespace {
+
+  /** Weight of the newest sample in the running estimates. */
+  const double SMOOTHING = 0.25;
+
+  /** Fraction of a budget that counts as clear headroom. */
+  const double HEADROOM = 0.75;
+
+  /** Samples from new settings to wait for before judging them. */
+  const size_t SETTLE_FRAMES = 3;
+
+  /** The fixed setting used before the controller existed. */
+  const int DEFAULT_QUALITY = 50;
+
+  double smooth(double estimate, double sample) {
+    return estimate + SMOOTHING * (sample - estimate);
+  }
+
+  int chromaRank(int subsamp) {
+    switch (subsamp) {
+      case TJSAMP_444: return 2;
+      case TJSAMP_422: return 1;
+      default: return 0;
+    }
+  }
+
+  /** Ladder order: downscale, then chroma, then quality. */
+  bool notMoreExpensive(const RateController::Settings& a,
+      const RateController::Settings& b) {
+    if (a.downscale != b.downscale) {
+      return a.downscale > b.downscale;
+    }
+    if (a.subsamp != b.subsamp) {
+      return chromaRank(a.subsamp) < chromaRank(b.subsamp);
+    }
+    return a.quality <= b.quality;
+  }
+
+}
+
+RateController::RateController(const Targets& targets)
+  : _targets(targets),
+    _level(0),
+    _generation(0),
+    _haveEstimate(false),
+    _headroomFrames(0),
+    _settledFrames(0) {
+  _estimate.encodeMs = 0.0;
+  _estimate.sendMs = 0.0;
+  _estimate.bytesPerFrame = 0.0;
+  _estimate.linkMegabytesPerSecond = 0.0;
+
+  buildLadder();
+
+  // Start where the fixed settings used to be.
+  for (size_t i = 0; i < _ladder.size(); ++i) {
+    const Settings& settings = _ladder[i];
+    if (settings.downscale == 1 && settings.subsamp == TJSAMP_420 &&
+        settings.quality >= DEFAULT_QUALITY) {
+      _level = i;
+      break;
+    }
+  }
+  setLevel(_level);
+}
+
+void RateController::buildLadder() {
+  int minQuality = std::max(1, std::min(_targets.minQuality, 100));
+  int maxQuality = std::max(minQuality, std::min(_targets.maxQuality, 100));
+
+  _ladder.clear();
+  auto addQualitySteps = [&](size_t downscale) {
+    for (int quality = minQuality; ; quality += QUALITY_STEP) {
+      Settings settings;
+      settings.quality = std::min(quality, maxQuality);
+      settings.subsamp = TJSAMP_420;
+      settings.downscale = downscale;
+      settings.generation = 0;
+      _ladder.push_back(settings);
+      if (quality >= maxQuality) {
+        break;
+      }
+    }
+  };
+
+  if (!_targets.adaptive) {
+    minQuality = maxQuality;
+    addQualitySteps(1);
+    return;
+  }
+
+  if (_targets.allowDownscale) {
+    addQualitySteps(2);
+  }
+  addQualitySteps(1);
+
+  // Finer chroma is only worth its bandwidth once quality is maxed out.
+  for (int subsamp : { TJSAMP_422, TJSAMP_444 }) {
+    Settings settings;
+    settings.quality = maxQuality;
+    settings.subsamp = subsamp;
+    settings.downscale = 1;
+    settings.generation = 0;
+    _ladder.push_back(settings);
+  }
+}
+
+void RateController::setLevel(size_t level) {
+  _level = std::min(level, _ladder.size() - 1);
+  _ladder[_level].generation = ++_generation;
+  _headroomFrames = 0;
+  _settledFrames = 0;
+}
+
+void RateController::setTargets(const Targets& targets) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  Settings current = _ladder[_level];
+  _targets = targets;
+  buildLadder();
+
+  // Keep the most expensive setting that costs no more than the current one.
+  size_t level = 0;
+  for (size_t i = 0; i < _ladder.size(); ++i) {
+    if (notMoreExpensive(_ladder[i], current)) {
+      level = i;
+    }
+  }
+  setLevel(level);
+}
+
+RateController::Targets RateController::getTargets() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _targets;
+}
+
+RateController::Settings RateController::getSettings() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _ladder[_level];
+}
+
+RateController::Estimate RateController::getEstimate() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _estimate;
+}
+
+void RateController::addSample(const Sample& sample) {
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  if (!_haveEstimate) {
+    _estimate.encodeMs = sample.encodeMs;
+    _estimate.sendMs = sample.sendMs;
+    _estimate.bytesPerFrame = static_cast<double>(sample.bytes);
+    _haveEstimate = true;
+  } else {
+    _estimate.encodeMs = smooth(_estimate.encodeMs, sample.encodeMs);
+    _estimate.sendMs = smooth(_estimate.sendMs, sample.sendMs);
+    _estimate.bytesPerFrame = smooth(_estimate.bytesPerFrame,
+      static_cast<double>(sample.bytes));
+  }
+  if (_estimate.sendMs > 0.0) {
+    _estimate.linkMegabytesPerSecond =
+      _estimate.bytesPerFrame / (_estimate.sendMs * 1000.0);
+  }
+
+  // Frames encoded before the last change say nothing about the new
+  // settings, and the estimates need a few frames to catch up.
+  if (sample.generation != _generation) {
+    return;
+  }
+  if (++_settledFrames < SETTLE_FRAMES) {
+    return;
+  }
+
+  double budgetMs = 1000.0 / std::max(_targets.framesPerSecond, 1.0);
+  double frameMs = std::max(_estimate.encodeMs, _estimate.sendMs);
+  double latencyMs = _estimate.encodeMs + _estimate.sendMs;
+
+  if (frameMs > budgetMs || latencyMs > _targets.latencyMs) {
+    if (_level > 0) {
+      setLevel(_level - 1);
+    }
+    _headroomFrames = 0;
+  } else if (frameMs < budgetMs * HEADROOM &&
+      latencyMs < _targets.latencyMs * HEADROOM) {
+    if (++_headroomFrames >= UPGRADE_FRAMES && _level + 1 < _ladder.size()) {
+      setLevel(_level + 1);
+    }
+  } else {
+    _headroomFrames = 0;
+  }
+}
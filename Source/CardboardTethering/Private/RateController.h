@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+/**
+ * Picks JPEG quality, chroma subsampling and encode downscale so that the
+ * stream keeps up with a target frame rate and latency budget. The encode
+ * and transmit stages run concurrently, so the frame rate is bounded by the
+ * slower of the two, while latency is roughly their sum.
+ *
+ * Settings form a ladder from cheapest to most expensive: quality steps at
+ * half resolution (if downscaling is allowed), quality steps at full
+ * resolution with 4:2:0 chroma, and finally 4:2:2 and 4:4:4 chroma at
+ * maximum quality. The controller steps down immediately when a budget is
+ * exceeded and steps up only after a run of frames with clear headroom.
+ *
+ * Thread-safe: the encoder reads settings while the sender reports samples.
+ */
+class RateController {
+public:
+  struct Targets {
+    double framesPerSecond;
+    double latencyMs;
+    int minQuality;
+    int maxQuality;
+    bool allowDownscale;
+    bool adaptive; /* false holds maxQuality, 4:2:0, full size; for benchmarks. */
+
+    Targets() : framesPerSecond(60.0), latencyMs(50.0),
+        minQuality(20), maxQuality(90), allowDownscale(true), adaptive(true) {}
+  };
+
+  struct Settings {
+    int quality;
+    int subsamp;      /* A TJSAMP value. */
+    size_t downscale; /* 1 for full resolution, 2 for half. */
+    uint64_t generation; /* Changes whenever the other fields do. */
+  };
+
+  /** What one frame cost, measured by the encode and send stages. */
+  struct Sample {
+    uint64_t generation; /* Of the settings the frame was encoded with. */
+    double encodeMs;
+    double sendMs;
+    size_t bytes;
+  };
+
+  struct Estimate {
+    double encodeMs;
+    double sendMs;
+    double bytesPerFrame;
+    double linkMegabytesPerSecond;
+  };
+
+  static constexpr int QUALITY_STEP = 5;
+  static constexpr size_t UPGRADE_FRAMES = 30;
+
+  explicit RateController(const Targets& targets = Targets());
+
+  void setTargets(const Targets& targets);
+  Targets getTargets() const;
+  Settings getSettings() const;
+  Estimate getEstimate() const;
+
+  /** Feeds one frame's measurements; samples from stale settings are ignored. */
+  void addSample(const Sample& sample);
+
+private:
+  mutable std::mutex _mutex;
+  Targets _targets;
+  std::vector<Settings> _ladder;
+  size_t _level;
+  uint64_t _generation;
+
+  bool _haveEstimate;
+  Estimate _estimate;
+  size_t _headroomFrames;
+  size_t _settledFrames;
+
+  void buildLadder();
+  void setLevel(size_t level);
+};
@@ -0,0 +1,152 @@
+#include "Reconnector.h"
+#include <algorithm>
+#include <iostream>
+
+Reconnector::Reconnector() :
+  _state(STATE_STREAMING),
+  _outages(0),
+  _recovered(0),
+  _abandoned(0),
+  _attempts(0),
+  _lastError(0),
+  _lastNs(0),
+  _totalNs(0),
+  _maxNs(0) {}
+
+const char* Reconnector::stateName(State state) {
+  switch (state) {
+    case STATE_STREAMING: return "streaming";
+    case STATE_BACKOFF: return "backing off";
+    case STATE_OPENING: return "opening";
+    case STATE_RESUMING: return "resuming";
+    case STATE_STARTING: return "starting";
+    case STATE_FAILED: return "failed";
+    default: return "unknown";
+  }
+}
+
+void Reconnector::setSettings(const Settings& settings) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _settings = settings;
+  _settings.maxAttempts = std::max<size_t>(settings.maxAttempts, 1);
+  _settings.initialBackoffMs = std::max(settings.initialBackoffMs, 0.0);
+  _settings.maxBackoffMs = std::max(settings.maxBackoffMs, _settings.initialBackoffMs);
+}
+
+Reconnector::Settings Reconnector::getSettings() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _settings;
+}
+
+double Reconnector::backoffMs(const Settings& settings, size_t attempt) {
+  double backoff = settings.initialBackoffMs;
+  for (size_t i = 1; i < attempt && backoff < settings.maxBackoffMs; ++i) {
+    backoff *= 2.0;
+  }
+  return std::min(backoff, settings.maxBackoffMs);
+}
+
+void Reconnector::setState(State state) {
+  _state.store(state);
+}
+
+void Reconnector::attempted(int status) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _attempts++;
+  if (status != 0) {
+    _lastError = status;
+  }
+}
+
+int Reconnector::reconnect(Link* link, int error) {
+  Settings settings = getSettings();
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _outages++;
+    _lastError = error;
+  }
+
+  int64_t startNs = link->nowNs();
+  int64_t budgetNs = static_cast<int64_t>(settings.budgetMs * 1e6);
+  int status = error;
+  for (size_t attempt = 1; attempt <= settings.maxAttempts; ++attempt) {
+    // Give the device time to re-enumerate before every attempt, the first
+    // included, and don't start one that the budget can't wait for.
+    int64_t waitNs = static_cast<int64_t>(backoffMs(settings, attempt) * 1e6);
+    if (link->nowNs() + waitNs - startNs > budgetNs) {
+      std::cout << "Reconnect: out of time after " << attempt - 1
+        << " attempts" << std::endl;
+      break;
+    }
+
+    setState(STATE_BACKOFF);
+    if (!link->wait(waitNs)) {
+      std::cout << "Reconnect cancelled" << std::endl;
+      std::unique_lock<std::mutex> lock(_mutex);
+      _abandoned++;
+      setState(STATE_FAILED);
+      return CANCELLED;
+    }
+
+    setState(STATE_OPENING);
+    status = link->open();
+    if (status == 0) {
+      setState(STATE_RESUMING);
+      status = link->resume();
+    }
+    if (status == 0) {
+      setState(STATE_STARTING);
+      status = link->start();
+    }
+    attempted(status);
+
+    if (status == 0) {
+      int64_t elapsedNs = link->nowNs() - startNs;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _recovered++;
+        _lastNs = elapsedNs;
+        _totalNs += elapsedNs;
+        _maxNs = std::max(_maxNs, elapsedNs);
+      }
+      setState(STATE_STREAMING);
+      std::cout << "Reconnected after " << attempt
+        << (attempt == 1 ? " attempt" : " attempts") << " in "
+        << elapsedNs / 1e6 << " ms" << std::endl;
+      return 0;
+    }
+
+    std::cout << "Reconnect attempt " << attempt << " failed ("
+      << stateName(_state.load()) << "), status=" << status << std::endl;
+    if (link->isPermanent(status)) {
+      break;
+    }
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _abandoned++;
+  }
+  setState(STATE_FAILED);
+  std::cout << "Reconnect: giving up, status=" << status << std::endl;
+  return status;
+}
+
+Reconnector::State Reconnector::getState() const {
+  return _state.load();
+}
+
+Reconnector::Stats Reconnector::getStats() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  Stats stats;
+  stats.state = _state.load();
+  stats.outages = _outages;
+  stats.recovered = _recovered;
+  stats.abandoned = _abandoned;
+  stats.attempts = _attempts;
+  stats.lastError = _lastError;
+  stats.lastMs = _lastNs / 1e6;
+  stats.averageMs = _recovered > 0 ? _totalNs / 1e6 / _recovered : 0.0;
+  stats.maxMs = _maxNs / 1e6;
+  return stats;
+}
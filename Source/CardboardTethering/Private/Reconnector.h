@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+
+/**
+ * Brings a stream back after the link fails, without the user: reopen the
+ * device, run the resume handshake (which must agree on the parameters
+ * negotiated the first time), then start streaming again. Each attempt
+ * waits first, from initialBackoffMs doubling up to maxBackoffMs, and the
+ * outage is given up after maxAttempts or once budgetMs has passed, or
+ * straight away on an error the link says retrying can't fix.
+ *
+ * The steps are behind Link so the same state machine drives the USB device
+ * in the plugin and a fault-injecting fake in cardboard_bench. It uses
+ * no clock or sleep of its own.
+ */
+class Reconnector {
+public:
+  enum State : uint8_t {
+    STATE_STREAMING,  /* Nothing to do. */
+    STATE_BACKOFF,    /* Waiting before the next attempt. */
+    STATE_OPENING,    /* Finding and claiming the device again. */
+    STATE_RESUMING,   /* Resume handshake. */
+    STATE_STARTING,   /* Restarting the send and read loops. */
+    STATE_FAILED      /* Gave up; the link has been torn down. */
+  };
+
+  static const char* stateName(State state);
+
+  /** What reconnect() returns when Link::wait() was cancelled. */
+  static constexpr int CANCELLED = 1;
+
+  class Link {
+  public:
+    virtual ~Link() {}
+
+    virtual int64_t nowNs() = 0;
+
+    /** Waits ns; returns false if reconnecting should stop. */
+    virtual bool wait(int64_t ns) = 0;
+
+    /** Each returns 0 or an error status. */
+    virtual int open() = 0;
+    virtual int resume() = 0;
+    virtual int start() = 0;
+
+    /** Whether retrying can't fix the error, e.g. a different phone answered. */
+    virtual bool isPermanent(int status) = 0;
+  };
+
+  struct Settings {
+    size_t maxAttempts;
+    double initialBackoffMs;
+    double maxBackoffMs;
+    double budgetMs; /* From the failure to giving up. */
+
+    Settings() : maxAttempts(10), initialBackoffMs(100.0), maxBackoffMs(2000.0),
+      budgetMs(15000.0) {}
+  };
+
+  struct Stats {
+    State state;
+    uint64_t outages;     /* Times reconnect() was called. */
+    uint64_t recovered;
+    uint64_t abandoned;   /* Gave up or cancelled. */
+    uint64_t attempts;
+    int lastError;        /* Of the most recent failed step. */
+    double lastMs;        /* Failure to streaming again, recovered outages only. */
+    double averageMs;
+    double maxMs;
+  };
+
+  Reconnector();
+
+  Reconnector(const Reconnector&) = delete;
+  Reconnector& operator=(const Reconnector&) = delete;
+
+  void setSettings(const Settings& settings);
+  Settings getSettings() const;
+
+  /** The wait before the given attempt (1 is the first). */
+  static double backoffMs(const Settings& settings, size_t attempt);
+
+  /**
+   * Runs attempts on the calling thread until link streams again or the
+   * outage is given up. error is what broke the link. Returns 0, CANCELLED,
+   * or the error that ended the last attempt.
+   */
+  int reconnect(Link* link, int error);
+
+  State getState() const;
+  Stats getStats() const;
+
+private:
+  mutable std::mutex _mutex;
+  Settings _settings;
+  std::atomic<State> _state;
+
+  uint64_t _outages;
+  uint64_t _recovered;
+  uint64_t _abandoned;
+  uint64_t _attempts;
+  int _lastError;
+  int64_t _lastNs;
+  int64_t _totalNs;
+  int64_t _maxNs;
+
+  void setState(State state);
+  void attempted(int status);
+};
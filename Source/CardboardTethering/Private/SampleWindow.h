@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <algorithm>
+#include <vector>
+
+/**
+ * The most recent Capacity values of a series, for stats over a sliding
+ * window: once full, each new value replaces the oldest. Values are kept in
+ * arrival order until the window wraps, and in no useful order after that.
+ * Not thread-safe; owners lock around it.
+ */
+template <typename T, size_t Capacity>
+class SampleWindow {
+  std::vector<T> _values;
+  size_t _next; /* Slot the next value goes into once full. */
+
+public:
+  static_assert(Capacity > 0, "A window holds at least one value");
+
+  SampleWindow() : _next(0) {}
+
+  void push(const T& value) {
+    if (_values.size() < Capacity) {
+      _values.push_back(value);
+    } else {
+      _values[_next] = value;
+    }
+    _next = (_next + 1) % Capacity;
+  }
+
+  void clear() {
+    _values.clear();
+    _next = 0;
+  }
+
+  size_t size() const { return _values.size(); }
+  bool empty() const { return _values.empty(); }
+  const std::vector<T>& values() const { return _values; }
+};
+
+/**
+ * The value below which `percent` of the sorted values fall: the one at
+ * size * percent / 100, or the largest for 100. T() if there are none.
+ */
+template <typename T>
+T percentileOfSorted(const std::vector<T>& sorted, size_t percent) {
+  if (sorted.empty()) {
+    return T();
+  }
+  return sorted[std::min(sorted.size() - 1, sorted.size() * percent / 100)];
+}
+
+/** percentileOfSorted over a sorted copy of the values. */
+template <typename T>
+T percentileOf(std::vector<T> values, size_t percent) {
+  std::sort(values.begin(), values.end());
+  return percentileOfSorted(values, percent);
+}
@@ -0,0 +1,205 @@
+#include "SocketTransport.h"
+
+#ifndef _WIN32
+
+#include "FramePipeline.h"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+namespace {
+
+  void setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  }
+
+  int makeWakePipe(int fds[2]) {
+    if (pipe(fds) != 0) {
+      fds[0] = fds[1] = -1;
+      return -1;
+    }
+    setNonBlocking(fds[0]);
+    setNonBlocking(fds[1]);
+    return 0;
+  }
+
+  void drain(int fd) {
+    unsigned char buf[64];
+    while (::read(fd, buf, sizeof(buf)) > 0) {}
+  }
+
+  void closeAll(int fds[2]) {
+    for (int i = 0; i < 2; ++i) {
+      if (fds[i] >= 0) {
+        close(fds[i]);
+      }
+    }
+  }
+
+  /** What a failed recv or send means to the session. */
+  int socketError(int error) {
+    switch (error) {
+      case EPIPE:
+      case ECONNRESET:
+      case ENOTCONN:
+        return Transport::ERROR_NO_DEVICE;
+      default:
+        return Transport::ERROR_IO;
+    }
+  }
+
+}
+
+SocketTransport::SocketTransport(int fd)
+  : _fd(fd),
+    _readCancelled(false),
+    _writeInterrupted(false) {
+  setNonBlocking(_fd);
+  makeWakePipe(_readWake);
+  makeWakePipe(_writeWake);
+}
+
+SocketTransport::~SocketTransport() {
+  close(_fd);
+  closeAll(_readWake);
+  closeAll(_writeWake);
+}
+
+bool SocketTransport::createPair(std::shared_ptr<SocketTransport>* a,
+    std::shared_ptr<SocketTransport>* b) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    return false;
+  }
+  a->reset(new SocketTransport(fds[0]));
+  b->reset(new SocketTransport(fds[1]));
+  return (*a)->isValid() && (*b)->isValid();
+}
+
+bool SocketTransport::isValid() const {
+  return _fd >= 0 && _readWake[0] >= 0 && _writeWake[0] >= 0;
+}
+
+int SocketTransport::waitFor(short events, int wakeFd, int64_t deadlineNs) {
+  while (true) {
+    int timeout = -1;
+    if (deadlineNs != 0) {
+      int64_t remainingNs = deadlineNs - steadyClockNs();
+      if (remainingNs <= 0) {
+        return ERROR_TIMEOUT;
+      }
+      timeout = static_cast<int>((remainingNs + 999999) / 1000000);
+    }
+
+    pollfd fds[2] = {
+      { _fd, events, 0 },
+      { wakeFd, POLLIN, 0 }
+    };
+    int ready = poll(fds, 2, timeout);
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return ERROR_IO;
+    }
+    if (fds[1].revents != 0) {
+      return ERROR_INTERRUPTED;
+    }
+    if (fds[0].revents != 0) {
+      // Errors and hangups are picked up by the recv or send that follows.
+      return SUCCESS;
+    }
+  }
+}
+
+int SocketTransport::read(unsigned char* data, int length, int* transferred,
+    unsigned int timeoutMs) {
+  *transferred = 0;
+  int64_t deadlineNs = timeoutMs == 0 ? 0 :
+    steadyClockNs() + static_cast<int64_t>(timeoutMs) * 1000000;
+  while (true) {
+    if (_readCancelled.load()) {
+      return ERROR_INTERRUPTED;
+    }
+
+    ssize_t count = ::recv(_fd, data, std::max(length, 0), 0);
+    if (count > 0) {
+      *transferred = static_cast<int>(count);
+      return SUCCESS;
+    } else if (count == 0) {
+      return ERROR_NO_DEVICE; // The other end closed.
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      return socketError(errno);
+    }
+
+    int status = waitFor(POLLIN, _readWake[0], deadlineNs);
+    if (status != SUCCESS) {
+      return status;
+    }
+  }
+}
+
+int SocketTransport::write(const unsigned char* header, size_t headerLen,
+    const unsigned char* payload, size_t payloadLen,
+    unsigned int timeoutMs) {
+  int64_t deadlineNs = timeoutMs == 0 ? 0 :
+    steadyClockNs() + static_cast<int64_t>(timeoutMs) * 1000000;
+  int status = writeBytes(header, headerLen, deadlineNs);
+  if (status == SUCCESS) {
+    status = writeBytes(payload, payloadLen, deadlineNs);
+  }
+  return status;
+}
+
+int SocketTransport::writeBytes(const unsigned char* data, size_t length,
+    int64_t deadlineNs) {
+  while (length > 0) {
+    if (_writeInterrupted.load()) {
+      return ERROR_INTERRUPTED;
+    }
+
+    ssize_t count = ::send(_fd, data, length, MSG_NOSIGNAL);
+    if (count > 0) {
+      data += count;
+      length -= count;
+      continue;
+    } else if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+        errno != EINTR) {
+      return socketError(errno);
+    }
+
+    int status = waitFor(POLLOUT, _writeWake[0], deadlineNs);
+    if (status != SUCCESS) {
+      return status;
+    }
+  }
+  return SUCCESS;
+}
+
+void SocketTransport::cancelReads() {
+  _readCancelled.store(true);
+  unsigned char wake = 1;
+  ::write(_readWake[1], &wake, 1);
+}
+
+void SocketTransport::resetReads() {
+  _readCancelled.store(false);
+  drain(_readWake[0]);
+}
+
+void SocketTransport::interruptSends() {
+  _writeInterrupted.store(true);
+  unsigned char wake = 1;
+  ::write(_writeWake[1], &wake, 1);
+}
+
+void SocketTransport::resetSends() {
+  _writeInterrupted.store(false);
+  drain(_writeWake[0]);
+}
+
+#endif // _WIN32
@@ -0,0 +1,52 @@
+#pragma once
+
+#ifndef _WIN32
+
+#include <memory>
+#include <atomic>
+#include "Transport.h"
+
+/**
+ * A connected stream socket as a Transport, for a session on Linux whose
+ * phone is a stand-in in another thread or process, or a real phone behind
+ * adb forward. POSIX only. Cancelling wakes the blocked call through a pipe
+ * of its own, so it needn't poll.
+ */
+class SocketTransport : public Transport {
+public:
+  /** Takes ownership of the socket and makes it non-blocking. */
+  explicit SocketTransport(int fd);
+  ~SocketTransport();
+
+  /** The two ends of a socketpair(); false if it couldn't be made. */
+  static bool createPair(std::shared_ptr<SocketTransport>* a,
+    std::shared_ptr<SocketTransport>* b);
+
+  /** Whether the wake pipes were made; if not, nothing will work. */
+  bool isValid() const;
+
+  virtual int read(unsigned char* data, int length, int* transferred,
+    unsigned int timeoutMs) override;
+  virtual void cancelReads() override;
+  virtual void resetReads() override;
+  virtual void interruptSends() override;
+  virtual void resetSends() override;
+
+protected:
+  virtual int write(const unsigned char* header, size_t headerLen,
+    const unsigned char* payload, size_t payloadLen,
+    unsigned int timeoutMs) override;
+
+private:
+  int _fd;
+  int _readWake[2];  /* Readable once reads are cancelled. */
+  int _writeWake[2]; /* Readable once sends are interrupted. */
+  std::atomic_bool _readCancelled;
+  std::atomic_bool _writeInterrupted;
+
+  /** Waits for events on _fd; 0, or the status to fail with. */
+  int waitFor(short events, int wakeFd, int64_t deadlineNs);
+  int writeBytes(const unsigned char* data, size_t length, int64_t deadlineNs);
+};
+
+#endif // _WIN32
@@ -0,0 +1,921 @@
+#include "StreamSession.h"
+#include "EndianUtils.h"
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+StreamSession::StreamSession(std::shared_ptr<Transport> transport)
+  : _transport(transport),
+    _handshake(false),
+    _reopening(false),
+    _receiveWorker(nullptr),
+    _captureRejected(0),
+    _expectedFrameBytes(0),
+    _frameMemory(0),
+    _encodeWorker(nullptr),
+    _encodeThreads(getDefaultEncodeThreads()),
+    _yuvInput(false),
+    _tileCoding(true),
+    _tileSize(DEFAULT_TILE_SIZE),
+    _tileRefresh(DEFAULT_TILE_REFRESH),
+    _sendWorker(nullptr),
+    _sending(false),
+    _jpegMemory(0),
+    _encoderMemory(0),
+    _sendFailed(false),
+    _sendsInterrupted(false),
+    _sentFrames(0),
+    _protocolVersion(Message::VERSION_MIN),
+    _tilesAccepted(true),
+    _lastStopMs(0.0) {
+  for (auto& sequence : _lastSentSequence) {
+    sequence.store(0);
+  }
+  for (EyeCounters& counters : _eyeCounters) {
+    counters.payloads.store(0);
+    counters.keyframes.store(0);
+    counters.bytes.store(0);
+    counters.encodeMicros.store(0);
+    counters.sendMicros.store(0);
+  }
+}
+
+StreamSession::~StreamSession() {
+  stopWorkers();
+}
+
+void StreamSession::setTransport(std::shared_ptr<Transport> transport) {
+  std::unique_lock<std::mutex> lock(_transportMutex);
+  _transport = transport;
+}
+
+std::shared_ptr<Transport> StreamSession::getTransport() {
+  std::unique_lock<std::mutex> lock(_transportMutex);
+  return _transport;
+}
+
+double StreamSession::stopWorkers() {
+  std::unique_ptr<WorkerThread>* workers[] = {
+    &_receiveWorker, &_encodeWorker, &_sendWorker
+  };
+  if (!_receiveWorker && !_encodeWorker && !_sendWorker) {
+    return 0.0;
+  }
+
+  // Only the thread that owns this session touches the workers; everyone
+  // else asks isSending(), which must say no before anything is torn down.
+  _sending.store(false);
+
+  // Cancel them all before joining any, so they wind down side by side.
+  auto start = std::chrono::steady_clock::now();
+  for (auto* worker : workers) {
+    if (*worker) {
+      (*worker)->cancel();
+    }
+  }
+  for (auto* worker : workers) {
+    if (*worker) {
+      (*worker)->stop();
+      worker->reset();
+    }
+  }
+
+  double ms = std::chrono::duration<double, std::milli>(
+    std::chrono::steady_clock::now() - start).count();
+  _lastStopMs.store(ms);
+  return ms;
+}
+
+bool StreamSession::isLinkError(int status) {
+  return status == STATUS_RECEIVE_ERROR ||
+    status == STATUS_SEND_ERROR ||
+    status == STATUS_PROTOCOL_ERROR ||
+    (status <= STATUS_LIBUSB_ERROR && status > STATUS_JPEG_ERROR);
+}
+
+void StreamSession::suspend() {
+  // The phone keeps its session, so the loops don't say TYPE_END on the way
+  // out.
+  _reopening.store(true);
+  _handshake.store(false);
+  stopWorkers();
+}
+
+void StreamSession::flushInput(Transport* transport, unsigned char* buf) {
+  int status = 0;
+  int read;
+  while (status == 0) {
+    status = transport->read(buf, BUFFER_LEN, &read, 10);
+  }
+}
+
+int StreamSession::handleHello(const unsigned char* payload, size_t length,
+    const Capabilities* resumed) {
+  Capabilities device;
+  if (!Capabilities::read(payload, length, &device)) {
+    std::cout << "Handshake: capability record too short, length=" << length << std::endl;
+    return STATUS_INCOMPATIBLE_CLIENT;
+  }
+
+  Capabilities reply;
+  uint8_t hostCodecs = (1 << CODEC_JPEG) | (1 << CODEC_TILES);
+  if (Capabilities::choose(device, hostCodecs, &reply) != 0) {
+    std::cout << "Handshake: phone speaks versions " << (int)device.versionMin
+      << "-" << (int)device.versionMax << ", codecs " << (int)device.codecs
+      << "; nothing in common" << std::endl;
+    return STATUS_INCOMPATIBLE_CLIENT;
+  }
+
+  // Frames already in flight and everything sized from the viewer assume the
+  // old link; a phone that now wants another one has to start over.
+  if (resumed != nullptr && !reply.sameLink(*resumed)) {
+    std::cout << "Resume: phone now wants version " << (int)reply.versionMax
+      << ", " << reply.viewportWidth << "x" << reply.viewportHeight
+      << ", codecs " << (int)reply.codecs << "; not the link we had" << std::endl;
+    return STATUS_CHANGED_CLIENT;
+  }
+
+  std::cout << "Handshake: version " << (int)reply.versionMax
+    << ", viewport " << device.viewportWidth << "x" << device.viewportHeight
+    << " sending " << reply.viewportWidth << "x" << reply.viewportHeight
+    << ", decode max " << device.maxDecodeWidth << "x" << device.maxDecodeHeight
+    << ", " << device.refreshHz() << " Hz, codecs " << (int)reply.codecs << std::endl;
+
+  std::unique_lock<std::mutex> lock(_paramsMutex);
+  _deviceCapabilities = device;
+  _linkCapabilities = reply;
+  _width = reply.viewportWidth;
+  _height = reply.viewportHeight;
+  _interpupillary = device.interpupillary;
+  _protocolVersion.store(reply.versionMax);
+  _pacer.setRefreshHint(device.refreshMilliHz);
+  return STATUS_OK;
+}
+
+void StreamSession::handleVsync(const unsigned char* payload, size_t length) {
+  if (length < VSYNC_PACKET_LEN) {
+    return;
+  }
+
+  int64_t receivedNs = steadyClockNs();
+  int64_t vsyncNs;
+  uint32_t periodNs;
+  uint64_t frameId;
+  int64_t arrivalNs;
+  std::memcpy(&vsyncNs, payload, sizeof(vsyncNs));
+  std::memcpy(&periodNs, payload + 8, sizeof(periodNs));
+  std::memcpy(&frameId, payload + 12, sizeof(frameId));
+  std::memcpy(&arrivalNs, payload + 20, sizeof(arrivalNs));
+
+  _pacer.addVsync(EndianUtils::bigToNative(vsyncNs),
+    EndianUtils::bigToNative(periodNs), receivedNs);
+  arrivalNs = EndianUtils::bigToNative(arrivalNs);
+  if (arrivalNs != 0) {
+    _pacer.addArrival(EndianUtils::bigToNative(frameId), arrivalNs);
+  }
+}
+
+void StreamSession::handleRefresh(const unsigned char* payload, size_t length) {
+  if (length < REFRESH_PACKET_LEN) {
+    return;
+  }
+
+  uint8_t eye = payload[0];
+  uint8_t reason = payload[1];
+  uint64_t frameId;
+  std::memcpy(&frameId, payload + 4, sizeof(frameId));
+  frameId = EndianUtils::bigToNative(frameId);
+
+  bool forced = _keyframeRequests.request(eye, frameId, steadyClockNs());
+  std::cout << "Keyframe request, eye=" << (int)eye << " frame=" << frameId
+    << " (" << KeyframeRequests::reasonName(reason) << ")"
+    << (forced ? "" : ", already repaired") << std::endl;
+}
+
+bool StreamSession::waitHandshakeAsync(std::function<void(int)> callback) {
+  std::shared_ptr<Transport> transport = getTransport();
+  if (!transport) {
+    return false;
+  }
+
+  if (_handshake.load()) {
+    std::cout << "Handshake previously completed!" << std::endl;
+    return false;
+  }
+
+  _receiveWorker.reset();
+  transport->resetReads();
+  _receiveWorker.reset(new WorkerThread("handshake",
+    [=](const WorkerThread::SharedAtomicBool cancel) {
+      unsigned char* inputBuffer = new unsigned char[BUFFER_LEN];
+      flushInput(transport.get(), inputBuffer);
+
+      // The phone opens with a TYPE_HELLO message; it may take a few reads.
+      Message::Parser parser;
+      bool firstRead = true;
+      int result = STATUS_HANDSHAKE_PENDING;
+      int i = 0;
+      int read = 0;
+      int status = Transport::ERROR_TIMEOUT;
+      bool cancelled;
+      while (true) {
+        cancelled = cancel->load();
+        if (cancelled || result != STATUS_HANDSHAKE_PENDING ||
+            (status != 0 && status != Transport::ERROR_TIMEOUT)) {
+          break;
+        }
+
+        std::cout << i++ << " Waiting..." << std::endl;
+        status = transport->read(inputBuffer, BUFFER_LEN, &read, 500);
+        if (status != 0 || read == 0) {
+          continue;
+        }
+
+        if (firstRead && inputBuffer[0] == Capabilities::LEGACY_HANDSHAKE_TAG) {
+          std::cout << "Handshake: phone app predates capability handshake" << std::endl;
+          result = STATUS_OLD_CLIENT;
+          break;
+        }
+        firstRead = false;
+
+        int parseStatus = parser.feed(inputBuffer, read,
+          [&](const Message::Header& header, const unsigned char* payload) {
+            if (result == STATUS_HANDSHAKE_PENDING && header.type == Message::TYPE_HELLO) {
+              result = handleHello(payload, header.length);
+            }
+          });
+        if (parseStatus != 0 && result == STATUS_HANDSHAKE_PENDING) {
+          std::cout << "Handshake: bad message, error=" << parseStatus << std::endl;
+          result = STATUS_PROTOCOL_ERROR;
+        }
+      }
+
+      if (cancelled) {
+        std::cout << "Handshake cancelled!" << std::endl;
+      } else {
+        if (result == STATUS_HANDSHAKE_PENDING) {
+          result = STATUS_LIBUSB_ERROR + status;
+        }
+        std::cout << "Received handshake, status=" << status
+          << " result=" << result << std::endl;
+
+        _handshake.store(result == STATUS_OK);
+        callback(result);
+      }
+
+      delete[] inputBuffer;
+      cancel->store(true);
+    },
+    [transport]() { transport->cancelReads(); }));
+
+  return true;
+}
+
+bool StreamSession::isHandshakeComplete() {
+  return _handshake.load();
+}
+
+int StreamSession::resumeHandshake(const std::atomic_bool& cancel, int timeoutMs) {
+  std::shared_ptr<Transport> transport = getTransport();
+  if (!transport) {
+    return STATUS_NOT_FOUND_ERROR;
+  }
+
+  Capabilities link;
+  {
+    std::unique_lock<std::mutex> lock(_paramsMutex);
+    link = _linkCapabilities;
+  }
+
+  std::vector<unsigned char> inputBuffer(BUFFER_LEN);
+  transport->resetReads();
+  transport->resetSends();
+  flushInput(transport.get(), inputBuffer.data());
+
+  // A phone that noticed the drop says hello by itself when it reopens, but
+  // that may have been flushed above, and one that didn't notice never will;
+  // ask either way.
+  std::vector<unsigned char> hello;
+  std::vector<unsigned char> helloMessage;
+  link.write(&hello);
+  Message::Writer writer(link.versionMax);
+  writer.append(Message::TYPE_HELLO, hello.data(), hello.size(), &helloMessage,
+    Message::FLAG_RESUME);
+  int status = transport->send(helloMessage.data(), helloMessage.size(),
+    nullptr, 0, 500).status;
+  if (status != 0) {
+    return STATUS_LIBUSB_ERROR + status;
+  }
+
+  Message::Parser parser;
+  int result = STATUS_HANDSHAKE_PENDING;
+  auto deadline = std::chrono::steady_clock::now() +
+    std::chrono::milliseconds(timeoutMs);
+  while (result == STATUS_HANDSHAKE_PENDING && !cancel.load() &&
+      std::chrono::steady_clock::now() < deadline) {
+    int read = 0;
+    status = transport->read(inputBuffer.data(), BUFFER_LEN, &read, 100);
+    if (status == Transport::ERROR_TIMEOUT || (status == 0 && read == 0)) {
+      continue;
+    } else if (status != 0) {
+      return STATUS_LIBUSB_ERROR + status;
+    }
+
+    int parseStatus = parser.feed(inputBuffer.data(), read,
+      [&](const Message::Header& header, const unsigned char* payload) {
+        if (result == STATUS_HANDSHAKE_PENDING && header.type == Message::TYPE_HELLO) {
+          result = handleHello(payload, header.length, &link);
+        }
+      });
+    if (parseStatus != 0 && result == STATUS_HANDSHAKE_PENDING) {
+      // Most likely the tail of a message from before the drop.
+      std::cout << "Resume: bad message, error=" << parseStatus << std::endl;
+      return STATUS_PROTOCOL_ERROR;
+    }
+  }
+
+  if (result == STATUS_HANDSHAKE_PENDING) {
+    return STATUS_LIBUSB_ERROR + Transport::ERROR_TIMEOUT;
+  }
+  std::cout << "Resumed handshake, result=" << result << std::endl;
+  _handshake.store(result == STATUS_OK);
+  return result;
+}
+
+bool StreamSession::beginReadLoop(
+    std::function<void(uint8_t, const unsigned char*, size_t, int)> callback) {
+  std::shared_ptr<Transport> transport = getTransport();
+  if (!transport) {
+    return false;
+  }
+
+  if (!_handshake.load()) {
+    return false;
+  }
+
+  // This may be called from the handshake loop. Stopping that cancels reads,
+  // so it has to be gone before they're let through again.
+  _receiveWorker.reset();
+  transport->resetReads();
+  _receiveWorker.reset(new WorkerThread("read loop",
+    [=](const WorkerThread::SharedAtomicBool cancel) {
+      unsigned char* inputBuffer = new unsigned char[READ_BUFFER_LEN];
+      Message::Parser parser;
+      int read = 0;
+      int status = Transport::ERROR_TIMEOUT;
+      int protocolStatus = 0;
+      bool cancelled;
+      while (true) {
+        cancelled = cancel->load();
+        if (cancelled || protocolStatus != 0 ||
+            (status != 0 && status != Transport::ERROR_TIMEOUT)) {
+          break;
+        }
+
+        // No timeout: stopping cancels the read, and a phone that goes
+        // quiet isn't an error, so waking up to poll would gain nothing.
+        status = transport->read(inputBuffer, READ_BUFFER_LEN, &read, 0);
+        if (status == 0) {
+          protocolStatus = parser.feed(inputBuffer, read,
+            [&](const Message::Header& header, const unsigned char* payload) {
+              if (header.type == Message::TYPE_VSYNC) {
+                handleVsync(payload, header.length);
+              } else if (header.type == Message::TYPE_REFRESH) {
+                handleRefresh(payload, header.length);
+              } else {
+                callback(header.type, payload, header.length, STATUS_OK);
+              }
+            });
+        }
+      }
+      delete[] inputBuffer;
+
+      if (protocolStatus != 0) {
+        std::cout << "Bad message from phone, error=" << protocolStatus << std::endl;
+        _handshake.store(false);
+        callback(0, nullptr, 0, STATUS_PROTOCOL_ERROR);
+      } else if (!cancelled) {
+        // Error if loop ended but not cancelled.
+        std::cout << "Status in beginReadLoop=" << status << std::endl;
+
+        // Reset handshake.
+        _handshake.store(false);
+
+        callback(0, nullptr, 0, STATUS_LIBUSB_ERROR + status);
+      }
+
+      std::cout << "Read loop ended" << std::endl;
+      cancel->store(true);
+    },
+    [transport]() { transport->cancelReads(); }));
+
+  return true;
+}
+
+bool StreamSession::beginSendLoop(std::function<void(int)> failureCallback) {
+  std::shared_ptr<Transport> transport = getTransport();
+  if (!transport) {
+    return false;
+  }
+
+  if (!_handshake.load()) {
+    return false;
+  }
+
+  // Frames are side-by-side eyes of the negotiated viewer size; size the
+  // frame slots for that up front rather than for the largest possible frame.
+  {
+    std::unique_lock<std::mutex> lock(_paramsMutex);
+    _expectedFrameBytes.store(
+      static_cast<size_t>(std::max(_width, 0)) * 2 * 4 * std::max(_height, 0));
+  }
+
+  // Reset in case there was a previous send loop. A new receiver has no
+  // canvas yet, so each eye starts with a full image; neither may a resumed
+  // one, if it reopened.
+  _encodeWorker.reset();
+  _sendWorker.reset();
+  transport->resetSends();
+  transport->resetStats();
+  _sendsInterrupted = false;
+  _sendFailed.store(false);
+  _sending.store(true); /* Before the workers, which may fail straight away. */
+  _reopening.store(false);
+  _pacer.reset();
+  _keyframeRequests.reset();
+  for (auto& sequence : _lastSentSequence) {
+    sequence.store(0);
+  }
+
+  // Either worker can fail; only the first failure is reported. The callback
+  // may drop the device, so a worker must return straight after it without
+  // touching this.
+  auto signalFailure = [=](int error) {
+    if (!_sendFailed.exchange(true)) {
+      // Reset handshake.
+      _handshake.store(false);
+      _sending.store(false);
+      failureCallback(error);
+    }
+  };
+
+  _encodeWorker.reset(new WorkerThread("encode loop",
+    [=](const WorkerThread::SharedAtomicBool cancel) {
+      while (_rawFrames.waitAcquire(*cancel)) {
+        // Hold off until the frame would land just before one of the phone's
+        // vsyncs, then swap in whatever newer frame was captured meanwhile.
+        // Capture itself follows the engine's frame rate; a capture that
+        // can't make a vsync is replaced here rather than queued.
+        int64_t releaseNs = _pacer.releaseTime(steadyClockNs());
+        int64_t waitNs = releaseNs - steadyClockNs();
+        if (waitNs > 0) {
+          std::this_thread::sleep_for(std::chrono::nanoseconds(waitNs));
+          if (cancel->load()) {
+            break;
+          }
+          _rawFrames.acquire();
+        }
+
+        const RawFrame& raw = _rawFrames.readSlot();
+        _pacer.released(raw.frameId, steadyClockNs());
+        EncodedFrame& encoded = _encodedFrames.writeSlot();
+
+        int jpegStatus = encodeFrame(raw, &encoded);
+        if (jpegStatus != 0) {
+          signalFailure(STATUS_JPEG_ERROR + jpegStatus);
+          cancel->store(true);
+          return;
+        }
+
+        encoded.frameId = raw.frameId;
+        encoded.pose = raw.pose;
+        encoded.captureNs = raw.captureNs;
+        encoded.encodedNs = steadyClockNs();
+        _encodedFrames.publish();
+      }
+
+      std::cout << "Encode loop ended" << std::endl;
+      cancel->store(true);
+    },
+    [=]() { _rawFrames.wake(); }));
+
+  std::shared_ptr<LatencyTracker> latencyTracker = _latencyTracker;
+  Capabilities reply;
+  {
+    std::unique_lock<std::mutex> lock(_paramsMutex);
+    reply = _linkCapabilities;
+  }
+  _tilesAccepted.store(reply.supportsCodec(CODEC_TILES));
+  _sendWorker.reset(new WorkerThread("send loop",
+    [=](const WorkerThread::SharedAtomicBool cancel) {
+      Message::Writer writer(_protocolVersion.load());
+      std::vector<unsigned char> header;
+
+      // Tell the phone what was picked before any frame arrives.
+      std::vector<unsigned char> hello;
+      std::vector<unsigned char> helloMessage;
+      reply.write(&hello);
+      writer.append(Message::TYPE_HELLO, hello.data(), hello.size(), &helloMessage);
+      Transport::SendResult helloResult = transport->send(
+        helloMessage.data(), helloMessage.size(), nullptr, 0, 500);
+      if (helloResult.status != 0) {
+        if (!cancel->load()) {
+          signalFailure(STATUS_LIBUSB_ERROR + helloResult.status);
+        }
+        cancel->store(true);
+        return;
+      }
+
+      while (_encodedFrames.waitAcquire(*cancel)) {
+        const EncodedFrame& encoded = _encodedFrames.readSlot();
+
+        // Each eye goes out as its own payload, left first, so the receiver
+        // can decode and upload it while the right eye is still in flight.
+        int sendStatus = 0;
+        double sendMs = 0.0;
+        size_t sentBytes = 0;
+        int64_t firstSendNs = 0;
+        for (size_t eye = 0; eye < EYE_COUNT; ++eye) {
+          const EncodedEye& payload = encoded.eyes[eye];
+
+          // The codec prefix is small, so it rides along with the header.
+          FrameHeader frameHeader;
+          frameHeader.payloadLength = static_cast<uint32_t>(payload.bodySize());
+          frameHeader.eye = static_cast<uint8_t>(eye);
+          frameHeader.codec = payload.codec;
+          frameHeader.frameId = encoded.frameId;
+          frameHeader.pose = encoded.pose;
+          frameHeader.captureNs = encoded.captureNs;
+          frameHeader.encodeNs = encoded.encodedNs;
+          frameHeader.sendNs = steadyClockNs();
+          header.resize(Message::HEADER_LEN + FrameHeader::LENGTH);
+          writer.header(Message::TYPE_FRAME,
+            FrameHeader::LENGTH + payload.bodySize(), header.data());
+          frameHeader.write(header.data() + Message::HEADER_LEN);
+          if (eye == 0) {
+            firstSendNs = frameHeader.sendNs;
+          }
+          header.insert(header.end(), payload.prefix.begin(),
+            payload.prefix.end());
+
+          Transport::SendResult result = transport->send(
+            header.data(),
+            header.size(),
+            payload.jpegBuffer,
+            payload.jpegBufferSize,
+            500);
+          if (result.status != 0) {
+            sendStatus = result.status;
+            break;
+          }
+
+          _lastSentSequence[eye].store(payload.sequence);
+          _keyframeRequests.sent(eye, encoded.frameId,
+            payload.codec == CODEC_JPEG, steadyClockNs());
+
+          EyeCounters& counters = _eyeCounters[eye];
+          counters.payloads++;
+          if (payload.codec == CODEC_JPEG) {
+            counters.keyframes++;
+          }
+          counters.bytes += payload.bodySize();
+          counters.encodeMicros += static_cast<uint64_t>(payload.encodeMs * 1000.0);
+          counters.sendMicros += static_cast<uint64_t>(result.elapsedMs * 1000.0);
+          sendMs += result.elapsedMs;
+          sentBytes += payload.bodySize();
+        }
+
+        if (sendStatus != 0) {
+          if (cancel->load()) {
+            // Interrupted by stop; say goodbye below.
+            break;
+          }
+          signalFailure(STATUS_LIBUSB_ERROR + sendStatus);
+          cancel->store(true);
+          return;
+        }
+
+        const RenderPose& pose = encoded.pose;
+        if (latencyTracker && pose.sequence != 0 && pose.receivedNs > 0) {
+          latencyTracker->addFrame(pose.sequence, encoded.frameId,
+            encoded.captureNs - pose.receivedNs,
+            encoded.encodedNs - pose.receivedNs,
+            firstSendNs - pose.receivedNs);
+        }
+
+        RateController::Sample sample;
+        sample.generation = encoded.settingsGeneration;
+        sample.encodeMs = encoded.encodeMs;
+        sample.sendMs = sendMs;
+        sample.bytes = sentBytes;
+        _rateController.addSample(sample);
+
+        _sentFrames++;
+      }
+
+      if (cancel->load() && !_reopening.load()) {
+        // Tell the phone we're done; ignore if written or not. Don't hold
+        // up whoever is stopping us for long if the phone isn't reading.
+        unsigned char end[Message::HEADER_LEN];
+        writer.header(Message::TYPE_END, 0, end);
+        {
+          std::lock_guard<std::mutex> lock(_sendInterruptMutex);
+          _sendsInterrupted = true;
+        }
+        transport->resetSends();
+        transport->send(end, sizeof(end), nullptr, 0, END_TIMEOUT_MS);
+      }
+
+      Transport::Stats stats = transport->getStats();
+      std::cout << "Send loop ended, frames=" << stats.frames
+        << " fps=" << stats.framesPerSecond()
+        << " MB/s=" << stats.megabytesPerSecond() << std::endl;
+      cancel->store(true);
+    },
+    [=]() {
+      // Only once, and not after the loop has started saying goodbye: stop()
+      // cancels again after stopWorkers() has, and either interrupt would
+      // cut off TYPE_END.
+      _encodedFrames.wake();
+      std::lock_guard<std::mutex> lock(_sendInterruptMutex);
+      if (!_sendsInterrupted) {
+        _sendsInterrupted = true;
+        transport->interruptSends();
+      }
+    }));
+
+  return true;
+}
+
+int StreamSession::encodeFrame(const RawFrame& raw, EncodedFrame* encoded) {
+  // Pick up thread count changes between frames. With more than one thread
+  // the eyes are encoded side by side, each splitting its share into strips.
+  size_t threads = _encodeThreads.load();
+  size_t threadsPerEye = std::max<size_t>(1, threads / EYE_COUNT);
+  JpegEncoder::InputFormat input = _yuvInput.load() ?
+    JpegEncoder::INPUT_YUV420 : JpegEncoder::INPUT_BGRX;
+  if (!_encoders[0] || _encoders[0]->threadCount() != threadsPerEye ||
+      _encoders[0]->inputFormat() != input) {
+    for (auto& encoder : _encoders) {
+      encoder.reset(new JpegEncoder(threadsPerEye, input));
+    }
+  }
+  bool tileCoding = _tileCoding.load() && _tilesAccepted.load();
+  size_t tileSize = _tileSize.load();
+  size_t tileRefresh = _tileRefresh.load();
+  for (auto& tiles : _tileEncoders) {
+    if (!tiles) {
+      tiles.reset(new TileEncoder(tileSize, tileRefresh));
+    } else if (tiles->tileSize() != tileSize ||
+        tiles->refreshInterval() != tileRefresh) {
+      tiles->configure(tileSize, tileRefresh);
+    }
+  }
+  if (threads >= EYE_COUNT && !_eyePool) {
+    _eyePool.reset(new WorkerPool(EYE_COUNT));
+  } else if (threads < EYE_COUNT) {
+    _eyePool.reset();
+  }
+
+  FrameView view;
+  view.data = raw.pixels.data();
+  view.width = raw.width;
+  view.widthPitch = raw.widthPitch;
+  view.height = raw.height;
+
+  RateController::Settings settings = _rateController.getSettings();
+  auto frameStart = std::chrono::steady_clock::now();
+
+  int status[EYE_COUNT] = {};
+  auto encodeEye = [&](size_t eye, size_t) {
+    EncodedEye& out = encoded->eyes[eye];
+    unsigned long capacityBefore = out.jpegBufferCapacity;
+    auto start = std::chrono::steady_clock::now();
+
+    // The receiver stretches each eye's image over its viewport, so a
+    // downscaled eye needs no extra signalling.
+    FrameView source = downscaleFrame(eyeView(view, eye), settings.downscale,
+      &_scaled[eye]);
+
+    // A keyframe request means the phone's image is wrong whatever it was
+    // sent; claiming it has nothing forces a keyframe. Plain JPEG always is.
+    bool keyframeRequested = _keyframeRequests.take(eye);
+    if (tileCoding) {
+      TileEncoder::Result result;
+      status[eye] = _tileEncoders[eye]->encode(source,
+        keyframeRequested ? 0 : _lastSentSequence[eye].load(),
+        _encoders[eye].get(),
+        settings.quality,
+        settings.subsamp,
+        &out,
+        &result);
+    } else {
+      unsigned long jpegBufferSizeUlong;
+      status[eye] = _encoders[eye]->encode(source,
+        settings.quality,
+        settings.subsamp,
+        &out.jpegBuffer,
+        &out.jpegBufferCapacity,
+        &jpegBufferSizeUlong);
+
+      out.codec = CODEC_JPEG;
+      out.prefix.clear();
+      out.jpegBufferSize = jpegBufferSizeUlong;
+      out.sequence = 0;
+    }
+    _jpegMemory += static_cast<int64_t>(out.jpegBufferCapacity) - capacityBefore;
+    out.encodeMs = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+  };
+
+  if (_eyePool) {
+    _eyePool->run(EYE_COUNT, encodeEye);
+  } else {
+    for (size_t eye = 0; eye < EYE_COUNT; ++eye) {
+      encodeEye(eye, 0);
+    }
+  }
+
+  for (size_t eye = 0; eye < EYE_COUNT; ++eye) {
+    if (status[eye] != 0) {
+      return status[eye];
+    }
+  }
+
+  size_t encoderMemory = 0;
+  for (size_t eye = 0; eye < EYE_COUNT; ++eye) {
+    encoderMemory += _encoders[eye]->memoryBytes() + _scaled[eye].capacity() +
+      _tileEncoders[eye]->memoryBytes();
+  }
+  _encoderMemory.store(encoderMemory);
+
+  encoded->encodeMs = std::chrono::duration<double, std::milli>(
+    std::chrono::steady_clock::now() - frameStart).count();
+  encoded->settingsGeneration = settings.generation;
+  return 0;
+}
+
+Transport::Stats StreamSession::getSendStats() {
+  std::shared_ptr<Transport> transport = getTransport();
+  if (transport) {
+    return transport->getStats();
+  }
+  return Transport::Stats();
+}
+
+MemoryStats StreamSession::getMemoryStats() {
+  MemoryStats stats;
+  stats.frames = static_cast<uint64_t>(_frameMemory.load());
+  stats.encoder = _encoderMemory.load();
+  stats.jpeg = static_cast<uint64_t>(_jpegMemory.load());
+  return stats;
+}
+
+PipelineStats StreamSession::getPipelineStats() {
+  PipelineStats stats;
+  stats.captured = _rawFrames.published();
+  stats.captureRejected = _captureRejected.load();
+  stats.droppedBeforeEncode = _rawFrames.dropped();
+  stats.encoded = _encodedFrames.published();
+  stats.droppedBeforeSend = _encodedFrames.dropped();
+  stats.sent = _sentFrames.load();
+  return stats;
+}
+
+EyeStats StreamSession::getEyeStats(size_t eye) {
+  const EyeCounters& counters = _eyeCounters[eye];
+  EyeStats stats;
+  stats.payloads = counters.payloads.load();
+  stats.keyframes = counters.keyframes.load();
+  stats.bytes = counters.bytes.load();
+  stats.encodeMs = counters.encodeMicros.load() / 1000.0;
+  stats.sendMs = counters.sendMicros.load() / 1000.0;
+  return stats;
+}
+
+void StreamSession::setRateTargets(const RateController::Targets& targets) {
+  _rateController.setTargets(targets);
+}
+
+void StreamSession::setLatencyTracker(std::shared_ptr<LatencyTracker> tracker) {
+  _latencyTracker = tracker;
+}
+
+void StreamSession::setPacing(const FramePacer::Settings& settings) {
+  _pacer.setSettings(settings);
+}
+
+FramePacer::Settings StreamSession::getPacingSettings() {
+  return _pacer.getSettings();
+}
+
+FramePacer::Stats StreamSession::getPacingStats() {
+  return _pacer.getStats();
+}
+
+KeyframeRequests::Stats StreamSession::getKeyframeRequestStats() {
+  return _keyframeRequests.getStats();
+}
+
+RateController::Settings StreamSession::getRateSettings() {
+  return _rateController.getSettings();
+}
+
+RateController::Estimate StreamSession::getRateEstimate() {
+  return _rateController.getEstimate();
+}
+
+void StreamSession::setEncodeThreads(size_t threads) {
+  _encodeThreads.store(std::max<size_t>(threads, 1));
+}
+
+size_t StreamSession::getEncodeThreads() {
+  return _encodeThreads.load();
+}
+
+size_t StreamSession::getDefaultEncodeThreads() {
+  // Leave cores for the game and render threads.
+  size_t cores = std::thread::hardware_concurrency();
+  return std::max<size_t>(1, std::min<size_t>(4, cores / 2));
+}
+
+void StreamSession::setYuvInput(bool enabled) {
+  _yuvInput.store(enabled);
+}
+
+bool StreamSession::getYuvInput() {
+  return _yuvInput.load();
+}
+
+void StreamSession::setTileCoding(bool enabled, size_t tileSize,
+    size_t refreshInterval) {
+  _tileSize.store(TileEncoder::roundTileSize(tileSize));
+  _tileRefresh.store(std::max<size_t>(refreshInterval, 1));
+  _tileCoding.store(enabled);
+}
+
+bool StreamSession::getTileCoding(size_t* tileSize, size_t* refreshInterval) {
+  *tileSize = _tileSize.load();
+  *refreshInterval = _tileRefresh.load();
+  return _tileCoding.load();
+}
+
+bool StreamSession::publishFrame(const FrameView& view) {
+  if (view.width > MAX_FRAME_DIMENSION || view.height > MAX_FRAME_DIMENSION) {
+    // Refuse absurdly large frames rather than growing without bound.
+    _captureRejected++;
+    return false;
+  }
+
+  // The write slot always belongs to us, so the render thread never waits
+  // on the encoder; an unencoded older frame is simply replaced. Slots grow
+  // if the render target is bigger than the viewer (or its rows padded).
+  RawFrame& raw = _rawFrames.writeSlot();
+  size_t sizeNeeded = view.widthPitch * view.height;
+  raw.pixels.setCounter(&_frameMemory);
+  if (!raw.pixels.reserve(std::max(sizeNeeded, _expectedFrameBytes.load()))) {
+    _captureRejected++;
+    return false;
+  }
+
+  copyAsBgrx(view, raw.pixels.data());
+
+  // Delay JPEG creation until encode loop to improve render performance.
+  raw.width = view.width;
+  raw.widthPitch = view.widthPitch;
+  raw.height = view.height;
+  raw.frameId = view.frameId;
+  raw.pose = view.pose;
+  raw.captureNs = view.captureNs != 0 ? view.captureNs : steadyClockNs();
+
+  // Dispatch encode loop.
+  _rawFrames.publish();
+  return true;
+}
+
+void StreamSession::captureFailed() {
+  _captureRejected++;
+}
+
+bool StreamSession::isSending() {
+  return _sending.load();
+}
+
+double StreamSession::getLastStopMs() {
+  return _lastStopMs.load();
+}
+
+void StreamSession::getViewerParams(int32_t* width, int32_t* height, float* interpupillary) {
+  std::unique_lock<std::mutex> lock(_paramsMutex);
+  *width = _width;
+  *height = _height;
+  *interpupillary = _interpupillary;
+}
+
+Capabilities StreamSession::getDeviceCapabilities() {
+  std::unique_lock<std::mutex> lock(_paramsMutex);
+  return _deviceCapabilities;
+}
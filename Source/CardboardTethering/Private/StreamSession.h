@@ -0,0 +1,254 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include "Transport.h"
+#include "WorkerThread.h"
+#include "FrameRing.h"
+#include "FramePipeline.h"
+#include "FrameSource.h"
+#include "FrameHeader.h"
+#include "JpegEncoder.h"
+#include "RateController.h"
+#include "TileCodec.h"
+#include "LatencyTracker.h"
+#include "MessageCodec.h"
+#include "Capabilities.h"
+#include "FramePacer.h"
+#include "KeyframeRequests.h"
+
+/**
+ * The streaming half of a connection to the phone, over any Transport: the
+ * handshake, the read loop, and the encode and send loops fed by whatever
+ * FrameSource delivers to it. Like the rest of the pipeline it includes only
+ * standard and third-party headers, so the whole stream builds and runs
+ * headless against a stand-in phone; UsbDevice adds the accessory and the
+ * Unreal side on top.
+ */
+class StreamSession : public FrameSink {
+  static constexpr size_t MAX_FRAME_DIMENSION = 16384; // D3D11's texture limit
+
+  std::mutex _transportMutex;
+  std::shared_ptr<Transport> _transport;
+
+  std::atomic_bool _handshake;
+  std::atomic_bool _reopening; /* Old loops stopping for a reconnect. */
+
+  std::unique_ptr<WorkerThread> _receiveWorker;
+
+  // Frames flow from publishFrame (the render thread) to the encode worker
+  // to the send worker; each stage only ever works on the newest frame
+  // available.
+  FrameRing<RawFrame> _rawFrames;
+  FrameRing<EncodedFrame> _encodedFrames;
+  std::atomic<uint64_t> _captureRejected;
+  std::atomic<size_t> _expectedFrameBytes; /* From the viewer size. */
+  MemoryCounter _frameMemory;
+
+  std::unique_ptr<WorkerThread> _encodeWorker;
+  // Only used by the encode worker. The eyes are encoded concurrently on
+  // _eyePool when there are threads to spare.
+  std::unique_ptr<JpegEncoder> _encoders[EYE_COUNT];
+  std::unique_ptr<WorkerPool> _eyePool;
+  AlignedBuffer _scaled[EYE_COUNT];
+  std::atomic<size_t> _encodeThreads;
+  std::atomic_bool _yuvInput;
+  RateController _rateController;
+  FramePacer _pacer; /* Fed by the read loop, consulted by the encode worker. */
+  // Tile coding needs to know what the receiver has; the send worker records
+  // the sequence number of each eye it finishes sending.
+  std::unique_ptr<TileEncoder> _tileEncoders[EYE_COUNT];
+  std::atomic<uint64_t> _lastSentSequence[EYE_COUNT];
+  KeyframeRequests _keyframeRequests; /* From the phone, after losses. */
+  std::atomic_bool _tileCoding;
+  std::atomic<size_t> _tileSize;
+  std::atomic<size_t> _tileRefresh;
+  std::unique_ptr<WorkerThread> _sendWorker;
+  std::atomic_bool _sending; /* Read by other threads instead of _sendWorker. */
+  MemoryCounter _jpegMemory;
+  std::atomic<size_t> _encoderMemory; /* Updated by the encode worker. */
+  std::atomic_bool _sendFailed;
+  std::mutex _sendInterruptMutex;
+  bool _sendsInterrupted; /* Set once the send loop must not be interrupted again. */
+  std::atomic<uint64_t> _sentFrames;
+  std::shared_ptr<LatencyTracker> _latencyTracker; /* Set before sending. */
+
+  struct EyeCounters {
+    std::atomic<uint64_t> payloads;
+    std::atomic<uint64_t> keyframes;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> encodeMicros;
+    std::atomic<uint64_t> sendMicros;
+  };
+  EyeCounters _eyeCounters[EYE_COUNT];
+
+  std::atomic<uint8_t> _protocolVersion; /* Message version, from the handshake. */
+  std::atomic_bool _tilesAccepted; /* The phone can composite CODEC_TILES. */
+
+  std::mutex _paramsMutex;
+  int32_t _width;
+  int32_t _height;
+  float _interpupillary;
+  Capabilities _deviceCapabilities; /* As the phone reported them. */
+  Capabilities _linkCapabilities;   /* What we picked and told the phone. */
+
+  /** Not a real status; the handshake is still waiting for TYPE_HELLO. */
+  static constexpr int STATUS_HANDSHAKE_PENDING = 1;
+
+  /** For the best-effort TYPE_END when the send loop is stopped. */
+  static constexpr unsigned int END_TIMEOUT_MS = 100;
+
+  std::atomic<double> _lastStopMs; /* How long stopWorkers() last took. */
+
+  void flushInput(Transport* transport, unsigned char* buf);
+  int handleHello(const unsigned char* payload, size_t length,
+    const Capabilities* resumed = nullptr);
+  void handleVsync(const unsigned char* payload, size_t length);
+  void handleRefresh(const unsigned char* payload, size_t length);
+  int encodeFrame(const RawFrame& raw, EncodedFrame* encoded);
+
+protected:
+  /** Bytes per handshake read, and per chunk for UsbSendQueue. */
+  static constexpr size_t BUFFER_LEN = 16384;
+
+  double stopWorkers();
+
+public:
+  static constexpr int STATUS_OK = 0;
+  static constexpr int STATUS_NOT_FOUND_ERROR = -1;
+  static constexpr int STATUS_DEVICE_DESCRIPTOR_ERROR = -2;
+  static constexpr int STATUS_CONFIG_DESCRIPTOR_ERROR = -3;
+  static constexpr int STATUS_DESCRIPTOR_READ_ERROR = -4;
+  static constexpr int STATUS_INTERFACE_CLAIM_ERROR = -5;
+  static constexpr int STATUS_RECEIVE_ERROR = -6;
+  static constexpr int STATUS_SEND_ERROR = -7;
+  static constexpr int STATUS_BAD_PROTOCOL_VERSION = -8;
+  static constexpr int STATUS_PROTOCOL_ERROR = -9;
+  static constexpr int STATUS_OLD_CLIENT = -10;          /* Phone app needs updating. */
+  static constexpr int STATUS_INCOMPATIBLE_CLIENT = -11; /* No common version or codec. */
+  static constexpr int STATUS_CHANGED_CLIENT = -13;      /* Resumed with other parameters. */
+  static constexpr int STATUS_LIBUSB_ERROR = -1000;
+  static constexpr int STATUS_JPEG_ERROR = -2000;
+
+  /**
+   * Pose payloads (Message::TYPE_POSE) from the phone: the quaternion as four BE floats, then a
+   * 32-bit BE sequence number and the 64-bit BE device timestamp in ns.
+   * Then the pose sequence of the last frame the phone displayed (0 for
+   * none) and how long after sampling that pose it was displayed, in
+   * microseconds, both 32-bit BE; see LatencyTracker.
+   * Older apps send only the quaternion, or stop after the timestamp.
+   */
+  static constexpr size_t POSE_PACKET_LEN = 36;
+  static constexpr size_t POSE_TIMESTAMP_LEN = 28;
+  static constexpr size_t POSE_QUATERNION_LEN = 16;
+
+  /**
+   * Vsync payloads (Message::TYPE_VSYNC) from the phone, one per display
+   * refresh: the 64-bit BE vsync time in ns on the same clock as pose
+   * timestamps, the 32-bit BE refresh period in ns (0 if unknown), then the
+   * 64-bit BE id of the last frame the phone received both eyes of and the
+   * 64-bit BE time it did (0 if none yet). They drive the FramePacer and are
+   * not passed on to the read loop callback.
+   */
+  static constexpr size_t VSYNC_PACKET_LEN = 28;
+
+  /**
+   * Refresh payloads (Message::TYPE_REFRESH) from the phone, asking for a
+   * keyframe: u8 eye (or KeyframeRequests::ALL_EYES), u8 reason (a
+   * KeyframeRequests::Reason), two reserved bytes, then the 64-bit BE id of
+   * a frame at or before which the eye's image went wrong (0 if unknown). They go
+   * to KeyframeRequests and are not passed on to the read loop callback.
+   */
+  static constexpr size_t REFRESH_PACKET_LEN = 12;
+
+  /** How long resumeHandshake() waits for the phone by default. */
+  static constexpr int RESUME_TIMEOUT_MS = 3000;
+
+  /** Bytes asked for per read; messages may span or share reads. */
+  static constexpr size_t READ_BUFFER_LEN = 4096;
+
+  static constexpr size_t DEFAULT_TILE_SIZE = 64;
+  static constexpr size_t DEFAULT_TILE_REFRESH = 120;
+
+  explicit StreamSession(std::shared_ptr<Transport> transport = nullptr);
+  /** Stops and joins the loops; a loop's own callback may drop the session. */
+  virtual ~StreamSession();
+
+  StreamSession(const StreamSession&) = delete;
+  StreamSession& operator=(const StreamSession&) = delete;
+
+  /** Only while the loops are stopped; the loops keep the one they began with. */
+  void setTransport(std::shared_ptr<Transport> transport);
+  std::shared_ptr<Transport> getTransport();
+
+  bool waitHandshakeAsync(std::function<void(int)> callback);
+  bool isHandshakeComplete();
+
+  /**
+   * Whether the status came from the link itself (a transfer failing or
+   * the stream losing sync) rather than the phone app or the encoder, so
+   * reopening the device might fix it.
+   */
+  static bool isLinkError(int status);
+
+  /**
+   * Stops the loops after the link failed, without telling the phone,
+   * keeping everything negotiated for resumeHandshake().
+   */
+  void suspend();
+
+  /**
+   * Handshake on a new link, on the calling thread: asks the phone for its
+   * TYPE_HELLO again (Message::FLAG_RESUME) and checks it still picks the
+   * link agreed before, or returns STATUS_CHANGED_CLIENT. On success the
+   * send and read loops can begin again.
+   */
+  int resumeHandshake(const std::atomic_bool& cancel,
+    int timeoutMs = RESUME_TIMEOUT_MS);
+  bool beginReadLoop(
+      std::function<void(uint8_t, const unsigned char*, size_t, int)> callback);
+  bool beginSendLoop(std::function<void(int)> failureCallback);
+
+  /**
+   * Whether frames are wanted. Safe from any thread, even while the owner is
+   * stopping or replacing the loops.
+   */
+  bool isSending();
+
+  /**
+   * Copies a captured frame into the pipeline for the encode loop, replacing
+   * one it hasn't started on. Frames come from a FrameSource on the render
+   * thread.
+   */
+  virtual bool publishFrame(const FrameView& view) override;
+
+  /** Counts a frame the source couldn't capture, for getPipelineStats(). */
+  void captureFailed();
+
+  /** How long the loops took to stop last time, in ms. */
+  double getLastStopMs();
+  Transport::Stats getSendStats();
+  PipelineStats getPipelineStats();
+  MemoryStats getMemoryStats();
+  EyeStats getEyeStats(size_t eye);
+  void setRateTargets(const RateController::Targets& targets);
+  void setLatencyTracker(std::shared_ptr<LatencyTracker> tracker);
+  void setPacing(const FramePacer::Settings& settings);
+  FramePacer::Settings getPacingSettings();
+  FramePacer::Stats getPacingStats();
+  KeyframeRequests::Stats getKeyframeRequestStats();
+  RateController::Settings getRateSettings();
+  RateController::Estimate getRateEstimate();
+  void setEncodeThreads(size_t threads);
+  size_t getEncodeThreads();
+  static size_t getDefaultEncodeThreads();
+  void setYuvInput(bool enabled);
+  bool getYuvInput();
+  void setTileCoding(bool enabled, size_t tileSize, size_t refreshInterval);
+  bool getTileCoding(size_t* tileSize, size_t* refreshInterval);
+  void getViewerParams(int32_t* width, int32_t* height, float* interpupillary);
+  Capabilities getDeviceCapabilities();
+};
@@ -0,0 +1,84 @@
+#include "SyntheticFrameSource.h"
+#include <algorithm>
+
+SyntheticFrameSource::SyntheticFrameSource(size_t width, size_t height,
+  Pattern pattern, size_t cycle
+) : _width(std::max<size_t>(width, 1)),
+    _height(std::max<size_t>(height, 1)),
+    _pattern(pattern),
+    _cycling(cycle > 0),
+    _nextFrameId(1) {
+  _frames.resize(std::max<size_t>(cycle, 1));
+  for (size_t i = 0; i < _frames.size(); ++i) {
+    _frames[i].resize(_width * 4 * _height);
+    if (_cycling) {
+      draw(_frames[i].data(), i);
+    }
+  }
+}
+
+void SyntheticFrameSource::draw(unsigned char* data, uint64_t frame) const {
+  if (_pattern == PATTERN_STATIC) {
+    fillStaticPattern(data, _width, _width * 4, _height, frame);
+  } else {
+    fillTestPattern(data, _width, _width * 4, _height, frame);
+  }
+}
+
+bool SyntheticFrameSource::deliver(FrameSink* sink) {
+  uint64_t frameId = _nextFrameId++;
+  std::vector<unsigned char>& pixels = _frames[(frameId - 1) % _frames.size()];
+  if (!_cycling) {
+    draw(pixels.data(), frameId - 1);
+  }
+
+  FrameView view;
+  view.data = pixels.data();
+  view.width = _width;
+  view.widthPitch = _width * 4;
+  view.height = _height;
+  view.format = FORMAT_BGRX;
+  view.frameId = frameId;
+  view.captureNs = steadyClockNs();
+  sink->publishFrame(view);
+  return true;
+}
+
+void SyntheticFrameSource::fillTestPattern(unsigned char* data, size_t width,
+    size_t widthPitch, size_t height, uint64_t frame) {
+  // Moving gradients give the encoder real edges to work with, and a little
+  // noise keeps it from compressing unrealistically well.
+  uint32_t noise = static_cast<uint32_t>(frame * 2654435761u) | 1;
+  for (size_t y = 0; y < height; ++y) {
+    unsigned char* row = data + y * widthPitch;
+    for (size_t x = 0; x < width; ++x) {
+      noise ^= noise << 13;
+      noise ^= noise >> 17;
+      noise ^= noise << 5;
+
+      unsigned char* px = row + x * 4;
+      px[0] = static_cast<unsigned char>(x + frame * 4);
+      px[1] = static_cast<unsigned char>(y + frame * 2);
+      px[2] = static_cast<unsigned char>(((x / 64 + y / 64 + frame / 8) & 1) * 160 + (noise & 0x1F));
+      px[3] = 0xFF;
+    }
+  }
+}
+
+void SyntheticFrameSource::fillStaticPattern(unsigned char* data, size_t width,
+    size_t widthPitch, size_t height, uint64_t frame) {
+  fillTestPattern(data, width, widthPitch, height, 0);
+
+  size_t box = std::min<size_t>(96, std::min(width, height));
+  size_t x0 = (frame * 7) % (width - box + 1);
+  size_t y0 = (frame * 3) % (height - box + 1);
+  for (size_t y = y0; y < y0 + box; ++y) {
+    unsigned char* row = data + y * widthPitch;
+    for (size_t x = x0; x < x0 + box; ++x) {
+      unsigned char* px = row + x * 4;
+      px[0] = 0x20;
+      px[1] = static_cast<unsigned char>(0x80 + frame);
+      px[2] = 0xE0;
+    }
+  }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "FrameSource.h"
+
+/**
+ * Draws frames instead of capturing them, for streaming and benchmarking
+ * without a game or a GPU: fillTestPattern's animation, or
+ * fillStaticPattern's mostly still scene with a box moving over it. Sizes
+ * are of the whole side-by-side frame.
+ */
+class SyntheticFrameSource : public FrameSource {
+public:
+  enum Pattern : uint8_t {
+    PATTERN_ANIMATED,
+    PATTERN_STATIC
+  };
+
+  /**
+   * cycle > 0 draws that many frames up front and repeats them, so drawing
+   * costs nothing per frame; 0 draws every frame afresh.
+   */
+  SyntheticFrameSource(size_t width, size_t height, Pattern pattern,
+    size_t cycle = 0);
+
+  /** Fills a BGRX frame with an animated pattern (gradients plus noise). */
+  static void fillTestPattern(unsigned char* data, size_t width,
+    size_t widthPitch, size_t height, uint64_t frame);
+
+  /**
+   * Fills a BGRX frame with a mostly static scene: the test pattern frozen at
+   * frame 0 with a box moving across it, like a cursor or a small animation
+   * over an editor window.
+   */
+  static void fillStaticPattern(unsigned char* data, size_t width,
+    size_t widthPitch, size_t height, uint64_t frame);
+
+  /** Draws the next frame; always has one. */
+  virtual bool deliver(FrameSink* sink) override;
+
+  size_t width() const { return _width; }
+  size_t height() const { return _height; }
+  uint64_t delivered() const { return _nextFrameId - 1; }
+
+private:
+  size_t _width;
+  size_t _height;
+  Pattern _pattern;
+  std::vector<std::vector<unsigned char>> _frames; /* One unless cycling. */
+  bool _cycling;
+  uint64_t _nextFrameId;
+
+  void draw(unsigned char* data, uint64_t frame) const;
+};
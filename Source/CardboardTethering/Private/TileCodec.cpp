@@ -0,0 +1,307 @@
+#include "TileCodec.h"
+#include <algorithm>
+#include <cstring>
+
+#include "turbojpeg.h"
+
+namespace {
+
+  const size_t TILE_HEADER_LEN = 10;
+
+  void putBig16(std::vector<unsigned char>* out, size_t value) {
+    out->push_back(static_cast<unsigned char>((value >> 8) & 0xFF));
+    out->push_back(static_cast<unsigned char>(value & 0xFF));
+  }
+
+  size_t getBig16(const unsigned char* p) {
+    return (static_cast<size_t>(p[0]) << 8) | p[1];
+  }
+
+}
+
+TileEncoder::TileEncoder(size_t tileSize, size_t refreshInterval)
+  : _width(0),
+    _height(0),
+    _tilesX(0),
+    _tilesY(0),
+    _sequence(0),
+    _baseSequence(0),
+    _lastKeyframe(0) {
+  _history.resize(HISTORY);
+  configure(tileSize, refreshInterval);
+}
+
+size_t TileEncoder::roundTileSize(size_t tileSize) {
+  // Small enough for the u8 in the tile header.
+  return std::min<size_t>(std::max<size_t>((tileSize + 15) / 16 * 16, 16), 64);
+}
+
+void TileEncoder::configure(size_t tileSize, size_t refreshInterval) {
+  _tileSize = roundTileSize(tileSize);
+  _refreshInterval = std::max<size_t>(refreshInterval, 1);
+  _width = 0;
+  _height = 0;
+}
+
+size_t TileEncoder::memoryBytes() const {
+  size_t bytes = _previous.capacity() + _atlas.capacity() + _pending.capacity();
+  for (const auto& changed : _history) {
+    bytes += changed.capacity();
+  }
+  return bytes;
+}
+
+void TileEncoder::resize(size_t width, size_t height) {
+  _width = width;
+  _height = height;
+  _tilesX = (width + _tileSize - 1) / _tileSize;
+  _tilesY = (height + _tileSize - 1) / _tileSize;
+  _previous.clear();
+  for (auto& changed : _history) {
+    changed.assign(_tilesX * _tilesY, 0);
+  }
+}
+
+void TileEncoder::diff(const FrameView& frame, std::vector<uint8_t>* changed) {
+  changed->assign(_tilesX * _tilesY, 0);
+  size_t previousPitch = _width * 4;
+
+  for (size_t ty = 0; ty < _tilesY; ++ty) {
+    size_t y0 = ty * _tileSize;
+    size_t y1 = std::min(y0 + _tileSize, _height);
+    for (size_t tx = 0; tx < _tilesX; ++tx) {
+      size_t x0 = tx * _tileSize;
+      size_t rowBytes = (std::min(x0 + _tileSize, _width) - x0) * 4;
+      for (size_t y = y0; y < y1; ++y) {
+        const unsigned char* now = frame.data + y * frame.widthPitch + x0 * 4;
+        const unsigned char* before = _previous.data() + y * previousPitch + x0 * 4;
+        if (std::memcmp(now, before, rowBytes) != 0) {
+          (*changed)[ty * _tilesX + tx] = 1;
+          break;
+        }
+      }
+    }
+  }
+}
+
+void TileEncoder::remember(const FrameView& frame) {
+  size_t pitch = _width * 4;
+  _previous.resize(pitch * _height);
+  for (size_t y = 0; y < _height; ++y) {
+    std::memcpy(&_previous[y * pitch], frame.data + y * frame.widthPitch, pitch);
+  }
+}
+
+int TileEncoder::encode(const FrameView& frame, uint64_t lastSent,
+    JpegEncoder* jpeg, int quality, int subsamp, EncodedEye* out,
+    Result* result) {
+  uint64_t sequence = ++_sequence;
+  if (frame.width != _width || frame.height != _height || _previous.empty()) {
+    resize(frame.width, frame.height);
+    _baseSequence = sequence;
+  }
+
+  std::vector<uint8_t>& changed = _history[sequence % HISTORY];
+  if (_previous.empty()) {
+    changed.assign(_tilesX * _tilesY, 1);
+  } else {
+    diff(frame, &changed);
+  }
+
+  // A delta needs the receiver to have a frame at this size, and history
+  // back to that frame.
+  size_t totalTiles = _tilesX * _tilesY;
+  bool keyframe = lastSent < _baseSequence || lastSent > sequence ||
+    sequence - lastSent >= HISTORY ||
+    sequence - _lastKeyframe >= _refreshInterval ||
+    _width > MAX_HEADER_FIELD || _height > MAX_HEADER_FIELD;
+
+  size_t changedTiles = totalTiles;
+  if (!keyframe) {
+    _pending.assign(totalTiles, 0);
+    for (uint64_t s = lastSent + 1; s <= sequence; ++s) {
+      const std::vector<uint8_t>& mask = _history[s % HISTORY];
+      for (size_t i = 0; i < totalTiles; ++i) {
+        _pending[i] |= mask[i];
+      }
+    }
+    changedTiles = std::count(_pending.begin(), _pending.end(), 1);
+    keyframe = changedTiles > totalTiles * MAX_DELTA_FRACTION ||
+      changedTiles > MAX_HEADER_FIELD;
+  }
+
+  remember(frame);
+  out->sequence = sequence;
+  result->keyframe = keyframe;
+  result->changedTiles = changedTiles;
+  result->totalTiles = totalTiles;
+
+  unsigned long jpegSize = 0;
+  if (keyframe) {
+    _lastKeyframe = sequence;
+    out->codec = CODEC_JPEG;
+    out->prefix.clear();
+    int status = jpeg->encode(frame, quality, subsamp,
+      &out->jpegBuffer, &out->jpegBufferCapacity, &jpegSize);
+    out->jpegBufferSize = jpegSize;
+    return status;
+  }
+
+  size_t columns = std::max<size_t>(std::min(changedTiles, _tilesX), 1);
+  size_t rows = (changedTiles + columns - 1) / columns;
+
+  out->codec = CODEC_TILES;
+  out->prefix.clear();
+  putBig16(&out->prefix, _width);
+  putBig16(&out->prefix, _height);
+  out->prefix.push_back(static_cast<unsigned char>(_tileSize));
+  out->prefix.push_back(0);
+  putBig16(&out->prefix, changedTiles);
+  putBig16(&out->prefix, columns);
+
+  size_t mapOffset = out->prefix.size();
+  out->prefix.resize(mapOffset + (totalTiles + 7) / 8, 0);
+  for (size_t i = 0; i < totalTiles; ++i) {
+    if (_pending[i]) {
+      out->prefix[mapOffset + i / 8] |= static_cast<unsigned char>(1 << (i % 8));
+    }
+  }
+
+  out->jpegBufferSize = 0;
+  if (changedTiles == 0) {
+    return 0;
+  }
+
+  // Copy each changed tile into its atlas cell, repeating the last column
+  // and row of clipped edge tiles so they compress well.
+  size_t atlasPitch = columns * _tileSize * 4;
+  _atlas.resize(atlasPitch * rows * _tileSize);
+  size_t cell = 0;
+  for (size_t i = 0; i < totalTiles; ++i) {
+    if (!_pending[i]) {
+      continue;
+    }
+
+    size_t x0 = (i % _tilesX) * _tileSize;
+    size_t y0 = (i / _tilesX) * _tileSize;
+    size_t w = std::min(_tileSize, _width - x0);
+    size_t h = std::min(_tileSize, _height - y0);
+    unsigned char* dest = &_atlas[(cell / columns) * _tileSize * atlasPitch +
+      (cell % columns) * _tileSize * 4];
+
+    for (size_t y = 0; y < _tileSize; ++y) {
+      const unsigned char* src = frame.data +
+        (y0 + std::min(y, h - 1)) * frame.widthPitch + x0 * 4;
+      unsigned char* row = dest + y * atlasPitch;
+      std::memcpy(row, src, w * 4);
+      for (size_t x = w; x < _tileSize; ++x) {
+        std::memcpy(row + x * 4, src + (w - 1) * 4, 4);
+      }
+    }
+    ++cell;
+  }
+
+  FrameView atlas;
+  atlas.data = _atlas.data();
+  atlas.width = columns * _tileSize;
+  atlas.widthPitch = atlasPitch;
+  atlas.height = rows * _tileSize;
+  int status = jpeg->encode(atlas, quality, subsamp,
+    &out->jpegBuffer, &out->jpegBufferCapacity, &jpegSize);
+  out->jpegBufferSize = jpegSize;
+  return status;
+}
+
+TileCompositor::TileCompositor()
+  : _decoder(tjInitDecompress()), _width(0), _height(0) {}
+
+TileCompositor::~TileCompositor() {
+  tjDestroy(_decoder);
+}
+
+int TileCompositor::decode(const unsigned char* jpeg, size_t size,
+    std::vector<unsigned char>* out, size_t* width, size_t* height) {
+  int w, h, subsamp, colorspace;
+  if (tjDecompressHeader3(_decoder, jpeg, static_cast<unsigned long>(size),
+      &w, &h, &subsamp, &colorspace) != 0) {
+    return -1;
+  }
+
+  out->resize(static_cast<size_t>(w) * h * 4);
+  if (tjDecompress2(_decoder, jpeg, static_cast<unsigned long>(size),
+      out->data(), w, 0, h, TJPF_BGRX, 0) != 0) {
+    return -1;
+  }
+
+  *width = w;
+  *height = h;
+  return 0;
+}
+
+int TileCompositor::apply(uint8_t codec, const unsigned char* body,
+    size_t size) {
+  if (codec == CODEC_JPEG) {
+    return decode(body, size, &_canvas, &_width, &_height);
+  }
+  if (codec != CODEC_TILES || size < TILE_HEADER_LEN) {
+    return -1;
+  }
+
+  size_t width = getBig16(body);
+  size_t height = getBig16(body + 2);
+  size_t tileSize = body[4];
+  size_t tileCount = getBig16(body + 6);
+  size_t columns = getBig16(body + 8);
+  if (width != _width || height != _height || tileSize == 0 || _canvas.empty()) {
+    return -1;
+  }
+
+  size_t tilesX = (width + tileSize - 1) / tileSize;
+  size_t tilesY = (height + tileSize - 1) / tileSize;
+  size_t totalTiles = tilesX * tilesY;
+  const unsigned char* map = body + TILE_HEADER_LEN;
+  size_t mapLen = (totalTiles + 7) / 8;
+  if (size < TILE_HEADER_LEN + mapLen) {
+    return -1;
+  }
+  if (tileCount == 0) {
+    return 0;
+  }
+  if (columns == 0) {
+    return -1;
+  }
+
+  size_t atlasWidth, atlasHeight;
+  const unsigned char* jpeg = map + mapLen;
+  if (decode(jpeg, size - TILE_HEADER_LEN - mapLen, &_atlas,
+      &atlasWidth, &atlasHeight) != 0) {
+    return -1;
+  }
+  size_t rows = (tileCount + columns - 1) / columns;
+  if (atlasWidth != columns * tileSize || atlasHeight != rows * tileSize) {
+    return -1;
+  }
+
+  size_t canvasPitch = width * 4;
+  size_t atlasPitch = atlasWidth * 4;
+  size_t cell = 0;
+  for (size_t i = 0; i < totalTiles && cell < tileCount; ++i) {
+    if (!(map[i / 8] & (1 << (i % 8)))) {
+      continue;
+    }
+
+    size_t x0 = (i % tilesX) * tileSize;
+    size_t y0 = (i / tilesX) * tileSize;
+    size_t w = std::min(tileSize, width - x0);
+    size_t h = std::min(tileSize, height - y0);
+    const unsigned char* src = &_atlas[(cell / columns) * tileSize * atlasPitch +
+      (cell % columns) * tileSize * 4];
+    for (size_t y = 0; y < h; ++y) {
+      std::memcpy(&_canvas[(y0 + y) * canvasPitch + x0 * 4],
+        src + y * atlasPitch, w * 4);
+    }
+    ++cell;
+  }
+
+  return cell == tileCount ? 0 : -1;
+}
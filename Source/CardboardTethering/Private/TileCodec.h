@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "FramePipeline.h"
+#include "JpegEncoder.h"
+
+/**
+ * Delta coding for mostly static content: only the tiles that changed since
+ * the last frame the receiver has are sent, packed into one JPEG "atlas".
+ *
+ * CODEC_TILES body (all integers big-endian):
+ *
+ *   u16 width, u16 height   Size of the eye image the tiles belong to.
+ *   u8  tileSize            Tile edge in pixels (16, 32 or 64).
+ *   u8  reserved            0.
+ *   u16 tileCount           Number of tiles in the atlas.
+ *   u16 atlasColumns        Atlas width in tiles.
+ *   tile map                ceil(tilesX * tilesY / 8) bytes; bit (i % 8) of
+ *                           byte (i / 8) is set if tile i (row-major) is sent.
+ *   JPEG                    The atlas, present only if tileCount > 0; it is
+ *                           atlasColumns tiles wide and
+ *                           ceil(tileCount / atlasColumns) tiles high.
+ *
+ * Compositing: the receiver keeps a canvas per eye. A CODEC_JPEG body
+ * replaces the canvas (and its size). A CODEC_TILES body whose size doesn't
+ * match the canvas is dropped. Otherwise the k-th set bit of the tile map,
+ * for tile (tx, ty), copies atlas cell (k % atlasColumns, k / atlasColumns)
+ * to canvas position (tx * tileSize, ty * tileSize), clipped to the canvas.
+ * Tile sizes are multiples of the 16-pixel MCU, so tiles never share a DCT
+ * block in the atlas.
+ */
+
+/**
+ * Encodes one eye as a full JPEG or a set of changed tiles. Keeps the last
+ * frame it saw and one bitmask of changed tiles per frame, so the tiles sent
+ * cover everything that changed since the last frame that actually reached
+ * the receiver, even if frames in between were dropped.
+ */
+class TileEncoder {
+public:
+  static constexpr size_t HISTORY = 64;
+
+  /** Above this fraction of changed tiles a full JPEG is cheaper. */
+  static constexpr double MAX_DELTA_FRACTION = 0.6;
+
+  /** The delta header's sizes and counts are 16 bits; past that, keyframes. */
+  static constexpr size_t MAX_HEADER_FIELD = 0xFFFF;
+
+  struct Result {
+    bool keyframe;
+    size_t changedTiles;
+    size_t totalTiles;
+  };
+
+  /** Rounds to a whole number of MCUs between 16 and 64. */
+  static size_t roundTileSize(size_t tileSize);
+
+  /** refreshInterval frames after a keyframe, the next frame is a keyframe. */
+  TileEncoder(size_t tileSize, size_t refreshInterval);
+
+  size_t tileSize() const { return _tileSize; }
+  size_t refreshInterval() const { return _refreshInterval; }
+
+  /**
+   * Changes the tiling; the next frame is a keyframe. Sequence numbers keep
+   * counting, so a receiver state recorded before the change stays valid.
+   */
+  void configure(size_t tileSize, size_t refreshInterval);
+
+  /** Previous frame, change history and atlas. */
+  size_t memoryBytes() const;
+
+  /**
+   * Encodes the frame into out, given the sequence number of the last frame
+   * the receiver has (0 for none). out->sequence is this frame's number.
+   * Returns 0 or the JpegEncoder error.
+   */
+  int encode(const FrameView& frame, uint64_t lastSent, JpegEncoder* jpeg,
+    int quality, int subsamp, EncodedEye* out, Result* result);
+
+private:
+  size_t _tileSize;
+  size_t _refreshInterval;
+
+  size_t _width;
+  size_t _height;
+  size_t _tilesX;
+  size_t _tilesY;
+  std::vector<unsigned char> _previous; /* Tightly packed BGRX. */
+
+  uint64_t _sequence;
+  uint64_t _baseSequence; /* First frame at the current size. */
+  uint64_t _lastKeyframe;
+  std::vector<std::vector<uint8_t>> _history; /* Changed tiles, by sequence. */
+  std::vector<uint8_t> _pending;
+  std::vector<unsigned char> _atlas;
+
+  void resize(size_t width, size_t height);
+  void diff(const FrameView& frame, std::vector<uint8_t>* changed);
+  void remember(const FrameView& frame);
+};
+
+/**
+ * Reference receiver: applies eye payload bodies to a BGRX canvas exactly as
+ * the protocol above describes. The phone does the same thing in Java.
+ */
+class TileCompositor {
+public:
+  TileCompositor();
+  ~TileCompositor();
+
+  TileCompositor(const TileCompositor&) = delete;
+  TileCompositor& operator=(const TileCompositor&) = delete;
+
+  /** Returns 0, or -1 for a malformed body or a delta without a canvas. */
+  int apply(uint8_t codec, const unsigned char* body, size_t size);
+
+  const unsigned char* canvas() const { return _canvas.data(); }
+  size_t width() const { return _width; }
+  size_t height() const { return _height; }
+
+private:
+  tjhandle _decoder;
+  std::vector<unsigned char> _canvas;
+  size_t _width;
+  size_t _height;
+  std::vector<unsigned char> _atlas;
+
+  int decode(const unsigned char* jpeg, size_t size,
+    std::vector<unsigned char>* out, size_t* width, size_t* height);
+};
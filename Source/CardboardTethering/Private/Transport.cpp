@@ -0,0 +1,62 @@
+#include "Transport.h"
+
+double Transport::Stats::megabytesPerSecond() const {
+  if (busyMs <= 0.0) {
+    return 0.0;
+  }
+  return (bytes / (1024.0 * 1024.0)) / (busyMs / 1000.0);
+}
+
+double Transport::Stats::framesPerSecond() const {
+  if (wallMs <= 0.0) {
+    return 0.0;
+  }
+  return frames / (wallMs / 1000.0);
+}
+
+Transport::Transport() {
+  resetStats();
+}
+
+Transport::SendResult Transport::send(
+    const unsigned char* header, size_t headerLen,
+    const unsigned char* payload, size_t payloadLen,
+    unsigned int timeoutMs) {
+  auto startTime = std::chrono::steady_clock::now();
+
+  SendResult result;
+  result.status = write(header, headerLen, payload, payloadLen, timeoutMs);
+  result.bytes = headerLen + payloadLen;
+  result.elapsedMs = std::chrono::duration<double, std::milli>(
+    std::chrono::steady_clock::now() - startTime).count();
+
+  if (result.status == SUCCESS) {
+    std::lock_guard<std::mutex> lock(_statsMutex);
+    if (_stats.frames == 0) {
+      _firstFrameTime = startTime;
+    }
+    _stats.frames++;
+    _stats.bytes += result.bytes;
+    _stats.busyMs += result.elapsedMs;
+  }
+
+  return result;
+}
+
+Transport::Stats Transport::getStats() const {
+  std::lock_guard<std::mutex> lock(_statsMutex);
+  Stats stats = _stats;
+  if (stats.frames > 0) {
+    stats.wallMs = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - _firstFrameTime).count();
+  }
+  return stats;
+}
+
+void Transport::resetStats() {
+  std::lock_guard<std::mutex> lock(_statsMutex);
+  _stats.frames = 0;
+  _stats.bytes = 0;
+  _stats.busyMs = 0.0;
+  _stats.wallMs = 0.0;
+}
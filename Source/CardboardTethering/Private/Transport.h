@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <chrono>
+
+/**
+ * The bulk IN and OUT pipes a StreamSession talks to the phone over: a
+ * UsbTransport in the plugin, or a LoopbackTransport or SocketTransport when
+ * the session runs headless. Statuses are libusb_error codes whichever it is,
+ * so a failed link is reported the same way (STATUS_LIBUSB_ERROR + status).
+ *
+ * read() and send() block. Each direction can be cut short from another
+ * thread, to unblock a loop that is stopping: that call and every later one
+ * fail with ERROR_INTERRUPTED until the direction is reset.
+ */
+class Transport {
+public:
+  /** The libusb_error values the session tells apart. */
+  static constexpr int SUCCESS = 0;
+  static constexpr int ERROR_IO = -1;
+  static constexpr int ERROR_NO_DEVICE = -4;
+  static constexpr int ERROR_TIMEOUT = -7;
+  static constexpr int ERROR_INTERRUPTED = -10;
+
+  struct SendResult {
+    int status; /* 0 or a libusb_error code. */
+    size_t bytes;
+    double elapsedMs;
+  };
+
+  struct Stats {
+    uint64_t frames; /* Successful send() calls. */
+    uint64_t bytes;
+    double busyMs;   /* Time spent inside send. */
+    double wallMs;   /* Time since the first frame was sent. */
+
+    double megabytesPerSecond() const;
+    double framesPerSecond() const;
+  };
+
+  Transport();
+  virtual ~Transport() {}
+
+  Transport(const Transport&) = delete;
+  Transport& operator=(const Transport&) = delete;
+
+  /**
+   * Like libusb_bulk_transfer on the IN pipe, including a timeout of 0
+   * waiting for ever and bytes that arrived before a timeout counting in
+   * transferred. Not reentrant.
+   */
+  virtual int read(unsigned char* data, int length, int* transferred,
+    unsigned int timeoutMs) = 0;
+
+  /**
+   * Writes the header followed by the payload to the OUT pipe and blocks
+   * until all of it has gone or failed. Not reentrant.
+   */
+  SendResult send(const unsigned char* header, size_t headerLen,
+    const unsigned char* payload, size_t payloadLen,
+    unsigned int timeoutMs);
+
+  /** Thread-safe; fails the read in progress, if any, and later ones. */
+  virtual void cancelReads() = 0;
+  /** Not while a read is in progress. */
+  virtual void resetReads() = 0;
+
+  /** Thread-safe; fails the send in progress, if any, and later ones. */
+  virtual void interruptSends() = 0;
+  /** Not while a send is in progress. */
+  virtual void resetSends() = 0;
+
+  Stats getStats() const;
+  void resetStats();
+
+protected:
+  /** send() without the bookkeeping; returns 0 or a libusb_error code. */
+  virtual int write(const unsigned char* header, size_t headerLen,
+    const unsigned char* payload, size_t payloadLen,
+    unsigned int timeoutMs) = 0;
+
+private:
+  mutable std::mutex _statsMutex;
+  Stats _stats;
+  std::chrono::steady_clock::time_point _firstFrameTime;
+};
@@ -1,23 +1,20 @@
 #include "CardboardTetheringPrivatePCH.h"
 #include "UsbDevice.h"
-#include "EndianUtils.h"
-#include "WindowsHelpers.h"
+#include "UsbTransport.h"
 #include <cstring>
 #include <algorithm>
 #include <iterator>
+#include <chrono>
 
 #include "AllowWindowsPlatformTypes.h"
 #include "libusb.h"
-#include "turbojpeg.h"
 #include "libwdi.h"
 #include "HideWindowsPlatformTypes.h"
 
 #define CHECKSTATUS(status) if (status) return status;
 
-using WindowsHelpers::ComPtr;
-
 int UsbDevice::create(
-  TSharedPtr<UsbDevice>* out,
+  TSharedPtr<UsbDevice, ESPMode::ThreadSafe>* out,
   TSharedPtr<LibraryInitParams>& initParams,
   uint16_t vid, uint16_t pid
 ) {
@@ -25,9 +22,29 @@ int UsbDevice::create(
 }
 
 int UsbDevice::create(
-  TSharedPtr<UsbDevice>* out,
+  TSharedPtr<UsbDevice, ESPMode::ThreadSafe>* out,
   TSharedPtr<LibraryInitParams>& initParams,
   std::vector<UsbDeviceId> ids
+) {
+  libusb_device_handle* handle;
+  UsbDeviceDesc desc(UsbDeviceId(), "", "");
+  uint8_t inEndpoint, outEndpoint;
+  int status = openDevice(initParams, ids, &handle, &desc, &inEndpoint, &outEndpoint);
+  CHECKSTATUS(status);
+
+  // Populate device.
+  *out = TSharedPtr<UsbDevice, ESPMode::ThreadSafe>(new UsbDevice(initParams, desc,
+    handle, inEndpoint, outEndpoint));
+  return STATUS_OK;
+}
+
+int UsbDevice::openDevice(
+  TSharedPtr<LibraryInitParams>& initParams,
+  const std::vector<UsbDeviceId>& ids,
+  libusb_device_handle** handle,
+  UsbDeviceDesc* deviceDesc,
+  uint8_t* inEndpoint,
+  uint8_t* outEndpoint
 ) {
   int status;
 
@@ -115,10 +132,10 @@ int UsbDevice::create(
     return STATUS_INTERFACE_CLAIM_ERROR;
   }
 
-  // Populate device.
-  *out = TSharedPtr<UsbDevice>(new UsbDevice(initParams,
-    UsbDeviceDesc(outId, outManufacturer, outProduct),
-    outHandle, outInputEndpoint, outOutputEndpoint));
+  *handle = outHandle;
+  *deviceDesc = UsbDeviceDesc(outId, outManufacturer, outProduct);
+  *inEndpoint = outInputEndpoint;
+  *outEndpoint = outOutputEndpoint;
   return STATUS_OK;
 }
 
@@ -237,57 +254,60 @@ UsbDevice::UsbDevice(TSharedPtr<LibraryInitParams>& initParams,
     _desc(desc),
     _hnd(handle),
     _inEndpoint(inEndpoint),
-    _outEndpoint(outEndpoint),
-    _receiveWorker(nullptr),
-    _sendWorker(nullptr),
-    _handshake(false),
-    _sendReady(false),
-    _rgbImageBuffer(new unsigned char[RGB_IMAGE_SIZE]),
-    _jpegBuffer(nullptr) {}
+    _outEndpoint(outEndpoint) {
+  attachTransport();
+}
 
 UsbDevice::~UsbDevice() {
-  bool receiving = _receiveWorker && !_receiveWorker->isCancelled();
-  bool sending = _sendWorker && !_sendWorker->isCancelled();
-  bool needDelay = false;
-
-  if (receiving) {
-    _receiveWorker->cancel();
-    needDelay = true;
+  // The loops must be gone before their handle is.
+  stopWorkers();
+  setTransport(nullptr);
+
+  // A failed reopen() leaves no handle.
+  if (_hnd != nullptr) {
+    libusb_release_interface(_hnd, 0);
+    libusb_close(_hnd);
   }
+}
 
-  if (sending) {
-    _sendWorker->cancel();
-    _sendCv.notify_one(); // Wake up the send loop so it can cancel.
-    needDelay = true;
+void UsbDevice::attachTransport() {
+  if (_hnd == nullptr || _inEndpoint == 0 || _outEndpoint == 0) {
+    setTransport(nullptr);
+    return;
   }
+  setTransport(std::make_shared<UsbTransport>(_initParams->UsbEvents.get(),
+    _hnd,
+    _inEndpoint,
+    _outEndpoint,
+    SEND_QUEUE_DEPTH,
+    BUFFER_LEN));
+}
 
-  if (needDelay) {
-    // Wait 2s since our send/receive loops check every 500ms for cancel flag.
-    std::this_thread::sleep_for(std::chrono::seconds(2));
-  }
+int UsbDevice::reopen() {
+  // The old loops must be gone before their handle is.
+  suspend();
+  setTransport(nullptr);
 
-  delete[] _rgbImageBuffer;
-  if (_jpegBuffer != nullptr) {
-    tjFree(_jpegBuffer);
+  if (_hnd != nullptr) {
+    libusb_release_interface(_hnd, 0);
+    libusb_close(_hnd);
+    _hnd = nullptr;
   }
 
-  libusb_release_interface(_hnd, 0);
-  libusb_close(_hnd);
-}
+  libusb_device_handle* handle;
+  UsbDeviceDesc desc(UsbDeviceId(), "", "");
+  uint8_t inEndpoint, outEndpoint;
+  int status = openDevice(_initParams, UsbDeviceId::getAoapIds(), &handle,
+    &desc, &inEndpoint, &outEndpoint);
+  CHECKSTATUS(status);
 
-void UsbDevice::flushInputBuffer(unsigned char* buf) {
-  if (_inEndpoint != 0) {
-    int status = 0;
-    int read;
-    while (status == 0) {
-      status = libusb_bulk_transfer(_hnd,
-        _inEndpoint,
-        buf,
-        BUFFER_LEN,
-        &read,
-        10);
-    }
-  }
+  _hnd = handle;
+  _desc = desc;
+  _inEndpoint = inEndpoint;
+  _outEndpoint = outEndpoint;
+  attachTransport();
+  std::cout << "Reopened " << getDescription() << std::endl;
+  return STATUS_OK;
 }
 
 std::string UsbDevice::getDescription() {
@@ -390,355 +410,3 @@ int UsbDevice::convertToAccessory() {
 
   return STATUS_OK;
 }
-
-#define HANDSHAKE_ASSERT(idx, expect, receive) if (expect != receive) { \
-  std::cout << "Handshake[" << idx << \
-  "] expect=" << (int) expect << ", receive=" << (int) receive << std::endl; \
-  success = false; \
-  goto error; \
-}
-
-bool UsbDevice::waitHandshakeAsync(std::function<void(bool)> callback) {
-  if (_inEndpoint == 0) {
-    return false;
-  }
-
-  if (_handshake.load()) {
-    std::cout << "Handshake previously completed!" << std::endl;
-    return false;
-  }
-
-  _receiveWorker = std::make_shared<InterruptibleThread>(
-    [=](const InterruptibleThread::SharedAtomicBool cancel) {
-      unsigned char* inputBuffer = new unsigned char[BUFFER_LEN];
-      flushInputBuffer(inputBuffer);
-
-      int i = 0;
-      int read = 0;
-      int status = LIBUSB_ERROR_TIMEOUT;
-      bool cancelled;
-      while (true) {
-        cancelled = cancel->load();
-        if (cancelled || status != LIBUSB_ERROR_TIMEOUT) {
-          break;
-        }
-
-        std::cout << i++ << " Waiting..." << std::endl;
-        status = libusb_bulk_transfer(_hnd,
-            _inEndpoint,
-            inputBuffer,
-            BUFFER_LEN,
-            &read,
-            500);
-      }
-
-      if (cancelled) {
-        std::cout << "Handshake cancelled!" << std::endl;
-      } else {
-        bool success = true;
-        if (read == BUFFER_LEN) {
-          HANDSHAKE_ASSERT(0, TAG_HEADER, inputBuffer[0]);
-
-          // Start populating params.
-          {
-            std::unique_lock<std::mutex> lock(_paramsMutex);
-            float floatData;
-            int32_t intData;
-
-            HANDSHAKE_ASSERT(1, TAG_WIDTH, inputBuffer[1]);
-            std::memcpy(&intData, &inputBuffer[2], sizeof(int32_t));
-            _width = EndianUtils::bigToNative(intData);
-
-            HANDSHAKE_ASSERT(6, TAG_HEIGHT, inputBuffer[6]);
-            std::memcpy(&intData, &inputBuffer[7], sizeof(int32_t));
-            _height = EndianUtils::bigToNative(intData);
-
-            HANDSHAKE_ASSERT(11, TAG_INTERPUPILLARY, inputBuffer[11]);
-            std::memcpy(&floatData, &inputBuffer[12], sizeof(float));
-            _interpupillary = EndianUtils::bigToNativeFloat(floatData);
-          }
-
-          for (int i = 16; i < BUFFER_LEN; ++i) {
-            HANDSHAKE_ASSERT(i, TAG_FILL, inputBuffer[i]);
-          }
-        } else {
-          std::cout << "Handshake read=" << read << std::endl;
-          success = false;
-        }
-
-error:
-        std::cout << "Received handshake, status=" << status << std::endl;
-
-        _handshake.store(success);
-        callback(success);
-      }
-
-      delete[] inputBuffer;
-      cancel->store(true);
-    }
-  );
-
-  return true;
-}
-
-bool UsbDevice::isHandshakeComplete() {
-  return _handshake.load();
-}
-
-bool UsbDevice::beginReadLoop(
-    std::function<void(const unsigned char*, int)> callback,
-    size_t readFrame) {
-  if (_inEndpoint == 0) {
-    return false;
-  }
-
-  if (!_handshake.load()) {
-    return false;
-  }
-
-  _receiveWorker = std::make_shared<InterruptibleThread>(
-    [=](const InterruptibleThread::SharedAtomicBool cancel) {
-      unsigned char* inputBuffer = new unsigned char[readFrame];
-      int read = 0;
-      int status = LIBUSB_ERROR_TIMEOUT;
-      bool cancelled;
-      while (true) {
-        cancelled = cancel->load();
-        if (cancelled || (status != 0 && status != LIBUSB_ERROR_TIMEOUT)) {
-          break;
-        }
-
-        status = libusb_bulk_transfer(_hnd,
-            _inEndpoint,
-            inputBuffer,
-            readFrame,
-            &read,
-            500);
-        if (status == 0) {
-          callback(inputBuffer, STATUS_OK);
-        }
-      }
-      delete[] inputBuffer;
-
-      if (!cancelled) {
-        // Error if loop ended but not cancelled.
-        std::cout << "Status in beginReadLoop=" << status << std::endl;
-
-        // Reset handshake.
-        _handshake.store(false);
-
-        callback(nullptr, STATUS_LIBUSB_ERROR + status);
-      }
-
-      std::cout << "Read loop ended" << std::endl;
-      cancel->store(true);
-    }
-  );
-
-  return true;
-}
-
-bool UsbDevice::beginSendLoop(std::function<void(int)> failureCallback) {
-  if (_outEndpoint == 0) {
-    return false;
-  }
-
-  if (!_handshake.load()) {
-    return false;
-  }
-
-  // Reset in case there was a previous send loop.
-  _sendReady = false;
-
-  _sendWorker = std::make_shared<InterruptibleThread>(
-    [=](const InterruptibleThread::SharedAtomicBool cancel) {
-      // TODO: add code for retrying when connection is flaky.
-      while (true) {
-        int error = STATUS_OK;
-
-        {
-          std::unique_lock<std::mutex> lock(_sendMutex);
-          _sendCv.wait(lock, [&] {
-            return _sendReady || cancel->load();
-          });
-
-          if (cancel->load()) {
-            int written = 0;
-
-            // Write 0 buffer size.
-            uint32_t bytes = 0;
-            libusb_bulk_transfer(_hnd,
-              _outEndpoint,
-              reinterpret_cast<unsigned char*>(&bytes),
-              4,
-              &written,
-              500);
-
-            // Ignore if written or not.
-            break;
-          } else {
-            unsigned long jpegBufferSizeUlong;
-            int jpegStatus = tjCompress2(_initParams->TurboJpegCompressor,
-              _rgbImageBuffer,
-              _jpegBufferWidth,
-              _jpegBufferWidthPitch,
-              _jpegBufferHeight,
-              TJPF_BGRX,
-              &_jpegBuffer,
-              &jpegBufferSizeUlong,
-              TJSAMP_420,
-              50 /* quality 1 to 100 */,
-              0);
-            if (jpegStatus != 0) {
-              error = STATUS_JPEG_ERROR + jpegStatus;
-            } else {
-              _jpegBufferSize = jpegBufferSizeUlong;
-              int written = 0;
-
-              // Write size of JPEG (32-bit int).
-              uint32_t header = EndianUtils::nativeToBig(
-                (uint32_t)_jpegBufferSize);
-
-              int status = libusb_bulk_transfer(_hnd,
-                _outEndpoint,
-                reinterpret_cast<unsigned char*>(&header),
-                sizeof(header),
-                &written,
-                500);
-              if (written < sizeof(header)) {
-                error = STATUS_LIBUSB_ERROR + status;
-              } else {
-                // Write JPEG in BUFFER_LEN chunks.
-                for (int i = 0; i < _jpegBufferSize; i += BUFFER_LEN) {
-                  written = 0;
-
-                  int chunk = std::min(BUFFER_LEN, _jpegBufferSize - i);
-                  int status = libusb_bulk_transfer(_hnd,
-                    _outEndpoint,
-                    _jpegBuffer + i,
-                    chunk,
-                    &written,
-                    500);
-
-                  if (written < chunk) {
-                    error = STATUS_LIBUSB_ERROR + status;
-                    break;
-                  }
-                }
-              }
-            }
-          }
-        }
-
-        if (error) {
-          // Reset handshake.
-          _handshake.store(false);
-
-          // Only signal on a send error.
-          failureCallback(error);
-          break;
-        } else {
-          // Only reset send flag if successful.
-          _sendReady = false;
-        }
-      }
-
-      std::cout << "Send loop ended" << std::endl;
-      cancel->store(true);
-    }
-  );
-
-  return true;
-}
-
-bool UsbDevice::isSending() {
-  return _sendWorker && !_sendWorker->isCancelled();
-}
-
-bool UsbDevice::supportsRasterFormat(DXGI_FORMAT format) {
-  switch (format) {
-    case DXGI_FORMAT_B8G8R8A8_TYPELESS:
-    case DXGI_FORMAT_B8G8R8X8_TYPELESS:
-      return true;
-    default:
-      return false;
-  }
-}
-
-bool UsbDevice::sendImage(ID3D11Texture2D* source) {
-  // If the send loop is busy, then skip this frame.
-  if (_sendMutex.try_lock()) {
-    std::lock_guard<std::mutex> lock(_sendMutex, std::adopt_lock);
-    if (!_sendReady) {
-      ComPtr<ID3D11Device> device;
-      source->GetDevice(&device);
-
-      ComPtr<ID3D11DeviceContext> context;
-      device->GetImmediateContext(&context);
-
-      D3D11_TEXTURE2D_DESC desc;
-      source->GetDesc(&desc);
-
-      if (desc.Width == 0 || desc.Height == 0) {
-        return false;
-      }
-
-      // We can only deal with BGRA/BGRX 32-bit formats.
-      switch (desc.Format) {
-        case DXGI_FORMAT_B8G8R8A8_TYPELESS:
-        case DXGI_FORMAT_B8G8R8X8_TYPELESS:
-        case DXGI_FORMAT_B8G8R8A8_UNORM:
-        case DXGI_FORMAT_B8G8R8X8_UNORM:
-        case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
-        case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
-          break;
-        default:
-          return false;
-      }
-
-      desc.BindFlags = 0;
-      desc.MiscFlags = 0;
-      desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-      desc.Usage = D3D11_USAGE_STAGING;
-
-      ComPtr<ID3D11Texture2D> staging;
-      device->CreateTexture2D(&desc, nullptr, &staging);
-      context->CopyResource(staging.Get(), source);
-
-      D3D11_MAPPED_SUBRESOURCE mapped;
-      HRESULT hr = context->Map(staging.Get(), 0, D3D11_MAP_READ, 0, &mapped);
-
-      if (SUCCEEDED(hr)) {
-        int sizeNeeded = mapped.RowPitch * desc.Height;
-        if (sizeNeeded > RGB_IMAGE_SIZE) {
-          // Can't store image size, not enough pre-allocated memory.
-          context->Unmap(staging.Get(), 0);
-          return false;
-        }
-
-        memcpy_s(_rgbImageBuffer, RGB_IMAGE_SIZE, mapped.pData, sizeNeeded);
-        context->Unmap(staging.Get(), 0);
-
-        // Delay JPEG creation until send loop to improve Maya performance.
-        _jpegBufferWidth = desc.Width;
-        _jpegBufferWidthPitch = mapped.RowPitch;
-        _jpegBufferHeight = desc.Height;
-
-        // Dispatch send loop.
-        _sendReady = true;
-        _sendCv.notify_one();
-
-        return true;
-      }
-    }
-  }
-
-  return false;
-}
-
-void UsbDevice::getViewerParams(int32_t* width, int32_t* height, float* interpupillary) {
-  std::unique_lock<std::mutex> lock(_paramsMutex);
-  *width = _width;
-  *height = _height;
-  *interpupillary = _interpupillary;
-}
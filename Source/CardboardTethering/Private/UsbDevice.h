@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <memory>
 #include <atomic>
 #include <thread>
 #include <mutex>
@@ -12,38 +13,11 @@
 #include <iostream>
 #include <iomanip>
 #include "LibraryInitParams.h"
-
-#include "AllowWindowsPlatformTypes.h"
-#define NOMINMAX
-#include <d3d11.h>
-#include "HideWindowsPlatformTypes.h"
+#include "StreamSession.h"
 
 struct libusb_device_handle;
 struct wdi_device_info;
 
-class InterruptibleThread {
-public:
-  using SharedAtomicBool = std::shared_ptr<std::atomic_bool>;
-
-  InterruptibleThread(std::function<void(const SharedAtomicBool)> func) {
-    _cancel = std::make_shared<std::atomic_bool>(false);
-    std::thread thread([=]() {
-      func(_cancel);
-    });
-    thread.detach();
-  }
-
-  ~InterruptibleThread() {
-    cancel();
-  }
-
-  void cancel() { _cancel->store(true); }
-  bool isCancelled() { return _cancel->load(); }
-
-private:
-  SharedAtomicBool _cancel;
-};
-
 struct UsbDeviceId {
   // From <https://developer.android.com/studio/run/device.html#VendorIds>.
   static constexpr uint16_t ANDROID_DEVICE_VIDS[] = {
@@ -149,9 +123,8 @@ struct UsbDeviceDesc {
   }
 };
 
-class UsbDevice {
-  static constexpr size_t RGB_IMAGE_SIZE = 2048 * 2048 * 16; // about 64 MB
-  static constexpr size_t BUFFER_LEN     = 16384;
+class UsbDevice : public StreamSession {
+  static constexpr size_t SEND_QUEUE_DEPTH = 4;
 
   TSharedPtr<LibraryInitParams> _initParams;
 
@@ -161,32 +134,19 @@ class UsbDevice {
   uint8_t _inEndpoint;
   uint8_t _outEndpoint;
 
-  std::atomic_bool _handshake;
-
-  std::shared_ptr<InterruptibleThread> _receiveWorker;
-
-  std::shared_ptr<InterruptibleThread> _sendWorker;
-  bool _sendReady; /* Note: doesn't have to be atomic because we lock. */
-  std::mutex _sendMutex;
-  std::condition_variable _sendCv;
-
-  unsigned char* _rgbImageBuffer;
-  unsigned char* _jpegBuffer;
-  size_t _jpegBufferSize;
-  size_t _jpegBufferWidth;
-  size_t _jpegBufferWidthPitch;
-  size_t _jpegBufferHeight;
-
-  std::mutex _paramsMutex;
-  int32_t _width;
-  int32_t _height;
-  float _interpupillary;
-
   int getControlInt16(int16_t* out, uint8_t request);
   int sendControl(uint8_t request);
   int sendControlString(uint8_t request, uint16_t index, std::string str);
 
-  void flushInputBuffer(unsigned char* buf);
+  /** Hands the endpoints to the session, if the accessory has both. */
+  void attachTransport();
+
+  static int openDevice(TSharedPtr<LibraryInitParams>& initParams,
+    const std::vector<UsbDeviceId>& ids,
+    libusb_device_handle** handle,
+    UsbDeviceDesc* deviceDesc,
+    uint8_t* inEndpoint,
+    uint8_t* outEndpoint);
 
   UsbDevice(TSharedPtr<LibraryInitParams>& initParams,
     UsbDeviceDesc desc,
@@ -199,42 +159,23 @@ class UsbDevice {
     TSharedPtr<LibraryInitParams>& initParams);
 
 public:
-  static constexpr int STATUS_OK = 0;
-  static constexpr int STATUS_NOT_FOUND_ERROR = -1;
-  static constexpr int STATUS_DEVICE_DESCRIPTOR_ERROR = -2;
-  static constexpr int STATUS_CONFIG_DESCRIPTOR_ERROR = -3;
-  static constexpr int STATUS_DESCRIPTOR_READ_ERROR = -4;
-  static constexpr int STATUS_INTERFACE_CLAIM_ERROR = -5;
-  static constexpr int STATUS_RECEIVE_ERROR = -6;
-  static constexpr int STATUS_SEND_ERROR = -7;
-  static constexpr int STATUS_BAD_PROTOCOL_VERSION = -8;
-  static constexpr int STATUS_LIBUSB_ERROR = -1000;
-  static constexpr int STATUS_JPEG_ERROR = -2000;
-
-  static constexpr unsigned char TAG_HEADER = 0x27;
-  static constexpr unsigned char TAG_WIDTH = 0x28;
-  static constexpr unsigned char TAG_HEIGHT = 0x29;
-  static constexpr unsigned char TAG_INTERPUPILLARY = 0x2A;
-  static constexpr unsigned char TAG_FILL = 0x30;
-
-  static int create(TSharedPtr<UsbDevice>* out,
+  static int create(TSharedPtr<UsbDevice, ESPMode::ThreadSafe>* out,
     TSharedPtr<LibraryInitParams>& initParams,
     uint16_t vid, uint16_t pid);
-  static int create(TSharedPtr<UsbDevice>* out,
+  static int create(TSharedPtr<UsbDevice, ESPMode::ThreadSafe>* out,
     TSharedPtr<LibraryInitParams>& initParams,
     std::vector<UsbDeviceId> ids = UsbDeviceId::getAoapIds());
   static std::vector<UsbDeviceDesc> getInstallableDeviceDescriptions(
     TSharedPtr<LibraryInitParams>& initParams);
+  /** Stops and joins the loops; a loop's own callback may drop the device. */
   ~UsbDevice();
   std::string getDescription();
   int convertToAccessory();
-  bool waitHandshakeAsync(std::function<void(bool)> callback);
-  bool isHandshakeComplete();
-  bool beginReadLoop(std::function<void(const unsigned char*, int)> callback,
-      size_t readFrame);
-  bool beginSendLoop(std::function<void(int)> failureCallback);
-  bool isSending();
-  bool sendImage(ID3D11Texture2D* source);
-  void getViewerParams(int32_t* width, int32_t* height, float* interpupillary);
-  static bool supportsRasterFormat(DXGI_FORMAT format);
+
+  /**
+   * Stops the loops and claims the accessory again, after the link failed;
+   * the handle is gone if this fails. Keeps everything negotiated. No other
+   * thread may use the device meanwhile.
+   */
+  int reopen();
 };
@@ -0,0 +1,70 @@
+#include "UsbEventThread.h"
+#include "FramePipeline.h"
+#include <algorithm>
+
+#ifdef _WIN32
+#include "AllowWindowsPlatformTypes.h"
+#endif
+#include "libusb.h"
+#ifdef _WIN32
+#include "HideWindowsPlatformTypes.h"
+#endif
+
+double UsbEventThread::Stats::wakeupsPerSecond() const {
+  if (wallMs <= 0.0) {
+    return 0.0;
+  }
+  return wakeups / (wallMs / 1000.0);
+}
+
+UsbEventThread::UsbEventThread(libusb_context* ctx) : _ctx(ctx) {
+  resetStats();
+  _thread.reset(new WorkerThread("USB events",
+    [this](const WorkerThread::SharedAtomicBool cancel) {
+      while (!cancel->load()) {
+        timeval tv;
+        tv.tv_sec = IDLE_TIMEOUT_MS / 1000;
+        tv.tv_usec = (IDLE_TIMEOUT_MS % 1000) * 1000;
+        libusb_handle_events_timeout_completed(_ctx, &tv, nullptr);
+        wokeUp();
+      }
+    }));
+}
+
+UsbEventThread::~UsbEventThread() {
+  // Explicitly, while the stats it updates are still there.
+  _thread.reset();
+}
+
+void UsbEventThread::wokeUp() {
+  std::lock_guard<std::mutex> lock(_statsMutex);
+  _wakeups++;
+}
+
+void UsbEventThread::completed(int64_t submittedNs) {
+  int64_t latencyNs = std::max<int64_t>(steadyClockNs() - submittedNs, 0);
+  std::lock_guard<std::mutex> lock(_statsMutex);
+  _completions++;
+  _totalLatencyNs += latencyNs;
+  _maxLatencyNs = std::max(_maxLatencyNs, latencyNs);
+}
+
+UsbEventThread::Stats UsbEventThread::getStats() const {
+  std::lock_guard<std::mutex> lock(_statsMutex);
+  Stats stats;
+  stats.wakeups = _wakeups;
+  stats.completions = _completions;
+  stats.averageLatencyMs = _completions > 0 ? _totalLatencyNs / 1e6 / _completions : 0.0;
+  stats.maxLatencyMs = _maxLatencyNs / 1e6;
+  stats.wallMs = (steadyClockNs() - _startNs) / 1e6;
+  return stats;
+}
+
+void UsbEventThread::resetStats() {
+  std::lock_guard<std::mutex> lock(_statsMutex);
+  _wakeups = 0;
+  _completions = 0;
+  _totalLatencyNs = 0;
+  _maxLatencyNs = 0;
+  _startNs = steadyClockNs();
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include "WorkerThread.h"
+
+struct libusb_context;
+
+/**
+ * Handles libusb events for one context on a thread of its own, so that
+ * asynchronous transfers complete, and their callbacks run, without the
+ * thread that submitted them pumping events. UsbSendQueue and UsbReader
+ * submit transfers and sleep until their callback, run here, wakes them.
+ *
+ * libusb wakes the thread for each batch of completions and at the next
+ * transfer timeout, and otherwise every IDLE_TIMEOUT_MS to check whether
+ * it should stop (the libusb in use can't interrupt a handler), so
+ * stopping can take that long.
+ */
+class UsbEventThread {
+public:
+  static constexpr int IDLE_TIMEOUT_MS = 500;
+
+  struct Stats {
+    uint64_t wakeups;        /* Returns from libusb event handling. */
+    uint64_t completions;    /* Transfer callbacks run. */
+    double averageLatencyMs; /* Submission to callback. */
+    double maxLatencyMs;
+    double wallMs;           /* Since the thread started or the stats were reset. */
+
+    double wakeupsPerSecond() const;
+  };
+
+  explicit UsbEventThread(libusb_context* ctx);
+  ~UsbEventThread();
+
+  UsbEventThread(const UsbEventThread&) = delete;
+  UsbEventThread& operator=(const UsbEventThread&) = delete;
+
+  libusb_context* context() const { return _ctx; }
+
+  /**
+   * Called from a transfer callback: one transfer, submitted at
+   * submittedNs (steadyClockNs()), has completed.
+   */
+  void completed(int64_t submittedNs);
+
+  Stats getStats() const;
+  void resetStats();
+
+private:
+  libusb_context* _ctx;
+
+  mutable std::mutex _statsMutex;
+  uint64_t _wakeups;
+  uint64_t _completions;
+  int64_t _totalLatencyNs;
+  int64_t _maxLatencyNs;
+  int64_t _startNs;
+
+  std::unique_ptr<WorkerThread> _thread; /* Last, so it stops first. */
+
+  void wokeUp();
+};
@@ -0,0 +1,86 @@
+#include "UsbReader.h"
+#include "UsbSendQueue.h"
+#include "UsbEventThread.h"
+#include "FramePipeline.h"
+
+#ifdef _WIN32
+#include "AllowWindowsPlatformTypes.h"
+#endif
+#include "libusb.h"
+#ifdef _WIN32
+#include "HideWindowsPlatformTypes.h"
+#endif
+
+struct UsbReaderCallbacks {
+  static void LIBUSB_CALL transferComplete(libusb_transfer* transfer) {
+    static_cast<UsbReader*>(transfer->user_data)->onTransferComplete();
+  }
+};
+
+UsbReader::UsbReader(UsbEventThread* events,
+  libusb_device_handle* handle,
+  uint8_t endpoint
+) : _events(events),
+    _hnd(handle),
+    _endpoint(endpoint),
+    _transfer(libusb_alloc_transfer(0)),
+    _busy(false),
+    _cancelled(false),
+    _submittedNs(0) {}
+
+UsbReader::~UsbReader() {
+  // read never returns with its transfer in flight.
+  libusb_free_transfer(_transfer);
+}
+
+int UsbReader::read(unsigned char* data, int length, int* transferred,
+    unsigned int timeoutMs) {
+  *transferred = 0;
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (_cancelled) {
+    return LIBUSB_ERROR_INTERRUPTED;
+  }
+
+  libusb_fill_bulk_transfer(_transfer,
+    _hnd,
+    _endpoint,
+    data,
+    length,
+    &UsbReaderCallbacks::transferComplete,
+    this,
+    timeoutMs);
+  _submittedNs = steadyClockNs();
+  int status = libusb_submit_transfer(_transfer);
+  if (status < 0) {
+    return status;
+  }
+  _busy = true;
+
+  _completionCv.wait(lock, [&] { return !_busy; });
+
+  // Whatever arrived before a timeout or cancel counts, as it does for
+  // libusb_bulk_transfer.
+  *transferred = _transfer->actual_length;
+  return UsbSendQueue::transferError(_transfer->status);
+}
+
+void UsbReader::cancel() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _cancelled = true;
+  if (_busy) {
+    // Completes through the normal callback, with LIBUSB_TRANSFER_CANCELLED.
+    libusb_cancel_transfer(_transfer);
+  }
+}
+
+void UsbReader::reset() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _cancelled = false;
+}
+
+void UsbReader::onTransferComplete() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _busy = false;
+  _events->completed(_submittedNs);
+  _completionCv.notify_all();
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+
+class UsbEventThread;
+struct libusb_device_handle;
+struct libusb_transfer;
+
+/**
+ * Reads a bulk IN endpoint through libusb's asynchronous transfer API, one
+ * transfer at a time, sleeping until the UsbEventThread completes it. Unlike libusb_bulk_transfer, a read blocked waiting
+ * for the phone can be cut short from another thread: cancel() cancels the
+ * transfer in flight, and that read and every later one fail with
+ * LIBUSB_ERROR_INTERRUPTED until reset().
+ */
+class UsbReader {
+public:
+  UsbReader(UsbEventThread* events, libusb_device_handle* handle, uint8_t endpoint);
+  ~UsbReader();
+
+  UsbReader(const UsbReader&) = delete;
+  UsbReader& operator=(const UsbReader&) = delete;
+
+  /** Like libusb_bulk_transfer; not reentrant. */
+  int read(unsigned char* data, int length, int* transferred,
+    unsigned int timeoutMs);
+
+  /** Thread-safe; fails reads until reset(). */
+  void cancel();
+  /** Not while a read is in progress. */
+  void reset();
+
+private:
+  UsbEventThread* _events;
+  libusb_device_handle* _hnd;
+  uint8_t _endpoint;
+  libusb_transfer* _transfer;
+
+  // Touched from the event thread.
+  std::mutex _mutex;
+  std::condition_variable _completionCv;
+  bool _busy;
+  bool _cancelled;
+  int64_t _submittedNs;
+
+  void onTransferComplete();
+
+  friend struct UsbReaderCallbacks;
+};
@@ -0,0 +1,209 @@
+#include "UsbSendQueue.h"
+#include "UsbEventThread.h"
+#include "FramePipeline.h"
+#include <algorithm>
+#include <chrono>
+
+#ifdef _WIN32
+#include "AllowWindowsPlatformTypes.h"
+#endif
+#include "libusb.h"
+#ifdef _WIN32
+#include "HideWindowsPlatformTypes.h"
+#endif
+
+struct UsbSendQueueCallbacks {
+  static void LIBUSB_CALL transferComplete(libusb_transfer* transfer) {
+    UsbSendQueue::Slot* slot = static_cast<UsbSendQueue::Slot*>(transfer->user_data);
+    slot->owner->onTransferComplete(slot);
+  }
+};
+
+int UsbSendQueue::transferError(int status) {
+  switch (status) {
+    case LIBUSB_TRANSFER_COMPLETED:
+      return LIBUSB_SUCCESS;
+    case LIBUSB_TRANSFER_TIMED_OUT:
+      return LIBUSB_ERROR_TIMEOUT;
+    case LIBUSB_TRANSFER_STALL:
+      return LIBUSB_ERROR_PIPE;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+      return LIBUSB_ERROR_NO_DEVICE;
+    case LIBUSB_TRANSFER_OVERFLOW:
+      return LIBUSB_ERROR_OVERFLOW;
+    case LIBUSB_TRANSFER_CANCELLED:
+      return LIBUSB_ERROR_INTERRUPTED;
+    default:
+      return LIBUSB_ERROR_IO;
+  }
+}
+
+UsbSendQueue::UsbSendQueue(UsbEventThread* events,
+  libusb_device_handle* handle,
+  uint8_t endpoint,
+  size_t maxInFlight,
+  size_t chunkLen
+) : _events(events),
+    _hnd(handle),
+    _endpoint(endpoint),
+    _chunkLen(std::max<size_t>(chunkLen, 1)),
+    _inFlight(0),
+    _completed(0),
+    _firstError(LIBUSB_SUCCESS),
+    _sending(false),
+    _interrupted(false) {
+  _slots.resize(std::max<size_t>(maxInFlight, 1));
+  for (Slot& slot : _slots) {
+    slot.owner = this;
+    slot.transfer = libusb_alloc_transfer(0);
+    slot.busy = false;
+    slot.submittedNs = 0;
+  }
+}
+
+UsbSendQueue::~UsbSendQueue() {
+  // sendFrame never returns with transfers in flight, so all are idle here.
+  for (Slot& slot : _slots) {
+    libusb_free_transfer(slot.transfer);
+  }
+}
+
+UsbSendQueue::FrameResult UsbSendQueue::sendFrame(
+    const unsigned char* header, size_t headerLen,
+    const unsigned char* payload, size_t payloadLen,
+    unsigned int timeoutMs) {
+  auto startTime = std::chrono::steady_clock::now();
+
+  // Header and payload go into one queue so that the payload's first chunk is
+  // already submitted while the header is still on the wire.
+  _chunks.clear();
+  if (headerLen > 0) {
+    _chunks.push_back({ header, static_cast<int>(headerLen) });
+  }
+  for (size_t i = 0; i < payloadLen; i += _chunkLen) {
+    size_t chunk = std::min(_chunkLen, payloadLen - i);
+    _chunks.push_back({ payload + i, static_cast<int>(chunk) });
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(_completionMutex);
+    _inFlight = 0;
+    _completed = 0;
+    _firstError = _interrupted ? LIBUSB_ERROR_INTERRUPTED : LIBUSB_SUCCESS;
+    _sending = true;
+  }
+
+  size_t next = 0;
+  FrameResult result;
+  {
+    std::unique_lock<std::mutex> lock(_completionMutex);
+    bool cancelled = false;
+    while (true) {
+      bool failed = _firstError != LIBUSB_SUCCESS;
+
+      // Top up the queue.
+      for (Slot& slot : _slots) {
+        if (failed || next >= _chunks.size()) {
+          break;
+        }
+        if (slot.busy) {
+          continue;
+        }
+
+        const Chunk& chunk = _chunks[next];
+        libusb_fill_bulk_transfer(slot.transfer,
+          _hnd,
+          _endpoint,
+          const_cast<unsigned char*>(chunk.data),
+          chunk.len,
+          &UsbSendQueueCallbacks::transferComplete,
+          &slot,
+          timeoutMs);
+
+        slot.submittedNs = steadyClockNs();
+        int status = libusb_submit_transfer(slot.transfer);
+        if (status < 0) {
+          _firstError = status;
+          failed = true;
+          break;
+        }
+
+        slot.busy = true;
+        ++_inFlight;
+        ++next;
+      }
+
+      if (_inFlight == 0 && (failed || next >= _chunks.size())) {
+        break;
+      }
+
+      if (failed && !cancelled) {
+        cancelInFlight();
+        cancelled = true;
+      }
+
+      // Sleep until the event thread reaps one of ours.
+      size_t completed = _completed;
+      _completionCv.wait(lock, [&] {
+        return _completed != completed || (!failed && _firstError != LIBUSB_SUCCESS);
+      });
+    }
+
+    result.status = _firstError;
+    _sending = false;
+  }
+  result.bytes = headerLen + payloadLen;
+  result.elapsedMs = std::chrono::duration<double, std::milli>(
+    std::chrono::steady_clock::now() - startTime).count();
+
+  return result;
+}
+
+void UsbSendQueue::onTransferComplete(Slot* slot) {
+  std::lock_guard<std::mutex> lock(_completionMutex);
+
+  libusb_transfer* transfer = slot->transfer;
+  int error = transferError(transfer->status);
+  if (error == LIBUSB_SUCCESS && transfer->actual_length < transfer->length) {
+    error = LIBUSB_ERROR_IO;
+  }
+  if (error != LIBUSB_SUCCESS && _firstError == LIBUSB_SUCCESS) {
+    _firstError = error;
+  }
+
+  slot->busy = false;
+  --_inFlight;
+  ++_completed;
+  _events->completed(slot->submittedNs);
+  _completionCv.notify_all();
+}
+
+void UsbSendQueue::cancelInFlight() {
+  for (Slot& slot : _slots) {
+    if (slot.busy) {
+      // The transfer still completes (with LIBUSB_TRANSFER_CANCELLED) through
+      // the normal callback, which is what releases the slot.
+      libusb_cancel_transfer(slot.transfer);
+    }
+  }
+}
+
+void UsbSendQueue::interrupt() {
+  std::lock_guard<std::mutex> lock(_completionMutex);
+  _interrupted = true;
+  if (!_sending) {
+    return;
+  }
+
+  // The sender stops topping up once it sees the error and waits for the
+  // cancelled transfers to be reaped, as after any other failure.
+  if (_firstError == LIBUSB_SUCCESS) {
+    _firstError = LIBUSB_ERROR_INTERRUPTED;
+  }
+  _completionCv.notify_all();
+}
+
+void UsbSendQueue::clearInterrupt() {
+  std::lock_guard<std::mutex> lock(_completionMutex);
+  _interrupted = false;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+class UsbEventThread;
+struct libusb_device_handle;
+struct libusb_transfer;
+
+/**
+ * Writes frames to a bulk OUT endpoint using libusb's asynchronous transfer
+ * API. Up to maxInFlight chunk transfers are kept submitted at once, so the
+ * bus never idles waiting for the previous chunk's round trip. Completions
+ * arrive on the UsbEventThread, which wakes the sender.
+ */
+class UsbSendQueue {
+public:
+  static constexpr size_t DEFAULT_IN_FLIGHT = 4;
+  static constexpr size_t DEFAULT_CHUNK_LEN = 16384;
+
+  struct FrameResult {
+    int status; /* 0 or a libusb_error code. */
+    size_t bytes;
+    double elapsedMs;
+  };
+
+  UsbSendQueue(UsbEventThread* events,
+    libusb_device_handle* handle,
+    uint8_t endpoint,
+    size_t maxInFlight = DEFAULT_IN_FLIGHT,
+    size_t chunkLen = DEFAULT_CHUNK_LEN);
+  ~UsbSendQueue();
+
+  UsbSendQueue(const UsbSendQueue&) = delete;
+  UsbSendQueue& operator=(const UsbSendQueue&) = delete;
+
+  /**
+   * Queues the header followed by the payload and blocks until every chunk
+   * has completed or failed. On failure, transfers still in flight are
+   * cancelled and reaped before returning.
+   */
+  FrameResult sendFrame(const unsigned char* header, size_t headerLen,
+    const unsigned char* payload, size_t payloadLen,
+    unsigned int timeoutMs);
+
+  /**
+   * Fails the frame being sent, if any, and every later one with
+   * LIBUSB_ERROR_INTERRUPTED until clearInterrupt(). Called from another
+   * thread to unblock a sender that is stopping.
+   */
+  void interrupt();
+  void clearInterrupt();
+
+  /** The libusb_error matching a libusb_transfer_status. */
+  static int transferError(int transferStatus);
+
+private:
+  struct Chunk {
+    const unsigned char* data;
+    int len;
+  };
+
+  struct Slot {
+    UsbSendQueue* owner;
+    libusb_transfer* transfer;
+    bool busy;
+    int64_t submittedNs;
+  };
+
+  UsbEventThread* _events;
+  libusb_device_handle* _hnd;
+  uint8_t _endpoint;
+  size_t _chunkLen;
+
+  std::vector<Slot> _slots;
+  std::vector<Chunk> _chunks;
+
+  // Completion state is touched from the event thread.
+  std::mutex _completionMutex;
+  std::condition_variable _completionCv;
+  size_t _inFlight;
+  size_t _completed;
+  int _firstError;
+  bool _sending;
+  bool _interrupted;
+
+  void onTransferComplete(Slot* slot);
+  void cancelInFlight(); /* With _completionMutex held. */
+
+  friend struct UsbSendQueueCallbacks;
+};
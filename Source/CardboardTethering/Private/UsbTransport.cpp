@@ -0,0 +1,38 @@
+#include "UsbTransport.h"
+
+UsbTransport::UsbTransport(UsbEventThread* events,
+  libusb_device_handle* handle,
+  uint8_t inEndpoint,
+  uint8_t outEndpoint,
+  size_t maxInFlight,
+  size_t chunkLen
+) : _reader(events, handle, inEndpoint),
+    _sendQueue(events, handle, outEndpoint, maxInFlight, chunkLen) {}
+
+int UsbTransport::read(unsigned char* data, int length, int* transferred,
+    unsigned int timeoutMs) {
+  return _reader.read(data, length, transferred, timeoutMs);
+}
+
+void UsbTransport::cancelReads() {
+  _reader.cancel();
+}
+
+void UsbTransport::resetReads() {
+  _reader.reset();
+}
+
+void UsbTransport::interruptSends() {
+  _sendQueue.interrupt();
+}
+
+void UsbTransport::resetSends() {
+  _sendQueue.clearInterrupt();
+}
+
+int UsbTransport::write(const unsigned char* header, size_t headerLen,
+    const unsigned char* payload, size_t payloadLen,
+    unsigned int timeoutMs) {
+  return _sendQueue.sendFrame(header, headerLen, payload, payloadLen,
+    timeoutMs).status;
+}
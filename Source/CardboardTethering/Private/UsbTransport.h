@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include "Transport.h"
+#include "UsbReader.h"
+#include "UsbSendQueue.h"
+
+class UsbEventThread;
+struct libusb_device_handle;
+
+/**
+ * A claimed accessory's bulk endpoints: reads go through a UsbReader and
+ * sends through a UsbSendQueue, both completed on the UsbEventThread. The
+ * handle must outlive it.
+ */
+class UsbTransport : public Transport {
+public:
+  UsbTransport(UsbEventThread* events,
+    libusb_device_handle* handle,
+    uint8_t inEndpoint,
+    uint8_t outEndpoint,
+    size_t maxInFlight = UsbSendQueue::DEFAULT_IN_FLIGHT,
+    size_t chunkLen = UsbSendQueue::DEFAULT_CHUNK_LEN);
+
+  virtual int read(unsigned char* data, int length, int* transferred,
+    unsigned int timeoutMs) override;
+  virtual void cancelReads() override;
+  virtual void resetReads() override;
+  virtual void interruptSends() override;
+  virtual void resetSends() override;
+
+protected:
+  virtual int write(const unsigned char* header, size_t headerLen,
+    const unsigned char* payload, size_t payloadLen,
+    unsigned int timeoutMs) override;
+
+private:
+  UsbReader _reader;
+  UsbSendQueue _sendQueue;
+};
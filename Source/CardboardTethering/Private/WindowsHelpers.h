@@ -1,5 +1,7 @@
 #pragma once
 
+#include <utility>
+
 namespace WindowsHelpers {
 
   /** This is a very light substitute for Microsoft::WRL::ComPtr. */
@@ -22,9 +24,23 @@ namespace WindowsHelpers {
 
   public:
     ComPtr() : _ptr(nullptr) {}
+    ComPtr(T* ptr) : _ptr(ptr) { InternalAddRef(); }
     ComPtr(ComPtr const & other) : _ptr(other._ptr) { InternalAddRef(); }
     ~ComPtr() { InternalRelease(); }
 
+    ComPtr& operator=(ComPtr const & other) {
+      if (_ptr != other._ptr) {
+        ComPtr temp(other);
+        std::swap(_ptr, temp._ptr);
+      }
+      return *this;
+    }
+
+    void Reset() {
+      InternalRelease();
+      _ptr = nullptr;
+    }
+
     T* operator->() const { return _ptr; }
     T** operator&() { return &_ptr; }
     T* Get() const { return _ptr; }
@@ -0,0 +1,77 @@
+#include "WorkerPool.h"
+#include <algorithm>
+
+WorkerPool::WorkerPool(size_t threads)
+  : _task(nullptr),
+    _count(0),
+    _next(0),
+    _finished(0),
+    _generation(0),
+    _stop(false) {
+  threads = std::max<size_t>(threads, 1);
+  for (size_t i = 0; i < threads; ++i) {
+    _threads.emplace_back([this, i]() {
+      workerLoop(i);
+    });
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _workCv.notify_all();
+
+  for (std::thread& thread : _threads) {
+    thread.join();
+  }
+}
+
+void WorkerPool::run(size_t count, const Task& task) {
+  if (count == 0) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  _task = &task;
+  _count = count;
+  _next = 0;
+  _finished = 0;
+  _generation++;
+  _workCv.notify_all();
+
+  _doneCv.wait(lock, [&] {
+    return _finished == _count;
+  });
+  _task = nullptr;
+}
+
+void WorkerPool::workerLoop(size_t worker) {
+  uint64_t seenGeneration = 0;
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  while (true) {
+    _workCv.wait(lock, [&] {
+      return _stop || (_generation != seenGeneration && _next < _count);
+    });
+    if (_stop) {
+      break;
+    }
+
+    // Drain as many tasks from this batch as we can get.
+    while (_next < _count) {
+      size_t index = _next++;
+      const Task* task = _task;
+
+      lock.unlock();
+      (*task)(index, worker);
+      lock.lock();
+
+      if (++_finished == _count) {
+        _doneCv.notify_one();
+      }
+    }
+    seenGeneration = _generation;
+  }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/**
+ * Fixed set of threads for data-parallel work. run() hands out task indices
+ * to the workers and blocks until every task has finished. The worker index
+ * passed to each task is stable for the lifetime of the pool, so callers can
+ * keep per-worker state (e.g. one TurboJPEG handle per thread).
+ */
+class WorkerPool {
+public:
+  using Task = std::function<void(size_t task, size_t worker)>;
+
+  explicit WorkerPool(size_t threads);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  size_t size() const { return _threads.size(); }
+
+  /** Runs task(0..count-1) across the pool; not reentrant. */
+  void run(size_t count, const Task& task);
+
+private:
+  std::vector<std::thread> _threads;
+
+  std::mutex _mutex;
+  std::condition_variable _workCv;
+  std::condition_variable _doneCv;
+  const Task* _task;
+  size_t _count;
+  size_t _next;
+  size_t _finished;
+  uint64_t _generation;
+  bool _stop;
+
+  void workerLoop(size_t worker);
+};
@@ -0,0 +1,47 @@
+#include "WorkerThread.h"
+#include <chrono>
+
+WorkerThread::WorkerThread(const char* name, Func func, std::function<void()> wake)
+  : _name(name),
+    _cancel(std::make_shared<std::atomic_bool>(false)),
+    _finished(std::make_shared<std::atomic_bool>(false)),
+    _wake(wake) {
+  // The thread only holds on to the shared flags, not to this, so it can
+  // outlive us when detached.
+  SharedAtomicBool cancel = _cancel;
+  SharedAtomicBool finished = _finished;
+  _thread = std::thread([=]() {
+    func(cancel);
+    finished->store(true);
+  });
+}
+
+WorkerThread::~WorkerThread() {
+  stop();
+}
+
+void WorkerThread::cancel() {
+  _cancel->store(true);
+  if (_wake) {
+    _wake();
+  }
+}
+
+double WorkerThread::stop() {
+  auto start = std::chrono::steady_clock::now();
+  cancel();
+
+  std::lock_guard<std::mutex> lock(_joinMutex);
+  if (!_thread.joinable()) {
+    return 0.0;
+  }
+  if (_thread.get_id() == std::this_thread::get_id()) {
+    _thread.detach();
+    return 0.0;
+  }
+
+  _thread.join();
+  double ms = std::chrono::duration<double, std::milli>(
+    std::chrono::steady_clock::now() - start).count();
+  return ms;
+}
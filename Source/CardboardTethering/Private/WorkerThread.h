@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <functional>
+
+/**
+ * A long-running loop on its own thread, owned by whoever creates it. The
+ * loop is handed a cancel flag to check; cancel() sets it and then calls
+ * wake, which should unblock whatever the loop may be waiting on (a
+ * FrameRing, a USB transfer) so that it notices promptly. stop() cancels
+ * and joins, and the destructor stops, so an owner that goes away never
+ * leaves its loop running against freed state.
+ *
+ * A loop may end up destroying its own owner, e.g. by reporting an error
+ * to a callback that drops the device. stop() from the loop's own thread
+ * detaches instead of joining; such a loop must not touch its owner after
+ * that callback returns.
+ */
+class WorkerThread {
+public:
+  using SharedAtomicBool = std::shared_ptr<std::atomic_bool>;
+  using Func = std::function<void(const SharedAtomicBool)>;
+
+  WorkerThread(const char* name, Func func, std::function<void()> wake = nullptr);
+  ~WorkerThread();
+
+  WorkerThread(const WorkerThread&) = delete;
+  WorkerThread& operator=(const WorkerThread&) = delete;
+
+  /** Asks the loop to end without waiting for it; thread-safe. */
+  void cancel();
+  bool isCancelled() const { return _cancel->load(); }
+
+  /** Whether func has returned. */
+  bool isFinished() const { return _finished->load(); }
+
+  /**
+   * Cancels, then waits for func to return. Returns how long that took in
+   * ms (0 if it had already been stopped, or if called from the loop).
+   */
+  double stop();
+
+  const std::string& name() const { return _name; }
+
+private:
+  std::string _name;
+  SharedAtomicBool _cancel;
+  SharedAtomicBool _finished;
+  std::function<void()> _wake;
+
+  std::mutex _joinMutex;
+  std::thread _thread;
+};